@@ -0,0 +1,525 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Calib.c
+
+Abstract:
+
+    Calibration of the write path cost model of Cost.c. Buckets that real
+    traffic never exercises on one of the paths are kept current by
+    calibration runs: at device start and then every
+    HDMI_CALIBRATE_INTERVAL seconds, one bucket at a time whenever the
+    write channel is idle, each size is written by PIO and by DMA to a
+    scratch area at the top of the SRAM.
+
+    The self-test, run on request or at start if the SelfTestAtStart
+    device parameter is set, measures the channel itself: a sweep of
+    transfer sizes up to HDMI_SELF_TEST_MAX_LENGTH, each timed from start
+    to interrupt, gives the latency and sustained bandwidth of the slot
+    the card sits in. The result is kept as the calibration table.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Calib.tmh"
+
+
+static VOID
+HdmiCalibrateDone(
+    IN PDEVICE_EXTENSION DevExt
+    )
+{
+    DevExt->CalibrationPending = FALSE;
+    DevExt->CalibrationTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
+                "Calibration done, PIO threshold %d bytes",
+                DevExt->PathCost.PioThreshold);
+}
+
+
+BOOLEAN
+HdmiCalibrateStartNext(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Runs the next calibration step on the idle write channel: a PIO copy,
+    timed here, and a DMA transfer of the same size, timed by the DPC.
+    Also starts a new run once the last one is HDMI_CALIBRATE_INTERVAL
+    seconds old.
+
+Return Value:
+
+    TRUE if a calibration transfer was started.
+
+--*/
+{
+    NTSTATUS    status;
+    LONGLONG    now;
+    ULONG       length;
+    ULONG       scratch;
+    PMDL        mdl;
+
+    if (!DevExt->TransferReady) {
+        //
+        // Stays pending until the first stream open.
+        //
+        return FALSE;
+    }
+
+    now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    if (!DevExt->CalibrationPending) {
+
+        if (DevExt->CalibrationTime == 0 ||
+            now - DevExt->CalibrationTime <
+                HDMI_CALIBRATE_INTERVAL * DevExt->TimestampFrequency) {
+            return FALSE;
+        }
+
+        DevExt->CalibrationPending = TRUE;
+        DevExt->CalibrationStep    = 0;
+    }
+
+    if (!DevExt->SRAMBase || DevExt->SRAMLength < HDMI_PIO_MAX_LENGTH ||
+        DevExt->CalibrationStep >= HDMI_COST_BUCKETS) {
+        HdmiCalibrateDone(DevExt);
+        return FALSE;
+    }
+
+    length  = 1UL << (HDMI_COST_MIN_SHIFT + DevExt->CalibrationStep);
+    scratch = DevExt->SRAMLength - HDMI_PIO_MAX_LENGTH;
+
+    HdmiPioCopy( (PUCHAR) DevExt->SRAMBase + scratch,
+                 (PUCHAR) DevExt->CalibrationBuffer,
+                 length );
+
+    HdmiCostUpdate( &DevExt->PathCost, TRUE, length,
+                    KeQueryPerformanceCounter(NULL).QuadPart - now );
+
+    mdl = IoAllocateMdl(DevExt->CalibrationBuffer, length, FALSE, FALSE, NULL);
+    if (!mdl) {
+        HdmiCalibrateDone(DevExt);
+        return FALSE;
+    }
+
+    MmBuildMdlForNonPagedPool(mdl);
+
+    status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                          HdmiEvtProgramWriteDma,
+                                          WdfDmaDirectionWriteToDevice,
+                                          mdl,
+                                          MmGetMdlVirtualAddress(mdl),
+                                          length );
+    if (NT_SUCCESS(status)) {
+
+        DevExt->CalibrationMdl    = mdl;
+        DevExt->WriteDeviceOffset = scratch;
+        DevExt->XferSource        = HdmiXferCalibrate;
+        DevExt->WriteStartTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                           WDF_NO_CONTEXT );
+        if (NT_SUCCESS(status)) {
+            return TRUE;
+        }
+
+        DevExt->CalibrationMdl    = NULL;
+        DevExt->WriteDeviceOffset = 0;
+        DevExt->XferSource        = HdmiXferNone;
+        WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+    }
+
+    TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                "HdmiCalibrateStartNext: %d bytes failed: %!STATUS!",
+                length, status);
+
+    IoFreeMdl(mdl);
+    HdmiCalibrateDone(DevExt);
+
+    return FALSE;
+}
+
+
+VOID
+HdmiCalibrateTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Called from the DPC when a calibration transfer has landed. Its cost
+    has already been recorded by the DPC like any other DMA transfer.
+
+--*/
+{
+    WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+
+    IoFreeMdl(DevExt->CalibrationMdl);
+    DevExt->CalibrationMdl = NULL;
+
+    DevExt->WriteDeviceOffset = 0;
+    DevExt->XferSource        = HdmiXferNone;
+
+    DevExt->CalibrationStep++;
+
+    if (!NT_SUCCESS(Status) || DevExt->CalibrationStep >= HDMI_COST_BUCKETS) {
+        HdmiCalibrateDone(DevExt);
+    }
+}
+
+
+//
+// Self-test: a bandwidth and latency sweep of the write channel.
+//
+
+static VOID
+HdmiSelfTestFinish(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Ends the sweep and wakes HdmiSelfTestRun. A complete sweep becomes
+    the calibration table, and its largest transfer the bandwidth the
+    watchdog deadlines are computed from until real traffic refines it.
+
+--*/
+{
+    PHDMI_CALIBRATION_ENTRY entry;
+
+    DevExt->SelfTestPending = FALSE;
+    DevExt->SelfTestStatus  = Status;
+
+    if (NT_SUCCESS(Status) && DevExt->SelfTestTable.EntryCount != 0) {
+
+        DevExt->SelfTestTable.Time = KeQueryPerformanceCounter(NULL).QuadPart;
+        DevExt->CalibrationTable   = DevExt->SelfTestTable;
+
+        entry = &DevExt->CalibrationTable.Entries[DevExt->CalibrationTable.EntryCount - 1];
+
+        if (entry->BytesPerSecond != 0) {
+            DevExt->WatchdogTicksPerMb =
+                (DevExt->TimestampFrequency << 20) / (LONGLONG) entry->BytesPerSecond;
+        }
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
+                    "Self-test done: %I64u bytes/s at %d bytes",
+                    entry->BytesPerSecond, entry->Length);
+    }
+
+    KeSetEvent(&DevExt->SelfTestEvent, IO_NO_INCREMENT, FALSE);
+}
+
+
+BOOLEAN
+HdmiSelfTestStartNext(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Starts the next transfer of a pending sweep on the idle write
+    channel: HDMI_SELF_TEST_REPEAT transfers of each size from
+    HDMI_SELF_TEST_MIN_LENGTH up, by factors of 4, to the start of the
+    SRAM through the normal descriptor path.
+
+Return Value:
+
+    TRUE if a self-test transfer was started.
+
+--*/
+{
+    NTSTATUS                status;
+    PHDMI_CALIBRATION_ENTRY entry;
+    ULONG                   length;
+
+    if (!DevExt->SelfTestPending) {
+        return FALSE;
+    }
+
+    length = HDMI_SELF_TEST_MIN_LENGTH << (2 * DevExt->SelfTestStep);
+
+    if (DevExt->SelfTestStep >= HDMI_SELF_TEST_SIZES ||
+        length > DevExt->SRAMLength) {
+        HdmiSelfTestFinish(DevExt, STATUS_SUCCESS);
+        return FALSE;
+    }
+
+    entry = &DevExt->SelfTestTable.Entries[DevExt->SelfTestStep];
+    entry->Length = length;
+
+    status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                          HdmiEvtProgramWriteDma,
+                                          WdfDmaDirectionWriteToDevice,
+                                          DevExt->SelfTestMdl,
+                                          MmGetMdlVirtualAddress(DevExt->SelfTestMdl),
+                                          length );
+    if (NT_SUCCESS(status)) {
+
+        DevExt->WriteDeviceOffset = 0;
+        DevExt->XferSource        = HdmiXferSelfTest;
+        DevExt->WriteStartTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                           WDF_NO_CONTEXT );
+        if (NT_SUCCESS(status)) {
+            return TRUE;
+        }
+
+        DevExt->XferSource = HdmiXferNone;
+        WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+    }
+
+    TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                "HdmiSelfTestStartNext: %d bytes failed: %!STATUS!",
+                length, status);
+
+    HdmiSelfTestFinish(DevExt, status);
+
+    return FALSE;
+}
+
+
+VOID
+HdmiSelfTestTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Called from the DPC when a self-test transfer has landed. Latency is
+    counted from when the transfer was started to its interrupt; the
+    bandwidth leaves out the time spent mapping it.
+
+--*/
+{
+    PHDMI_CALIBRATION_ENTRY entry;
+    LONGLONG                latency;
+    LONGLONG                dma;
+
+    WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+
+    DevExt->XferSource = HdmiXferNone;
+
+    if (!NT_SUCCESS(Status)) {
+        HdmiSelfTestFinish(DevExt, Status);
+        return;
+    }
+
+    entry   = &DevExt->SelfTestTable.Entries[DevExt->SelfTestStep];
+    latency = DevExt->IsrTimestamp - DevExt->WriteStartTime;
+
+    if (entry->Samples == 0 || latency < entry->LatencyMin) {
+        entry->LatencyMin = latency;
+    }
+
+    if (latency > entry->LatencyMax) {
+        entry->LatencyMax = latency;
+    }
+
+    entry->Samples++;
+
+    DevExt->SelfTestLatencySum += latency;
+    DevExt->SelfTestDmaSum     += latency - DevExt->XferMapTicks;
+
+    if (entry->Samples < HDMI_SELF_TEST_REPEAT) {
+        return;
+    }
+
+    entry->LatencyAvg = DevExt->SelfTestLatencySum / entry->Samples;
+
+    dma = DevExt->SelfTestDmaSum / entry->Samples;
+
+    if (dma > 0) {
+        entry->BytesPerSecond =
+            (ULONGLONG) entry->Length * DevExt->TimestampFrequency / dma;
+    }
+
+    DevExt->SelfTestLatencySum = 0;
+    DevExt->SelfTestDmaSum     = 0;
+
+    DevExt->SelfTestStep++;
+    DevExt->SelfTestTable.EntryCount = DevExt->SelfTestStep;
+}
+
+
+NTSTATUS
+HdmiSelfTestRun(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Runs a sweep and waits for it, at PASSIVE_LEVEL. It has the write
+    channel to itself between frames of the streams, which wait for it,
+    and overwrites the first HDMI_SELF_TEST_MAX_LENGTH bytes of the SRAM,
+    so it is refused while a stream is showing frames. On success the
+    result is in DevExt->CalibrationTable.
+
+--*/
+{
+    NTSTATUS    status;
+    PMDL        mdl;
+
+    PAGED_CODE();
+
+    if (DevExt->SRAMLength == 0) {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    status = HdmiAllocateTransferResources(DevExt);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    mdl = HdmiRingAllocatePages(DevExt, HDMI_SELF_TEST_MAX_LENGTH);
+    if (!mdl) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    //
+    // Without waiting: this may run from a PnP callback.
+    //
+    status = WdfDeviceStopIdle(DevExt->Device, FALSE);
+    if (!NT_SUCCESS(status)) {
+        goto Free;
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    if (DevExt->SelfTestMdl != NULL || DevExt->StreamsInD0 != 0) {
+
+        //
+        // A sweep under way, or a show whose picture the sweep would
+        // overwrite.
+        //
+        status = STATUS_DEVICE_BUSY;
+
+    } else {
+
+        DevExt->SelfTestMdl        = mdl;
+        DevExt->SelfTestStep       = 0;
+        DevExt->SelfTestLatencySum = 0;
+        DevExt->SelfTestDmaSum     = 0;
+        RtlZeroMemory(&DevExt->SelfTestTable, sizeof(HDMI_CALIBRATION_TABLE));
+
+        KeClearEvent(&DevExt->SelfTestEvent);
+        DevExt->SelfTestPending = TRUE;
+
+        HdmiStartNextWrite(DevExt);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (NT_SUCCESS(status)) {
+
+        KeWaitForSingleObject( &DevExt->SelfTestEvent,
+                               Executive,
+                               KernelMode,
+                               FALSE,
+                               NULL );
+
+        WdfObjectAcquireLock(DevExt->Device);
+
+        status = DevExt->SelfTestStatus;
+        DevExt->SelfTestMdl = NULL;
+
+        WdfObjectReleaseLock(DevExt->Device);
+    }
+
+    WdfDeviceResumeIdle(DevExt->Device);
+
+Free:
+
+    MmFreePagesFromMdl(mdl);
+    ExFreePool(mdl);
+
+    return status;
+}
+
+
+VOID
+HdmiSelfTestCancel(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called on removal, once the write channel is quiet. Ends a sweep that
+    is still waiting for the channel.
+
+--*/
+{
+    WdfObjectAcquireLock(DevExt->Device);
+
+    if (DevExt->SelfTestPending) {
+        HdmiSelfTestFinish(DevExt, STATUS_DELETE_PENDING);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+}
+
+
+VOID
+HdmiSelfTestRequest(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_SELF_TEST from HdmiEvtIoInCallerContext, where it
+    can wait for the sweep.
+
+--*/
+{
+    NTSTATUS                status;
+    PHDMI_CALIBRATION_TABLE table;
+
+    PAGED_CODE();
+
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             sizeof(HDMI_CALIBRATION_TABLE),
+                                             &table,
+                                             NULL );
+    if (NT_SUCCESS(status)) {
+        status = HdmiSelfTestRun(DevExt);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    *table = DevExt->CalibrationTable;
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    table->TimestampFrequency = DevExt->TimestampFrequency;
+
+    WdfRequestCompleteWithInformation( Request,
+                                       STATUS_SUCCESS,
+                                       sizeof(HDMI_CALIBRATION_TABLE) );
+}
+
@@ -0,0 +1,202 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Clock.c
+
+Abstract:
+
+    Playout clock model. The interrupt timestamps of completed frames are
+    fitted with a least-squares line over the last HDMI_CLOCK_SAMPLES
+    completions, giving the card's frame period and phase.
+
+    Only integer arithmetic is used, since the model is updated from the
+    DPC. Nothing here touches the device, so the estimator is also built
+    in user mode, see Model.h, and tested with synthetic clocks by
+    Test\TestClock.c.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+
+static VOID
+HdmiClockReset(
+    IN OUT PHDMI_CLOCK_STATE Clock
+    )
+{
+    RtlZeroMemory(Clock, sizeof(HDMI_CLOCK_STATE));
+}
+
+
+static VOID
+HdmiClockFit(
+    IN OUT PHDMI_CLOCK_STATE Clock
+    )
+/*++
+Routine Description:
+
+    Fits time = a + b * frame through the samples. Frames and times are
+    taken relative to the oldest sample, which keeps all sums well inside
+    64 bits for any window the gap limit allows.
+
+--*/
+{
+    ULONG       oldest;
+    ULONG       i;
+    ULONG       j;
+    LONGLONG    n = Clock->Count;
+    LONGLONG    x;
+    LONGLONG    y;
+    LONGLONG    sx = 0;
+    LONGLONG    sy = 0;
+    LONGLONG    sxx = 0;
+    LONGLONG    sxy = 0;
+    LONGLONG    num;
+    LONGLONG    den;
+    LONGLONG    period;
+    LONGLONG    intercept;
+    LONGLONG    residual;
+    LONGLONG    jitter = 0;
+
+    oldest = (Clock->Next + HDMI_CLOCK_SAMPLES - Clock->Count) % HDMI_CLOCK_SAMPLES;
+
+    for (i = 0; i < Clock->Count; i++) {
+
+        j = (oldest + i) % HDMI_CLOCK_SAMPLES;
+
+        x = Clock->Frame[j] - Clock->Frame[oldest];
+        y = Clock->Time[j]  - Clock->Time[oldest];
+
+        sx  += x;
+        sy  += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    num = n * sxy - sx * sy;
+    den = n * sxx - sx * sx;
+
+    if (den <= 0 || num <= 0) {
+        return;
+    }
+
+    //
+    // Period in 16.16 without shifting num, which could overflow.
+    //
+    period    = ((num / den) << 16) + (((num % den) << 16) / den);
+    intercept = ((sy << 16) - period * sx) / n;
+
+    for (i = 0; i < Clock->Count; i++) {
+
+        j = (oldest + i) % HDMI_CLOCK_SAMPLES;
+
+        x = Clock->Frame[j] - Clock->Frame[oldest];
+        y = Clock->Time[j]  - Clock->Time[oldest];
+
+        residual = y - ((intercept + period * x) >> 16);
+        jitter  += residual < 0 ? -residual : residual;
+    }
+
+    x = Clock->FrameNumber - Clock->Frame[oldest];
+
+    Clock->Period = period;
+    Clock->Phase  = Clock->Time[oldest] + ((intercept + period * x) >> 16);
+    Clock->Jitter = jitter / n;
+}
+
+
+VOID
+HdmiClockUpdate(
+    IN OUT PHDMI_CLOCK_STATE Clock,
+    IN     LONGLONG          Timestamp
+    )
+/*++
+Routine Description:
+
+    Adds the interrupt timestamp of a completed frame to the model. Once
+    a period is known, a completion that comes late is taken to have
+    skipped the frames in between. A stall longer than HDMI_CLOCK_MAX_GAP
+    frames (or a clock going backwards) restarts the fit.
+
+    Called from the DPC.
+
+--*/
+{
+    LONGLONG    frames = 1;
+    LONGLONG    gap;
+
+    if (Clock->Count != 0) {
+
+        gap = Timestamp - Clock->LastTime;
+
+        if (Clock->Period != 0) {
+            frames = ((gap << 16) + Clock->Period / 2) / Clock->Period;
+            if (frames < 1) {
+                frames = 1;
+            }
+        }
+
+        if (gap <= 0 || frames > HDMI_CLOCK_MAX_GAP) {
+            HdmiClockReset(Clock);
+            frames = 0;
+        }
+    } else {
+        frames = 0;
+    }
+
+    Clock->FrameNumber += frames;
+    Clock->LastTime     = Timestamp;
+
+    Clock->Frame[Clock->Next] = Clock->FrameNumber;
+    Clock->Time[Clock->Next]  = Timestamp;
+
+    Clock->Next = (Clock->Next + 1) % HDMI_CLOCK_SAMPLES;
+
+    if (Clock->Count < HDMI_CLOCK_SAMPLES) {
+        Clock->Count++;
+    }
+
+    if (Clock->Count >= HDMI_CLOCK_MIN_SAMPLES) {
+        HdmiClockFit(Clock);
+    }
+}
+
+
+VOID
+HdmiClockQuery(
+    IN  PHDMI_CLOCK_STATE Clock,
+    OUT PHDMI_CLOCK       Model
+    )
+/*++
+Routine Description:
+
+    Fills in the HDMI_CLOCK returned by IOCTL_HDMI_GET_CLOCK. The caller
+    sets TimestampFrequency.
+
+--*/
+{
+    RtlZeroMemory(Model, sizeof(HDMI_CLOCK));
+
+    Model->Samples = Clock->Count;
+
+    if (Clock->Period == 0 || Clock->Count < HDMI_CLOCK_MIN_SAMPLES) {
+        return;
+    }
+
+    Model->Period        = Clock->Period;
+    Model->LastTimestamp = Clock->Phase;
+    Model->NextTimestamp = Clock->Phase + ((Clock->Period + 0x8000) >> 16);
+    Model->Jitter        = Clock->Jitter;
+}
@@ -0,0 +1,115 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Cost.c
+
+Abstract:
+
+    Cost model for the two write paths. Every DMA transfer and every PIO
+    copy is timed and folded into a per-size bucket; small writes then go
+    by PIO as long as that is the cheaper path for their bucket. The
+    timings come from real traffic and from the calibration runs of
+    Calib.c.
+
+    Nothing here touches the device, so the model is also built in user
+    mode, see Model.h, and tested with synthetic cost curves by
+    Test\TestCost.c.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+
+static ULONG
+HdmiCostBucket(
+    IN ULONG Length
+    )
+/*++
+Routine Description:
+
+    Returns the bucket for a write of Length bytes, or HDMI_COST_BUCKETS
+    if it is too long for PIO.
+
+--*/
+{
+    ULONG   bucket = 0;
+
+    while (bucket < HDMI_COST_BUCKETS &&
+           Length > (1UL << (HDMI_COST_MIN_SHIFT + bucket))) {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+
+VOID
+HdmiCostUpdate(
+    IN OUT PHDMI_PATH_COST Cost,
+    IN     BOOLEAN         Pio,
+    IN     ULONG           Length,
+    IN     LONGLONG        Ticks
+    )
+/*++
+Routine Description:
+
+    Folds one timed write into its bucket and recomputes PioThreshold: the
+    largest bucket up to which PIO has been cheaper than DMA in every
+    bucket measured on both paths.
+
+--*/
+{
+    PLONGLONG   cost;
+    ULONG       bucket;
+
+    bucket = HdmiCostBucket(Length);
+
+    if (bucket >= HDMI_COST_BUCKETS || Ticks <= 0) {
+        return;
+    }
+
+    cost = Pio ? &Cost->Pio[bucket] : &Cost->Dma[bucket];
+
+    if (*cost == 0) {
+        *cost = Ticks;
+    } else {
+        *cost += (Ticks - *cost) / 4;
+        if (*cost == 0) {
+            *cost = 1;
+        }
+    }
+
+    Cost->PioThreshold = 0;
+
+    for (bucket = 0; bucket < HDMI_COST_BUCKETS; bucket++) {
+
+        if (Cost->Pio[bucket] == 0 || Cost->Dma[bucket] == 0 ||
+            Cost->Pio[bucket] >= Cost->Dma[bucket]) {
+            break;
+        }
+
+        Cost->PioThreshold = 1UL << (HDMI_COST_MIN_SHIFT + bucket);
+    }
+}
+
+
+BOOLEAN
+HdmiCostUsePio(
+    IN PHDMI_PATH_COST Cost,
+    IN ULONG           Length
+    )
+{
+    return (BOOLEAN) (Length != 0 && Length <= Cost->PioThreshold);
+}
@@ -38,6 +38,7 @@ VOID HdmiEvtIoDeviceCtr(
 { 
     NTSTATUS          status = STATUS_UNSUCCESSFUL;
     PDEVICE_EXTENSION DevExt = NULL;
+    PHDMI_STREAM_CONTEXT stream;
     PVOID  UserModeVirtualAddress = NULL;
     PVOID  RecieveBuf;
     PMDL BufferMdl;
@@ -69,12 +70,209 @@ VOID HdmiEvtIoDeviceCtr(
 			(USHORT *)RecieveBuf = UserModeVirtualAddress;
 			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, 8); 
 			break;
+
+		case IOCTL_HDMI_RING_ENTER:
+			HdmiRingEnter(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_WRITE_BATCH:
+			HdmiBatchSubmit(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_GET_STATISTICS:
+			status = WdfRequestRetrieveOutputBuffer(Request, sizeof(HDMI_STATISTICS), &RecieveBuf, NULL);
+			if (!NT_SUCCESS(status))
+			{
+				WdfRequestComplete(Request, status);
+				break;
+			}
+			stream = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+			stream->Stats.PioThreshold = DevExt->PathCost.PioThreshold;
+			stream->Stats.ChannelResets = DevExt->ChannelResets;
+			RtlCopyMemory(RecieveBuf, &stream->Stats, sizeof(HDMI_STATISTICS));
+			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(HDMI_STATISTICS));
+			break;
+
+		case IOCTL_HDMI_GET_CLOCK:
+			status = WdfRequestRetrieveOutputBuffer(Request, sizeof(HDMI_CLOCK), &RecieveBuf, NULL);
+			if (!NT_SUCCESS(status))
+			{
+				WdfRequestComplete(Request, status);
+				break;
+			}
+			HdmiClockQuery(&DevExt->Clock, (PHDMI_CLOCK) RecieveBuf);
+			((PHDMI_CLOCK) RecieveBuf)->TimestampFrequency = DevExt->TimestampFrequency;
+			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(HDMI_CLOCK));
+			break;
+
+		case IOCTL_HDMI_PIO_WRITE:
+			HdmiPioWrite(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_FLUSH:
+			HdmiStreamFlush(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_SHOW_END:
+			HdmiPowerShowEnd(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_GET_CALIBRATION:
+			status = WdfRequestRetrieveOutputBuffer(Request, sizeof(HDMI_CALIBRATION_TABLE), &RecieveBuf, NULL);
+			if (!NT_SUCCESS(status))
+			{
+				WdfRequestComplete(Request, status);
+				break;
+			}
+			DevExt->CalibrationTable.TimestampFrequency = DevExt->TimestampFrequency;
+			RtlCopyMemory(RecieveBuf, &DevExt->CalibrationTable, sizeof(HDMI_CALIBRATION_TABLE));
+			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(HDMI_CALIBRATION_TABLE));
+			break;
+
+		case IOCTL_HDMI_GET_STARTUP_PROFILE:
+			status = WdfRequestRetrieveOutputBuffer(Request, sizeof(HDMI_STARTUP_PROFILE), &RecieveBuf, NULL);
+			if (!NT_SUCCESS(status))
+			{
+				WdfRequestComplete(Request, status);
+				break;
+			}
+			DevExt->Startup.TimestampFrequency = DevExt->TimestampFrequency;
+			RtlCopyMemory(RecieveBuf, &DevExt->Startup, sizeof(HDMI_STARTUP_PROFILE));
+			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(HDMI_STARTUP_PROFILE));
+			break;
+
+		case IOCTL_HDMI_SET_STREAM:
+			HdmiStreamConfigure(DevExt, Request);
+			break;
+
+		case IOCTL_HDMI_GET_DEVICE_INFO:
+			status = WdfRequestRetrieveOutputBuffer(Request, sizeof(HDMI_DEVICE_INFO), &RecieveBuf, NULL);
+			if (!NT_SUCCESS(status))
+			{
+				WdfRequestComplete(Request, status);
+				break;
+			}
+			RtlZeroMemory(RecieveBuf, sizeof(HDMI_DEVICE_INFO));
+			((PHDMI_DEVICE_INFO) RecieveBuf)->NumaNode = DevExt->NumaNode;
+			((PHDMI_DEVICE_INFO) RecieveBuf)->CardIndex = DevExt->CardIndex;
+			((PHDMI_DEVICE_INFO) RecieveBuf)->DmaVersion = DevExt->DmaVersion;
+			WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(HDMI_DEVICE_INFO));
+			break;
+
 		default:
+			WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
 			break;
     }
 
 }
 
 
+//-----------------------------------------------------------------------------
+//
+//-----------------------------------------------------------------------------
+VOID
+HdmiEvtIoInCallerContext(
+    IN WDFDEVICE  Device,
+    IN WDFREQUEST Request
+    )
+/*++
+
+Routine Description:
+
+    Called in the context of the thread that sent the request, before it
+    is queued. Completion ring setup and teardown and the statistics page
+    map and unmap views in the calling process, and batched and group
+    writes lock the caller's buffers, so they are handled here; so is the
+    power policy, which is set at PASSIVE_LEVEL. Everything else is passed
+    on to the I/O queues. Frames are noted on the way, see
+    HdmiPowerFrameSubmitted.
+
+Arguments:
+
+    Device  - Handle to the framework device object.
+
+    Request - Handle to the framework request object.
+
+Return Value:
+
+--*/
+{
+    NTSTATUS                status;
+    PDEVICE_EXTENSION       devExt;
+    WDF_REQUEST_PARAMETERS  params;
+
+    devExt = HdmiGetDeviceContext(Device);
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type == WdfRequestTypeWrite) {
+        HdmiPowerFrameSubmitted(devExt);
+    }
+
+    if (params.Type == WdfRequestTypeDeviceControl) {
+
+        switch (params.Parameters.DeviceIoControl.IoControlCode) {
+
+        case IOCTL_HDMI_RING_ENTER:
+            HdmiPowerFrameSubmitted(devExt);
+            break;
+
+        case IOCTL_HDMI_POWER_POLICY:
+            HdmiPowerPolicy(devExt, Request);
+            return;
+
+        case IOCTL_HDMI_SELF_TEST:
+            //
+            // Waits for the sweep, so it cannot hold up the IOCTL queue.
+            //
+            HdmiSelfTestRequest(devExt, Request);
+            return;
+
+        case IOCTL_HDMI_RING_SETUP:
+            HdmiRingSetup(devExt, Request);
+            return;
+
+        case IOCTL_HDMI_MAP_STATISTICS:
+            HdmiStatsMap(devExt, Request);
+            return;
+
+        case IOCTL_HDMI_RING_TEARDOWN:
+            HdmiRingTeardown(devExt,
+                             HdmiGetStreamContext(WdfRequestGetFileObject(Request)),
+                             Request);
+            return;
+
+        case IOCTL_HDMI_WRITE_BATCH:
+            //
+            // Lock the frames while we are still in the caller's process.
+            //
+            HdmiPowerFrameSubmitted(devExt);
+            HdmiBatchPrepare(devExt, Request);
+            return;
+
+        case IOCTL_HDMI_WRITE_GROUP:
+            //
+            // Spans several devices, so it is never queued on this one.
+            //
+            HdmiPowerFrameSubmitted(devExt);
+            HdmiGroupWrite(devExt, Request);
+            return;
+
+        default:
+            break;
+        }
+    }
+
+    status = WdfDeviceEnqueueRequest(Device, Request);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                    "WdfDeviceEnqueueRequest failed: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+    }
+}
+
+
 
 
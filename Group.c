@@ -0,0 +1,838 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Group.c
+
+Abstract:
+
+    Frame-synchronized writes across several cards (IOCTL_HDMI_WRITE_GROUP)
+    for stereo projector pairs and tiled walls.
+
+    Every started card is entered in a driver-wide table and gets a
+    CardIndex. A group names one frame per card. Each card arms its
+    frame from HdmiStartNextWrite as soon as its write channel is free:
+    the descriptor table and control registers are programmed but the
+    LastDesc doorbell is held back. The card that arms last rings all the
+    doorbells back to back at HIGH_LEVEL, so the cards start within a few
+    register writes of each other whatever the load on each of them was.
+
+    Locking: the group is set up in the caller's context with no device
+    lock held, taking each member's lock in turn. Arming and completion
+    run under the member's own lock only; the Ready and Pending counts
+    in the group context are what ties the members together. Only one
+    group is in flight at a time.
+
+    A member that never arms would hold the armed ones' channels for
+    good. Once the first armed member has waited HDMI_GROUP_ARM_TIMEOUT_MS
+    its watchdog gives the group up: a DPC, holding no device lock, takes
+    each member's lock in turn, fails the frames not yet armed and aborts
+    the armed ones with STATUS_IO_TIMEOUT. Cancelling the request does the
+    same with STATUS_CANCELLED. ArmStatus decides between ringing the
+    doorbells and giving up, whichever comes first.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Group.tmh"
+
+
+static KSPIN_LOCK           HdmiGroupLock;
+static PDEVICE_EXTENSION    HdmiGroupCards[HDMI_GROUP_MAX_CARDS];
+static PHDMI_GROUP_CONTEXT  HdmiGroupActive;
+
+
+VOID
+HdmiGroupInitialize(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Called from DriverEntry.
+
+--*/
+{
+    KeInitializeSpinLock(&HdmiGroupLock);
+}
+
+
+VOID
+HdmiGroupRegister(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Gives a started card the lowest free CardIndex. Cards beyond
+    HDMI_GROUP_MAX_CARDS cannot take part in groups.
+
+--*/
+{
+    KIRQL   oldIrql;
+    ULONG   i;
+
+    KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+
+    for (i = 0; i < HDMI_GROUP_MAX_CARDS; i++) {
+        if (HdmiGroupCards[i] == NULL) {
+            HdmiGroupCards[i] = DevExt;
+            break;
+        }
+    }
+
+    DevExt->CardIndex = i;
+
+    KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INIT,
+                "HdmiGroupRegister: card index %d", i);
+}
+
+
+VOID
+HdmiGroupUnregister(
+    IN PDEVICE_EXTENSION DevExt
+    )
+{
+    KIRQL   oldIrql;
+
+    KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+
+    if (DevExt->CardIndex < HDMI_GROUP_MAX_CARDS &&
+        HdmiGroupCards[DevExt->CardIndex] == DevExt) {
+        HdmiGroupCards[DevExt->CardIndex] = NULL;
+    }
+
+    DevExt->CardIndex = HDMI_GROUP_MAX_CARDS;
+
+    KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+}
+
+
+static VOID
+HdmiGroupComplete(
+    IN PHDMI_GROUP_CONTEXT GroupCtx
+    )
+/*++
+Routine Description:
+
+    Returns the per-frame results and the achieved skew, and completes
+    the group. Called by whichever member drops the last Pending count.
+
+--*/
+{
+    NTSTATUS            status;
+    WDFREQUEST          request = (WDFREQUEST) WdfObjectContextGetObject(GroupCtx);
+    PHDMI_GROUP_RESULT  result;
+    LONGLONG            first = 0;
+    LONGLONG            last = 0;
+    BOOLEAN             any = FALSE;
+    KIRQL               oldIrql;
+    ULONG               i;
+
+    if (GroupCtx->ArmStatus == STATUS_CANCELLED) {
+        status = STATUS_CANCELLED;
+    } else {
+        status = WdfRequestRetrieveOutputBuffer(request, sizeof(HDMI_GROUP_RESULT),
+                                                &result, NULL);
+    }
+    if (NT_SUCCESS(status)) {
+
+        RtlZeroMemory(result, sizeof(HDMI_GROUP_RESULT));
+
+        for (i = 0; i < GroupCtx->FrameCount; i++) {
+
+            result->Frames[i] = GroupCtx->Result[i];
+
+            if (!NT_SUCCESS(GroupCtx->Result[i].Status)) {
+                continue;
+            }
+
+            if (!any || GroupCtx->Result[i].Timestamp < first) {
+                first = GroupCtx->Result[i].Timestamp;
+            }
+            if (!any || GroupCtx->Result[i].Timestamp > last) {
+                last = GroupCtx->Result[i].Timestamp;
+            }
+            any = TRUE;
+        }
+
+        result->TimestampFrequency = GroupCtx->Member[0]->TimestampFrequency;
+        result->Skew               = last - first;
+        result->FrameCount         = GroupCtx->FrameCount;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC,
+                "HdmiGroupComplete: Request %p, %d frames, skew %I64d",
+                request, GroupCtx->FrameCount, last - first);
+
+    KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+    HdmiGroupActive = NULL;
+    KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+
+    WdfRequestCompleteWithInformation(request, status,
+                                      NT_SUCCESS(status) ? sizeof(HDMI_GROUP_RESULT) : 0);
+}
+
+
+static VOID
+HdmiGroupRelease(
+    IN PHDMI_GROUP_CONTEXT GroupCtx
+    )
+/*++
+Routine Description:
+
+    Drops a Pending count. One count stands for the request being
+    cancelable: it is dropped by HdmiEvtGroupRequestCancel or, when it is
+    the last one left, here once the request is no longer cancelable.
+
+--*/
+{
+    WDFREQUEST  request = (WDFREQUEST) WdfObjectContextGetObject(GroupCtx);
+    LONG        pending;
+
+    pending = InterlockedDecrement(&GroupCtx->Pending);
+
+    if (pending == 1 && !GroupCtx->Cancelled &&
+        WdfRequestUnmarkCancelable(request) != STATUS_CANCELLED) {
+        pending = InterlockedDecrement(&GroupCtx->Pending);
+    }
+
+    if (pending == 0) {
+        HdmiGroupComplete(GroupCtx);
+    }
+}
+
+
+static VOID
+HdmiGroupFire(
+    IN PHDMI_GROUP_CONTEXT GroupCtx
+    )
+/*++
+Routine Description:
+
+    Rings the doorbells of all armed members. Nothing but the register
+    writes happens at HIGH_LEVEL, so the spread between the first and the
+    last card is a handful of posted writes.
+
+    The members' channels belong to the group until their DPC completes
+    the frame, so their WriteStartTime can be set from here.
+
+--*/
+{
+    KIRQL       oldIrql;
+    LONGLONG    now;
+    ULONG       i;
+
+    now = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    for (i = 0; i < GroupCtx->FrameCount; i++) {
+        if (GroupCtx->Doorbell[i] != NULL) {
+            GroupCtx->Member[i]->WriteStartTime = now;
+        }
+    }
+
+    KeRaiseIrql(HIGH_LEVEL, &oldIrql);
+
+    for (i = 0; i < GroupCtx->FrameCount; i++) {
+        if (GroupCtx->Doorbell[i] != NULL) {
+            WRITE_REGISTER_ULONG(GroupCtx->Doorbell[i], GroupCtx->LastDesc[i]);
+        }
+    }
+
+    KeLowerIrql(oldIrql);
+
+    //
+    // The doorbells bypass HdmiRegStrobe to keep the spread down, so
+    // they are counted here.
+    //
+    for (i = 0; i < GroupCtx->FrameCount; i++) {
+        if (GroupCtx->Doorbell[i] != NULL) {
+            HdmiStatsCpu(GroupCtx->Member[i])->MmioWrites++;
+        }
+    }
+}
+
+
+static VOID
+HdmiGroupReady(
+    IN PHDMI_GROUP_CONTEXT GroupCtx
+    )
+/*++
+Routine Description:
+
+    Counts a member as armed or failed. The last one rings the doorbells,
+    unless the group has been given up on, and drops the count that kept
+    the group alive until then.
+
+--*/
+{
+    if (InterlockedIncrement(&GroupCtx->Ready) == (LONG) GroupCtx->FrameCount) {
+
+        if (InterlockedCompareExchange((PLONG) &GroupCtx->ArmStatus,
+                                       STATUS_SUCCESS,
+                                       STATUS_PENDING) == STATUS_PENDING) {
+            HdmiGroupFire(GroupCtx);
+        }
+
+        HdmiGroupRelease(GroupCtx);
+    }
+}
+
+
+static VOID
+HdmiGroupExpire(
+    IN PHDMI_GROUP_CONTEXT GroupCtx,
+    IN NTSTATUS            Status
+    )
+/*++
+Routine Description:
+
+    Gives up a group whose doorbells have not been rung: fails the frames
+    not armed yet with Status and aborts the armed ones, which frees their
+    channels for the next transfer. Does nothing once the doorbells have
+    been rung; the watchdog looks after a group frame that stalls.
+
+    Called with no device lock held, at or below DISPATCH_LEVEL. The
+    caller holds a Pending count, so the group cannot complete under it.
+
+--*/
+{
+    PDEVICE_EXTENSION   member;
+    ULONG               i;
+
+    if (InterlockedCompareExchange((PLONG) &GroupCtx->ArmStatus,
+                                   Status,
+                                   STATUS_PENDING) != STATUS_PENDING) {
+        return;
+    }
+
+    TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                "HdmiGroupExpire: %d of %d frames armed: %!STATUS!",
+                GroupCtx->Ready, GroupCtx->FrameCount, Status);
+
+    for (i = 0; i < GroupCtx->FrameCount; i++) {
+
+        member = GroupCtx->Member[i];
+
+        WdfObjectAcquireLock(member->Device);
+
+        //
+        // A member HdmiGroupWrite has not got to yet fails the frame in
+        // HdmiGroupArm when it does.
+        //
+        if (member->Group == GroupCtx) {
+
+            if (member->XferSource == HdmiXferGroup) {
+
+                HdmiAbortWriteTransfer(member, Status);
+
+                HdmiStartNextWrite(member);
+
+            } else {
+
+                GroupCtx->Result[i].Status = Status;
+                member->Group = NULL;
+
+                HdmiGroupRelease(GroupCtx);
+
+                HdmiGroupReady(GroupCtx);
+            }
+        }
+
+        WdfObjectReleaseLock(member->Device);
+    }
+}
+
+
+static VOID
+HdmiGroupExpiryDpc(
+    IN PKDPC Dpc,
+    IN PVOID DeferredContext,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2
+    )
+/*++
+Routine Description:
+
+    Queued by HdmiGroupArmTimeout, which runs under one member's lock and
+    so cannot take the others'. Drops the count it was queued with.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = (PHDMI_GROUP_CONTEXT) DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    HdmiGroupExpire(groupCtx, STATUS_IO_TIMEOUT);
+
+    HdmiGroupRelease(groupCtx);
+}
+
+
+VOID
+HdmiGroupArmTimeout(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called from the watchdog when DevExt's group frame has waited
+    HDMI_GROUP_ARM_TIMEOUT_MS for the other members to arm. The armed
+    frame still holds a Pending count, so the group is alive here.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = DevExt->Group;
+
+    if (InterlockedExchange(&groupCtx->ExpiryQueued, TRUE) == FALSE) {
+
+        InterlockedIncrement(&groupCtx->Pending);
+
+        KeInsertQueueDpc(&groupCtx->ExpiryDpc, NULL, NULL);
+    }
+}
+
+
+VOID
+HdmiEvtGroupRequestCancel(
+    IN WDFREQUEST Request
+    )
+/*++
+Routine Description:
+
+    Gives the group up with STATUS_CANCELLED and drops the count that
+    stands for the request being cancelable. Frames already running are
+    left to finish; the request completes when the last one has.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = HdmiGetGroupContext(Request);
+
+    groupCtx->Cancelled = TRUE;
+
+    HdmiGroupExpire(groupCtx, STATUS_CANCELLED);
+
+    HdmiGroupRelease(groupCtx);
+}
+
+
+VOID
+HdmiGroupWrite(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+
+Routine Description:
+
+    Handles IOCTL_HDMI_WRITE_GROUP from HdmiEvtIoInCallerContext. Resolves
+    the member cards, keeps them in D0, locks the frames while we are
+    still in the caller's process and hands each member its frame.
+
+    The request is not queued: it belongs to the group from here on and
+    is completed by the member that finishes last. It is cancelable until
+    then, see HdmiEvtGroupRequestCancel.
+
+Arguments:
+
+    DevExt  - Pointer to our DEVICE_EXTENSION
+
+    Request - The group request; completed here on failure.
+
+Return Value:
+
+--*/
+{
+    NTSTATUS              status;
+    PHDMI_GROUP           group;
+    size_t                inputLength;
+    PVOID                 result;
+    PHDMI_GROUP_CONTEXT   groupCtx;
+    PDEVICE_EXTENSION     member;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    KIRQL                 oldIrql;
+    ULONG                 frameCount;
+    ULONG                 cardIndex;
+    ULONG                 length;
+    ULONG                 i;
+    ULONG                 j;
+    PMDL                  mdl;
+
+    UNREFERENCED_PARAMETER(DevExt);
+
+    PAGED_CODE();
+
+    status = WdfRequestRetrieveInputBuffer( Request,
+                                            FIELD_OFFSET(HDMI_GROUP, Frames),
+                                            &group,
+                                            &inputLength );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    frameCount = group->FrameCount;
+
+    if (frameCount == 0 || frameCount > HDMI_GROUP_MAX_CARDS ||
+        inputLength < FIELD_OFFSET(HDMI_GROUP, Frames) +
+                      frameCount * sizeof(HDMI_GROUP_FRAME)) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Done;
+    }
+
+    //
+    // Group frames land at the start of every member's SRAM; a stream
+    // that has moved its frames elsewhere cannot send them.
+    //
+    if (HdmiGetStreamContext(WdfRequestGetFileObject(Request))->DeviceOffset != 0) {
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        goto Done;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             sizeof(HDMI_GROUP_RESULT),
+                                             &result,
+                                             NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, HDMI_GROUP_CONTEXT);
+    attributes.EvtCleanupCallback = HdmiEvtGroupContextCleanup;
+
+    status = WdfObjectAllocateContext( Request, &attributes, &groupCtx );
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "WdfObjectAllocateContext (group) failed: %!STATUS!", status);
+        goto Done;
+    }
+
+    groupCtx->FrameCount = frameCount;
+    groupCtx->ArmStatus  = STATUS_PENDING;
+
+    KeInitializeDpc(&groupCtx->ExpiryDpc, HdmiGroupExpiryDpc, groupCtx);
+
+    //
+    // Resolve the cards. The reference keeps a member's context around
+    // until the request is gone even if the card is removed meanwhile.
+    //
+    KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+
+    for (i = 0; i < frameCount; i++) {
+
+        cardIndex = group->Frames[i].CardIndex;
+        member = cardIndex < HDMI_GROUP_MAX_CARDS ? HdmiGroupCards[cardIndex] : NULL;
+
+        for (j = 0; j < i && member != NULL; j++) {
+            if (groupCtx->Member[j] == member) {
+                member = NULL;
+            }
+        }
+
+        if (member == NULL) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        WdfObjectReference(member->Device);
+        groupCtx->Member[i] = member;
+    }
+
+    KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "HdmiGroupWrite: frame %d names no usable card", i);
+        goto Done;
+    }
+
+    for (i = 0; i < frameCount; i++) {
+
+        member = groupCtx->Member[i];
+        length = group->Frames[i].Length;
+
+        if (length == 0 || length > member->MaximumTransferLength ||
+            !HdmiSramFits(member, 0, length)) {
+            status = STATUS_INVALID_BUFFER_SIZE;
+            goto Done;
+        }
+
+        //
+        // A member nobody has opened has no descriptor tables yet.
+        //
+        status = HdmiAllocateTransferResources(member);
+        if (!NT_SUCCESS(status)) {
+            goto Done;
+        }
+
+        status = WdfDeviceStopIdle(member->Device, TRUE);
+        if (!NT_SUCCESS(status)) {
+            goto Done;
+        }
+        groupCtx->IdleStopped[i] = TRUE;
+
+        mdl = IoAllocateMdl( (PVOID) (ULONG_PTR) group->Frames[i].Buffer,
+                             length,
+                             FALSE,
+                             FALSE,
+                             NULL );
+        if (!mdl) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        __try {
+
+            MmProbeAndLockPages(mdl, UserMode, IoReadAccess);
+
+        } __except(EXCEPTION_EXECUTE_HANDLER) {
+
+            status = GetExceptionCode();
+            IoFreeMdl(mdl);
+            mdl = NULL;
+        }
+
+        if (!mdl) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "HdmiGroupWrite: frame %d not accessible: %!STATUS!",
+                        i, status);
+            goto Done;
+        }
+
+        //
+        // HdmiEvtGroupContextCleanup unlocks whatever is recorded here.
+        //
+        groupCtx->Mdl[i]    = mdl;
+        groupCtx->Length[i] = length;
+    }
+
+    KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+
+    if (HdmiGroupActive == NULL) {
+        HdmiGroupActive = groupCtx;
+    } else {
+        status = STATUS_DEVICE_BUSY;
+    }
+
+    KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    //
+    // One count per frame, one until the doorbells are rung and one while
+    // the request is cancelable.
+    //
+    groupCtx->Pending = frameCount + 2;
+
+    status = WdfRequestMarkCancelableEx(Request, HdmiEvtGroupRequestCancel);
+    if (!NT_SUCCESS(status)) {
+
+        KeAcquireSpinLock(&HdmiGroupLock, &oldIrql);
+        HdmiGroupActive = NULL;
+        KeReleaseSpinLock(&HdmiGroupLock, oldIrql);
+
+        goto Done;
+    }
+
+    for (i = 0; i < frameCount; i++) {
+
+        member = groupCtx->Member[i];
+
+        WdfObjectAcquireLock(member->Device);
+
+        member->Group     = groupCtx;
+        member->GroupSlot = i;
+
+        HdmiStartNextWrite(member);
+
+        WdfObjectReleaseLock(member->Device);
+    }
+
+    return;
+
+Done:
+
+    WdfRequestComplete(Request, status);
+}
+
+
+VOID
+HdmiEvtGroupContextCleanup(
+    IN WDFOBJECT Object
+    )
+/*++
+
+Routine Description:
+
+    Unlocks the frames of a group request and lets the members go idle
+    again when the request goes away.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = HdmiGetGroupContext(Object);
+    ULONG               i;
+
+    for (i = 0; i < HDMI_GROUP_MAX_CARDS; i++) {
+
+        if (groupCtx->Mdl[i]) {
+            MmUnlockPages(groupCtx->Mdl[i]);
+            IoFreeMdl(groupCtx->Mdl[i]);
+            groupCtx->Mdl[i] = NULL;
+        }
+
+        if (groupCtx->Member[i]) {
+
+            if (groupCtx->IdleStopped[i]) {
+                WdfDeviceResumeIdle(groupCtx->Member[i]->Device);
+            }
+
+            WdfObjectDereference(groupCtx->Member[i]->Device);
+            groupCtx->Member[i] = NULL;
+        }
+    }
+}
+
+
+BOOLEAN
+HdmiGroupArm(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+
+Routine Description:
+
+    Called from HdmiStartNextWrite with the write channel idle and a group
+    frame waiting. Programs the frame without ringing the doorbell, see
+    HdmiGroupSetDoorbell, and reports the member as ready.
+
+Return Value:
+
+    TRUE if the frame now holds the write channel.
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_GROUP_CONTEXT groupCtx = DevExt->Group;
+    ULONG               i = DevExt->GroupSlot;
+
+    //
+    // A group given up on before this member got here fails the frame
+    // with the status it was given up with.
+    //
+    status = groupCtx->ArmStatus;
+
+    if (status == STATUS_PENDING) {
+
+        status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                              HdmiEvtProgramWriteDma,
+                                              WdfDmaDirectionWriteToDevice,
+                                              groupCtx->Mdl[i],
+                                              MmGetMdlVirtualAddress(groupCtx->Mdl[i]),
+                                              groupCtx->Length[i] );
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        DevExt->XferSource = HdmiXferGroup;
+
+        //
+        // Only for the mapping time; the transfer itself starts when
+        // HdmiGroupFire rings the doorbells.
+        //
+        DevExt->WriteStartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                           WDF_NO_CONTEXT );
+        if (!NT_SUCCESS(status)) {
+            DevExt->XferSource = HdmiXferNone;
+            WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+        }
+    }
+
+    if (!NT_SUCCESS(status)) {
+
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "HdmiGroupArm: frame %d failed: %!STATUS!", i, status);
+
+        groupCtx->Result[i].Status = status;
+        DevExt->Group = NULL;
+
+        HdmiGroupRelease(groupCtx);
+    }
+
+    HdmiGroupReady(groupCtx);
+
+    return (BOOLEAN) NT_SUCCESS(status);
+}
+
+
+VOID
+HdmiGroupSetDoorbell(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             LastDesc
+    )
+/*++
+
+Routine Description:
+
+    Called from HdmiEvtProgramWriteDma in place of the LastDesc write
+    when the transfer is a group frame.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = DevExt->Group;
+
+    groupCtx->LastDesc[DevExt->GroupSlot] = LastDesc;
+    groupCtx->Doorbell[DevExt->GroupSlot] =
+        (PULONG) &DevExt->Regs->WriteCtr.LastDesc;
+}
+
+
+VOID
+HdmiGroupTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+
+Routine Description:
+
+    Called from the DPC when a member's group frame has been transferred.
+    Records its result and completion time; the last member to get here
+    completes the group.
+
+--*/
+{
+    PHDMI_GROUP_CONTEXT groupCtx = DevExt->Group;
+    ULONG               i = DevExt->GroupSlot;
+
+    groupCtx->Result[i].Status = Status;
+    groupCtx->Result[i].BytesTransferred = (ULONG)
+        WdfDmaTransactionGetBytesTransferred(DevExt->WriteDmaTransaction);
+    groupCtx->Result[i].Timestamp = DevExt->IsrTimestamp;
+    groupCtx->Doorbell[i] = NULL;
+
+    WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+
+    DevExt->XferSource = HdmiXferNone;
+    DevExt->Group      = NULL;
+
+    HdmiGroupRelease(groupCtx);
+}
@@ -17,8 +17,11 @@
 #pragma alloc_text (PAGE, HdmiEvtDevicePrepareHardware)
 #pragma alloc_text (PAGE, HdmiEvtDeviceReleaseHardware)
 #pragma alloc_text (PAGE, HdmiEvtDeviceD0Exit)
+#pragma alloc_text (PAGE, HdmiEvtDeviceSelfManagedIoSuspend)
 #pragma alloc_text (PAGE, HdmiEvtDriverContextCleanup)
+#pragma alloc_text (PAGE, HdmiEvtDeviceContextCleanup)
 #pragma alloc_text (PAGE, HdmiSetIdleAndWakeSettings)
+#pragma alloc_text (PAGE, HdmiEvtFileCleanup)
 #endif
 
 
@@ -78,6 +81,8 @@ Return Value:
     WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
     attributes.EvtCleanupCallback = HdmiEvtDriverContextCleanup;
 
+    HdmiGroupInitialize();
+
     status = WdfDriverCreate( DriverObject,
                               RegistryPath,
                               &attributes,
@@ -126,9 +131,14 @@ Return Value:
 {
     NTSTATUS                   status = STATUS_SUCCESS;
     WDF_PNPPOWER_EVENT_CALLBACKS pnpPowerCallbacks;
+    WDF_FILEOBJECT_CONFIG       fileConfig;
+    WDF_OBJECT_ATTRIBUTES       fileAttributes;
     WDF_OBJECT_ATTRIBUTES       attributes;
     WDFDEVICE                   device;
     PDEVICE_EXTENSION           devExt = NULL;
+    LARGE_INTEGER               frequency;
+    LONGLONG                    start;
+    LONGLONG                    phase;
 
     UNREFERENCED_PARAMETER( Driver );
 
@@ -136,6 +146,8 @@ Return Value:
 
     PAGED_CODE();
 
+    start = KeQueryPerformanceCounter(&frequency).QuadPart;
+
     WdfDeviceInitSetIoType(DeviceInit, WdfDeviceIoDirect);
 
     //
@@ -151,18 +163,58 @@ Return Value:
     pnpPowerCallbacks.EvtDevicePrepareHardware = HdmiEvtDevicePrepareHardware;
     pnpPowerCallbacks.EvtDeviceReleaseHardware = HdmiEvtDeviceReleaseHardware;
 
+    //
+    // Runs once the device is started, to calibrate the transfer paths.
+    //
+    pnpPowerCallbacks.EvtDeviceSelfManagedIoInit = HdmiEvtDeviceSelfManagedIoInit;
+
+    //
+    // Takes the card out of the table used by group writes on removal.
+    //
+    pnpPowerCallbacks.EvtDeviceSelfManagedIoCleanup = HdmiEvtDeviceSelfManagedIoCleanup;
+
+    //
+    // Quiesce the write channel before a power transition and hand it
+    // out again after, see Power.c.
+    //
+    pnpPowerCallbacks.EvtDeviceSelfManagedIoSuspend = HdmiEvtDeviceSelfManagedIoSuspend;
+    pnpPowerCallbacks.EvtDeviceSelfManagedIoRestart = HdmiEvtDeviceSelfManagedIoRestart;
+
     //
     // These two callbacks set up and tear down hardware state that must be
     // done every time the device moves in and out of the D0-working state.
     //
-    // pnpPowerCallbacks.EvtDeviceD0Entry         = HdmiEvtDeviceD0Entry;
-    // pnpPowerCallbacks.EvtDeviceD0Exit          = HdmiEvtDeviceD0Exit;
+    pnpPowerCallbacks.EvtDeviceD0Entry         = HdmiEvtDeviceD0Entry;
+    pnpPowerCallbacks.EvtDeviceD0Exit          = HdmiEvtDeviceD0Exit;
 
     //
     // Register the PnP Callbacks..
     //
     WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpPowerCallbacks);
 
+    //
+    // Completion ring views are mapped into the caller's process, so ring
+    // setup and teardown must see requests in the caller's context, and
+    // a ring left behind by a closed handle is torn down at cleanup.
+    //
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit,
+                                              HdmiEvtIoInCallerContext);
+
+    //
+    // Every handle is a stream of its own, see Stream.c.
+    //
+    WDF_FILEOBJECT_CONFIG_INIT(&fileConfig,
+                               HdmiEvtDeviceFileCreate,
+                               WDF_NO_EVENT_CALLBACK,
+                               HdmiEvtFileCleanup);
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, HDMI_STREAM_CONTEXT);
+    fileAttributes.EvtCleanupCallback = HdmiEvtStreamContextCleanup;
+
+    WdfDeviceInitSetFileObjectConfig(DeviceInit,
+                                     &fileConfig,
+                                     &fileAttributes);
+
     //
     // Initialize Fdo Attributes.
     //
@@ -178,6 +230,12 @@ Return Value:
     //
     attributes.SynchronizationScope = WdfSynchronizationScopeDevice;
 
+    //
+    // The statistics page is not a framework object; it is freed with the
+    // device, whether or not EvtDeviceAdd got as far as allocating it.
+    //
+    attributes.EvtCleanupCallback = HdmiEvtDeviceContextCleanup;
+
     //
     // Create the device
     //
@@ -202,6 +260,11 @@ Return Value:
     devExt = HdmiGetDeviceContext(device);
 
     devExt->Device = device;
+    devExt->CardIndex = HDMI_GROUP_MAX_CARDS;
+    devExt->TimestampFrequency = frequency.QuadPart;
+    InitializeListHead(&devExt->StreamList);
+
+    devExt->Startup.DeviceCreate = KeQueryPerformanceCounter(NULL).QuadPart - start;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
                 "     AddDevice PDO (0x%p) FDO (0x%p), DevExt (0x%p)",
@@ -254,14 +317,22 @@ Return Value:
     //
     // Initalize the Device Extension.
     //
+    phase = KeQueryPerformanceCounter(NULL).QuadPart;
+
     status = HdmiInitializeDeviceExtension(devExt);
 
     if (!NT_SUCCESS(status)) {
         return status;
     }
 
+    devExt->Startup.DeviceExtension = KeQueryPerformanceCounter(NULL).QuadPart - phase;
+    devExt->Startup.DeviceAdd       = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
-                "<-- HdmiEvtDeviceAdd %!STATUS!", status);
+                "<-- HdmiEvtDeviceAdd %!STATUS!: %I64d ticks, create %I64d, "
+                "extension %I64d, DMA %I64d",
+                status, devExt->Startup.DeviceAdd, devExt->Startup.DeviceCreate,
+                devExt->Startup.DeviceExtension, devExt->Startup.DmaInit);
 
     return status;
 }
@@ -299,6 +370,7 @@ Return Value:
 {
     NTSTATUS            status = STATUS_SUCCESS;
     PDEVICE_EXTENSION   devExt;
+    LONGLONG            start;
 
     UNREFERENCED_PARAMETER(Resources);
 
@@ -309,14 +381,18 @@ Return Value:
 
     devExt = HdmiGetDeviceContext(Device);
 
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
     status = HdmiPrepareHardware(devExt, ResourcesTranslated);
     if (!NT_SUCCESS (status)){
         return status;
     }
 
+    devExt->Startup.PrepareHardware = KeQueryPerformanceCounter(NULL).QuadPart - start;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
-                "<-- HdmiEvtDevicePrepareHardware, status %!STATUS!", status);
+                "<-- HdmiEvtDevicePrepareHardware, status %!STATUS!, %I64d ticks",
+                status, devExt->Startup.PrepareHardware);
 
     return status;
 }
@@ -365,10 +441,13 @@ Return Value:
         devExt->RegsBase = NULL;
     }
 
-   /* if(devExt->SRAMBase){
+    if (devExt->SRAMBase) {
+
         MmUnmapIoSpace(devExt->SRAMBase, devExt->SRAMLength);
         devExt->SRAMBase = NULL;
-    }*/
+    }
+
+    devExt->SRAMLength = 0;
 
 	/*if (devExt->Request)
 	{
@@ -423,11 +502,12 @@ Return Value:
 {
     PDEVICE_EXTENSION   devExt;
     NTSTATUS            status;
-
-    UNREFERENCED_PARAMETER(PreviousState);
+    LONGLONG            start;
 
     devExt = HdmiGetDeviceContext(Device);
 
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
     status = HdmiInitWrite( devExt );
     if (NT_SUCCESS(status)) {
 
@@ -435,6 +515,17 @@ Return Value:
 
     }
 
+    if (NT_SUCCESS(status)) {
+
+        HdmiPowerRestore( devExt, PreviousState );
+
+        devExt->Startup.D0Entry = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                    "D0 entry from power state %d: %I64d ticks",
+                    PreviousState, devExt->Startup.D0Entry);
+    }
+
     return status;
 }
 
@@ -476,18 +567,18 @@ Return Value:
 
     devExt = HdmiGetDeviceContext(Device);
 
+    WdfTimerStop(devExt->WatchdogTimer, TRUE);
+
     switch (TargetState) {
     case WdfPowerDeviceD1:
     case WdfPowerDeviceD2:
     case WdfPowerDeviceD3:
 
         //
-        // Fill in any code to save hardware state here.
-        //
-
-        //
-        // Fill in any code to put the device in a low-power state here.
+        // The channel is already quiet, see HdmiPowerQuiesce. Stop the
+        // engines; the DMA resources stay for HdmiEvtDeviceD0Entry.
         //
+        HdmiHardwareReset(devExt);
         break;
 
     case WdfPowerDevicePrepareForHibernation:
@@ -516,6 +607,228 @@ Return Value:
 
 
 
+NTSTATUS
+HdmiEvtDeviceSelfManagedIoInit(
+    IN  WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Called once after the device has first entered D0 and its queues are
+    running. Makes the card available to group writes and starts the
+    calibration of the DMA and PIO write paths; the steps run whenever
+    the write channel has nothing else to do, from the first stream open
+    on, which allocates the descriptor tables. Runs the self-test if the
+    SelfTestAtStart device parameter asks for it.
+
+Arguments:
+
+    Device  - The handle to the WDF device object
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PDEVICE_EXTENSION   devExt;
+    NTSTATUS            status;
+    WDFKEY              key;
+    ULONG               selfTest = 0;
+    DECLARE_CONST_UNICODE_STRING(selfTestName, L"SelfTestAtStart");
+
+    devExt = HdmiGetDeviceContext(Device);
+
+    HdmiGroupRegister(devExt);
+
+    WdfObjectAcquireLock(Device);
+
+    devExt->CalibrationPending = TRUE;
+    devExt->CalibrationStep    = 0;
+
+    HdmiStartNextWrite(devExt);
+
+    WdfObjectReleaseLock(Device);
+
+    //
+    // The self-test is optional; a card whose slot is known need not
+    // spend the start-up time on it.
+    //
+    status = WdfDeviceOpenRegistryKey( Device,
+                                       PLUGPLAY_REGKEY_DEVICE,
+                                       KEY_READ,
+                                       WDF_NO_OBJECT_ATTRIBUTES,
+                                       &key );
+    if (NT_SUCCESS(status)) {
+        (VOID) WdfRegistryQueryULong(key, &selfTestName, &selfTest);
+        WdfRegistryClose(key);
+    }
+
+    if (selfTest != 0) {
+
+        status = HdmiSelfTestRun(devExt);
+
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                    "Self-test at start: %!STATUS!", status);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HdmiEvtDeviceSelfManagedIoCleanup(
+    IN  WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Called when the device is being removed.
+
+Arguments:
+
+    Device  - The handle to the WDF device object
+
+Return Value:
+
+--*/
+{
+    HdmiGroupUnregister(HdmiGetDeviceContext(Device));
+
+    HdmiSelfTestCancel(HdmiGetDeviceContext(Device));
+}
+
+
+NTSTATUS
+HdmiEvtDeviceSelfManagedIoSuspend(
+    IN  WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Called before the device leaves D0, when it idles, the system sleeps
+    or its resources are rebalanced. Lets the transfer on the write
+    channel finish; frames submitted from now on wait for the device to
+    return.
+
+Arguments:
+
+    Device  - The handle to the WDF device object
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    PAGED_CODE();
+
+    HdmiPowerQuiesce(HdmiGetDeviceContext(Device));
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+HdmiEvtDeviceSelfManagedIoRestart(
+    IN  WDFDEVICE Device
+    )
+/*++
+
+Routine Description:
+
+    Called when the device is back in D0. Resumes the streams where they
+    stopped; the first frame transferred from now on ends the resume
+    latency measurement, see HdmiPowerFrameDone.
+
+Arguments:
+
+    Device  - The handle to the WDF device object
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    HdmiPowerResume(HdmiGetDeviceContext(Device));
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HdmiEvtDeviceFileCreate(
+    IN WDFDEVICE     Device,
+    IN WDFREQUEST    Request,
+    IN WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Called when a handle is opened. Sets up the handle's stream.
+
+Arguments:
+
+    Device - Handle to the framework device object.
+
+    Request - The create request; completed here.
+
+    FileObject - The new framework file object.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    NTSTATUS    status;
+
+    PAGED_CODE();
+
+    status = HdmiStreamCreate(HdmiGetDeviceContext(Device), FileObject);
+
+    WdfRequestComplete(Request, status);
+}
+
+
+VOID
+HdmiEvtFileCleanup(
+    IN WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    Called when the last handle to a file object is closed. Tears down the
+    handle's stream and any completion ring it left behind. This runs in
+    the context of the process that closed the handle, which is where the
+    ring views are.
+
+Arguments:
+
+    FileObject - handle to the framework file object being cleaned up.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    PDEVICE_EXTENSION   devExt;
+
+    PAGED_CODE();
+
+    devExt = HdmiGetDeviceContext(WdfFileObjectGetDevice(FileObject));
+
+    HdmiStreamCleanup(devExt, FileObject);
+}
+
+
 VOID
 HdmiEvtDriverContextCleanup(
     IN WDFDRIVER Driver
@@ -545,6 +858,32 @@ Return Value:
 }
 
 
+VOID
+HdmiEvtDeviceContextCleanup(
+    IN WDFOBJECT Device
+    )
+/*++
+Routine Description:
+
+    Frees what the device holds outside the framework when the device
+    object is deleted.
+
+Arguments:
+
+    Device - handle to a WDF device object.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    PAGED_CODE ();
+
+    HdmiStatsFree(HdmiGetDeviceContext(Device));
+}
+
+
 
 NTSTATUS
 HdmiSetIdleAndWakeSettings(
@@ -577,8 +916,12 @@ Return Value:
     //
     // Init the idle policy structure.
     //
+    //
+    // Open streams keep the card in D0 regardless, see Power.c; this is
+    // how long it waits once the last show has ended.
+    //
     WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS_INIT(&idleSettings, IdleCanWakeFromS0);
-    idleSettings.IdleTimeout = 10000; // 10-sec
+    idleSettings.IdleTimeout = HDMI_IDLE_TIMEOUT_DEFAULT;
 
     status = WdfDeviceAssignS0IdleSettings(FdoData->Device, &idleSettings);
     if ( !NT_SUCCESS(status)) {
@@ -587,6 +930,8 @@ Return Value:
         return status;
     }
 
+    FdoData->IdleTimeout = idleSettings.IdleTimeout;
+
     //
     // Init wait-wake policy structure.
     //
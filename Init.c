@@ -25,12 +25,60 @@ Environment:
 
 #include "Init.tmh"
 
+//
+// Layout of DEVICE_EXTENSION, see Private.h: each group that is written
+// by a different party starts a cache line, and the ISR's timestamp is
+// clear of its neighbours whatever the alignment of the context.
+//
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, IsrPadBefore) % HDMI_CACHE_LINE == 0);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, IsrTimestamp) -
+         FIELD_OFFSET(DEVICE_EXTENSION, IsrPadBefore) >=
+         HDMI_CACHE_LINE - MEMORY_ALLOCATION_ALIGNMENT);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, LowPower) -
+         FIELD_OFFSET(DEVICE_EXTENSION, IsrTimestamp) >= HDMI_CACHE_LINE);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, LowPower) % HDMI_CACHE_LINE == 0);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, XferSource) % HDMI_CACHE_LINE == 0);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, Clock) % HDMI_CACHE_LINE == 0);
+C_ASSERT(FIELD_OFFSET(DEVICE_EXTENSION, Startup) % HDMI_CACHE_LINE == 0);
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (PAGE, HdmiInitializeDeviceExtension)
 #pragma alloc_text (PAGE, HdmiPrepareHardware)
 #pragma alloc_text (PAGE, HdmiInitializeDMA)
+#pragma alloc_text (PAGE, HdmiAllocateTransferResources)
+#pragma alloc_text (PAGE, HdmiGetNodeAffinity)
 #endif
 
+
+BOOLEAN
+HdmiGetNodeAffinity(
+    IN  PDEVICE_EXTENSION DevExt,
+    OUT PGROUP_AFFINITY   Affinity
+    )
+/*++
+Routine Description:
+
+    Returns the active processors of the NUMA node the card hangs off.
+
+Return Value:
+
+    FALSE if the node is not known or has no active processors.
+
+--*/
+{
+    USHORT  count;
+
+    PAGED_CODE();
+
+    if (DevExt->NumaNode == HDMI_NUMA_NODE_UNKNOWN) {
+        return FALSE;
+    }
+
+    KeQueryNodeActiveAffinity( (USHORT) DevExt->NumaNode, Affinity, &count );
+
+    return (BOOLEAN) (count != 0);
+}
+
 NTSTATUS
 HdmiInitializeDeviceExtension(
     IN PDEVICE_EXTENSION DevExt
@@ -54,10 +102,27 @@ Return Value:
 {
     NTSTATUS    status;
     ULONG       dteCount;
+    USHORT      node;
     WDF_IO_QUEUE_CONFIG  queueConfig;
+    GROUP_AFFINITY       nodeAffinity;
+    GROUP_AFFINITY       oldAffinity;
+    BOOLEAN              onNode;
+    LONGLONG             start;
 
     PAGED_CODE();
 
+    //
+    // Find the NUMA node the card is attached to. Memory the card reads
+    // per frame is allocated there and its interrupt is steered there.
+    //
+    status = IoGetDeviceNumaNode( WdfDeviceWdmGetPhysicalDevice(DevExt->Device),
+                                  &node );
+
+    DevExt->NumaNode = NT_SUCCESS(status) ? node : HDMI_NUMA_NODE_UNKNOWN;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                "NUMA node %d", DevExt->NumaNode);
+
     //
     // Set Maximum Transfer Length (which must be less than the SRAM size).
     //
@@ -96,17 +161,17 @@ Return Value:
 
 
     //
-    // Setup a queue to handle only IRP_MJ_WRITE requests in Sequential
-    // dispatch mode. This mode ensures there is only one write request
-    // outstanding in the driver at any time. Framework will present the next
-    // request only if the current request is completed.
+    // Setup a queue to handle only IRP_MJ_WRITE requests in Parallel
+    // dispatch mode. HdmiEvtIoWrite only moves each request on to the
+    // queue of its stream (see Stream.c); the streams take turns on the
+    // write channel, which still carries one transfer at a time.
     // Since we have configured the queue to dispatch all the specific requests
     // we care about, we don't need a default queue.  A default queue is
     // used to receive requests that are not preconfigured to goto
     // a specific queue.
     //
     WDF_IO_QUEUE_CONFIG_INIT ( &queueConfig,
-                              WdfIoQueueDispatchSequential);
+                              WdfIoQueueDispatchParallel);
 
     queueConfig.EvtIoWrite = HdmiEvtIoWrite;
     //queueConfig.EvtIoRead = HdmiEvtIoRead;
@@ -153,20 +218,109 @@ Return Value:
                                        DevExt->IoctrQueue,
                                        WdfRequestTypeDeviceControl);
 
-  DevExt->DMAcompleted = 7;
+    //
+    // IOCTL_HDMI_RING_ENTER requests wait here while the completion ring
+    // has nothing to report. The DPC completes those of the ring's stream
+    // after posting a CQE.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT ( &queueConfig,
+                              WdfIoQueueDispatchManual);
+
+    queueConfig.PowerManaged = WdfFalse;
+
+    status = WdfIoQueueCreate( DevExt->Device,
+                                           &queueConfig,
+                                           WDF_NO_OBJECT_ATTRIBUTES,
+                                           &DevExt->RingWaitQueue );
+
+    if(!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfIoQueueCreate (ring wait) failed: %!STATUS!", status);
+        return status;
+    }
+
+    //
+    // IOCTL_HDMI_WRITE_BATCH requests wait here until their stream gets
+    // to them; a stream sends one batch at a time.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT ( &queueConfig,
+                              WdfIoQueueDispatchManual);
+
+    status = WdfIoQueueCreate( DevExt->Device,
+                                           &queueConfig,
+                                           WDF_NO_OBJECT_ATTRIBUTES,
+                                           &DevExt->BatchQueue );
+
+    if(!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfIoQueueCreate (batch) failed: %!STATUS!", status);
+        return status;
+    }
+
+    //
+    // WdfDmaEnablerCreate does not take a node, but the memory manager
+    // prefers the node of the allocating thread.
+    //
+    onNode = HdmiGetNodeAffinity(DevExt, &nodeAffinity);
+
+    if (onNode) {
+        KeSetSystemGroupAffinityThread(&nodeAffinity, &oldAffinity);
+    }
+
+    //
+    // The descriptor tables and the calibration buffer follow on the
+    // first stream open, see HdmiAllocateTransferResources.
+    //
+    status = WdfWaitLockCreate( WDF_NO_OBJECT_ATTRIBUTES,
+                                &DevExt->TransferLock );
+
+    if(!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfWaitLockCreate failed: %!STATUS!", status);
+        goto Done;
+    }
+
+    KeInitializeEvent(&DevExt->SelfTestEvent, NotificationEvent, FALSE);
+
     //
     // Create a WDFINTERRUPT object.
     //
     status = HdmiInterruptCreate(DevExt);
 
     if (!NT_SUCCESS(status)) {
-        return status;
+        goto Done;
     }
 
-    status = HdmiInitializeDMA( DevExt );
+    status = HdmiWatchdogCreate(DevExt);
 
     if (!NT_SUCCESS(status)) {
-        return status;
+        goto Done;
+    }
+
+    status = HdmiPowerInitialize(DevExt);
+
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    status = HdmiStatsInitialize(DevExt);
+
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    HdmiMapInitialize(DevExt);
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    status = HdmiInitializeDMA( DevExt );
+
+    DevExt->Startup.DmaInit = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+Done:
+
+    if (onNode) {
+        KeRevertToUserGroupAffinityThread(&oldAffinity);
     }
 
     return status;
@@ -313,24 +467,28 @@ Return Value:
     DevExt->Regs = (PHDMICARD_REG) DevExt->RegsBase;
 
     //
-    // Map in the SRAM Memory Space resource: BAR2
+    // Map in the SRAM Memory Space resource: BAR0
+    //
+    // Frames go to the SRAM by DMA; the mapping is only used for
+    // IOCTL_HDMI_PIO_WRITE, so it is write-combined and the device still
+    // starts without it. The size still bounds every DMA write.
     //
-   /* DevExt->SRAMBase = (PUCHAR) MmMapIoSpace( SRAMBasePA,
+    DevExt->SRAMLength = SRAMLength;
+
+    DevExt->SRAMBase = (PULONG) MmMapIoSpace( SRAMBasePA,
                                               SRAMLength,
-                                              MmNonCached );
+                                              MmWriteCombined );
 
     if (!DevExt->SRAMBase) {
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_PNP,
                     " - Unable to map SRAM memory %08I64X, length %d",
                     SRAMBasePA.QuadPart,  SRAMLength);
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-
-    DevExt->SRAMLength = SRAMLength;
+    } else {
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
-                " - SRAM      %p, length %d",
-                DevExt->SRAMBase, DevExt->SRAMLength );*/
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                    " - SRAM      %p, length %d",
+                    DevExt->SRAMBase, DevExt->SRAMLength );
+    }
 
     return status;
 }
@@ -344,7 +502,8 @@ HdmiInitializeDMA(
 /*++
 Routine Description:
 
-    Initializes the DMA adapter.
+    Initializes the DMA adapter and the write transaction. The descriptor
+    tables are allocated later, see HdmiAllocateTransferResources.
 
 Arguments:
 
@@ -381,11 +540,40 @@ Return Value:
         TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
                     " - The DMA Profile is WdfDmaProfileScatterGather64Duplex");
 
+        DevExt->DmaVersion = 2;
+        status = STATUS_NOT_SUPPORTED;
+
+#if (KMDF_VERSION_MINOR >= 11)
+        //
+        // Ask for the DMA v3 adapter. Its map registers are allocated
+        // without the legacy adapter-channel queueing, which matters
+        // when every frame is mapped through an IOMMU. Systems without
+        // it fail the create, so try again with the default interface.
+        //
+        dmaConfig.WdmDmaVersionOverride = 3;
+
         status = WdfDmaEnablerCreate( DevExt->Device,
                                       &dmaConfig,
                                       WDF_NO_OBJECT_ATTRIBUTES,
                                       &DevExt->DmaEnabler );
 
+        if (NT_SUCCESS(status)) {
+            DevExt->DmaVersion = 3;
+        } else {
+            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                        " - DMA v3 not available: %!STATUS!", status);
+            dmaConfig.WdmDmaVersionOverride = 0;
+        }
+
+#endif
+
+        if (!NT_SUCCESS(status)) {
+            status = WdfDmaEnablerCreate( DevExt->Device,
+                                          &dmaConfig,
+                                          WDF_NO_OBJECT_ATTRIBUTES,
+                                          &DevExt->DmaEnabler );
+        }
+
         if (!NT_SUCCESS (status)) {
 
             TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
@@ -394,6 +582,85 @@ Return Value:
         }
     }
 
+    //
+    // Since we are using sequential queue and processing one request
+    // at a time, we will create transaction objects upfront and reuse
+    // them to do DMA transfer. Transactions objects are parented to
+    // DMA enabler object by default. They will be deleted along with
+    // along with the DMA enabler object. So need to delete them
+    // explicitly.
+    //
+
+    // WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
+    //
+    // Create a new DmaTransaction.
+    //
+    status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &DevExt->WriteDmaTransaction );
+
+    if(!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "WdfDmaTransactionCreate(write) failed: %!STATUS!", status);
+        return status;
+    }
+		dmaTransactionbuf = DevExt->WriteDmaTransaction;
+    return status;
+}
+
+
+NTSTATUS
+HdmiAllocateTransferResources(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Allocates the descriptor tables and the calibration buffer, which are
+    sized for the largest transfer and not needed until the card has
+    something to send. Called at PASSIVE_LEVEL by the first stream open
+    and by a group write naming the card; later calls return at once.
+
+    The memory is zeroed here, so every page of it has been touched
+    before the first frame is programmed.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+     NTSTATUS
+
+--*/
+{
+    NTSTATUS              status = STATUS_SUCCESS;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    GROUP_AFFINITY        nodeAffinity;
+    GROUP_AFFINITY        oldAffinity;
+    BOOLEAN               onNode;
+    LONGLONG              start;
+
+    PAGED_CODE();
+
+    if (DevExt->TransferReady) {
+        return STATUS_SUCCESS;
+    }
+
+    WdfWaitLockAcquire(DevExt->TransferLock, NULL);
+
+    if (DevExt->TransferReady) {
+        goto Unlock;
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    onNode = HdmiGetNodeAffinity(DevExt, &nodeAffinity);
+
+    if (onNode) {
+        KeSetSystemGroupAffinityThread(&nodeAffinity, &oldAffinity);
+    }
+
     //
     // Allocate common buffer for building writes
     //
@@ -413,10 +680,10 @@ Return Value:
     if (!NT_SUCCESS(status)) {
         TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
                     "WdfCommonBufferCreate (write) failed: %!STATUS!", status);
-        return status;
+        DevExt->WriteCommonBuffer1 = NULL;
+        goto Done;
     }
 
-
     DevExt->WriteCommonBuffer1Base =
         WdfCommonBufferGetAlignedVirtualAddress(DevExt->WriteCommonBuffer1);
 
@@ -426,18 +693,23 @@ Return Value:
     RtlZeroMemory( DevExt->WriteCommonBuffer1Base,
                    DevExt->WriteCommonBuffer1Size);
 
+    ((PDMA_DESC_HEADER) DevExt->WriteCommonBuffer1Base)->Eplast =
+        HDMI_EPLAST_IDLE;
+
+    DevExt->WriteCommonBuffer2Size = DevExt->WriteCommonBuffer1Size;
+
     status = WdfCommonBufferCreate( DevExt->DmaEnabler,
-                                    DevExt->WriteCommonBuffer1Size,
+                                    DevExt->WriteCommonBuffer2Size,
                                     WDF_NO_OBJECT_ATTRIBUTES,
                                     &DevExt->WriteCommonBuffer2 );
 
     if (!NT_SUCCESS(status)) {
         TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
                     "WdfCommonBufferCreate (write) failed: %!STATUS!", status);
-        return status;
+        DevExt->WriteCommonBuffer2 = NULL;
+        goto Done;
     }
 
-
     DevExt->WriteCommonBuffer2Base =
         WdfCommonBufferGetAlignedVirtualAddress(DevExt->WriteCommonBuffer2);
 
@@ -445,38 +717,75 @@ Return Value:
         WdfCommonBufferGetAlignedLogicalAddress(DevExt->WriteCommonBuffer2);
 
     RtlZeroMemory( DevExt->WriteCommonBuffer2Base,
-                   DevExt->WriteCommonBuffer2Size);	
-	
-
-    /*TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
-                "WriteCommonBuffer 0x%p  (#0x%I64X), length %I64d",
-                DevExt->WriteCommonBuffer1Base,
-                DevExt->WriteCommonBuffer1BaseLA.LowPart,
-                WdfCommonBufferGetLength(DevExt->WriteCommonBuffer1) );*/
+                   DevExt->WriteCommonBuffer2Size);
 
     //
-    // Since we are using sequential queue and processing one request
-    // at a time, we will create transaction objects upfront and reuse
-    // them to do DMA transfer. Transactions objects are parented to
-    // DMA enabler object by default. They will be deleted along with
-    // along with the DMA enabler object. So need to delete them
-    // explicitly.
+    // Source buffer for the calibration transfers (see Calib.c).
     //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = DevExt->Device;
 
-    // WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, TRANSACTION_CONTEXT);
-    //
-    // Create a new DmaTransaction.
-    //
-    status = WdfDmaTransactionCreate( DevExt->DmaEnabler,
-                                      WDF_NO_OBJECT_ATTRIBUTES,
-                                      &DevExt->WriteDmaTransaction );
+    status = WdfMemoryCreate( &attributes,
+                              NonPagedPool,
+                              HDMI_POOL_TAG,
+                              HDMI_PIO_MAX_LENGTH,
+                              &DevExt->CalibrationMemory,
+                              &DevExt->CalibrationBuffer );
 
     if(!NT_SUCCESS(status)) {
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
-                    "WdfDmaTransactionCreate(write) failed: %!STATUS!", status);
-        return status;
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfMemoryCreate (calibration) failed: %!STATUS!", status);
+        DevExt->CalibrationMemory = NULL;
+        goto Done;
     }
-		dmaTransactionbuf = DevExt->WriteDmaTransaction;
+
+    RtlZeroMemory(DevExt->CalibrationBuffer, HDMI_PIO_MAX_LENGTH);
+
+Done:
+
+    if (onNode) {
+        KeRevertToUserGroupAffinityThread(&oldAffinity);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        //
+        // Start over on the next open.
+        //
+        if (DevExt->WriteCommonBuffer1) {
+            WdfObjectDelete(DevExt->WriteCommonBuffer1);
+            DevExt->WriteCommonBuffer1     = NULL;
+            DevExt->WriteCommonBuffer1Base = NULL;
+        }
+        if (DevExt->WriteCommonBuffer2) {
+            WdfObjectDelete(DevExt->WriteCommonBuffer2);
+            DevExt->WriteCommonBuffer2     = NULL;
+            DevExt->WriteCommonBuffer2Base = NULL;
+        }
+        goto Unlock;
+    }
+
+    DevExt->Startup.TransferResources = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                "Transfer resources allocated in %I64d ticks",
+                DevExt->Startup.TransferResources);
+
+    //
+    // The write channel may be handed out from now on; a calibration
+    // left pending since start-up runs once it is idle.
+    //
+    WdfObjectAcquireLock(DevExt->Device);
+
+    DevExt->TransferReady = TRUE;
+
+    HdmiStartNextWrite(DevExt);
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+Unlock:
+
+    WdfWaitLockRelease(DevExt->TransferLock);
+
     return status;
 }
 
@@ -570,15 +879,44 @@ Return Value:
     //
     // WdfInterrupt is already disabled so issue a full reset
     //
-   /* if (DevExt->Regs) {
+    if (DevExt->Regs) {
 
         HdmiHardwareReset(DevExt);
-    }*/
+    }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "<--- HdmiShutdown");
 }
 
 
+VOID
+HdmiHardwareReset(
+    IN PDEVICE_EXTENSION    DevExt
+    )
+/*++
+
+Routine Description:
+
+    Stops both DMA engines. The write channel alone is reset by the
+    watchdog, see HdmiResetWriteChannel.
+
+Arguments:
+
+    DevExt -  Pointer to our adapter
+
+Return Value:
+
+    None
 
+--*/
+{
+    WdfInterruptAcquireLock( DevExt->Interrupt );
 
+    HdmiRegStrobe( DevExt, HDMI_REG(ReadCtr.CtrBit), 0xffffffff );
+    HdmiRegStrobe( DevExt, HDMI_REG(ReadCtr.CtrBit), 0 );
 
+    HdmiRegInvalidate( DevExt, HDMI_REG(ReadCtr), sizeof(DMA_TRANSFER_CTR) );
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+
+    HdmiResetWriteChannel(DevExt);
+}
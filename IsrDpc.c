@@ -75,6 +75,27 @@ Return Value:
     if( !NT_SUCCESS(status) ) {
         TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
                     "WdfInterruptCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    //
+    // Take the interrupt, and with it the DPC, on the card's own NUMA
+    // node, where its descriptors and ring pages live.
+    //
+    {
+        WDF_INTERRUPT_EXTENDED_POLICY   policy;
+        GROUP_AFFINITY                  affinity;
+
+        if (HdmiGetNodeAffinity(DevExt, &affinity)) {
+
+            WDF_INTERRUPT_EXTENDED_POLICY_INIT(&policy);
+
+            policy.Policy   = WdfIrqPolicySpecifiedProcessors;
+            policy.Priority = WdfIrqPriorityNormal;
+            policy.TargetProcessorSetAndGroup = affinity;
+
+            WdfInterruptSetExtendedPolicy(DevExt->Interrupt, &policy);
+        }
     }
 
     return status;
@@ -111,6 +132,7 @@ Return Value:
 --*/
 {
     PDEVICE_EXTENSION   devExt;
+    PDMA_DESC_HEADER    header;
     BOOLEAN             isRecognized = TRUE;
 
     
@@ -122,6 +144,25 @@ Return Value:
 
     devExt  = HdmiGetDeviceContext(WdfInterruptGetDevice(Interrupt));
 
+    //
+    // The interrupt is the completion of the transfer on the channel only
+    // if the card has written back that transfer's last descriptor; the
+    // engine posts EPLAST before the interrupt message. A late one of a
+    // transfer the watchdog or a flush has failed finds the table of the
+    // next transfer still IDLE, see HdmiResetWriteChannel. The fields are
+    // set under the interrupt lock, which the ISR holds.
+    //
+    // Completion ring CQEs carry the time of the interrupt, not of the DPC.
+    //
+    header = devExt->WriteTable;
+
+    if (header != NULL && header->Eplast == devExt->WriteLastDesc) {
+        devExt->IsrTimestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+        devExt->IsrSequence  = devExt->WriteSequence;
+    }
+
+    HdmiStatsCpu(devExt)->Interrupts++;
+
 	//WdfRequestUnmarkCancelable(devExt->Request);
 	
     WdfInterruptQueueDpcForIsr( devExt->Interrupt);
@@ -167,41 +208,115 @@ Return Value:
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC, "--> EvtInterruptDpc");
 
     devExt  = HdmiGetDeviceContext(WdfInterruptGetDevice(Interrupt));
+
+    HdmiStatsCpu(devExt)->Dpcs++;
+
+    //
+    // A late interrupt of a transfer the watchdog or a flush has already
+    // failed, or of one this DPC has completed already: the ISR has not
+    // seen the transfer on the channel finish.
+    //
+    if (devExt->XferSource == HdmiXferNone ||
+        devExt->IsrSequence != devExt->WriteSequence) {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_DPC,
+                    "<-- EvtInterruptDpc: stale interrupt");
+        HdmiStartNextWrite(devExt);
+        return;
+    }
+
     
 		dmaTransaction = devExt->WriteDmaTransaction;
 
-		length = WdfDmaTransactionGetCurrentDmaTransferLength( dmaTransaction );
-//		dteVA = (PDMA_TRANSFER_ELEMENT) devExt->WriteCommonBuffer1Base + 16;
-		if (length != 0xE10000)
+		if (devExt->XferDirect)
 			{
-				transactionComplete = WdfDmaTransactionDmaCompletedFinal(dmaTransaction,
-																							length,
-                                     					&status);	 
+				//
+				// A pre-mapped ring slot; there is no transaction.
+				//
+				length = devExt->XferDirectLength;
+				status = STATUS_SUCCESS;
+				transactionComplete = TRUE;
 			}
 		else
 			{
-	       	/* while((dteVA->DescPtr & 0x40000000) == 0) {
-	            length -= ((dteVA->DescPtr & 0xFFFFFF) << 2);
-	            dteVA++;
-	        }
-	        length -= ((dteVA->DescPtr & 0xFFFFFF) << 2);*/
-				transactionComplete = WdfDmaTransactionDmaCompletedWithLength(dmaTransaction,
-																																				length,
-					                                                     					&status);	
-				/*	transactionComplete = WdfDmaTransactionDmaCompleted( dmaTransaction,
-                                                         &status );       */                        
+				length = WdfDmaTransactionGetCurrentDmaTransferLength( dmaTransaction );
+//				dteVA = (PDMA_TRANSFER_ELEMENT) devExt->WriteCommonBuffer1Base + 16;
+				if (length != 0xE10000)
+					{
+						transactionComplete = WdfDmaTransactionDmaCompletedFinal(dmaTransaction,
+																									length,
+		                                     					&status);	 
+					}
+				else
+					{
+			       	/* while((dteVA->DescPtr & 0x40000000) == 0) {
+			            length -= ((dteVA->DescPtr & 0xFFFFFF) << 2);
+			            dteVA++;
+			        }
+			        length -= ((dteVA->DescPtr & 0xFFFFFF) << 2);*/
+						transactionComplete = WdfDmaTransactionDmaCompletedWithLength(dmaTransaction,
+																																						length,
+							                                                     					&status);	
+						/*	transactionComplete = WdfDmaTransactionDmaCompleted( dmaTransaction,
+		                                                         &status );       */                        
+					}
 			}
 		if (transactionComplete) 
 			{
+					//
+					// Only whole frames tell the clock model anything.
+					//
+					if (NT_SUCCESS(status) && !devExt->XferSlice &&
+						!(devExt->XferSource == HdmiXferRing &&
+						  (devExt->XferRing->InflightFlags & HDMI_SQE_FLAG_SLICE)) &&
+						devExt->XferSource != HdmiXferCalibrate &&
+						devExt->XferSource != HdmiXferSelfTest &&
+						devExt->XferSource != HdmiXferChunk)
+						{
+							//
+							// The card's frame period is that of the main
+							// picture; overlays, LUTs and group frames
+							// keep their own pace.
+							//
+							if (devExt->XferStream != NULL &&
+								devExt->XferStream->Class == HDMI_STREAM_CLASS_PICTURE)
+								{
+									HdmiClockUpdate( &devExt->Clock, devExt->IsrTimestamp );
+								}
+
+							HdmiPowerFrameDone( devExt );
+							HdmiStatsCpu( devExt )->Frames++;
+						}
+
+					if (NT_SUCCESS(status))
+						{
+							HdmiCostUpdate( &devExt->PathCost, FALSE, (ULONG) length,
+							                devExt->IsrTimestamp - devExt->WriteStartTime );
+							HdmiWatchdogUpdate( devExt, (ULONG) length,
+							                    devExt->IsrTimestamp - devExt->WriteStartTime );
+
+							if (devExt->XferSource != HdmiXferCalibrate &&
+								devExt->XferSource != HdmiXferSelfTest)
+								{
+									HdmiStatsCpu( devExt )->Bytes += length;
+								}
+						}
+
+					HdmiStreamCharge( devExt, (ULONG) length );
+
 					//
 					// Complete this DmaTransaction.
 					//
 					TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC,
-					                         "Completing Write request in the DpcForIsr");
-					
-					
-					HdmiWriteRequestComplete( dmaTransaction, status ); 
-					devExt->DMAcompleted = 7;
+					            "Completing write transfer in the DpcForIsr");
+
+					HdmiCompleteWriteTransfer( devExt, status );
+
+					devExt->XferStream = NULL;
+
+					//
+					// Keep the channel busy with whatever is waiting.
+					//
+					HdmiStartNextWrite( devExt );
 			
 			}			
     
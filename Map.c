@@ -0,0 +1,222 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Map.c
+
+Abstract:
+
+    Pre-mapped ring slots. A slot backed by a common buffer has its logical
+    address from the moment it is allocated, so its frames are started
+    without allocating map registers or building an SG list, which on a
+    host with an IOMMU is most of the cost of starting a frame.
+
+    Buffers are kept when their ring goes away and handed to the next ring
+    asking for the same slot size. HDMI_MAP_BYTES_MAX bounds the memory
+    held; unused buffers are given back, oldest first, to make room, and
+    a slot that does not fit is allocated as ordinary pages instead. The
+    descriptor table of a polled ring comes from the same cache.
+
+    Which buffer to hand out or give back is decided by MapCache.c; this
+    file holds the lock and allocates and frees the buffers.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Map.tmh"
+
+
+VOID
+HdmiMapInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    )
+{
+    KeInitializeSpinLock(&DevExt->MapLock);
+    HdmiMapCacheInitialize(&DevExt->MapCache, HDMI_MAP_BYTES_MAX);
+}
+
+
+static PHDMI_MAPPED_BUFFER
+HdmiMapCreate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Allocates a common buffer of Length bytes, on the card's node if it is
+    known, and the MDL its user view is built from.
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFCOMMONBUFFER         commonBuffer;
+    PHDMI_MAPPED_BUFFER     buffer;
+    GROUP_AFFINITY          nodeAffinity;
+    GROUP_AFFINITY          oldAffinity;
+    BOOLEAN                 onNode;
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, HDMI_MAPPED_BUFFER);
+    attributes.EvtCleanupCallback = HdmiEvtMappedBufferCleanup;
+
+    onNode = HdmiGetNodeAffinity(DevExt, &nodeAffinity);
+
+    if (onNode) {
+        KeSetSystemGroupAffinityThread(&nodeAffinity, &oldAffinity);
+    }
+
+    status = WdfCommonBufferCreate( DevExt->DmaEnabler,
+                                    Length,
+                                    &attributes,
+                                    &commonBuffer );
+
+    if (onNode) {
+        KeRevertToUserGroupAffinityThread(&oldAffinity);
+    }
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_IOCTLS,
+                    "HdmiMapCreate: %d bytes failed: %!STATUS!", Length, status);
+        return NULL;
+    }
+
+    buffer = HdmiGetMappedBuffer(commonBuffer);
+
+    buffer->CommonBuffer   = commonBuffer;
+    buffer->VirtualAddress = WdfCommonBufferGetAlignedVirtualAddress(commonBuffer);
+    buffer->LogicalAddress = WdfCommonBufferGetAlignedLogicalAddress(commonBuffer);
+    buffer->Entry.Length   = Length;
+
+    buffer->Mdl = IoAllocateMdl( buffer->VirtualAddress,
+                                 Length,
+                                 FALSE,
+                                 FALSE,
+                                 NULL );
+    if (!buffer->Mdl) {
+        WdfObjectDelete(commonBuffer);
+        return NULL;
+    }
+
+    MmBuildMdlForNonPagedPool(buffer->Mdl);
+
+    return buffer;
+}
+
+
+PHDMI_MAPPED_BUFFER
+HdmiMapAcquire(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Returns a zeroed, pre-mapped buffer of Length bytes for a ring slot
+    or poll table, from the cache if it has one of that size. Called at
+    PASSIVE_LEVEL from HdmiRingSetup.
+
+Return Value:
+
+    The buffer, or NULL if the slot has to use ordinary pages.
+
+--*/
+{
+    KIRQL               oldIrql;
+    PLIST_ENTRY         entry;
+    LIST_ENTRY          evicted;
+    PHDMI_MAP_ENTRY     cached;
+    PHDMI_MAPPED_BUFFER buffer = NULL;
+    BOOLEAN             reserved;
+
+    KeAcquireSpinLock(&DevExt->MapLock, &oldIrql);
+    cached = HdmiMapCacheTake(&DevExt->MapCache, Length, &evicted, &reserved);
+    KeReleaseSpinLock(&DevExt->MapLock, oldIrql);
+
+    if (cached != NULL) {
+        buffer = CONTAINING_RECORD(cached, HDMI_MAPPED_BUFFER, Entry);
+    }
+
+    //
+    // Common buffers are freed at PASSIVE_LEVEL, so outside the lock.
+    //
+    while (!IsListEmpty(&evicted)) {
+        entry = RemoveHeadList(&evicted);
+        WdfObjectDelete(CONTAINING_RECORD(entry, HDMI_MAPPED_BUFFER, Entry.Link)->CommonBuffer);
+    }
+
+    if (reserved) {
+
+        buffer = HdmiMapCreate(DevExt, Length);
+
+        if (buffer == NULL) {
+            KeAcquireSpinLock(&DevExt->MapLock, &oldIrql);
+            HdmiMapCacheUnreserve(&DevExt->MapCache, Length);
+            KeReleaseSpinLock(&DevExt->MapLock, oldIrql);
+        }
+    }
+
+    if (buffer != NULL) {
+        //
+        // It may hold another process's frames.
+        //
+        RtlZeroMemory(buffer->VirtualAddress, Length);
+    }
+
+    return buffer;
+}
+
+
+VOID
+HdmiMapRelease(
+    IN PDEVICE_EXTENSION   DevExt,
+    IN PHDMI_MAPPED_BUFFER Buffer
+    )
+/*++
+Routine Description:
+
+    Puts a slot buffer back on the cache. The user view must be gone and
+    no DMA may reference it any more. Callable at DISPATCH_LEVEL, so from
+    the DPC that frees a ring.
+
+--*/
+{
+    KIRQL   oldIrql;
+
+    KeAcquireSpinLock(&DevExt->MapLock, &oldIrql);
+    HdmiMapCachePut(&DevExt->MapCache, &Buffer->Entry);
+    KeReleaseSpinLock(&DevExt->MapLock, oldIrql);
+}
+
+
+VOID
+HdmiEvtMappedBufferCleanup(
+    IN WDFOBJECT Object
+    )
+/*++
+Routine Description:
+
+    Frees the MDL of a slot buffer when its common buffer is deleted, by
+    HdmiMapAcquire or along with the DMA enabler.
+
+--*/
+{
+    PHDMI_MAPPED_BUFFER buffer = HdmiGetMappedBuffer(Object);
+
+    if (buffer->Mdl) {
+        IoFreeMdl(buffer->Mdl);
+        buffer->Mdl = NULL;
+    }
+}
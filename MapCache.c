@@ -0,0 +1,130 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    MapCache.c
+
+Abstract:
+
+    Policy of the pre-mapped buffer cache of Map.c. A buffer asked for is
+    an unused one of the same length if there is one; otherwise the cache
+    reserves room for a new one within its limit, giving up unused
+    buffers, oldest first, as long as that leaves too little room. The
+    caller allocates and frees the buffers and holds whatever lock the
+    cache needs.
+
+    Nothing here allocates, frees or waits, so it is also built in user
+    mode, see Model.h, and tested by Test\TestMapCache.c.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+
+VOID
+HdmiMapCacheInitialize(
+    OUT PHDMI_MAP_CACHE Cache,
+    IN  ULONG           Limit
+    )
+{
+    InitializeListHead(&Cache->Unused);
+    Cache->Bytes = 0;
+    Cache->Limit = Limit;
+}
+
+
+PHDMI_MAP_ENTRY
+HdmiMapCacheTake(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     ULONG           Length,
+    OUT    PLIST_ENTRY     Evicted,
+    OUT    PBOOLEAN        Reserved
+    )
+/*++
+Routine Description:
+
+    Takes an unused entry of Length bytes off the cache. If there is none,
+    moves the oldest unused entries to Evicted until Length fits within
+    the limit, and if it then does, counts it and sets Reserved: the
+    caller is to create the buffer, or call HdmiMapCacheUnreserve if it
+    cannot.
+
+    Evicted is initialized here, and the caller frees what it holds.
+
+Return Value:
+
+    The entry, or NULL.
+
+--*/
+{
+    PLIST_ENTRY     entry;
+    PHDMI_MAP_ENTRY cached;
+
+    InitializeListHead(Evicted);
+    *Reserved = FALSE;
+
+    for (entry = Cache->Unused.Flink; entry != &Cache->Unused; entry = entry->Flink) {
+
+        cached = CONTAINING_RECORD(entry, HDMI_MAP_ENTRY, Link);
+
+        if (cached->Length == Length) {
+            RemoveEntryList(entry);
+            return cached;
+        }
+    }
+
+    //
+    // Bytes never exceeds Limit, so the difference cannot wrap, while
+    // Bytes + Length could.
+    //
+    while (Length > Cache->Limit - Cache->Bytes && !IsListEmpty(&Cache->Unused)) {
+
+        entry = RemoveHeadList(&Cache->Unused);
+        Cache->Bytes -= CONTAINING_RECORD(entry, HDMI_MAP_ENTRY, Link)->Length;
+        InsertTailList(Evicted, entry);
+    }
+
+    if (Length <= Cache->Limit - Cache->Bytes) {
+        Cache->Bytes += Length;
+        *Reserved = TRUE;
+    }
+
+    return NULL;
+}
+
+
+VOID
+HdmiMapCachePut(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     PHDMI_MAP_ENTRY Entry
+    )
+/*++
+Routine Description:
+
+    Gives back an entry taken or reserved earlier; it stays counted.
+
+--*/
+{
+    InsertTailList(&Cache->Unused, &Entry->Link);
+}
+
+
+VOID
+HdmiMapCacheUnreserve(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     ULONG           Length
+    )
+{
+    Cache->Bytes -= Length;
+}
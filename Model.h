@@ -0,0 +1,217 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Model.h
+
+Abstract:
+
+    The parts of the driver that neither touch the device nor call WDF.
+    Their source files include nothing but precomp.h, which with
+    HDMI_USER_MODE defined gives them only this header, Public.h and the
+    Win32 headers, so the tests in Test\ build them as they are.
+
+Environment:
+
+    Kernel mode, or user mode for the tests
+
+--*/
+
+
+#if !defined(_HDMI_MODEL_H_)
+#define _HDMI_MODEL_H_
+
+#if defined(HDMI_USER_MODE)
+
+//
+// The list routines of wdm.h, which the Win32 headers lack.
+//
+FORCEINLINE
+VOID
+InitializeListHead(
+    OUT PLIST_ENTRY ListHead
+    )
+{
+    ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+FORCEINLINE
+BOOLEAN
+IsListEmpty(
+    IN const LIST_ENTRY *ListHead
+    )
+{
+    return (BOOLEAN) (ListHead->Flink == ListHead);
+}
+
+FORCEINLINE
+BOOLEAN
+RemoveEntryList(
+    IN PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY Blink = Entry->Blink;
+    PLIST_ENTRY Flink = Entry->Flink;
+
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return (BOOLEAN) (Flink == Blink);
+}
+
+FORCEINLINE
+PLIST_ENTRY
+RemoveHeadList(
+    IN OUT PLIST_ENTRY ListHead
+    )
+{
+    PLIST_ENTRY Entry = ListHead->Flink;
+
+    RemoveEntryList(Entry);
+    return Entry;
+}
+
+FORCEINLINE
+VOID
+InsertTailList(
+    IN OUT PLIST_ENTRY ListHead,
+    IN OUT PLIST_ENTRY Entry
+    )
+{
+    PLIST_ENTRY Blink = ListHead->Blink;
+
+    Entry->Flink = ListHead;
+    Entry->Blink = Blink;
+    Blink->Flink = Entry;
+    ListHead->Blink = Entry;
+}
+
+#endif // HDMI_USER_MODE
+
+//
+// Clock model state, see Clock.c. Sample times are kept with the frame
+// number they were assigned, so skipped frames leave a gap in the fit.
+//
+#define HDMI_CLOCK_SAMPLES        32
+#define HDMI_CLOCK_MIN_SAMPLES    8
+#define HDMI_CLOCK_MAX_GAP        64    // frames; a longer stall restarts the fit
+
+typedef struct _HDMI_CLOCK_STATE {
+
+    ULONG                   Count;      // valid samples
+    ULONG                   Next;       // next sample to overwrite
+    LONGLONG                Frame[HDMI_CLOCK_SAMPLES];
+    LONGLONG                Time[HDMI_CLOCK_SAMPLES];
+
+    LONGLONG                FrameNumber; // frame of the latest sample
+    LONGLONG                LastTime;    // raw time of the latest sample
+    LONGLONG                Period;      // 16.16, 0 until fitted
+    LONGLONG                Phase;       // fitted time of FrameNumber
+    LONGLONG                Jitter;
+
+} HDMI_CLOCK_STATE, *PHDMI_CLOCK_STATE;
+
+//
+// Transfer path cost model, see Cost.c. Bucket b holds writes of up to
+// 1 << (HDMI_COST_MIN_SHIFT + b) bytes, the last one HDMI_PIO_MAX_LENGTH.
+// Costs are smoothed counter ticks per write, 0 while unknown.
+//
+#define HDMI_COST_MIN_SHIFT       8
+#define HDMI_COST_BUCKETS         9
+
+typedef struct _HDMI_PATH_COST {
+
+    LONGLONG                Dma[HDMI_COST_BUCKETS];
+    LONGLONG                Pio[HDMI_COST_BUCKETS];
+    ULONG                   PioThreshold; // longest write sent by PIO
+
+} HDMI_PATH_COST, *PHDMI_PATH_COST;
+
+//
+// Cache of buffers kept between uses, see MapCache.c. Bytes counts every
+// buffer the cache has let its owner create and not yet seen given back,
+// in use or not; Unused holds those not in use, oldest first.
+//
+typedef struct _HDMI_MAP_ENTRY {
+
+    LIST_ENTRY              Link;       // Unused while not in use
+    ULONG                   Length;
+
+} HDMI_MAP_ENTRY, *PHDMI_MAP_ENTRY;
+
+typedef struct _HDMI_MAP_CACHE {
+
+    LIST_ENTRY              Unused;
+    ULONG                   Bytes;
+    ULONG                   Limit;      // most Bytes may reach
+
+} HDMI_MAP_CACHE, *PHDMI_MAP_CACHE;
+
+//
+// Playout clock model (Clock.c)
+//
+VOID
+HdmiClockUpdate(
+    IN OUT PHDMI_CLOCK_STATE Clock,
+    IN     LONGLONG          Timestamp
+    );
+
+VOID
+HdmiClockQuery(
+    IN  PHDMI_CLOCK_STATE Clock,
+    OUT PHDMI_CLOCK       Model
+    );
+
+//
+// Transfer path cost model (Cost.c)
+//
+VOID
+HdmiCostUpdate(
+    IN OUT PHDMI_PATH_COST Cost,
+    IN     BOOLEAN         Pio,
+    IN     ULONG           Length,
+    IN     LONGLONG        Ticks
+    );
+
+BOOLEAN
+HdmiCostUsePio(
+    IN PHDMI_PATH_COST Cost,
+    IN ULONG           Length
+    );
+
+//
+// Buffer cache policy (MapCache.c)
+//
+VOID
+HdmiMapCacheInitialize(
+    OUT PHDMI_MAP_CACHE Cache,
+    IN  ULONG           Limit
+    );
+
+PHDMI_MAP_ENTRY
+HdmiMapCacheTake(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     ULONG           Length,
+    OUT    PLIST_ENTRY     Evicted,
+    OUT    PBOOLEAN        Reserved
+    );
+
+VOID
+HdmiMapCachePut(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     PHDMI_MAP_ENTRY Entry
+    );
+
+VOID
+HdmiMapCacheUnreserve(
+    IN OUT PHDMI_MAP_CACHE Cache,
+    IN     ULONG           Length
+    );
+
+#endif // _HDMI_MODEL_H_
@@ -0,0 +1,230 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Pio.c
+
+Abstract:
+
+    Programmed I/O into the frame SRAM. A few KB are copied faster by the
+    CPU through the write-combined BAR0 mapping than by building an SG
+    list and waiting for the DMA interrupt.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#if defined(_M_AMD64) || defined(_M_IX86)
+#include <emmintrin.h>
+#endif
+
+#include "Pio.tmh"
+
+
+VOID
+HdmiPioCopy(
+    OUT PUCHAR Destination,
+    IN  PUCHAR Source,
+    IN  ULONG  Length
+    )
+/*++
+Routine Description:
+
+    Copies Length bytes (a multiple of 4) into the SRAM mapping with
+    streaming stores, in full 16-byte chunks where the destination
+    allows, and fences so the data has left the write-combining buffers
+    before the caller is told it is there.
+
+--*/
+{
+#if defined(_M_AMD64) || defined(_M_IX86)
+
+    while (Length != 0 && ((ULONG_PTR) Destination & 15) != 0) {
+        *(volatile ULONG *) Destination = *(ULONG UNALIGNED *) Source;
+        Destination += sizeof(ULONG);
+        Source      += sizeof(ULONG);
+        Length      -= sizeof(ULONG);
+    }
+
+    while (Length >= 16) {
+        _mm_stream_si128( (__m128i *) Destination,
+                          _mm_loadu_si128((__m128i *) Source) );
+        Destination += 16;
+        Source      += 16;
+        Length      -= 16;
+    }
+
+    while (Length != 0) {
+        *(volatile ULONG *) Destination = *(ULONG UNALIGNED *) Source;
+        Destination += sizeof(ULONG);
+        Source      += sizeof(ULONG);
+        Length      -= sizeof(ULONG);
+    }
+
+    _mm_sfence();
+
+#else
+
+    RtlCopyMemory(Destination, Source, Length);
+    KeMemoryBarrier();
+
+#endif
+}
+
+
+VOID
+HdmiPioWrite(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_PIO_WRITE. The IOCTL queue is power managed, so the
+    SRAM is mapped and the card is in D0 while we copy.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+    Request     The PIO request; completed here.
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_PIO_WRITE     pio;
+    PVOID               data;
+    size_t              length;
+    ULONG               offset;
+    LONGLONG            start;
+
+    if (!DevExt->SRAMBase) {
+        status = STATUS_NOT_SUPPORTED;
+        goto Done;
+    }
+
+    status = WdfRequestRetrieveInputBuffer( Request,
+                                            sizeof(HDMI_PIO_WRITE),
+                                            &pio,
+                                            NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    offset = pio->Offset;
+
+    //
+    // METHOD_IN_DIRECT: the "output" buffer is the locked data to send.
+    //
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             sizeof(ULONG),
+                                             &data,
+                                             &length );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    if ((offset & 3) != 0 || (length & 3) != 0 ||
+        length > HDMI_PIO_MAX_LENGTH ||
+        !HdmiSramFits(DevExt, offset, length)) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Done;
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    HdmiPioCopy( (PUCHAR) DevExt->SRAMBase + offset,
+                 (PUCHAR) data,
+                 (ULONG) length );
+
+    HdmiCostUpdate( &DevExt->PathCost, TRUE, (ULONG) length,
+                    KeQueryPerformanceCounter(NULL).QuadPart - start );
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS,
+                "HdmiPioWrite: %d bytes at SRAM offset %x",
+                (ULONG) length, offset);
+
+Done:
+
+    WdfRequestCompleteWithInformation( Request,
+                                       status,
+                                       NT_SUCCESS(status) ? length : 0 );
+}
+
+
+BOOLEAN
+HdmiPioWriteRequest(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    )
+/*++
+Routine Description:
+
+    Sends an IRP_MJ_WRITE through the SRAM mapping instead of DMA when the
+    cost model says that is cheaper for its size. Called with the write
+    channel idle, so it cannot overtake an earlier frame. The data goes
+    to WriteDeviceOffset, the stream's offset.
+
+Return Value:
+
+    TRUE if the request was completed here.
+
+--*/
+{
+    NTSTATUS            status;
+    PVOID               data;
+    size_t              length;
+    LONGLONG            start;
+
+    if (!DevExt->SRAMBase) {
+        return FALSE;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(Request, 0, &data, &length);
+    if (!NT_SUCCESS(status)) {
+        return FALSE;
+    }
+
+    if ((length & 3) != 0 ||
+        !HdmiCostUsePio(&DevExt->PathCost, (ULONG) length)) {
+        return FALSE;
+    }
+
+    start = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    HdmiPioCopy( (PUCHAR) DevExt->SRAMBase + DevExt->WriteDeviceOffset,
+                 (PUCHAR) data,
+                 (ULONG) length );
+
+    HdmiCostUpdate( &DevExt->PathCost, TRUE, (ULONG) length,
+                    KeQueryPerformanceCounter(NULL).QuadPart - start );
+
+    Stream->Stats.PioWrites++;
+
+    HdmiStatsCpu(DevExt)->Frames++;
+    HdmiStatsCpu(DevExt)->Bytes += length;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE,
+                "HdmiPioWriteRequest: Request %p, %d bytes",
+                Request, (ULONG) length);
+
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, length);
+
+    return TRUE;
+}
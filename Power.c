@@ -0,0 +1,461 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Power.c
+
+Abstract:
+
+    Power policy driven by the streams. The framework idles the card after
+    IdleTimeout without I/O, and the first frame after that pays for the
+    whole return to D0. A pause in a show must not cost that, so every
+    stream that is going holds a WdfDeviceStopIdle reference: from the
+    time its handle is opened, and again from each frame it submits, until
+    it ends the show with IOCTL_HDMI_SHOW_END, submits nothing for
+    ShowTimeout or is closed. Only then does the idle timeout run.
+
+    The time from the first frame submitted in a low-power state to the
+    end of its transfer is measured and returned by
+    IOCTL_HDMI_POWER_POLICY.
+
+    Leaving D0 only quiesces the write channel. The common buffers, the
+    descriptor tables, the ring slots and the DMA transaction are kept,
+    so coming back costs an engine reset rather than HdmiInitializeDMA,
+    and the streams carry on where they stopped.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Power.tmh"
+
+
+NTSTATUS
+HdmiPowerInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Creates the timer that ends the shows of streams gone quiet. It runs
+    only while a stream holds the card in D0.
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+
+    DevExt->ShowTimeout = HDMI_SHOW_TIMEOUT_DEFAULT;
+
+    KeInitializeEvent(&DevExt->QuiesceEvent, NotificationEvent, TRUE);
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, HdmiEvtPowerTimer);
+    timerConfig.AutomaticSerialization = TRUE;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = DevExt->Device;
+
+    status = WdfTimerCreate( &timerConfig,
+                             &attributes,
+                             &DevExt->PowerTimer );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfTimerCreate (power) failed: %!STATUS!", status);
+    }
+
+    return status;
+}
+
+
+VOID
+HdmiPowerStreamActive(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Called under the device lock when a stream is opened or submits a
+    frame. Keeps the card in D0 for the stream if it is not already.
+    The reference is taken without waiting for D0; the frame waits for
+    it in the power-managed queue.
+
+--*/
+{
+    NTSTATUS    status;
+
+    if (Stream->Closing) {
+        return;
+    }
+
+    Stream->LastActivity = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    if (Stream->HoldsD0) {
+        return;
+    }
+
+    status = WdfDeviceStopIdle(DevExt->Device, FALSE);
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_PNP,
+                    "WdfDeviceStopIdle failed: %!STATUS!", status);
+        return;
+    }
+
+    Stream->HoldsD0 = TRUE;
+
+    if (DevExt->StreamsInD0++ == 0) {
+        WdfTimerStart( DevExt->PowerTimer,
+                       WDF_REL_TIMEOUT_IN_SEC(HDMI_POWER_CHECK_INTERVAL) );
+    }
+}
+
+
+VOID
+HdmiPowerStreamIdle(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Called under the device lock when the show of a stream ends. Lets the
+    card idle once no other stream holds it.
+
+--*/
+{
+    if (!Stream->HoldsD0) {
+        return;
+    }
+
+    Stream->HoldsD0 = FALSE;
+    DevExt->StreamsInD0--;
+
+    WdfDeviceResumeIdle(DevExt->Device);
+}
+
+
+VOID
+HdmiPowerShowEnd(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_SHOW_END from the IOCTL queue. Frames still queued
+    are sent; the card idles after them unless another stream is going.
+
+--*/
+{
+    HdmiPowerStreamIdle( DevExt,
+                         HdmiGetStreamContext(WdfRequestGetFileObject(Request)) );
+
+    WdfRequestComplete(Request, STATUS_SUCCESS);
+}
+
+
+VOID
+HdmiPowerFrameSubmitted(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called from HdmiEvtIoInCallerContext for every frame, before it is
+    queued. The first one to arrive while the card is in a low-power state
+    starts the resume latency measurement.
+
+--*/
+{
+    if (DevExt->LowPower && DevExt->ResumeRequestTime == 0) {
+        InterlockedCompareExchange64( &DevExt->ResumeRequestTime,
+                                      KeQueryPerformanceCounter(NULL).QuadPart,
+                                      0 );
+    }
+}
+
+
+VOID
+HdmiPowerFrameDone(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called from the DPC for every frame transferred. Ends the resume
+    latency measurement, if one is running, and times the first frame
+    after a D0 entry.
+
+--*/
+{
+    LONGLONG    latency;
+
+    if (DevExt->D0FramePending) {
+        DevExt->D0FramePending = FALSE;
+        DevExt->D0FrameLatency = DevExt->IsrTimestamp - DevExt->D0EntryTime;
+    }
+
+    if (DevExt->ResumeRequestTime == 0 || DevExt->LowPower) {
+        return;
+    }
+
+    latency = DevExt->IsrTimestamp -
+              InterlockedExchange64(&DevExt->ResumeRequestTime, 0);
+
+    DevExt->ResumeLatency = latency;
+
+    if (latency > DevExt->ResumeLatencyMax) {
+        DevExt->ResumeLatencyMax = latency;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                "First frame after resume: %I64d ticks", latency);
+}
+
+
+VOID
+HdmiPowerQuiesce(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called from EvtDeviceSelfManagedIoSuspend, while the interrupt is
+    still connected. Stops handing out the write channel and lets the
+    transfer on it finish; one that does not within
+    HDMI_QUIESCE_TIMEOUT_MS is aborted. Frames not yet started stay
+    where they are until HdmiPowerResume.
+
+--*/
+{
+    NTSTATUS        status;
+    LARGE_INTEGER   timeout;
+    BOOLEAN         busy;
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    DevExt->LowPower = TRUE;
+
+    busy = (BOOLEAN) (DevExt->XferSource != HdmiXferNone);
+
+    if (busy) {
+        KeClearEvent(&DevExt->QuiesceEvent);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (!busy) {
+        return;
+    }
+
+    timeout.QuadPart = WDF_REL_TIMEOUT_IN_MS(HDMI_QUIESCE_TIMEOUT_MS);
+
+    status = KeWaitForSingleObject( &DevExt->QuiesceEvent,
+                                    Executive,
+                                    KernelMode,
+                                    FALSE,
+                                    &timeout );
+
+    if (status == STATUS_TIMEOUT) {
+
+        WdfObjectAcquireLock(DevExt->Device);
+
+        if (DevExt->XferSource != HdmiXferNone) {
+
+            TraceEvents(TRACE_LEVEL_WARNING, DBG_PNP,
+                        "Write channel busy at suspend: source %d aborted",
+                        DevExt->XferSource);
+
+            HdmiAbortWriteTransfer(DevExt, STATUS_CANCELLED);
+        }
+
+        WdfObjectReleaseLock(DevExt->Device);
+    }
+}
+
+
+VOID
+HdmiPowerRestore(
+    IN PDEVICE_EXTENSION      DevExt,
+    IN WDF_POWER_DEVICE_STATE PreviousState
+    )
+/*++
+Routine Description:
+
+    Called from EvtDeviceD0Entry, before the interrupt is connected. The
+    engines may have lost power, so both are reset to idle; nothing else
+    on the card outlives a transfer. Starts timing the first frame.
+
+--*/
+{
+    if (PreviousState != WdfPowerDeviceD3Final) {
+        HdmiHardwareReset(DevExt);
+    }
+
+    DevExt->D0EntryTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+    DevExt->D0FramePending = TRUE;
+}
+
+
+VOID
+HdmiPowerResume(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Called from EvtDeviceSelfManagedIoRestart once the device is back in
+    D0 with its interrupt connected. Hands the write channel out again.
+
+--*/
+{
+    WdfObjectAcquireLock(DevExt->Device);
+
+    DevExt->LowPower = FALSE;
+    DevExt->Resumes++;
+
+    HdmiStartNextWrite(DevExt);
+
+    WdfObjectReleaseLock(DevExt->Device);
+}
+
+
+VOID
+HdmiPowerPolicy(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_POWER_POLICY in the caller's context, at
+    PASSIVE_LEVEL as WdfDeviceAssignS0IdleSettings requires. Neither
+    buffer is required; the input is read before the output is written
+    over it.
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_POWER_POLICY  policy;
+    PHDMI_POWER_STATUS  powerStatus;
+    ULONG               showTimeout = 0;
+    ULONG               idleTimeout = 0;
+    size_t              information = 0;
+
+    if (NT_SUCCESS(WdfRequestRetrieveInputBuffer( Request,
+                                                  sizeof(HDMI_POWER_POLICY),
+                                                  &policy,
+                                                  NULL ))) {
+        showTimeout = policy->ShowTimeout;
+        idleTimeout = policy->IdleTimeout;
+    }
+
+    if (idleTimeout != 0) {
+
+        WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS idleSettings;
+
+        WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS_INIT(&idleSettings, IdleCanWakeFromS0);
+        idleSettings.IdleTimeout = idleTimeout;
+
+        status = WdfDeviceAssignS0IdleSettings(DevExt->Device, &idleSettings);
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                        "WdfDeviceAssignS0IdleSettings failed: %!STATUS!", status);
+            WdfRequestComplete(Request, status);
+            return;
+        }
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    if (idleTimeout != 0) {
+        DevExt->IdleTimeout = idleTimeout;
+    }
+
+    if (showTimeout != 0) {
+        DevExt->ShowTimeout = showTimeout;
+    }
+
+    if (NT_SUCCESS(WdfRequestRetrieveOutputBuffer( Request,
+                                                   sizeof(HDMI_POWER_STATUS),
+                                                   &powerStatus,
+                                                   NULL ))) {
+
+        RtlZeroMemory(powerStatus, sizeof(HDMI_POWER_STATUS));
+
+        powerStatus->ShowTimeout        = DevExt->ShowTimeout;
+        powerStatus->IdleTimeout        = DevExt->IdleTimeout;
+        powerStatus->StreamsInD0        = DevExt->StreamsInD0;
+        powerStatus->Resumes            = DevExt->Resumes;
+        powerStatus->ResumeLatency      = DevExt->ResumeLatency;
+        powerStatus->ResumeLatencyMax   = DevExt->ResumeLatencyMax;
+        powerStatus->D0FrameLatency     = DevExt->D0FrameLatency;
+        powerStatus->TimestampFrequency = DevExt->TimestampFrequency;
+
+        information = sizeof(HDMI_POWER_STATUS);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, information);
+}
+
+
+VOID
+HdmiEvtPowerTimer(
+    IN WDFTIMER Timer
+    )
+/*++
+Routine Description:
+
+    Ends the show of every stream that has submitted nothing for
+    ShowTimeout, and runs again while any stream still holds the card.
+
+--*/
+{
+    PDEVICE_EXTENSION       devExt;
+    PLIST_ENTRY             entry;
+    PHDMI_STREAM_CONTEXT    stream;
+    LONGLONG                now;
+    LONGLONG                timeout;
+
+    devExt = HdmiGetDeviceContext(WdfTimerGetParentObject(Timer));
+
+    now     = KeQueryPerformanceCounter(NULL).QuadPart;
+    timeout = devExt->TimestampFrequency * devExt->ShowTimeout;
+
+    for (entry = devExt->StreamList.Flink;
+         entry != &devExt->StreamList;
+         entry = entry->Flink) {
+
+        stream = CONTAINING_RECORD(entry, HDMI_STREAM_CONTEXT, Link);
+
+        if (stream->HoldsD0 && now - stream->LastActivity >= timeout) {
+
+            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                        "Stream %p idle for %d s, show ended",
+                        stream, devExt->ShowTimeout);
+
+            HdmiPowerStreamIdle(devExt, stream);
+        }
+    }
+
+    if (devExt->StreamsInD0 != 0) {
+        WdfTimerStart( Timer,
+                       WDF_REL_TIMEOUT_IN_SEC(HDMI_POWER_CHECK_INTERVAL) );
+    }
+}
@@ -1,3 +1,15 @@
+#if defined(HDMI_USER_MODE)
+
+//
+// Only the files described in Model.h, built by the tests in Test\.
+//
+#include <windows.h>
+#include <winioctl.h>
+#include "Public.h"
+#include "Model.h"
+
+#else
+
 #define WIN9X_COMPAT_SPINLOCK
 #include <ntddk.h>
 #pragma warning(disable:4201)  // nameless struct/union warning
@@ -12,7 +24,10 @@
 #include <wdf.h>
 #include "Reg9656.h"
 #include "Public.h"
+#include "Model.h"
 #include "Private.h"
 #include "trace.h"
 
+#endif
+
 
@@ -23,11 +23,233 @@ Environment:
 #if !defined(_HDMI_H_)
 #define _HDMI_H_
 #define ASSOC_WRITE_REQUEST_WITH_DMA_TRANSACTION   1
+
+#define HDMI_POOL_TAG   'imdH'
+
+//
+// What the single write DMA channel is currently busy with.
+//
+typedef enum _HDMI_XFER_SOURCE {
+
+    HdmiXferNone = 0,
+    HdmiXferRequest,            // IRP_MJ_WRITE from the write queue
+    HdmiXferRing,               // SQE from the shared completion ring
+    HdmiXferBatch,              // frame of an IOCTL_HDMI_WRITE_BATCH
+    HdmiXferCalibrate,          // driver-initiated cost calibration
+    HdmiXferGroup,              // frame of an IOCTL_HDMI_WRITE_GROUP
+    HdmiXferChunk,              // piece of a stream's long IRP_MJ_WRITE
+    HdmiXferSelfTest            // transfer of the bandwidth self-test
+
+} HDMI_XFER_SOURCE;
+
+//
+// Path cost calibration, see Calib.c.
+//
+#define HDMI_CALIBRATE_INTERVAL   60    // seconds between idle recalibrations
+
+//
+// Write channel watchdog, see Watchdog.c.
+//
+#define HDMI_WATCHDOG_FACTOR      4     // times the expected duration
+#define HDMI_WATCHDOG_MIN_MS      5     // shortest deadline
+#define HDMI_WATCHDOG_DEFAULT_MBPS 100  // assumed until a transfer is measured
+#define HDMI_WATCHDOG_MIN_SAMPLE  (64 * 1024) // shortest transfer measured
+#define HDMI_GROUP_ARM_TIMEOUT_MS 1000  // longest wait for all group members to arm
+
+//
+// Stream-driven power policy, see Power.c.
+//
+#define HDMI_POWER_CHECK_INTERVAL 5     // seconds between checks for quiet streams
+#define HDMI_QUIESCE_TIMEOUT_MS   500   // longest wait for the channel at suspend
+
+//
+// A common buffer used as a ring slot, see Map.c. It is mapped for DMA
+// once, when created, and kept in DevExt->MapCache between rings so the
+// next ring of the same slot size gets it without a new allocation.
+//
+#define HDMI_MAP_BYTES_MAX      (64 * 1024 * 1024)  // live and cached together
+
+typedef struct _HDMI_MAPPED_BUFFER {
+
+    HDMI_MAP_ENTRY          Entry;      // in DevExt->MapCache, with the length
+    WDFCOMMONBUFFER         CommonBuffer;
+    PVOID                   VirtualAddress;
+    PHYSICAL_ADDRESS        LogicalAddress;
+    PMDL                    Mdl;        // describes VirtualAddress, for the user view
+
+} HDMI_MAPPED_BUFFER, *PHDMI_MAPPED_BUFFER;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(HDMI_MAPPED_BUFFER, HdmiGetMappedBuffer)
+
+//
+// A polled ring's transfers use a descriptor table of its own, so that the
+// card writes EPLAST into memory the player can see. The table starts this
+// far into its buffer: the header is at the end of the first page, which
+// alone is mapped, read-only, and the descriptors begin on the second.
+//
+#define HDMI_POLL_TABLE_OFFSET  (PAGE_SIZE - 16 * sizeof(DMA_TRANSFER_ELEMENT))
+
+//
+// One frame slot of the shared completion ring.
+//
+typedef struct _HDMI_RING_SLOT {
+
+    PMDL                    Mdl;
+    PVOID                   UserVa;
+    PHDMI_MAPPED_BUFFER     Mapped;     // NULL if the pages are mapped per transfer
+
+} HDMI_RING_SLOT, *PHDMI_RING_SLOT;
+
+//
+// Kernel side of the shared completion ring. SqHead and CqTail are private
+// copies; the values in the shared page are only ever written from here.
+//
+typedef struct _HDMI_RING_CONTEXT {
+
+    PMDL                    RingMdl;
+    PHDMI_RING              Ring;       // system address of the shared page
+    PVOID                   RingUserVa;
+
+    ULONG                   SlotCount;
+    ULONG                   SlotSize;
+    HDMI_RING_SLOT          Slots[HDMI_RING_MAX_SLOTS];
+
+    BOOLEAN                 Poll;       // HDMI_RING_FLAG_POLL
+    PHDMI_MAPPED_BUFFER     PollTable;  // own descriptor table, poll mode only
+    PMDL                    PollMdl;    // first page of PollTable, for the user view
+    PVOID                   PollUserVa;
+
+    ULONG                   SqHead;
+    ULONG                   CqTail;
+
+    struct _HDMI_STREAM_CONTEXT *Stream; // NULL once the stream is gone
+    ULONGLONG               InflightTag;
+    LONGLONG                InflightDeadline;
+    LONGLONG                XferEstimate; // smoothed transfer time, counter ticks
+    ULONG                   SchedPolicy;
+    ULONG                   InflightFlags;
+
+    BOOLEAN                 InFrame;    // slices of a frame are being taken
+    BOOLEAN                 DropFrame;  // skip the rest of this frame
+    NTSTATUS                FrameStatus;
+    ULONG                   FrameBytes;
+    BOOLEAN                 Closing;    // no new SQEs are started
+    BOOLEAN                 UserMapped; // views exist; the DPC must not free
+    PEPROCESS               Process;    // where the views are, referenced
+
+    BOOLEAN                 Partial;    // rest of a chunked SQE is in PartialSqe
+    HDMI_RING_SQE           PartialSqe;
+
+} HDMI_RING_CONTEXT, *PHDMI_RING_CONTEXT;
+
+//
+// Per-handle stream, the context of every WDFFILEOBJECT. Streams with
+// work are picked by HdmiStreamStartNext, see Stream.c.
+//
+#define HDMI_STREAM_VT_SCALE    4096    // virtual time per byte, divided by the weight
+
+typedef struct _HDMI_STREAM_CONTEXT {
+
+    LIST_ENTRY              Link;       // DevExt->StreamList
+    WDFQUEUE                WriteQueue; // IRP_MJ_WRITEs not yet started
+    PHDMI_RING_CONTEXT      RingCtx;
+    BOOLEAN                 RingSetupPending;
+    BOOLEAN                 Closing;
+
+    // IOCTL_HDMI_SET_STREAM
+    ULONG                   DeviceOffset;
+    ULONG                   Weight;
+    ULONG                   Class;
+
+    ULONGLONG               VirtualTime; // start tag of its next transfer
+    ULONG                   Round;      // DevExt->StreamRound when last tried
+
+    WDFREQUEST              ChunkRequest; // write being sent in chunks
+    ULONG                   ChunkOffset;  // bytes of it already sent
+    ULONG                   ChunkDeviceOffset; // DeviceOffset when it started
+
+    WDFREQUEST              BatchRequest; // IOCTL_HDMI_WRITE_BATCH being sent
+
+    BOOLEAN                 HoldsD0;      // its show keeps the card in D0
+    LONGLONG                LastActivity; // counter when it last submitted a frame
+
+    PVOID                   StatsUserVa;  // its view of the statistics page
+    PEPROCESS               StatsProcess; // where that view is, referenced
+
+    HDMI_STATISTICS         Stats;
+
+} HDMI_STREAM_CONTEXT, *PHDMI_STREAM_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(HDMI_STREAM_CONTEXT, HdmiGetStreamContext)
+
+//
+// Context allocated on an IOCTL_HDMI_WRITE_BATCH request in the caller's
+// context. The frames stay locked until the request is completed.
+//
+typedef struct _HDMI_BATCH_CONTEXT {
+
+    ULONG                   FrameCount;
+    ULONG                   Next;       // next frame to put on the channel
+    ULONG                   FrameOffset; // bytes of that frame already sent
+    ULONG                   DeviceOffset; // where that frame goes on the card
+    BOOLEAN                 Cancelled;  // complete with the frame on the channel
+    PMDL                    Mdl[HDMI_BATCH_MAX_FRAMES];
+    ULONG                   Length[HDMI_BATCH_MAX_FRAMES];
+    HDMI_BATCH_RESULT       Result[HDMI_BATCH_MAX_FRAMES];
+
+} HDMI_BATCH_CONTEXT, *PHDMI_BATCH_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(HDMI_BATCH_CONTEXT, HdmiGetBatchContext)
+
+//
+// Context allocated on an IOCTL_HDMI_WRITE_GROUP request, see Group.c.
+// Frame i goes to Member[i]. Ready counts the members that have armed,
+// or failed to arm, their frame. Pending holds one count per member
+// still transferring and one more that is dropped once the doorbells
+// have been rung; the request is completed when it reaches zero.
+//
+typedef struct _HDMI_GROUP_CONTEXT {
+
+    ULONG                   FrameCount;
+    volatile LONG           Ready;
+    volatile LONG           Pending;
+    volatile NTSTATUS       ArmStatus;      // PENDING, SUCCESS once fired, else given up
+    volatile LONG           ExpiryQueued;
+    BOOLEAN                 Cancelled;
+    KDPC                    ExpiryDpc;
+    struct _DEVICE_EXTENSION *Member[HDMI_GROUP_MAX_CARDS];
+    BOOLEAN                 IdleStopped[HDMI_GROUP_MAX_CARDS];
+    PMDL                    Mdl[HDMI_GROUP_MAX_CARDS];
+    ULONG                   Length[HDMI_GROUP_MAX_CARDS];
+    PULONG                  Doorbell[HDMI_GROUP_MAX_CARDS]; // NULL if not armed
+    ULONG                   LastDesc[HDMI_GROUP_MAX_CARDS];
+    HDMI_GROUP_FRAME_RESULT Result[HDMI_GROUP_MAX_CARDS];
+
+} HDMI_GROUP_CONTEXT, *PHDMI_GROUP_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(HDMI_GROUP_CONTEXT, HdmiGetGroupContext)
+
 //
 // The device extension for the device object
 //
+// The fields are grouped by who writes them, so that a processor writing
+// one group does not take the cache line from a processor using another.
+// The channel fields are all written under the device lock, but those of
+// the submit side (starting a transfer) and of the completion side (the
+// DPC) are kept apart, ready for the two to run on different processors.
+// The ISR and the threads submitting frames write outside the lock and
+// get lines of their own. The layout is checked in Init.c.
+//
+#define HDMI_CACHE_LINE     SYSTEM_CACHE_ALIGNMENT_SIZE
+
+#pragma warning(push)
+#pragma warning(disable:4324) // structure padded due to __declspec(align())
+
 typedef struct _DEVICE_EXTENSION {
 
+    //
+    // Read-mostly: set up at start and only read by the hot paths.
+    //
     WDFDEVICE               Device;
 
     // Following fields are specific to the hardware
@@ -38,7 +260,7 @@ typedef struct _DEVICE_EXTENSION {
     PULONG                  RegsBase;         // Registers base address
     ULONG                   RegsLength;       // Registers base length
 
-    PULONG                  SRAMBase;         // SRAM base address
+    PULONG                  SRAMBase;         // SRAM base address (write-combined)
     ULONG                   SRAMLength;       // SRAM base length
 
     PULONG                  SRAM2Base;        // SRAM (alt) base address
@@ -46,12 +268,13 @@ typedef struct _DEVICE_EXTENSION {
 
     WDFINTERRUPT            Interrupt;     // Returned by InterruptCreate
 
+    ULONG                   NumaNode;      // HDMI_NUMA_NODE_UNKNOWN if not known
+
 
     // DmaEnabler
     WDFDMAENABLER           DmaEnabler;
     ULONG                   MaximumTransferLength;
-
-	WDFREQUEST       Request;
+    ULONG                   DmaVersion;
 
     // Write
     WDFQUEUE                WriteQueue;
@@ -69,15 +292,131 @@ typedef struct _DEVICE_EXTENSION {
     PHYSICAL_ADDRESS        WriteCommonBuffer2BaseLA;  // Logical Address
 
     WDFQUEUE                IoctrQueue;
+    WDFQUEUE                RingWaitQueue;        // IOCTL_HDMI_RING_ENTER
+    WDFQUEUE                BatchQueue;           // batches not yet started
+
+    ULONG                   CardIndex;            // HDMI_GROUP_MAX_CARDS if none
+    LONGLONG                TimestampFrequency;
+    BOOLEAN                 TransferReady;        // descriptor tables allocated
 
-    ULONG                   HwErrCount;
-		
-	ULONG_PTR				 CommonBufferPA;
-	ULONG						 DmaNumber;
-	ULONG						 DMAcompleted;
+    // Statistics page, see Stats.c
+    PMDL                    StatsMdl;
+    PHDMI_STATS_PAGE        Stats;
+
+    //
+    // Written by the ISR at DIRQL, outside the device lock. KMDF aligns
+    // the context to MEMORY_ALLOCATION_ALIGNMENT only, so the two fields
+    // have most of a line of padding on either side.
+    //
+    DECLSPEC_CACHEALIGN
+    UCHAR                   IsrPadBefore[HDMI_CACHE_LINE - sizeof(LONGLONG)];
+    LONGLONG                IsrTimestamp;         // counter when the last transfer finished
+    ULONG                   IsrSequence;          // WriteSequence of that transfer
+    UCHAR                   IsrPadAfter[HDMI_CACHE_LINE - sizeof(LONGLONG)];
+
+    //
+    // Read by the threads submitting frames, outside the device lock, see
+    // HdmiPowerFrameSubmitted.
+    //
+    DECLSPEC_CACHEALIGN
+    BOOLEAN                 LowPower;             // between self-managed I/O suspend and restart
+    volatile LONGLONG       ResumeRequestTime;    // counter at the first frame while in low power
+
+    //
+    // Write channel, submit side: written when a transfer is picked and
+    // programmed.
+    //
+    DECLSPEC_CACHEALIGN
+    HDMI_XFER_SOURCE        XferSource;
+    BOOLEAN                 XferDirect;           // programmed without a DMA transaction
+    BOOLEAN                 XferSlice;            // batch frame chunk, more of it follows
+    ULONG                   XferDirectLength;
+    LONGLONG                XferMapTicks;         // mapping time of the transfer on the channel
+    PHDMI_STREAM_CONTEXT    XferStream;           // stream on the channel, or NULL
+    PHDMI_RING_CONTEXT      XferRing;             // ring whose SQE is on the channel
+    ULONG                   WriteDeviceOffset;    // card offset of a ring slice
+    LONGLONG                WriteStartTime;       // counter when the transfer was started
+    LONGLONG                WatchdogTimeout;      // deadline of the transfer, counter ticks
+    LONGLONG                WatchdogArmTime;      // counter when it was programmed
+
+    // Read by the ISR; written under the interrupt lock
+    PDMA_DESC_HEADER        WriteTable;           // header of the table on the channel, or NULL
+    ULONG                   WriteLastDesc;        // its EPLAST once the transfer is done
+    ULONG                   WriteSequence;        // bumped for every transfer programmed
+
+    // Register shadow, see HdmiRegWrite
+    HDMICARD_REG            RegShadow;            // last value written to each register
+    ULONG                   RegShadowValid;       // bit per ULONG register of RegShadow
+
+    // Streams, one per open handle
+    LIST_ENTRY              StreamList;
+    ULONGLONG               VirtualTime;          // start tag of the last stream served
+    ULONG                   StreamRound;
+
+    // Frame-synchronized group writes
+    PHDMI_GROUP_CONTEXT     Group;                // frame waiting for or on the channel
+    ULONG                   GroupSlot;            // index of that frame in Group
+
+    //
+    // Write channel, completion side: written by the DPC as transfers
+    // finish.
+    //
+    DECLSPEC_CACHEALIGN
+    HDMI_CLOCK_STATE        Clock;
+    HDMI_PATH_COST          PathCost;
+    LONGLONG                WatchdogTicksPerMb;   // measured DMA time per MB
+    ULONG                   HwErrCount;           // transfers failed, not counting cancels
+    ULONG                   ChannelResets;
+    BOOLEAN                 D0FramePending;       // no frame transferred since D0 entry
+
+    //
+    // Cold: start-up, power policy, calibration and self-test.
+    //
+    DECLSPEC_CACHEALIGN
+    HDMI_STARTUP_PROFILE    Startup;
+    WDFWAITLOCK             TransferLock;         // serializes HdmiAllocateTransferResources
+
+    // Pre-mapped ring slots
+    KSPIN_LOCK              MapLock;
+    HDMI_MAP_CACHE          MapCache;             // of HDMI_MAPPED_BUFFERs, under MapLock
+
+    // Watchdog
+    WDFTIMER                WatchdogTimer;
+
+    // Power policy
+    WDFTIMER                PowerTimer;
+    ULONG                   ShowTimeout;          // s a stream may submit nothing
+    ULONG                   IdleTimeout;          // ms in D0 once no stream holds it
+    ULONG                   StreamsInD0;          // streams holding the card in D0
+    KEVENT                  QuiesceEvent;         // set once the channel is idle in low power
+    ULONGLONG               Resumes;
+    LONGLONG                ResumeLatency;        // from the resume request to the end of its transfer
+    LONGLONG                ResumeLatencyMax;
+    LONGLONG                D0EntryTime;          // counter at the last D0 entry
+    LONGLONG                D0FrameLatency;       // from then to the end of the first frame
+
+    WDFMEMORY               CalibrationMemory;
+    PVOID                   CalibrationBuffer;
+    PMDL                    CalibrationMdl;       // in flight only
+    BOOLEAN                 CalibrationPending;
+    ULONG                   CalibrationStep;
+    LONGLONG                CalibrationTime;      // counter at the last run
+
+    // Self-test
+    HDMI_CALIBRATION_TABLE  CalibrationTable;     // last complete sweep
+    HDMI_CALIBRATION_TABLE  SelfTestTable;        // sweep in progress
+    PMDL                    SelfTestMdl;          // its source pages, while one runs
+    BOOLEAN                 SelfTestPending;      // transfers left to start
+    ULONG                   SelfTestStep;         // size being measured
+    LONGLONG                SelfTestLatencySum;
+    LONGLONG                SelfTestDmaSum;       // latency less mapping time
+    NTSTATUS                SelfTestStatus;
+    KEVENT                  SelfTestEvent;        // set when the sweep ends
 
 }  DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
+#pragma warning(pop)
+
 //
 // This will generate the function named HdmiGetDeviceContext to be use for
 // retreiving the DEVICE_EXTENSION pointer.
@@ -105,15 +444,25 @@ DRIVER_INITIALIZE DriverEntry;
 
 EVT_WDF_DRIVER_DEVICE_ADD HdmiEvtDeviceAdd;
 
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtDeviceContextCleanup;
+
 EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtDriverContextCleanup;
 
 EVT_WDF_DEVICE_D0_ENTRY HdmiEvtDeviceD0Entry;
 EVT_WDF_DEVICE_D0_EXIT HdmiEvtDeviceD0Exit;
 EVT_WDF_DEVICE_PREPARE_HARDWARE HdmiEvtDevicePrepareHardware;
 EVT_WDF_DEVICE_RELEASE_HARDWARE HdmiEvtDeviceReleaseHardware;
+EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT HdmiEvtDeviceSelfManagedIoInit;
+EVT_WDF_DEVICE_SELF_MANAGED_IO_CLEANUP HdmiEvtDeviceSelfManagedIoCleanup;
+EVT_WDF_DEVICE_SELF_MANAGED_IO_SUSPEND HdmiEvtDeviceSelfManagedIoSuspend;
+EVT_WDF_DEVICE_SELF_MANAGED_IO_RESTART HdmiEvtDeviceSelfManagedIoRestart;
 
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL HdmiEvtIoDeviceCtr;
 EVT_WDF_IO_QUEUE_IO_WRITE HdmiEvtIoWrite;
+EVT_WDF_IO_IN_CALLER_CONTEXT HdmiEvtIoInCallerContext;
+
+EVT_WDF_DEVICE_FILE_CREATE HdmiEvtDeviceFileCreate;
+EVT_WDF_FILE_CLEANUP HdmiEvtFileCleanup;
 
 EVT_WDF_INTERRUPT_ISR HdmiEvtInterruptIsr;
 EVT_WDF_INTERRUPT_DPC HdmiEvtInterruptDpc;
@@ -130,6 +479,11 @@ HdmiInitializeDeviceExtension(
     IN PDEVICE_EXTENSION DevExt
     );
 
+NTSTATUS
+HdmiAllocateTransferResources(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
 NTSTATUS
 HdmiPrepareHardware(
     IN PDEVICE_EXTENSION DevExt,
@@ -166,6 +520,529 @@ HdmiWriteRequestComplete(
     IN NTSTATUS           Status
     );
 
+VOID
+HdmiStartNextWrite(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiStartWriteRequest(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    );
+
+VOID
+HdmiBatchPrepare(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiBatchSubmit(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+BOOLEAN
+HdmiBatchStartNext(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    );
+
+VOID
+HdmiBatchTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+VOID
+HdmiBatchFlush(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    );
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtBatchContextCleanup;
+
+//
+// Frame-synchronized writes across cards (Group.c)
+//
+VOID
+HdmiGroupInitialize(
+    VOID
+    );
+
+VOID
+HdmiGroupRegister(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiGroupUnregister(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiGroupWrite(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+BOOLEAN
+HdmiGroupArm(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiGroupSetDoorbell(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             LastDesc
+    );
+
+VOID
+HdmiGroupTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+VOID
+HdmiGroupArmTimeout(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtGroupContextCleanup;
+EVT_WDF_REQUEST_CANCEL HdmiEvtGroupRequestCancel;
+
+//
+// Per-handle streams (Stream.c)
+//
+NTSTATUS
+HdmiStreamCreate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    );
+
+BOOLEAN
+HdmiStreamStartNext(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Class
+    );
+
+VOID
+HdmiStreamCharge(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    );
+
+VOID
+HdmiStreamChunkComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+VOID
+HdmiStreamConfigure(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiStreamCleanup(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    );
+
+VOID
+HdmiStreamFlush(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtStreamContextCleanup;
+
+//
+// Write channel watchdog (Watchdog.c)
+//
+NTSTATUS
+HdmiWatchdogCreate(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiWatchdogArm(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    );
+
+VOID
+HdmiWatchdogUpdate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length,
+    IN LONGLONG          Ticks
+    );
+
+VOID
+HdmiResetWriteChannel(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+LONGLONG
+HdmiWriteTransferStart(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiAbortWriteTransfer(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+EVT_WDF_TIMER HdmiEvtWatchdogTimer;
+
+//
+// Stream-driven power policy (Power.c)
+//
+NTSTATUS
+HdmiPowerInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiPowerStreamActive(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    );
+
+VOID
+HdmiPowerStreamIdle(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    );
+
+VOID
+HdmiPowerShowEnd(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiPowerFrameSubmitted(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiPowerFrameDone(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiPowerQuiesce(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiPowerRestore(
+    IN PDEVICE_EXTENSION      DevExt,
+    IN WDF_POWER_DEVICE_STATE PreviousState
+    );
+
+VOID
+HdmiPowerResume(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiPowerPolicy(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+EVT_WDF_TIMER HdmiEvtPowerTimer;
+
+//
+// Statistics page (Stats.c)
+//
+NTSTATUS
+HdmiStatsInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiStatsFree(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiStatsMap(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiStatsUnmap(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    );
+
+//
+// The counters of the current processor. Only for code that cannot move
+// to another processor while it counts: the ISR, the DPC and anything
+// under the device lock.
+//
+FORCEINLINE
+PHDMI_STATS_CPU
+HdmiStatsCpu(
+    IN PDEVICE_EXTENSION DevExt
+    )
+{
+    return &DevExt->Stats->Cpu[KeGetCurrentProcessorNumberEx(NULL)];
+}
+
+//
+// Register access. Every access to HDMICARD_REG goes through these, so
+// the MMIO cost of a frame shows in the statistics page. A register is
+// named by its offset, HDMI_REG(WriteCtr.CtrBit) for example.
+//
+// HdmiRegWrite leaves out a write of the value the register already
+// holds according to RegShadow. HdmiRegStrobe always writes; it is for
+// doorbells and resets, whose write is the point whatever the value.
+// A register the card may have changed by itself must be dropped from
+// the shadow with HdmiRegInvalidate. Callers hold the interrupt lock,
+// or are otherwise the only ones touching the registers.
+//
+#define HDMI_REG(Field)     FIELD_OFFSET(HDMICARD_REG, Field)
+
+C_ASSERT(sizeof(HDMICARD_REG) / sizeof(ULONG) <= 32);
+
+FORCEINLINE
+ULONG
+HdmiRegRead(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Offset
+    )
+{
+    HdmiStatsCpu(DevExt)->MmioReads++;
+
+    return READ_REGISTER_ULONG( (PULONG) ((PUCHAR) DevExt->Regs + Offset) );
+}
+
+FORCEINLINE
+VOID
+HdmiRegStrobe(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Offset,
+    IN ULONG             Value
+    )
+{
+    WRITE_REGISTER_ULONG( (PULONG) ((PUCHAR) DevExt->Regs + Offset), Value );
+
+    ((PULONG) &DevExt->RegShadow)[Offset / sizeof(ULONG)] = Value;
+    DevExt->RegShadowValid |= 1 << (Offset / sizeof(ULONG));
+
+    HdmiStatsCpu(DevExt)->MmioWrites++;
+}
+
+FORCEINLINE
+VOID
+HdmiRegWrite(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Offset,
+    IN ULONG             Value
+    )
+{
+    if ((DevExt->RegShadowValid & (1 << (Offset / sizeof(ULONG)))) &&
+        ((PULONG) &DevExt->RegShadow)[Offset / sizeof(ULONG)] == Value) {
+        return;
+    }
+
+    HdmiRegStrobe(DevExt, Offset, Value);
+}
+
+FORCEINLINE
+VOID
+HdmiRegInvalidate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Offset,
+    IN ULONG             Length
+    )
+{
+    DevExt->RegShadowValid &= ~(((1 << (Length / sizeof(ULONG))) - 1) <<
+                                (Offset / sizeof(ULONG)));
+}
+
+//
+// Pre-mapped ring slots (Map.c)
+//
+VOID
+HdmiMapInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+PHDMI_MAPPED_BUFFER
+HdmiMapAcquire(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    );
+
+VOID
+HdmiMapRelease(
+    IN PDEVICE_EXTENSION   DevExt,
+    IN PHDMI_MAPPED_BUFFER Buffer
+    );
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HdmiEvtMappedBufferCleanup;
+
+//
+// Completion ring support (Ring.c)
+//
+PMDL
+HdmiRingAllocatePages(
+    IN PDEVICE_EXTENSION DevExt,
+    IN SIZE_T            Length
+    );
+
+PVOID
+HdmiRingMapToUser(
+    IN PMDL    Mdl,
+    IN BOOLEAN ReadOnly
+    );
+
+VOID
+HdmiRingUnmapFromUser(
+    IN PEPROCESS Process,
+    IN PVOID     UserVa,
+    IN PMDL      Mdl
+    );
+
+VOID
+HdmiRingSetup(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiRingTeardown(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    );
+
+VOID
+HdmiRingEnter(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+VOID
+HdmiRingWakeWaiters(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN NTSTATUS             Status
+    );
+
+BOOLEAN
+HdmiRingStartNext(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    );
+
+VOID
+HdmiRingTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+VOID
+HdmiRingFlush(
+    IN PHDMI_RING_CONTEXT RingCtx
+    );
+
+//
+// Programmed I/O into the SRAM (Pio.c)
+//
+VOID
+HdmiPioWrite(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
+BOOLEAN
+HdmiPioWriteRequest(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    );
+
+VOID
+HdmiPioCopy(
+    OUT PUCHAR Destination,
+    IN  PUCHAR Source,
+    IN  ULONG  Length
+    );
+
+//
+// Path cost calibration (Calib.c)
+//
+BOOLEAN
+HdmiCalibrateStartNext(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiCalibrateTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+//
+// Calibration writes its samples to the last HDMI_PIO_MAX_LENGTH bytes
+// of the SRAM, so frames have to stay below them. Without that much SRAM
+// there is no calibration and nothing to keep free.
+//
+FORCEINLINE
+BOOLEAN
+HdmiSramFits(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONGLONG         Offset,
+    IN ULONGLONG         Length
+    )
+{
+    ULONG usable = DevExt->SRAMLength;
+
+    if (usable >= HDMI_PIO_MAX_LENGTH) {
+        usable -= HDMI_PIO_MAX_LENGTH;
+    }
+
+    return (BOOLEAN) (Offset + Length <= usable);
+}
+
+BOOLEAN
+HdmiSelfTestStartNext(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiSelfTestTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+NTSTATUS
+HdmiSelfTestRun(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiSelfTestCancel(
+    IN PDEVICE_EXTENSION DevExt
+    );
+
+VOID
+HdmiSelfTestRequest(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    );
+
 NTSTATUS
 HdmiInitializeHardware(
     IN PDEVICE_EXTENSION DevExt
@@ -179,6 +1056,19 @@ HdmiShutdown(
 EVT_WDF_PROGRAM_DMA HdmiEvtProgramReadDma;
 EVT_WDF_PROGRAM_DMA HdmiEvtProgramWriteDma;
 
+VOID
+HdmiCompleteWriteTransfer(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    );
+
+VOID
+HdmiProgramWriteDirect(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PHYSICAL_ADDRESS  LogicalAddress,
+    IN ULONG             Length
+    );
+
 VOID
 HdmiHardwareReset(
     IN PDEVICE_EXTENSION    DevExt
@@ -189,6 +1079,12 @@ HdmiInitializeDMA(
     IN PDEVICE_EXTENSION DevExt
     );
 
+BOOLEAN
+HdmiGetNodeAffinity(
+    IN  PDEVICE_EXTENSION DevExt,
+    OUT PGROUP_AFFINITY   Affinity
+    );
+
 
 NTSTATUS 
 CreateAndMapMemory(
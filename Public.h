@@ -36,3 +36,574 @@ DEFINE_GUID (GUID_Hdmi_INTERFACE,
 
 #define IOCTL_GET_BUFFERADDRESS2  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+
+//
+// Shared-memory submission/completion rings.
+//
+// IOCTL_HDMI_RING_SETUP allocates SlotCount frame slots of SlotSize bytes
+// plus one HDMI_RING page and maps all of them into the calling process.
+// The player fills a slot, writes an HDMI_RING_SQE at Sq[SqTail % Entries]
+// and then advances SqTail. The driver consumes SQEs in order and posts an
+// HDMI_RING_CQE at Cq[CqTail % Entries] from its DPC once the slot has been
+// transferred to the card. Head/tail values are free-running counters.
+//
+// While the channel is busy the DPC starts the next SQE by itself, so no
+// system call is needed per frame. IOCTL_HDMI_RING_ENTER starts an idle
+// channel and, if the CQ is empty, pends until the next completion.
+//
+// With HDMI_RING_FLAG_POLL the ring's transfers use a descriptor table of
+// their own, and the card writes back the number of the last descriptor
+// it finished (EPLAST) to a word of it mapped read-only at
+// HDMI_RING_MAPPING.Eplast. Once
+//
+//     seq = PollSequence; Eplast == PollLastDesc; PollSequence == seq
+//
+// holds, every SQE before index seq has left the host, well before the
+// interrupt gets the CQE posted. A player should spin on this for at most
+// PollSpinLimit microseconds and then sleep in IOCTL_HDMI_RING_ENTER; the
+// CQE still follows in both cases.
+//
+// An SQE may carry a presentation Deadline in performance counter ticks.
+// SQEs are still consumed in submission order, so the player queues them
+// in presentation order. With a SchedPolicy other than HDMI_SCHED_FIFO the
+// driver drops frames that cannot make their slot any more and completes
+// them with STATUS_IO_TIMEOUT:
+//
+//     HDMI_SCHED_DROP_LATE    the frame would finish after its deadline
+//     HDMI_SCHED_LATEST       same, and also when the next queued frame
+//                             is already due, so it replaces this one
+//
+// A frame may also be sent as slices, e.g. one per decoded band, so the
+// transfer starts before the whole frame is ready. Each slice is its own
+// SQE naming the same slot; Offset is both the byte offset in the slot
+// and in the frame on the card, past the stream's DeviceOffset (see
+// IOCTL_HDMI_SET_STREAM). All but the last slice carry
+// HDMI_SQE_FLAG_SLICE. Only the last slice gets a CQE, with the first
+// error of the frame and the total byte count. The late-frame policy is
+// applied when the first slice is taken, from its Deadline; a dropped
+// frame has all its slices skipped.
+//
+#define HDMI_RING_ENTRIES         64
+#define HDMI_RING_MAX_SLOTS       16
+
+#define HDMI_SCHED_FIFO           0
+#define HDMI_SCHED_DROP_LATE      1
+#define HDMI_SCHED_LATEST         2
+
+#define HDMI_SQE_FLAG_SLICE       0x00000001  // more slices of this frame follow
+
+#define HDMI_RING_FLAG_POLL             0x00000001
+
+#define HDMI_RING_POLL_SPIN_DEFAULT     200     // microseconds
+#define HDMI_RING_POLL_SPIN_MAX         2000
+
+typedef struct _HDMI_RING_SQE {
+
+    ULONG           Slot;               // frame slot to transfer
+    ULONG           Length;             // bytes, from the start of the slot
+    ULONG           Flags;              // HDMI_SQE_FLAG_xxx
+    ULONG           Offset;             // slice offset, multiple of 4
+    ULONGLONG       UserTag;            // returned in the matching CQE
+    LONGLONG        Deadline;           // performance counter, 0 for none
+
+} HDMI_RING_SQE, *PHDMI_RING_SQE;
+
+typedef struct _HDMI_RING_CQE {
+
+    ULONGLONG       UserTag;
+    LONG            Status;             // NTSTATUS of the transfer
+    ULONG           BytesTransferred;
+    LONGLONG        Timestamp;          // performance counter at the interrupt
+
+} HDMI_RING_CQE, *PHDMI_RING_CQE;
+
+typedef struct _HDMI_RING {
+
+    volatile ULONG  SqHead;             // written by the driver
+    volatile ULONG  SqTail;             // written by the player
+    volatile ULONG  CqHead;             // written by the player
+    volatile ULONG  CqTail;             // written by the driver
+    ULONG           Entries;
+    ULONG           SlotCount;
+    ULONG           SlotSize;
+    ULONG           Flags;              // HDMI_RING_FLAG_xxx
+    LONGLONG        TimestampFrequency; // performance counter frequency
+
+    volatile ULONG  PollSequence;       // SqHead of the SQE on the channel
+    volatile ULONG  PollLastDesc;       // EPLAST value that means it is done
+    ULONG           PollSpinLimit;      // microseconds
+    ULONG           Reserved;
+
+    HDMI_RING_SQE   Sq[HDMI_RING_ENTRIES];
+    HDMI_RING_CQE   Cq[HDMI_RING_ENTRIES];
+
+} HDMI_RING, *PHDMI_RING;
+
+typedef struct _HDMI_RING_SETUP {
+
+    ULONG           SlotCount;
+    ULONG           SlotSize;
+    ULONG           Flags;              // HDMI_RING_FLAG_xxx
+    ULONG           PollSpinLimit;      // microseconds, 0 for the default
+    ULONG           SchedPolicy;        // HDMI_SCHED_xxx
+    ULONG           Reserved;
+
+} HDMI_RING_SETUP, *PHDMI_RING_SETUP;
+
+typedef struct _HDMI_RING_MAPPING {
+
+    ULONGLONG       Ring;                       // user address of HDMI_RING
+    ULONGLONG       Slots[HDMI_RING_MAX_SLOTS]; // user address of each slot
+    ULONGLONG       Eplast;                     // HDMI_RING_FLAG_POLL only
+
+} HDMI_RING_MAPPING, *PHDMI_RING_MAPPING;
+
+#define IOCTL_HDMI_RING_SETUP     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+#define IOCTL_HDMI_RING_ENTER     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x811, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+#define IOCTL_HDMI_RING_TEARDOWN  CTL_CODE(FILE_DEVICE_UNKNOWN, 0x812, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Batched writes.
+//
+// IOCTL_HDMI_WRITE_BATCH takes an HDMI_BATCH describing up to
+// HDMI_BATCH_MAX_FRAMES frames in the caller's address space (a stereo
+// L/R pair, a pre-roll burst, ...) and transfers them back to back with a
+// single kernel transition. The request completes once the last frame is
+// done; the output buffer receives one HDMI_BATCH_RESULT per frame.
+// Every frame is written at the stream's DeviceOffset as it is when the
+// frame starts. The frames are sent in the stream's turns on the write
+// channel, with its class and weight, and are cut into chunks like its
+// writes (see IOCTL_HDMI_SET_STREAM). Nothing else of the same stream
+// gets between them, but other streams may.
+//
+#define HDMI_BATCH_MAX_FRAMES     16
+
+typedef struct _HDMI_BATCH_FRAME {
+
+    ULONGLONG       Buffer;             // user address of the frame
+    ULONG           Length;
+    ULONG           Reserved;
+
+} HDMI_BATCH_FRAME, *PHDMI_BATCH_FRAME;
+
+typedef struct _HDMI_BATCH {
+
+    ULONG           FrameCount;
+    ULONG           Reserved;
+    HDMI_BATCH_FRAME Frames[1];         // FrameCount entries
+
+} HDMI_BATCH, *PHDMI_BATCH;
+
+typedef struct _HDMI_BATCH_RESULT {
+
+    LONG            Status;             // NTSTATUS of this frame
+    ULONG           BytesTransferred;
+
+} HDMI_BATCH_RESULT, *PHDMI_BATCH_RESULT;
+
+#define IOCTL_HDMI_WRITE_BATCH    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x820, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Stream statistics, returned by IOCTL_HDMI_GET_STATISTICS. Counters are
+// those of the calling handle's stream since it was opened; PioThreshold
+// and ChannelResets are the device's. MapTicks / TransfersMapped is the
+// mapping cost of a transfer, in units of the TimestampFrequency of
+// HDMI_CLOCK. A transfer the watchdog fails completes with
+// STATUS_IO_DEVICE_ERROR.
+//
+typedef struct _HDMI_STATISTICS {
+
+    ULONGLONG       FramesOnTime;       // finished by their deadline
+    ULONGLONG       FramesLate;         // finished after their deadline
+    ULONGLONG       FramesDropped;      // could not make their deadline
+    ULONGLONG       FramesReplaced;     // superseded by a frame already due
+
+    ULONGLONG       PioWrites;          // writes sent through the SRAM mapping
+    ULONGLONG       BytesWritten;       // moved by DMA for this stream
+    ULONGLONG       MapTicks;           // spent mapping DMA transfers, counter ticks
+    ULONGLONG       TransfersMapped;    // mapped by the DMA adapter when started
+    ULONGLONG       TransfersPremapped; // from ring slots mapped at setup
+    ULONG           PioThreshold;       // longest write sent by PIO, 0 for none
+    ULONG           ChannelResets;      // stalled transfers failed by the watchdog
+
+} HDMI_STATISTICS, *PHDMI_STATISTICS;
+
+#define IOCTL_HDMI_GET_STATISTICS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x830, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Playout clock model, returned by IOCTL_HDMI_GET_CLOCK.
+//
+// The driver fits a line through the interrupt timestamps of the recent
+// frame completions of HDMI_STREAM_CLASS_PICTURE streams; a player that
+// wants the model sets that class with IOCTL_HDMI_SET_STREAM. Other
+// streams, group frames and chunks do not count. All times are
+// performance counter values. Period is
+// the card's frame period in 1/65536 counter ticks and stays 0 until
+// enough completions have been seen; LastTimestamp is the fitted time of
+// the latest completion and NextTimestamp the predicted time of the next
+// one, so a player can have its next frame queued just before then.
+//
+typedef struct _HDMI_CLOCK {
+
+    LONGLONG        TimestampFrequency;
+    LONGLONG        LastTimestamp;
+    LONGLONG        NextTimestamp;
+    LONGLONG        Period;             // counter ticks per frame, 16.16
+    LONGLONG        Jitter;             // mean absolute residual, ticks
+    ULONG           Samples;            // completions in the fit
+    ULONG           Reserved;
+
+} HDMI_CLOCK, *PHDMI_CLOCK;
+
+#define IOCTL_HDMI_GET_CLOCK      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x840, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Programmed I/O into the frame SRAM (BAR0).
+//
+// For payloads too small to be worth a DMA transfer (a subtitle overlay,
+// a metadata packet) IOCTL_HDMI_PIO_WRITE copies the data straight into
+// the write-combined SRAM mapping. The input buffer is an HDMI_PIO_WRITE,
+// the output buffer holds the data. Offset and data length must be
+// multiples of 4 and the length at most HDMI_PIO_MAX_LENGTH.
+//
+// The driver keeps the last HDMI_PIO_MAX_LENGTH bytes of the SRAM for
+// its transfer cost calibration; no write of any kind may reach them.
+//
+#define HDMI_PIO_MAX_LENGTH       (64 * 1024)
+
+typedef struct _HDMI_PIO_WRITE {
+
+    ULONG           Offset;             // byte offset into the SRAM
+    ULONG           Reserved;
+
+} HDMI_PIO_WRITE, *PHDMI_PIO_WRITE;
+
+#define IOCTL_HDMI_PIO_WRITE      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x850, METHOD_IN_DIRECT, FILE_WRITE_ACCESS)
+
+//
+// Device placement, returned by IOCTL_HDMI_GET_DEVICE_INFO. A player
+// driving several cards should allocate each card's frames on its
+// NumaNode and run the feeding thread there.
+//
+#define HDMI_NUMA_NODE_UNKNOWN    0xFFFFFFFF
+
+typedef struct _HDMI_DEVICE_INFO {
+
+    ULONG           NumaNode;           // HDMI_NUMA_NODE_UNKNOWN if not known
+    ULONG           CardIndex;          // for HDMI_GROUP_FRAME; HDMI_GROUP_MAX_CARDS if none
+    ULONG           DmaVersion;         // 3 if the DMA v3 adapter interface is in use
+    ULONG           Reserved;
+
+} HDMI_DEVICE_INFO, *PHDMI_DEVICE_INFO;
+
+#define IOCTL_HDMI_GET_DEVICE_INFO CTL_CODE(FILE_DEVICE_UNKNOWN, 0x860, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Frame-synchronized writes across cards.
+//
+// IOCTL_HDMI_WRITE_GROUP, sent to any one card, takes one frame per card
+// of a stereo pair or tiled wall; cards are named by the CardIndex from
+// IOCTL_HDMI_GET_DEVICE_INFO. Each card arms its descriptor table as soon
+// as its write channel is free, and once all of them are armed the
+// doorbells are rung back to back. Only one group is in flight at a
+// time; another gets STATUS_DEVICE_BUSY.
+//
+// If the cards are not all armed within a second of the first, the
+// group is given up: every frame fails with STATUS_IO_TIMEOUT in its
+// result and no card sends its frame. Cancelling the request before the
+// doorbells are rung gives the group up the same way and completes it
+// with STATUS_CANCELLED.
+//
+// Group frames are written to the start of each card's SRAM. A handle
+// whose DeviceOffset is not 0 gets STATUS_INVALID_DEVICE_REQUEST.
+//
+// The output receives an HDMI_GROUP_RESULT. Skew is the spread of the
+// completion timestamps of the frames that were transferred, in
+// TimestampFrequency units.
+//
+#define HDMI_GROUP_MAX_CARDS      8
+
+typedef struct _HDMI_GROUP_FRAME {
+
+    ULONGLONG       Buffer;             // user address of the frame
+    ULONG           Length;
+    ULONG           CardIndex;
+
+} HDMI_GROUP_FRAME, *PHDMI_GROUP_FRAME;
+
+typedef struct _HDMI_GROUP {
+
+    ULONG           FrameCount;
+    ULONG           Reserved;
+    HDMI_GROUP_FRAME Frames[1];         // FrameCount entries
+
+} HDMI_GROUP, *PHDMI_GROUP;
+
+typedef struct _HDMI_GROUP_FRAME_RESULT {
+
+    LONG            Status;             // NTSTATUS of this frame
+    ULONG           BytesTransferred;
+    LONGLONG        Timestamp;          // completion, performance counter
+
+} HDMI_GROUP_FRAME_RESULT, *PHDMI_GROUP_FRAME_RESULT;
+
+typedef struct _HDMI_GROUP_RESULT {
+
+    LONGLONG        TimestampFrequency;
+    LONGLONG        Skew;               // latest minus earliest completion
+    ULONG           FrameCount;
+    ULONG           Reserved;
+    HDMI_GROUP_FRAME_RESULT Frames[HDMI_GROUP_MAX_CARDS];
+
+} HDMI_GROUP_RESULT, *PHDMI_GROUP_RESULT;
+
+#define IOCTL_HDMI_WRITE_GROUP    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x870, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Streams.
+//
+// Every open handle is a stream of its own, with its own write queue,
+// completion ring and statistics, so the main picture, an overlay and an
+// aux stream can share a card from separate processes.
+//
+// IOCTL_HDMI_SET_STREAM sets where the stream's frames land on the card:
+// IRP_MJ_WRITE data and ring SQEs are written at DeviceOffset onwards.
+// The offset is 0 for a new handle and must be a multiple of 4, below
+// the calibration area at the end of the SRAM (see HDMI_PIO_MAX_LENGTH).
+//
+// It also sets how the stream shares the write channel. Streams of
+// HDMI_STREAM_CLASS_PICTURE always go first. The rest share what is left
+// in proportion to their Weight (0 selects HDMI_STREAM_WEIGHT_DEFAULT),
+// and their transfers are cut into pieces of at most
+// HDMI_STREAM_CHUNK_SIZE bytes, so a picture frame never waits for more
+// than one chunk of them. A chunked ring SQE still gets a single CQE.
+//
+#define HDMI_STREAM_CLASS_NORMAL    0
+#define HDMI_STREAM_CLASS_PICTURE   1
+
+#define HDMI_STREAM_WEIGHT_DEFAULT  16
+#define HDMI_STREAM_WEIGHT_MAX      256
+
+#define HDMI_STREAM_CHUNK_SIZE      (256 * 1024)
+
+typedef struct _HDMI_STREAM_CONFIG {
+
+    ULONG           DeviceOffset;       // byte offset into the SRAM
+    ULONG           Weight;             // 1..HDMI_STREAM_WEIGHT_MAX, 0 for default
+    ULONG           Class;              // HDMI_STREAM_CLASS_xxx
+    ULONG           Reserved;
+
+} HDMI_STREAM_CONFIG, *PHDMI_STREAM_CONFIG;
+
+#define IOCTL_HDMI_SET_STREAM     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x880, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Flush, for a seek or a stop. IOCTL_HDMI_FLUSH completes everything the
+// calling handle has queued with STATUS_CANCELLED: writes, batches and
+// the rest of its ring's SQ, as far as the CQ has room. A frame of the
+// handle that is being transferred is cut off where it is, and the card
+// is ready for the frames of the new position when the IOCTL completes.
+//
+#define IOCTL_HDMI_FLUSH          CTL_CODE(FILE_DEVICE_UNKNOWN, 0x890, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Power policy.
+//
+// The card is not put into a low-power state in the middle of a show. A
+// handle keeps it in D0 from the time it is opened, and again from every
+// frame it submits, until it sends IOCTL_HDMI_SHOW_END, submits nothing
+// for ShowTimeout seconds or is closed. Once no handle keeps it in D0,
+// the card idles after IdleTimeout milliseconds without I/O.
+//
+// IOCTL_HDMI_POWER_POLICY sets the timeouts given in an HDMI_POWER_POLICY,
+// where 0 leaves one as it is; the input is optional. It returns an
+// HDMI_POWER_STATUS if the output buffer has room for one. ResumeLatency
+// is the time from the first frame submitted while the card was in a
+// low-power state to the end of its transfer, and D0FrameLatency the time
+// from the last return to D0, for any reason, to the end of the first frame
+// transferred after it, both in TimestampFrequency ticks.
+//
+#define HDMI_SHOW_TIMEOUT_DEFAULT   600     // seconds
+#define HDMI_IDLE_TIMEOUT_DEFAULT   10000   // milliseconds
+
+typedef struct _HDMI_POWER_POLICY {
+
+    ULONG           ShowTimeout;        // seconds, 0 to leave unchanged
+    ULONG           IdleTimeout;        // milliseconds, 0 to leave unchanged
+
+} HDMI_POWER_POLICY, *PHDMI_POWER_POLICY;
+
+typedef struct _HDMI_POWER_STATUS {
+
+    ULONG           ShowTimeout;
+    ULONG           IdleTimeout;
+    ULONG           StreamsInD0;        // handles keeping the card in D0
+    ULONG           Reserved;
+    ULONGLONG       Resumes;            // returns to D0 from a low-power state
+    LONGLONG        ResumeLatency;      // of the last one
+    LONGLONG        ResumeLatencyMax;
+    LONGLONG        D0FrameLatency;
+    LONGLONG        TimestampFrequency;
+
+} HDMI_POWER_STATUS, *PHDMI_POWER_STATUS;
+
+#define IOCTL_HDMI_POWER_POLICY   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8A0, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_HDMI_SHOW_END       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8A1, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Start-up profile, returned by IOCTL_HDMI_GET_STARTUP_PROFILE. Each phase
+// is its duration in TimestampFrequency ticks: EvtDeviceAdd as a whole and
+// its device creation, device extension and DMA setup, EvtDevicePrepareHardware
+// and the last EvtDeviceD0Entry. The descriptor tables are allocated when
+// the first handle is opened; TransferResources is the time that took, or
+// 0 if no handle has been opened yet.
+//
+typedef struct _HDMI_STARTUP_PROFILE {
+
+    LONGLONG        DeviceAdd;
+    LONGLONG        DeviceCreate;
+    LONGLONG        DeviceExtension;
+    LONGLONG        DmaInit;            // part of DeviceExtension
+    LONGLONG        PrepareHardware;
+    LONGLONG        D0Entry;
+    LONGLONG        TransferResources;
+    LONGLONG        TimestampFrequency;
+
+} HDMI_STARTUP_PROFILE, *PHDMI_STARTUP_PROFILE;
+
+#define IOCTL_HDMI_GET_STARTUP_PROFILE CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8B0, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Write channel self-test.
+//
+// IOCTL_HDMI_SELF_TEST writes HDMI_SELF_TEST_REPEAT transfers of each
+// size from HDMI_SELF_TEST_MIN_LENGTH up to HDMI_SELF_TEST_MAX_LENGTH, by
+// factors of 4, to the start of the SRAM and returns the measured table.
+// Frames of the streams wait while it runs, and what they left in that
+// part of the SRAM is overwritten. While any handle is showing frames
+// (HDMI_POWER_STATUS.StreamsInD0) it fails with STATUS_DEVICE_BUSY. The
+// test also runs once at device start if the SelfTestAtStart device
+// parameter is non-zero.
+//
+// IOCTL_HDMI_GET_CALIBRATION returns the table of the last complete test;
+// Time is 0 if there has been none. Latencies run from the start of a
+// transfer to its interrupt, in TimestampFrequency ticks. BytesPerSecond
+// leaves out the time taken to map the buffer for DMA.
+//
+#define HDMI_SELF_TEST_MIN_LENGTH   (4 * 1024)
+#define HDMI_SELF_TEST_MAX_LENGTH   (4 * 1024 * 1024)
+#define HDMI_SELF_TEST_SIZES        6
+#define HDMI_SELF_TEST_REPEAT       8
+
+typedef struct _HDMI_CALIBRATION_ENTRY {
+
+    ULONG           Length;
+    ULONG           Samples;
+    LONGLONG        LatencyMin;
+    LONGLONG        LatencyAvg;
+    LONGLONG        LatencyMax;
+    ULONGLONG       BytesPerSecond;
+
+} HDMI_CALIBRATION_ENTRY, *PHDMI_CALIBRATION_ENTRY;
+
+typedef struct _HDMI_CALIBRATION_TABLE {
+
+    LONGLONG        TimestampFrequency;
+    LONGLONG        Time;               // counter when it was measured
+    ULONG           EntryCount;
+    ULONG           Reserved;
+    HDMI_CALIBRATION_ENTRY Entries[HDMI_SELF_TEST_SIZES];
+
+} HDMI_CALIBRATION_TABLE, *PHDMI_CALIBRATION_TABLE;
+
+#define IOCTL_HDMI_SELF_TEST      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8C0, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_HDMI_GET_CALIBRATION CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8C1, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Device statistics page, mapped read-only into the calling process by
+// IOCTL_HDMI_MAP_STATISTICS for as long as the handle stays open.
+//
+// Every processor counts into cache lines of its own with plain stores,
+// so the page can be polled without a system call and the driver never
+// takes a lock or an interlocked operation for it. The device totals are
+// the sums over Cpu[0] to Cpu[CpuCount - 1], see HdmiStatsSum. On 64-bit
+// Windows each counter is read whole; the sums are not taken at a single
+// instant, so two counters may disagree by the work in flight.
+//
+// MmioReads and MmioWrites count the register accesses that reached the
+// card; divided by Frames they give the register cost of a frame.
+//
+#define HDMI_STATS_VERSION      2
+#define HDMI_STATS_LINE_SIZE    64
+
+typedef struct _HDMI_STATS_CPU {
+
+    ULONGLONG       Frames;             // whole frames written, by DMA or PIO
+    ULONGLONG       Bytes;              // of stream data written to the card
+    ULONGLONG       Descriptors;        // write descriptors programmed
+    ULONGLONG       Interrupts;
+    ULONGLONG       Dpcs;
+    ULONGLONG       Errors;             // transfers failed, not counting cancels
+    ULONGLONG       Drops;              // ring frames dropped or replaced unsent
+    ULONGLONG       LateFrames;         // ring frames finished after their deadline
+    ULONGLONG       MmioReads;
+    ULONGLONG       MmioWrites;         // not counting those the shadow saved
+    ULONGLONG       Reserved[6];
+
+} HDMI_STATS_CPU, *PHDMI_STATS_CPU;     // 2 * HDMI_STATS_LINE_SIZE bytes
+
+typedef struct _HDMI_STATS_PAGE {
+
+    ULONG           Version;            // HDMI_STATS_VERSION
+    ULONG           CpuCount;
+    LONGLONG        TimestampFrequency;
+    ULONGLONG       Reserved[6];
+    HDMI_STATS_CPU  Cpu[1];             // CpuCount of them
+
+} HDMI_STATS_PAGE, *PHDMI_STATS_PAGE;
+
+typedef struct _HDMI_STATS_MAPPING {
+
+    ULONGLONG       Page;               // user address of the HDMI_STATS_PAGE
+    ULONG           Length;             // bytes mapped
+    ULONG           Reserved;
+
+} HDMI_STATS_MAPPING, *PHDMI_STATS_MAPPING;
+
+#define IOCTL_HDMI_MAP_STATISTICS CTL_CODE(FILE_DEVICE_UNKNOWN, 0x8D0, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+FORCEINLINE
+VOID
+HdmiStatsSum(
+    const volatile HDMI_STATS_PAGE *Page,
+    PHDMI_STATS_CPU                 Total
+    )
+{
+    ULONG   cpu;
+
+    Total->Frames      = 0;
+    Total->Bytes       = 0;
+    Total->Descriptors = 0;
+    Total->Interrupts  = 0;
+    Total->Dpcs        = 0;
+    Total->Errors      = 0;
+    Total->Drops       = 0;
+    Total->LateFrames  = 0;
+    Total->MmioReads   = 0;
+    Total->MmioWrites  = 0;
+
+    for (cpu = 0; cpu < Page->CpuCount; cpu++) {
+        Total->Frames      += Page->Cpu[cpu].Frames;
+        Total->Bytes       += Page->Cpu[cpu].Bytes;
+        Total->Descriptors += Page->Cpu[cpu].Descriptors;
+        Total->Interrupts  += Page->Cpu[cpu].Interrupts;
+        Total->Dpcs        += Page->Cpu[cpu].Dpcs;
+        Total->Errors      += Page->Cpu[cpu].Errors;
+        Total->Drops       += Page->Cpu[cpu].Drops;
+        Total->LateFrames  += Page->Cpu[cpu].LateFrames;
+        Total->MmioReads   += Page->Cpu[cpu].MmioReads;
+        Total->MmioWrites  += Page->Cpu[cpu].MmioWrites;
+    }
+}
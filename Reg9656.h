@@ -80,6 +80,23 @@ typedef struct _DMA_CTR_ {
 
 } DMA_CTR;
 
+#define HDMI_DESC_EPLAST_ENA        0x00020000  // DESC_PTR.EplastEna
+#define HDMI_DMA_CTR_EPLAST_ENA     0x00040000  // DMA_CTR.EplastEna
+
+//-----------------------------------------------------------------------------
+// Descriptor table header. It sits in front of the descriptors; with
+// EplastEna set the engine writes the number of the last descriptor it
+// has completed into Eplast.
+//-----------------------------------------------------------------------------
+#define HDMI_EPLAST_IDLE            0xFFFFFFFF
+
+typedef struct _DMA_DESC_HEADER {
+
+    unsigned int       Reserved[3]     ;
+    unsigned int       Eplast          ;
+
+} DMA_DESC_HEADER, * PDMA_DESC_HEADER;
+
 typedef struct _DMA_TRANSFER_CTR_ {
 
     unsigned int	   CtrBit         ;
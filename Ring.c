@@ -0,0 +1,1103 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Ring.c
+
+Abstract:
+
+    Shared-memory submission/completion rings. Frames posted by the player
+    are started from the DPC of the previous frame and completed by writing
+    a CQE, so a busy stream costs no IRP and no system call per frame.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Ring.tmh"
+
+C_ASSERT(sizeof(HDMI_RING) <= PAGE_SIZE);
+C_ASSERT((HDMI_RING_ENTRIES & (HDMI_RING_ENTRIES - 1)) == 0);
+
+
+PMDL
+HdmiRingAllocatePages(
+    IN PDEVICE_EXTENSION DevExt,
+    IN SIZE_T            Length
+    )
+/*++
+Routine Description:
+
+    Allocates zeroed, locked pages for a ring page or a frame slot, on the
+    card's NUMA node if it is known.
+
+--*/
+{
+    PHYSICAL_ADDRESS    lowAddress;
+    PHYSICAL_ADDRESS    highAddress;
+    PHYSICAL_ADDRESS    skipBytes;
+
+    lowAddress.QuadPart  = 0;
+    highAddress.QuadPart = -1;
+    skipBytes.QuadPart   = 0;
+
+    if (DevExt->NumaNode != HDMI_NUMA_NODE_UNKNOWN) {
+
+        return MmAllocateNodePagesForMdlEx( lowAddress,
+                                            highAddress,
+                                            skipBytes,
+                                            Length,
+                                            MmCached,
+                                            DevExt->NumaNode,
+                                            MM_ALLOCATE_FULLY_REQUIRED );
+    }
+
+    return MmAllocatePagesForMdlEx( lowAddress,
+                                    highAddress,
+                                    skipBytes,
+                                    Length,
+                                    MmCached,
+                                    MM_ALLOCATE_FULLY_REQUIRED );
+}
+
+
+PVOID
+HdmiRingMapToUser(
+    IN PMDL    Mdl,
+    IN BOOLEAN ReadOnly
+    )
+/*++
+Routine Description:
+
+    Maps the pages described by Mdl into the current process.
+
+--*/
+{
+    PVOID   userVa;
+
+    __try {
+
+        userVa = MmMapLockedPagesSpecifyCache( Mdl,
+                                               UserMode,
+                                               MmCached,
+                                               NULL,
+                                               FALSE,
+                                               NormalPagePriority |
+                                               (ReadOnly ? MdlMappingNoWrite : 0) );
+
+    } __except(EXCEPTION_EXECUTE_HANDLER) {
+
+        userVa = NULL;
+    }
+
+    return userVa;
+}
+
+
+VOID
+HdmiRingUnmapFromUser(
+    IN PEPROCESS Process,
+    IN PVOID     UserVa,
+    IN PMDL      Mdl
+    )
+/*++
+Routine Description:
+
+    Removes a view HdmiRingMapToUser made in Process. The last handle of
+    a stream may be closed in another process than the one that mapped
+    it, after DuplicateHandle or handle inheritance, so this attaches to
+    Process first. A process that has exited lost its views with its
+    address space. Called at PASSIVE_LEVEL.
+
+--*/
+{
+    KAPC_STATE      apcState;
+    LARGE_INTEGER   timeout;
+    BOOLEAN         attached = FALSE;
+
+    timeout.QuadPart = 0;
+
+    if (KeWaitForSingleObject( Process,
+                               Executive,
+                               KernelMode,
+                               FALSE,
+                               &timeout ) == STATUS_SUCCESS) {
+        return;
+    }
+
+    if (Process != PsGetCurrentProcess()) {
+        KeStackAttachProcess(Process, &apcState);
+        attached = TRUE;
+    }
+
+    MmUnmapLockedPages(UserVa, Mdl);
+
+    if (attached) {
+        KeUnstackDetachProcess(&apcState);
+    }
+}
+
+
+static VOID
+HdmiRingUnmapUser(
+    IN PHDMI_RING_CONTEXT RingCtx
+    )
+/*++
+Routine Description:
+
+    Removes the user views created by HdmiRingSetup, in the process that
+    set the ring up. Must be called at PASSIVE_LEVEL.
+
+--*/
+{
+    ULONG   i;
+
+    if (RingCtx->Process == NULL) {
+        return;
+    }
+
+    for (i = 0; i < HDMI_RING_MAX_SLOTS; i++) {
+
+        if (RingCtx->Slots[i].UserVa) {
+            HdmiRingUnmapFromUser( RingCtx->Process,
+                                   RingCtx->Slots[i].UserVa,
+                                   RingCtx->Slots[i].Mdl );
+            RingCtx->Slots[i].UserVa = NULL;
+        }
+    }
+
+    if (RingCtx->RingUserVa) {
+        HdmiRingUnmapFromUser(RingCtx->Process, RingCtx->RingUserVa, RingCtx->RingMdl);
+        RingCtx->RingUserVa = NULL;
+    }
+
+    if (RingCtx->PollUserVa) {
+        HdmiRingUnmapFromUser(RingCtx->Process, RingCtx->PollUserVa, RingCtx->PollMdl);
+        RingCtx->PollUserVa = NULL;
+    }
+
+    ObDereferenceObject(RingCtx->Process);
+    RingCtx->Process = NULL;
+}
+
+
+static VOID
+HdmiRingFree(
+    IN PDEVICE_EXTENSION  DevExt,
+    IN PHDMI_RING_CONTEXT RingCtx
+    )
+/*++
+Routine Description:
+
+    Releases the ring page, the poll table and all frame slots; pre-mapped
+    buffers go back to the cache. The user views must already be gone and
+    no DMA may reference the slots or the table any more.
+
+--*/
+{
+    ULONG   i;
+
+    if (RingCtx->PollMdl) {
+        IoFreeMdl(RingCtx->PollMdl);
+    }
+
+    if (RingCtx->PollTable) {
+
+        //
+        // The ISR must not read the table once it is back in the cache.
+        //
+        WdfInterruptAcquireLock(DevExt->Interrupt);
+
+        if ((PUCHAR) DevExt->WriteTable ==
+            (PUCHAR) RingCtx->PollTable->VirtualAddress + HDMI_POLL_TABLE_OFFSET) {
+            DevExt->WriteTable = NULL;
+        }
+
+        WdfInterruptReleaseLock(DevExt->Interrupt);
+
+        HdmiMapRelease(DevExt, RingCtx->PollTable);
+    }
+
+    for (i = 0; i < HDMI_RING_MAX_SLOTS; i++) {
+
+        if (RingCtx->Slots[i].Mapped) {
+            HdmiMapRelease(DevExt, RingCtx->Slots[i].Mapped);
+        } else if (RingCtx->Slots[i].Mdl) {
+            MmFreePagesFromMdl(RingCtx->Slots[i].Mdl);
+            ExFreePool(RingCtx->Slots[i].Mdl);
+        }
+    }
+
+    if (RingCtx->RingMdl) {
+
+        if (RingCtx->Ring) {
+            MmUnmapLockedPages(RingCtx->Ring, RingCtx->RingMdl);
+        }
+
+        MmFreePagesFromMdl(RingCtx->RingMdl);
+        ExFreePool(RingCtx->RingMdl);
+    }
+
+    ExFreePoolWithTag(RingCtx, HDMI_POOL_TAG);
+}
+
+
+static VOID
+HdmiRingPostCompletion(
+    IN PHDMI_RING_CONTEXT RingCtx,
+    IN ULONGLONG          UserTag,
+    IN NTSTATUS           Status,
+    IN ULONG              BytesTransferred,
+    IN LONGLONG           Timestamp
+    )
+{
+    PHDMI_RING      ring = RingCtx->Ring;
+    PHDMI_RING_CQE  cqe;
+
+    cqe = &ring->Cq[RingCtx->CqTail & (HDMI_RING_ENTRIES - 1)];
+
+    cqe->UserTag          = UserTag;
+    cqe->Status           = Status;
+    cqe->BytesTransferred = BytesTransferred;
+    cqe->Timestamp        = Timestamp;
+
+    //
+    // The entry must be visible before the player can see the new tail.
+    //
+    KeMemoryBarrier();
+
+    RingCtx->CqTail++;
+    ring->CqTail = RingCtx->CqTail;
+}
+
+
+static VOID
+HdmiRingFinishSqe(
+    IN PHDMI_RING_CONTEXT RingCtx,
+    IN ULONGLONG          UserTag,
+    IN ULONG              Flags,
+    IN NTSTATUS           Status,
+    IN ULONG              BytesTransferred,
+    IN LONGLONG           Timestamp
+    )
+/*++
+Routine Description:
+
+    Accounts for a finished SQE. A slice is folded into its frame; the
+    frame's CQE is posted with its last slice.
+
+--*/
+{
+    if (NT_SUCCESS(RingCtx->FrameStatus)) {
+        RingCtx->FrameStatus = Status;
+    }
+
+    RingCtx->FrameBytes += BytesTransferred;
+
+    if (Flags & HDMI_SQE_FLAG_SLICE) {
+        RingCtx->InFrame = TRUE;
+        return;
+    }
+
+    HdmiRingPostCompletion( RingCtx,
+                            UserTag,
+                            RingCtx->FrameStatus,
+                            RingCtx->FrameBytes,
+                            Timestamp );
+
+    RingCtx->InFrame     = FALSE;
+    RingCtx->DropFrame   = FALSE;
+    RingCtx->FrameStatus = STATUS_SUCCESS;
+    RingCtx->FrameBytes  = 0;
+}
+
+
+VOID
+HdmiRingWakeWaiters(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN NTSTATUS             Status
+    )
+/*++
+Routine Description:
+
+    Completes the IOCTL_HDMI_RING_ENTER requests of Stream parked on
+    RingWaitQueue, or those of every stream if Stream is NULL.
+
+--*/
+{
+    WDFREQUEST  request;
+    NTSTATUS    status;
+
+    for (;;) {
+
+        if (Stream == NULL) {
+            status = WdfIoQueueRetrieveNextRequest(DevExt->RingWaitQueue,
+                                                   &request);
+        } else {
+            status = WdfIoQueueRetrieveRequestByFileObject(
+                            DevExt->RingWaitQueue,
+                            (WDFFILEOBJECT) WdfObjectContextGetObject(Stream),
+                            &request);
+        }
+
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        WdfRequestComplete(request, Status);
+    }
+}
+
+
+VOID
+HdmiRingSetup(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_RING_SETUP from HdmiEvtIoInCallerContext. Allocates
+    the ring page and the frame slots and maps them into the calling
+    process. Each stream may have one ring.
+
+    In poll mode the ring also gets a descriptor table of its own, see
+    HDMI_POLL_TABLE_OFFSET. Only the page with its header is mapped, read
+    only, so the player sees the card's EPLAST write-back and nothing of
+    the descriptors.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+    Request     The setup request; completed here.
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_RING_SETUP    setup;
+    PHDMI_RING_MAPPING  mapping;
+    PHDMI_STREAM_CONTEXT stream;
+    PHDMI_RING_CONTEXT  ringCtx = NULL;
+    ULONG               slotCount;
+    ULONG               slotSize;
+    ULONG               flags;
+    ULONG               spinLimit;
+    ULONG               policy;
+    ULONG               i;
+    BOOLEAN             claimed = FALSE;
+
+    status = WdfRequestRetrieveInputBuffer( Request,
+                                            sizeof(HDMI_RING_SETUP),
+                                            &setup,
+                                            NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    //
+    // Capture the input before the (shared) system buffer is overwritten.
+    //
+    slotCount = setup->SlotCount;
+    slotSize  = setup->SlotSize;
+    flags     = setup->Flags;
+    spinLimit = setup->PollSpinLimit;
+    policy    = setup->SchedPolicy;
+
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             sizeof(HDMI_RING_MAPPING),
+                                             &mapping,
+                                             NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    if (slotCount == 0 || slotCount > HDMI_RING_MAX_SLOTS ||
+        slotSize == 0 || slotSize > DevExt->MaximumTransferLength ||
+        (flags & ~HDMI_RING_FLAG_POLL) != 0 ||
+        policy > HDMI_SCHED_LATEST) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Done;
+    }
+
+    if (spinLimit == 0) {
+        spinLimit = HDMI_RING_POLL_SPIN_DEFAULT;
+    } else if (spinLimit > HDMI_RING_POLL_SPIN_MAX) {
+        spinLimit = HDMI_RING_POLL_SPIN_MAX;
+    }
+
+    slotSize = (ULONG) ROUND_TO_PAGES(slotSize);
+
+    stream = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    if (stream->RingCtx == NULL && !stream->RingSetupPending) {
+        stream->RingSetupPending = TRUE;
+        claimed = TRUE;
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (!claimed) {
+        status = STATUS_DEVICE_BUSY;
+        goto Done;
+    }
+
+    ringCtx = (PHDMI_RING_CONTEXT) ExAllocatePoolWithTag( NonPagedPool,
+                                                          sizeof(HDMI_RING_CONTEXT),
+                                                          HDMI_POOL_TAG );
+    if (!ringCtx) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    RtlZeroMemory(ringCtx, sizeof(HDMI_RING_CONTEXT));
+
+    ringCtx->SlotCount = slotCount;
+    ringCtx->SlotSize  = slotSize;
+    ringCtx->Stream    = stream;
+    ringCtx->Poll      = (flags & HDMI_RING_FLAG_POLL) ? TRUE : FALSE;
+    ringCtx->SchedPolicy = policy;
+
+    ringCtx->RingMdl = HdmiRingAllocatePages(DevExt, PAGE_SIZE);
+    if (!ringCtx->RingMdl) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    ringCtx->Ring = (PHDMI_RING) MmGetSystemAddressForMdlSafe( ringCtx->RingMdl,
+                                                               NormalPagePriority );
+    if (!ringCtx->Ring) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    ringCtx->Ring->Entries            = HDMI_RING_ENTRIES;
+    ringCtx->Ring->SlotCount          = slotCount;
+    ringCtx->Ring->SlotSize           = slotSize;
+    ringCtx->Ring->TimestampFrequency = DevExt->TimestampFrequency;
+    ringCtx->Ring->Flags              = flags;
+    ringCtx->Ring->PollSpinLimit      = spinLimit;
+
+    //
+    // Before the slots, which can do with ordinary pages if the cache is
+    // full; the table cannot.
+    //
+    if (ringCtx->Poll) {
+
+        ringCtx->PollTable = HdmiMapAcquire( DevExt,
+                                             (ULONG) ROUND_TO_PAGES(
+                                                 HDMI_POLL_TABLE_OFFSET +
+                                                 sizeof(DMA_TRANSFER_ELEMENT) *
+                                                 DevExt->WriteTransferElements) );
+        if (!ringCtx->PollTable) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        ((PDMA_DESC_HEADER) ((PUCHAR) ringCtx->PollTable->VirtualAddress +
+                             HDMI_POLL_TABLE_OFFSET))->Eplast = HDMI_EPLAST_IDLE;
+
+        ringCtx->PollMdl = IoAllocateMdl( ringCtx->PollTable->VirtualAddress,
+                                          PAGE_SIZE,
+                                          FALSE,
+                                          FALSE,
+                                          NULL );
+        if (!ringCtx->PollMdl) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        MmBuildMdlForNonPagedPool(ringCtx->PollMdl);
+    }
+
+    for (i = 0; i < slotCount; i++) {
+
+        ringCtx->Slots[i].Mapped = HdmiMapAcquire(DevExt, slotSize);
+        if (ringCtx->Slots[i].Mapped) {
+            ringCtx->Slots[i].Mdl = ringCtx->Slots[i].Mapped->Mdl;
+            continue;
+        }
+
+        ringCtx->Slots[i].Mdl = HdmiRingAllocatePages(DevExt, slotSize);
+        if (!ringCtx->Slots[i].Mdl) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                        "HdmiRingSetup: slot %d of %d bytes failed", i, slotSize);
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+    }
+
+    ringCtx->UserMapped = TRUE;
+
+    ringCtx->Process = PsGetCurrentProcess();
+    ObReferenceObject(ringCtx->Process);
+
+    ringCtx->RingUserVa = HdmiRingMapToUser(ringCtx->RingMdl, FALSE);
+    if (!ringCtx->RingUserVa) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    RtlZeroMemory(mapping, sizeof(HDMI_RING_MAPPING));
+
+    mapping->Ring = (ULONGLONG) (ULONG_PTR) ringCtx->RingUserVa;
+
+    for (i = 0; i < slotCount; i++) {
+
+        ringCtx->Slots[i].UserVa = HdmiRingMapToUser(ringCtx->Slots[i].Mdl, FALSE);
+        if (!ringCtx->Slots[i].UserVa) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        mapping->Slots[i] = (ULONGLONG) (ULONG_PTR) ringCtx->Slots[i].UserVa;
+    }
+
+    if (ringCtx->Poll) {
+
+        ringCtx->PollUserVa = HdmiRingMapToUser(ringCtx->PollMdl, TRUE);
+        if (!ringCtx->PollUserVa) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        mapping->Eplast = (ULONGLONG) (ULONG_PTR) ringCtx->PollUserVa +
+                          HDMI_POLL_TABLE_OFFSET +
+                          FIELD_OFFSET(DMA_DESC_HEADER, Eplast);
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    stream->RingCtx = ringCtx;
+    stream->RingSetupPending = FALSE;
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "HdmiRingSetup: %d slots of %d bytes, ring %p, flags %x",
+                slotCount, slotSize, ringCtx->RingUserVa, flags);
+
+    ringCtx = NULL;
+
+Done:
+
+    if (ringCtx) {
+        HdmiRingUnmapUser(ringCtx);
+        HdmiRingFree(DevExt, ringCtx);
+    }
+
+    if (claimed && !NT_SUCCESS(status)) {
+
+        WdfObjectAcquireLock(DevExt->Device);
+        stream->RingSetupPending = FALSE;
+        WdfObjectReleaseLock(DevExt->Device);
+    }
+
+    WdfRequestCompleteWithInformation( Request,
+                                       status,
+                                       NT_SUCCESS(status) ?
+                                           sizeof(HDMI_RING_MAPPING) : 0 );
+}
+
+
+VOID
+HdmiRingTeardown(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    )
+/*++
+Routine Description:
+
+    Destroys the ring of Stream. Called for IOCTL_HDMI_RING_TEARDOWN and
+    from HdmiStreamCleanup, in both cases at PASSIVE_LEVEL; the views are
+    removed in the process that set the ring up. If an SQE is still on
+    the channel the pages are released by the DPC once it lands.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+    Stream      The stream whose ring is destroyed.
+
+    Request     Teardown request to complete, or NULL.
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS            status = STATUS_SUCCESS;
+    PHDMI_RING_CONTEXT  ringCtx;
+
+    //
+    // Stop the ring from starting anything new.
+    //
+    WdfObjectAcquireLock(DevExt->Device);
+
+    ringCtx = Stream->RingCtx;
+
+    if (ringCtx == NULL || ringCtx->Closing) {
+        ringCtx = NULL;
+    } else {
+        ringCtx->Closing = TRUE;
+        HdmiRingWakeWaiters(DevExt, Stream, STATUS_CANCELLED);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (ringCtx == NULL) {
+        status = STATUS_INVALID_DEVICE_STATE;
+        goto Done;
+    }
+
+    HdmiRingUnmapUser(ringCtx);
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    Stream->RingCtx = NULL;
+
+    if (DevExt->XferRing == ringCtx) {
+        //
+        // HdmiRingTransferComplete frees it. The stream may be gone by
+        // then.
+        //
+        ringCtx->UserMapped = FALSE;
+        ringCtx->Stream = NULL;
+        ringCtx = NULL;
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (ringCtx) {
+        HdmiRingFree(DevExt, ringCtx);
+    }
+
+Done:
+
+    if (Request) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+
+VOID
+HdmiRingEnter(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_RING_ENTER. Starts the channel if it is idle and
+    completes the request at once unless the CQ is empty while a frame of
+    this ring is still being transferred or waiting for its turn, in which
+    case it waits for the next CQE.
+
+--*/
+{
+    NTSTATUS              status;
+    PHDMI_STREAM_CONTEXT  stream;
+    PHDMI_RING_CONTEXT    ringCtx;
+
+    stream  = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+    ringCtx = stream->RingCtx;
+
+    if (ringCtx == NULL || ringCtx->Closing) {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_STATE);
+        return;
+    }
+
+    HdmiPowerStreamActive(DevExt, stream);
+
+    HdmiStartNextWrite(DevExt);
+
+    if (ringCtx->CqTail != ringCtx->Ring->CqHead ||
+        (DevExt->XferRing != ringCtx &&
+         ringCtx->SqHead == ringCtx->Ring->SqTail)) {
+        WdfRequestComplete(Request, STATUS_SUCCESS);
+        return;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, DevExt->RingWaitQueue);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+
+static BOOLEAN
+HdmiRingDropFrame(
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN PHDMI_RING_CONTEXT   RingCtx,
+    IN PHDMI_RING_SQE       Sqe
+    )
+/*++
+Routine Description:
+
+    Applies the ring's late-frame policy to the SQE just taken off the
+    ring, which starts a frame. A frame is late if it cannot finish by its
+    deadline with the usual transfer time; under HDMI_SCHED_LATEST a whole
+    frame is also dropped when the next queued frame is already due.
+
+Return Value:
+
+    TRUE if the frame is to be dropped.
+
+--*/
+{
+    PHDMI_RING  ring = RingCtx->Ring;
+    LONGLONG    due;
+    LONGLONG    next;
+
+    if (RingCtx->SchedPolicy == HDMI_SCHED_FIFO) {
+        return FALSE;
+    }
+
+    due = KeQueryPerformanceCounter(NULL).QuadPart + RingCtx->XferEstimate;
+
+    if (Sqe->Deadline != 0 && Sqe->Deadline < due) {
+        Stream->Stats.FramesDropped++;
+        return TRUE;
+    }
+
+    if (RingCtx->SchedPolicy == HDMI_SCHED_LATEST &&
+        !(Sqe->Flags & HDMI_SQE_FLAG_SLICE) &&
+        RingCtx->SqHead != ring->SqTail) {
+
+        KeMemoryBarrier();
+
+        next = ring->Sq[RingCtx->SqHead & (HDMI_RING_ENTRIES - 1)].Deadline;
+
+        if (next != 0 && next <= due) {
+            Stream->Stats.FramesReplaced++;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+BOOLEAN
+HdmiRingStartNext(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Takes the next SQE off the stream's ring and starts it on the write
+    channel. Malformed SQEs and dropped frames are finished with an error
+    and skipped. Nothing is started while the CQ has no room for the
+    completion.
+
+    Unless the stream is of the picture class, an SQE longer than
+    HDMI_STREAM_CHUNK_SIZE is sent one chunk at a time. Each chunk but
+    the last goes as a slice, so only the last posts the CQE; the rest of
+    the SQE is kept in PartialSqe until the stream's next turn.
+
+    A slot that was mapped at setup is started directly from its logical
+    address, without a DMA transaction.
+
+    Called from HdmiStreamStartNext with the channel idle.
+
+Return Value:
+
+    TRUE if a transfer was started.
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_RING_CONTEXT  ringCtx = Stream->RingCtx;
+    PHDMI_RING          ring;
+    HDMI_RING_SQE       sqe;
+    PMDL                mdl;
+    PHDMI_MAPPED_BUFFER mapped;
+    PHYSICAL_ADDRESS    address;
+
+    if (ringCtx == NULL || ringCtx->Closing) {
+        return FALSE;
+    }
+
+    ring = ringCtx->Ring;
+
+    for (;;) {
+
+        if (ringCtx->Partial) {
+            sqe = ringCtx->PartialSqe;
+            ringCtx->Partial = FALSE;
+            goto Chunk;
+        }
+
+        if (ringCtx->SqHead == ring->SqTail) {
+            return FALSE;
+        }
+
+        if (ringCtx->CqTail - ring->CqHead >= HDMI_RING_ENTRIES) {
+            return FALSE;
+        }
+
+        //
+        // Read the tail before the entry, then take a private copy of the
+        // entry so the player cannot change it under us.
+        //
+        KeMemoryBarrier();
+
+        sqe = ring->Sq[ringCtx->SqHead & (HDMI_RING_ENTRIES - 1)];
+
+        ringCtx->SqHead++;
+        ring->SqHead = ringCtx->SqHead;
+
+        if (sqe.Slot >= ringCtx->SlotCount ||
+            (sqe.Flags & ~HDMI_SQE_FLAG_SLICE) != 0 ||
+            (sqe.Offset & 3) != 0 || sqe.Offset >= ringCtx->SlotSize ||
+            sqe.Length == 0 || sqe.Length > ringCtx->SlotSize - sqe.Offset) {
+
+            HdmiRingFinishSqe( ringCtx, sqe.UserTag, sqe.Flags,
+                               STATUS_INVALID_PARAMETER, 0, 0 );
+            continue;
+        }
+
+        if (!ringCtx->InFrame && HdmiRingDropFrame(Stream, ringCtx, &sqe)) {
+            ringCtx->DropFrame = TRUE;
+            HdmiStatsCpu(DevExt)->Drops++;
+        }
+
+Chunk:
+
+        if (!ringCtx->DropFrame &&
+            Stream->Class != HDMI_STREAM_CLASS_PICTURE &&
+            sqe.Length > HDMI_STREAM_CHUNK_SIZE) {
+
+            ringCtx->PartialSqe         = sqe;
+            ringCtx->PartialSqe.Offset += HDMI_STREAM_CHUNK_SIZE;
+            ringCtx->PartialSqe.Length -= HDMI_STREAM_CHUNK_SIZE;
+            ringCtx->Partial            = TRUE;
+
+            sqe.Length = HDMI_STREAM_CHUNK_SIZE;
+            sqe.Flags |= HDMI_SQE_FLAG_SLICE;
+        }
+
+        if (ringCtx->DropFrame) {
+            HdmiRingFinishSqe( ringCtx, sqe.UserTag, sqe.Flags,
+                               STATUS_IO_TIMEOUT, 0, 0 );
+            continue;
+        }
+
+        //
+        // Checked here rather than with the rest of the SQE: each chunk
+        // lands past the stream's offset as it is now.
+        //
+        if (!HdmiSramFits(DevExt, (ULONGLONG) Stream->DeviceOffset + sqe.Offset,
+                          sqe.Length)) {
+            HdmiRingFinishSqe( ringCtx, sqe.UserTag, sqe.Flags,
+                               STATUS_INVALID_PARAMETER, 0, 0 );
+            continue;
+        }
+
+        ringCtx->InflightTag      = sqe.UserTag;
+        ringCtx->InflightFlags    = sqe.Flags;
+        ringCtx->InflightDeadline = sqe.Deadline;
+
+        mapped = ringCtx->Slots[sqe.Slot].Mapped;
+
+        if (mapped != NULL) {
+
+            address.QuadPart = mapped->LogicalAddress.QuadPart + sqe.Offset;
+
+            DevExt->WriteStartTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+            DevExt->WriteDeviceOffset = Stream->DeviceOffset + sqe.Offset;
+            DevExt->XferRing   = ringCtx;
+            DevExt->XferSource = HdmiXferRing;
+
+            HdmiProgramWriteDirect(DevExt, address, sqe.Length);
+            return TRUE;
+        }
+
+        mdl = ringCtx->Slots[sqe.Slot].Mdl;
+
+        status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                              HdmiEvtProgramWriteDma,
+                                              WdfDmaDirectionWriteToDevice,
+                                              mdl,
+                                              (PUCHAR) MmGetMdlVirtualAddress(mdl) +
+                                                  sqe.Offset,
+                                              sqe.Length );
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "HdmiRingStartNext: WdfDmaTransactionInitialize "
+                        "failed: %!STATUS!", status);
+            HdmiRingFinishSqe(ringCtx, sqe.UserTag, sqe.Flags, status, 0, 0);
+            continue;
+        }
+
+        DevExt->WriteStartTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+        DevExt->WriteDeviceOffset = Stream->DeviceOffset + sqe.Offset;
+        DevExt->XferRing   = ringCtx;
+        DevExt->XferSource = HdmiXferRing;
+
+        status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                           WDF_NO_CONTEXT );
+        if (!NT_SUCCESS(status)) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "HdmiRingStartNext: WdfDmaTransactionExecute "
+                        "failed: %!STATUS!", status);
+            DevExt->XferSource = HdmiXferNone;
+            DevExt->XferRing   = NULL;
+            DevExt->WriteDeviceOffset = 0;
+            WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+            HdmiRingFinishSqe(ringCtx, sqe.UserTag, sqe.Flags, status, 0, 0);
+            continue;
+        }
+
+        return TRUE;
+    }
+}
+
+
+VOID
+HdmiRingTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Called from the DPC when the in-flight SQE has been transferred. Posts
+    the CQE with the interrupt timestamp, unless more slices of the frame
+    are to come, and wakes any waiter. The transfer time feeds the
+    estimate used by HdmiRingDropFrame.
+
+--*/
+{
+    PHDMI_RING_CONTEXT  ringCtx = DevExt->XferRing;
+    size_t              bytesTransferred;
+    LONGLONG            elapsed;
+
+    ASSERT(ringCtx != NULL);
+
+    if (DevExt->XferDirect) {
+
+        bytesTransferred = NT_SUCCESS(Status) ? DevExt->XferDirectLength : 0;
+        DevExt->XferDirect = FALSE;
+
+    } else {
+
+        bytesTransferred =
+            WdfDmaTransactionGetBytesTransferred(DevExt->WriteDmaTransaction);
+
+        WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+    }
+
+    DevExt->XferSource = HdmiXferNone;
+    DevExt->XferRing   = NULL;
+    DevExt->WriteDeviceOffset = 0;
+
+    //
+    // Slices say nothing about how long a whole frame takes, and only
+    // the last one tells whether the frame made its deadline.
+    //
+    if (NT_SUCCESS(Status) && !ringCtx->InFrame &&
+        !(ringCtx->InflightFlags & HDMI_SQE_FLAG_SLICE)) {
+
+        elapsed = DevExt->IsrTimestamp - DevExt->WriteStartTime;
+        ringCtx->XferEstimate += (elapsed - ringCtx->XferEstimate) / 8;
+    }
+
+    if (NT_SUCCESS(Status) && ringCtx->Stream != NULL &&
+        !(ringCtx->InflightFlags & HDMI_SQE_FLAG_SLICE)) {
+
+        if (ringCtx->InflightDeadline != 0) {
+            if (DevExt->IsrTimestamp <= ringCtx->InflightDeadline) {
+                ringCtx->Stream->Stats.FramesOnTime++;
+            } else {
+                ringCtx->Stream->Stats.FramesLate++;
+                HdmiStatsCpu(DevExt)->LateFrames++;
+            }
+        }
+    }
+
+    HdmiRingFinishSqe( ringCtx,
+                       ringCtx->InflightTag,
+                       ringCtx->InflightFlags,
+                       Status,
+                       (ULONG) bytesTransferred,
+                       DevExt->IsrTimestamp );
+
+    if (ringCtx->Closing && !ringCtx->UserMapped) {
+        HdmiRingFree(DevExt, ringCtx);
+        return;
+    }
+
+    if (ringCtx->Stream != NULL) {
+        HdmiRingWakeWaiters(DevExt, ringCtx->Stream, STATUS_SUCCESS);
+    }
+}
+
+
+VOID
+HdmiRingFlush(
+    IN PHDMI_RING_CONTEXT RingCtx
+    )
+/*++
+Routine Description:
+
+    Called for IOCTL_HDMI_FLUSH. Finishes the rest of a chunked SQE and
+    every SQE still on the ring with STATUS_CANCELLED, as far as the CQ
+    has room. An SQE of the ring on the channel must have been aborted
+    already.
+
+--*/
+{
+    PHDMI_RING      ring = RingCtx->Ring;
+    HDMI_RING_SQE   sqe;
+
+    if (RingCtx->Partial) {
+        RingCtx->Partial = FALSE;
+        HdmiRingFinishSqe( RingCtx, RingCtx->PartialSqe.UserTag,
+                           RingCtx->PartialSqe.Flags, STATUS_CANCELLED, 0, 0 );
+    }
+
+    while (RingCtx->SqHead != ring->SqTail &&
+           RingCtx->CqTail - ring->CqHead < HDMI_RING_ENTRIES) {
+
+        KeMemoryBarrier();
+
+        sqe = ring->Sq[RingCtx->SqHead & (HDMI_RING_ENTRIES - 1)];
+
+        RingCtx->SqHead++;
+        ring->SqHead = RingCtx->SqHead;
+
+        HdmiRingFinishSqe( RingCtx, sqe.UserTag, sqe.Flags & HDMI_SQE_FLAG_SLICE,
+                           STATUS_CANCELLED, 0, 0 );
+    }
+
+    //
+    // Whatever frame was being assembled is gone; the next SQE starts a
+    // new one.
+    //
+    RingCtx->InFrame     = FALSE;
+    RingCtx->DropFrame   = FALSE;
+    RingCtx->FrameStatus = STATUS_SUCCESS;
+    RingCtx->FrameBytes  = 0;
+}
@@ -0,0 +1,154 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Device.c
+
+Abstract:
+
+    Finding and opening the cards, and the plain WriteFile path.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <initguid.h>
+#include "HdmiSdkP.h"
+
+
+DWORD
+HdmiSdkOpen(
+    IN  ULONG   CardIndex,
+    OUT PHANDLE Device
+    )
+/*++
+Routine Description:
+
+    Opens a new stream on the CardIndex-th card with the HdmiCard device
+    interface, in enumeration order.
+
+--*/
+{
+    HDEVINFO                            devInfo;
+    SP_DEVICE_INTERFACE_DATA            interfaceData;
+    PSP_DEVICE_INTERFACE_DETAIL_DATA    detail = NULL;
+    DWORD                               length = 0;
+    DWORD                               error = ERROR_SUCCESS;
+
+    *Device = INVALID_HANDLE_VALUE;
+
+    devInfo = SetupDiGetClassDevs( &GUID_Hdmi_INTERFACE,
+                                   NULL,
+                                   NULL,
+                                   DIGCF_PRESENT | DIGCF_DEVICEINTERFACE );
+    if (devInfo == INVALID_HANDLE_VALUE) {
+        return GetLastError();
+    }
+
+    interfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    if (!SetupDiEnumDeviceInterfaces( devInfo,
+                                      NULL,
+                                      &GUID_Hdmi_INTERFACE,
+                                      CardIndex,
+                                      &interfaceData )) {
+        error = GetLastError();
+        goto Done;
+    }
+
+    (VOID) SetupDiGetDeviceInterfaceDetail( devInfo,
+                                            &interfaceData,
+                                            NULL,
+                                            0,
+                                            &length,
+                                            NULL );
+
+    detail = (PSP_DEVICE_INTERFACE_DETAIL_DATA) HeapAlloc( GetProcessHeap(),
+                                                           0,
+                                                           length );
+    if (detail == NULL) {
+        error = ERROR_NOT_ENOUGH_MEMORY;
+        goto Done;
+    }
+
+    detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+    if (!SetupDiGetDeviceInterfaceDetail( devInfo,
+                                          &interfaceData,
+                                          detail,
+                                          length,
+                                          NULL,
+                                          NULL )) {
+        error = GetLastError();
+        goto Done;
+    }
+
+    *Device = CreateFile( detail->DevicePath,
+                          GENERIC_READ | GENERIC_WRITE,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          NULL,
+                          OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL,
+                          NULL );
+    if (*Device == INVALID_HANDLE_VALUE) {
+        error = GetLastError();
+    }
+
+Done:
+
+    if (detail != NULL) {
+        HeapFree(GetProcessHeap(), 0, detail);
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+
+    return error;
+}
+
+
+VOID
+HdmiSdkClose(
+    IN HANDLE   Device
+    )
+/*++
+Routine Description:
+
+    Closes the stream. A ring still set up on it is torn down by the
+    driver.
+
+--*/
+{
+    CloseHandle(Device);
+}
+
+
+DWORD
+HdmiSdkWriteFrame(
+    IN HANDLE   Device,
+    IN PVOID    Frame,
+    IN ULONG    Length
+    )
+/*++
+Routine Description:
+
+    Sends one frame to the stream's offset on the card and returns once
+    the card has it.
+
+--*/
+{
+    DWORD   written;
+
+    if (!WriteFile(Device, Frame, Length, &written, NULL)) {
+        return GetLastError();
+    }
+
+    return (written == Length) ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+}
@@ -0,0 +1,413 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Frame.c
+
+Abstract:
+
+    Frame buffer allocation, fill and copy. A frame is written once and
+    then read by the card, not by the processor, so the fill and copy
+    use non-temporal stores: the data goes to memory through the write
+    combining buffers and the decoder's working set stays in the cache.
+    A large frame is split over thread pool threads, since one core
+    cannot saturate the memory bus with streaming stores.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+#include <emmintrin.h>
+
+typedef struct _HDMI_FRAME_JOB {
+
+    PUCHAR          Dest;
+    const UCHAR    *Source;             // NULL for a fill
+    ULONG           Pattern;
+    SIZE_T          Length;
+    SIZE_T          ChunkSize;
+    ULONG           ChunkCount;
+    volatile LONG   NextChunk;
+
+} HDMI_FRAME_JOB, *PHDMI_FRAME_JOB;
+
+
+static VOID
+HdmiFrameFillRange(
+    IN PUCHAR           Base,
+    IN SIZE_T           Start,
+    IN SIZE_T           End,
+    IN ULONG            Pattern,
+    IN BOOL             Stream
+    )
+/*++
+Routine Description:
+
+    Fills Base[Start..End) with Pattern repeated from Base on, so that
+    the chunks of a frame can be filled independently.
+
+--*/
+{
+    __m128i     v;
+    PUCHAR      p = Base + Start;
+    PUCHAR      end = Base + End;
+    ULONG       shift;
+
+    while (p < end && ((ULONG_PTR) p & 15) != 0) {
+        *p = (UCHAR) (Pattern >> (8 * ((p - Base) & 3)));
+        p++;
+    }
+
+    shift = 8 * (ULONG) ((p - Base) & 3);
+    v = _mm_set1_epi32((int) ((Pattern >> shift) | (shift ? Pattern << (32 - shift) : 0)));
+
+    if (Stream) {
+        for (; end - p >= 64; p += 64) {
+            _mm_stream_si128((__m128i *) p + 0, v);
+            _mm_stream_si128((__m128i *) p + 1, v);
+            _mm_stream_si128((__m128i *) p + 2, v);
+            _mm_stream_si128((__m128i *) p + 3, v);
+        }
+    }
+
+    for (; end - p >= 16; p += 16) {
+        _mm_store_si128((__m128i *) p, v);
+    }
+
+    for (; p < end; p++) {
+        *p = (UCHAR) (Pattern >> (8 * ((p - Base) & 3)));
+    }
+}
+
+
+static VOID
+HdmiFrameCopyRange(
+    OUT PUCHAR          Dest,
+    IN  const UCHAR    *Source,
+    IN  SIZE_T          Length
+    )
+{
+    PUCHAR      end = Dest + Length;
+
+    while (Dest < end && ((ULONG_PTR) Dest & 15) != 0) {
+        *Dest++ = *Source++;
+    }
+
+    for (; end - Dest >= 64; Dest += 64, Source += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) Source + 0);
+        __m128i b = _mm_loadu_si128((const __m128i *) Source + 1);
+        __m128i c = _mm_loadu_si128((const __m128i *) Source + 2);
+        __m128i d = _mm_loadu_si128((const __m128i *) Source + 3);
+
+        _mm_stream_si128((__m128i *) Dest + 0, a);
+        _mm_stream_si128((__m128i *) Dest + 1, b);
+        _mm_stream_si128((__m128i *) Dest + 2, c);
+        _mm_stream_si128((__m128i *) Dest + 3, d);
+    }
+
+    while (Dest < end) {
+        *Dest++ = *Source++;
+    }
+}
+
+
+static VOID
+HdmiFrameRunJob(
+    IN PHDMI_FRAME_JOB  Job
+    )
+/*++
+Routine Description:
+
+    Takes chunks of the job until there are none left. Every thread that
+    ran streaming stores fences them before the caller is told the frame
+    is done.
+
+--*/
+{
+    ULONG   chunk;
+    SIZE_T  start;
+    SIZE_T  end;
+
+    for (;;) {
+
+        chunk = (ULONG) InterlockedIncrement(&Job->NextChunk) - 1;
+
+        if (chunk >= Job->ChunkCount) {
+            break;
+        }
+
+        start = chunk * Job->ChunkSize;
+        end = (chunk == Job->ChunkCount - 1) ? Job->Length : start + Job->ChunkSize;
+
+        if (Job->Source != NULL) {
+            HdmiFrameCopyRange(Job->Dest + start, Job->Source + start, end - start);
+        } else {
+            HdmiFrameFillRange(Job->Dest, start, end, Job->Pattern, TRUE);
+        }
+    }
+
+    _mm_sfence();
+}
+
+
+static VOID CALLBACK
+HdmiFrameWorkCallback(
+    IN OUT PTP_CALLBACK_INSTANCE    Instance,
+    IN OUT PVOID                    Context,
+    IN OUT PTP_WORK                 Work
+    )
+{
+    UNREFERENCED_PARAMETER(Instance);
+    UNREFERENCED_PARAMETER(Work);
+
+    HdmiFrameRunJob((PHDMI_FRAME_JOB) Context);
+}
+
+
+static VOID
+HdmiFrameRun(
+    IN PHDMI_FRAME_JOB  Job,
+    IN ULONG            Threads
+    )
+/*++
+Routine Description:
+
+    Runs Job on the calling thread and Threads - 1 thread pool threads.
+    The frame is cut into twice as many chunks as there are threads so
+    a thread that starts late does not hold up the others. If no work
+    object can be had the caller does it all.
+
+--*/
+{
+    PTP_WORK    work = NULL;
+    ULONG       i;
+
+    if (Threads == 0) {
+        Threads = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    }
+
+    //
+    // Also bounds a caller's count, so 2 * Threads cannot wrap to 0.
+    //
+    if (Threads == 0) {
+        Threads = 1;
+    } else if (Threads > HDMI_FRAME_MAX_THREADS) {
+        Threads = HDMI_FRAME_MAX_THREADS;
+    }
+
+    Job->ChunkCount = 2 * Threads;
+    Job->ChunkSize = (Job->Length / Job->ChunkCount + HDMI_FRAME_CHUNK_ALIGN - 1) &
+                     ~(SIZE_T) (HDMI_FRAME_CHUNK_ALIGN - 1);
+
+    if (Job->ChunkSize < HDMI_FRAME_MIN_CHUNK) {
+        Job->ChunkSize = HDMI_FRAME_MIN_CHUNK;
+    }
+
+    Job->ChunkCount = (ULONG) ((Job->Length + Job->ChunkSize - 1) / Job->ChunkSize);
+    Job->NextChunk = 0;
+
+    if (Job->ChunkCount > 1 && Threads > 1) {
+        work = CreateThreadpoolWork(HdmiFrameWorkCallback, Job, NULL);
+    }
+
+    if (work != NULL) {
+        for (i = 1; i < Threads && i < Job->ChunkCount; i++) {
+            SubmitThreadpoolWork(work);
+        }
+    }
+
+    HdmiFrameRunJob(Job);
+
+    if (work != NULL) {
+        WaitForThreadpoolWorkCallbacks(work, FALSE);
+        CloseThreadpoolWork(work);
+    }
+}
+
+
+VOID
+HdmiSdkFillFrame(
+    OUT PVOID           Dest,
+    IN  SIZE_T          Length,
+    IN  ULONG           Pattern,
+    IN  ULONG           Threads
+    )
+/*++
+Routine Description:
+
+    Fills Length bytes at Dest with Pattern, little-endian, repeated.
+    Buffers under HDMI_FRAME_STREAM_MIN are filled on the caller with
+    ordinary stores; they are cheap to keep in the cache and are likely
+    to be read again.
+
+--*/
+{
+    HDMI_FRAME_JOB  job;
+
+    if (Length < HDMI_FRAME_STREAM_MIN) {
+        HdmiFrameFillRange((PUCHAR) Dest, 0, Length, Pattern, FALSE);
+        return;
+    }
+
+    ZeroMemory(&job, sizeof(job));
+
+    job.Dest = (PUCHAR) Dest;
+    job.Pattern = Pattern;
+    job.Length = Length;
+
+    HdmiFrameRun(&job, Threads);
+}
+
+
+VOID
+HdmiSdkCopyFrame(
+    OUT PVOID           Dest,
+    IN  const VOID     *Source,
+    IN  SIZE_T          Length,
+    IN  ULONG           Threads
+    )
+/*++
+Routine Description:
+
+    Copies Length bytes, e.g. a decoded frame into a ring slot. The
+    buffers must not overlap.
+
+--*/
+{
+    HDMI_FRAME_JOB  job;
+
+    if (Length < HDMI_FRAME_STREAM_MIN) {
+        CopyMemory(Dest, Source, Length);
+        return;
+    }
+
+    ZeroMemory(&job, sizeof(job));
+
+    job.Dest = (PUCHAR) Dest;
+    job.Source = (const UCHAR *) Source;
+    job.Length = Length;
+
+    HdmiFrameRun(&job, Threads);
+}
+
+
+static BOOL
+HdmiFrameEnableLockMemory(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Large pages need SeLockMemoryPrivilege enabled in the process token.
+    The account must have been granted "Lock pages in memory" for this
+    to succeed.
+
+--*/
+{
+    HANDLE              token;
+    TOKEN_PRIVILEGES    privileges;
+    BOOL                enabled;
+
+    if (!OpenProcessToken( GetCurrentProcess(),
+                           TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY,
+                           &token )) {
+        return FALSE;
+    }
+
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+    enabled = LookupPrivilegeValue( NULL,
+                                    SE_LOCK_MEMORY_NAME,
+                                    &privileges.Privileges[0].Luid ) &&
+              AdjustTokenPrivileges( token,
+                                     FALSE,
+                                     &privileges,
+                                     0,
+                                     NULL,
+                                     NULL ) &&
+              GetLastError() == ERROR_SUCCESS;
+
+    CloseHandle(token);
+
+    return enabled;
+}
+
+
+DWORD
+HdmiSdkAllocateFrame(
+    IN  SIZE_T          Size,
+    IN  ULONG           Flags,
+    OUT PVOID          *Buffer,
+    OUT PBOOL           LargePages OPTIONAL
+    )
+/*++
+Routine Description:
+
+    Allocates a page-aligned frame buffer of at least Size bytes. With
+    HDMI_FRAME_LARGE_PAGES it is backed by large pages if the process
+    can have them, which saves the TLB misses of walking a 14 MB frame
+    in 4 KB pages and lets the driver lock it for DMA faster. Otherwise,
+    or if no large pages are free, ordinary pages are used.
+
+--*/
+{
+    SIZE_T  largePage;
+    PVOID   buffer = NULL;
+
+    if (LargePages != NULL) {
+        *LargePages = FALSE;
+    }
+
+    if (Size == 0) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if ((Flags & HDMI_FRAME_LARGE_PAGES) != 0) {
+
+        largePage = GetLargePageMinimum();
+
+        if (largePage != 0 && HdmiFrameEnableLockMemory()) {
+
+            buffer = VirtualAlloc( NULL,
+                                   (Size + largePage - 1) & ~(largePage - 1),
+                                   MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                   PAGE_READWRITE );
+
+            if (buffer != NULL && LargePages != NULL) {
+                *LargePages = TRUE;
+            }
+        }
+    }
+
+    if (buffer == NULL) {
+        buffer = VirtualAlloc( NULL,
+                               Size,
+                               MEM_RESERVE | MEM_COMMIT,
+                               PAGE_READWRITE );
+    }
+
+    *Buffer = buffer;
+
+    return (buffer != NULL) ? ERROR_SUCCESS : GetLastError();
+}
+
+
+VOID
+HdmiSdkFreeFrame(
+    IN PVOID            Buffer
+    )
+{
+    if (Buffer != NULL) {
+        VirtualFree(Buffer, 0, MEM_RELEASE);
+    }
+}
@@ -0,0 +1,360 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    HdmiSdk.h
+
+Abstract:
+
+    Playout SDK for the HdmiCard driver: opening the card, writing frames
+    through WriteFile or the shared completion ring, packing decoded
+    planar pictures into the layout the card takes, allocating, filling
+    and copying frame buffers, and a reference pipeline that plays a
+    track file.
+
+    Link with HdmiSdk.lib, setupapi.lib and advapi32.lib. Functions
+    return a Win32 error code, ERROR_SUCCESS on success, unless noted
+    otherwise.
+
+Environment:
+
+    User mode
+
+--*/
+
+#if !defined(_HDMI_SDK_H_)
+#define _HDMI_SDK_H_
+
+#include <windows.h>
+#include <winioctl.h>
+#include "..\Public.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// Device access (Device.c)
+//
+// Each handle is a stream of its own in the driver; a player opens one
+// handle per stream it sends.
+//
+DWORD
+HdmiSdkOpen(
+    IN  ULONG   CardIndex,      // n-th card present
+    OUT PHANDLE Device
+    );
+
+VOID
+HdmiSdkClose(
+    IN HANDLE   Device
+    );
+
+DWORD
+HdmiSdkWriteFrame(
+    IN HANDLE   Device,
+    IN PVOID    Frame,
+    IN ULONG    Length
+    );
+
+//
+// Completion ring (Ring.c), see IOCTL_HDMI_RING_SETUP in Public.h. The
+// slots are mapped for DMA by the driver, so a frame packed straight
+// into Slots[i] is sent without another copy.
+//
+typedef struct _HDMI_SDK_RING {
+
+    HANDLE          Device;
+    PHDMI_RING      Ring;
+    PVOID           Slots[HDMI_RING_MAX_SLOTS];
+    ULONG           SlotCount;
+    ULONG           SlotSize;
+    volatile ULONG *Eplast;             // HDMI_RING_FLAG_POLL only
+
+} HDMI_SDK_RING, *PHDMI_SDK_RING;
+
+DWORD
+HdmiSdkRingOpen(
+    IN  HANDLE              Device,
+    IN  PHDMI_RING_SETUP    Setup,
+    OUT PHDMI_SDK_RING      Ring
+    );
+
+DWORD
+HdmiSdkRingClose(
+    IN PHDMI_SDK_RING       Ring
+    );
+
+BOOL
+HdmiSdkRingSubmit(              // FALSE if the SQ is full
+    IN PHDMI_SDK_RING       Ring,
+    IN PHDMI_RING_SQE       Sqe
+    );
+
+BOOL
+HdmiSdkRingReap(                // FALSE if the CQ is empty
+    IN  PHDMI_SDK_RING      Ring,
+    OUT PHDMI_RING_CQE      Cqe
+    );
+
+DWORD
+HdmiSdkRingEnter(               // starts an idle channel, waits for a CQE
+    IN PHDMI_SDK_RING       Ring
+    );
+
+//
+// Pixel packing (Pack.c)
+//
+// The source is three planes of 12-bit samples (X, Y, Z or R, G, B) in
+// the low bits of 16-bit words, as JPEG 2000 decoders deliver them. The
+// card takes the three components of a pixel together, in one of these
+// layouts, little-endian:
+//
+//     HdmiPixelRgb48  a USHORT per component, the sample in bits 15:4
+//     HdmiPixelRgb36  12 bits per component, each pair of consecutive
+//                     components in 3 bytes, first one in the low bits;
+//                     two pixels take 9 bytes, so the width must be even
+//     HdmiPixelRgb30  a ULONG per pixel, the top 10 bits of the
+//                     components in bits 9:0, 19:10 and 29:20
+//
+// An optional LUT, e.g. a gamma or colour-space transfer curve, maps
+// every sample before it is packed, in the same pass. Only its low 12
+// bits are used.
+//
+// The kernels use AVX-512 (F and BW) or AVX2 where the processor and the
+// compiler have them; all levels give bit-identical output.
+//
+typedef enum _HDMI_PIXEL_FORMAT {
+
+    HdmiPixelRgb48 = 0,
+    HdmiPixelRgb36,
+    HdmiPixelRgb30,
+    HdmiPixelFormatCount
+
+} HDMI_PIXEL_FORMAT;
+
+typedef enum _HDMI_SIMD_LEVEL {
+
+    HdmiSimdScalar = 0,
+    HdmiSimdAvx2,
+    HdmiSimdAvx512
+
+} HDMI_SIMD_LEVEL;
+
+#define HDMI_PACK_LUT_ENTRIES   4096
+
+typedef struct _HDMI_PACK_LUT {
+
+    USHORT          Entry[HDMI_PACK_LUT_ENTRIES];
+    USHORT          Reserved[2];        // lets the kernels read entries as ULONGs
+
+} HDMI_PACK_LUT, *PHDMI_PACK_LUT;
+
+typedef struct _HDMI_PLANAR_FRAME {
+
+    const USHORT   *Plane[3];
+    SIZE_T          Pitch[3];           // bytes from one row to the next
+
+} HDMI_PLANAR_FRAME, *PHDMI_PLANAR_FRAME;
+
+typedef struct _HDMI_PACK_PARAMS {
+
+    HDMI_PIXEL_FORMAT Format;
+    ULONG           Width;
+    ULONG           Height;
+    SIZE_T          DestPitch;          // 0 for rows back to back
+    const HDMI_PACK_LUT *Lut;           // NULL for none
+
+} HDMI_PACK_PARAMS, *PHDMI_PACK_PARAMS;
+
+SIZE_T
+HdmiSdkPackRowSize(
+    IN HDMI_PIXEL_FORMAT    Format,
+    IN ULONG                Width
+    );
+
+DWORD
+HdmiSdkPack(
+    IN  PHDMI_PACK_PARAMS   Params,
+    IN  PHDMI_PLANAR_FRAME  Source,
+    OUT PVOID               Dest,
+    IN  SIZE_T              DestSize
+    );
+
+HDMI_SIMD_LEVEL
+HdmiSdkGetSimdLevel(            // best level the processor and build support
+    VOID
+    );
+
+HDMI_SIMD_LEVEL
+HdmiSdkSetSimdLevel(            // caps the level used; returns the level now used
+    IN HDMI_SIMD_LEVEL      Level
+    );
+
+//
+// Frame buffers (Frame.c)
+//
+// HdmiSdkFillFrame and HdmiSdkCopyFrame write with non-temporal stores,
+// bypassing the cache, on up to Threads threads (0 for one per
+// processor); the count is capped either way. Use them for data the
+// processor will not read again, such as a frame about to be sent.
+//
+#define HDMI_FRAME_LARGE_PAGES  0x00000001  // back with large pages if allowed
+
+DWORD
+HdmiSdkAllocateFrame(
+    IN  SIZE_T          Size,
+    IN  ULONG           Flags,              // HDMI_FRAME_xxx
+    OUT PVOID          *Buffer,
+    OUT PBOOL           LargePages OPTIONAL
+    );
+
+VOID
+HdmiSdkFreeFrame(
+    IN PVOID            Buffer
+    );
+
+VOID
+HdmiSdkFillFrame(
+    OUT PVOID           Dest,
+    IN  SIZE_T          Length,
+    IN  ULONG           Pattern,
+    IN  ULONG           Threads
+    );
+
+VOID
+HdmiSdkCopyFrame(
+    OUT PVOID           Dest,
+    IN  const VOID     *Source,
+    IN  SIZE_T          Length,
+    IN  ULONG           Threads
+    );
+
+//
+// Playout pipeline (Pipeline.c)
+//
+// Plays the picture track file TrackFile: a read stage reads it with
+// unbuffered overlapped I/O and picks out the picture KLVs, a decode
+// stage runs Decode on each, and a submit stage sends the frames with
+// WriteFile on Device or, if Ring is set, through the ring. Decode is
+// called on one thread, in picture order; a decoder that needs more
+// cores runs its own threads inside it. It fills Frame->Frame, e.g.
+// with HdmiSdkPack, and may set FrameLength and Deadline; a picture it
+// fails is counted and skipped. Encrypted track files are not read.
+//
+// DecodeDepth pictures may wait for the decoder and SubmitDepth frames
+// for the card. A stage that finds its next queue full waits, so a slow
+// stage holds back the ones before it.
+//
+typedef enum _HDMI_PIPE_STAGE_ID {
+
+    HdmiPipeStageRead = 0,
+    HdmiPipeStageDecode,
+    HdmiPipeStageSubmit,
+    HdmiPipeStageCount
+
+} HDMI_PIPE_STAGE_ID;
+
+typedef struct _HDMI_PIPE_FRAME {
+
+    ULONG           Index;              // picture number in the track file
+    ULONG           EssenceLength;
+    PVOID           Essence;            // the picture KLV's value
+    PVOID           Frame;              // where the decoder puts the frame
+    ULONG           FrameSize;          // bytes at Frame
+    ULONG           FrameLength;        // bytes to send, 0 for FrameSize
+    LONGLONG        Deadline;           // ring only, see HDMI_RING_SQE
+    ULONG           Slot;               // ring slot at Frame, ring only
+
+} HDMI_PIPE_FRAME, *PHDMI_PIPE_FRAME;
+
+typedef DWORD
+HDMI_PIPE_DECODE(
+    IN     PVOID            Context,
+    IN OUT PHDMI_PIPE_FRAME Frame
+    );
+
+typedef HDMI_PIPE_DECODE *PHDMI_PIPE_DECODE;
+
+typedef struct _HDMI_PIPE_CONFIG {
+
+    PCWSTR          TrackFile;
+    HANDLE          Device;             // WriteFile path
+    PHDMI_SDK_RING  Ring;               // ring path if not NULL
+    ULONG           FrameSize;          // 0 for the slot size on the ring
+    ULONG           EssenceSize;        // largest picture KLV value, 0 for 4 MB
+    ULONG           DecodeDepth;        // 0 for 4
+    ULONG           SubmitDepth;        // 0 for 4
+    ULONG           ReadSize;           // bytes per read, 0 for 4 MB
+    ULONG           ReadDepth;          // reads in flight, 0 for 4
+    PHDMI_PIPE_DECODE Decode;
+    PVOID           Context;            // passed to Decode
+
+} HDMI_PIPE_CONFIG, *PHDMI_PIPE_CONFIG;
+
+//
+// Per stage, in TimestampFrequency ticks:
+//
+//                  Busy                Starved             Blocked
+//     read         parsing, copying    waiting for reads   no free frame
+//     decode       in Decode           no picture          submit queue full
+//     submit       WriteFile, SQEs     no frame            waiting for a CQE
+//
+// Bytes are read from the file, decoded from essence and sent to the
+// card, respectively.
+//
+typedef struct _HDMI_PIPE_STAGE_STATS {
+
+    ULONGLONG       Frames;
+    ULONGLONG       Bytes;
+    LONGLONG        BusyTicks;
+    LONGLONG        StarvedTicks;
+    LONGLONG        BlockedTicks;
+
+} HDMI_PIPE_STAGE_STATS, *PHDMI_PIPE_STAGE_STATS;
+
+typedef struct _HDMI_PIPE_STATS {
+
+    LONGLONG        TimestampFrequency;
+    ULONGLONG       Errors;             // pictures that failed on their own
+    ULONGLONG       Dropped;            // frames the driver dropped as late
+    HDMI_PIPE_STAGE_STATS Stage[HdmiPipeStageCount];
+
+} HDMI_PIPE_STATS, *PHDMI_PIPE_STATS;
+
+typedef struct _HDMI_PIPE *PHDMI_PIPE;
+
+DWORD
+HdmiSdkPipeCreate(
+    IN  PHDMI_PIPE_CONFIG   Config,
+    OUT PHDMI_PIPE         *Pipe
+    );
+
+DWORD
+HdmiSdkPipeWait(                // WAIT_TIMEOUT, or how the pipeline ended
+    IN PHDMI_PIPE           Pipe,
+    IN DWORD                Milliseconds
+    );
+
+VOID
+HdmiSdkPipeGetStats(
+    IN  PHDMI_PIPE          Pipe,
+    OUT PHDMI_PIPE_STATS    Stats
+    );
+
+VOID
+HdmiSdkPipeClose(
+    IN PHDMI_PIPE           Pipe
+    );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HDMI_SDK_H_
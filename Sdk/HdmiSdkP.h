@@ -0,0 +1,144 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    HdmiSdkP.h
+
+Abstract:
+
+    Declarations private to the SDK.
+
+Environment:
+
+    User mode
+
+--*/
+
+#if !defined(_HDMI_SDK_P_H_)
+#define _HDMI_SDK_P_H_
+
+#include "HdmiSdk.h"
+#include <setupapi.h>
+#include <intrin.h>
+
+//
+// AVX2 intrinsics need Visual C++ 2012, AVX-512 ones Visual C++ 2017.
+// Kernels the compiler cannot build are left out and never selected.
+//
+#if defined(_MSC_VER) && (_MSC_VER >= 1700)
+#define HDMI_SDK_AVX2       1
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1911)
+#define HDMI_SDK_AVX512     1
+#endif
+
+//
+// A row kernel packs Width pixels of one row. Lut is NULL or the table
+// of an HDMI_PACK_LUT. The SIMD kernels finish the pixels that do not
+// fill a whole vector with the scalar kernel, starting at pixel First.
+//
+typedef VOID
+HDMI_PACK_ROW(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    );
+
+typedef HDMI_PACK_ROW *PHDMI_PACK_ROW;
+
+//
+// Pack.c
+//
+HDMI_PACK_ROW HdmiPackRowRgb48;
+HDMI_PACK_ROW HdmiPackRowRgb36;
+HDMI_PACK_ROW HdmiPackRowRgb30;
+
+//
+// PackAvx2.c
+//
+#if defined(HDMI_SDK_AVX2)
+VOID
+HdmiPackAvx2Initialize(
+    VOID
+    );
+
+HDMI_PACK_ROW HdmiPackRowRgb48Avx2;
+HDMI_PACK_ROW HdmiPackRowRgb36Avx2;
+HDMI_PACK_ROW HdmiPackRowRgb30Avx2;
+#endif
+
+//
+// PackAvx512.c
+//
+#if defined(HDMI_SDK_AVX512)
+VOID
+HdmiPackAvx512Initialize(
+    VOID
+    );
+
+HDMI_PACK_ROW HdmiPackRowRgb48Avx512;
+HDMI_PACK_ROW HdmiPackRowRgb36Avx512;
+HDMI_PACK_ROW HdmiPackRowRgb30Avx512;
+#endif
+
+//
+// Frame.c. Below HDMI_FRAME_STREAM_MIN bytes a fill or copy stays in the
+// cache and on the calling thread. Chunks are whole pages so that two
+// threads never write to the same one.
+//
+#define HDMI_FRAME_STREAM_MIN   (256 * 1024)
+#define HDMI_FRAME_MIN_CHUNK    (256 * 1024)
+#define HDMI_FRAME_CHUNK_ALIGN  4096
+#define HDMI_FRAME_MAX_THREADS  8
+
+//
+// Pipeline.c
+//
+#define HDMI_PIPE_LINE              64          // cache line
+#define HDMI_PIPE_KLV_HEADER_MAX    (16 + 9)    // key and longest BER length
+#define HDMI_PIPE_READ_ALIGN        (64 * 1024) // any sector size divides it
+#define HDMI_PIPE_MAX_READS         16
+#define HDMI_PIPE_MAX_DEPTH         64
+#define HDMI_PIPE_DEFAULT_READS     4
+#define HDMI_PIPE_DEFAULT_READ_SIZE (4 * 1024 * 1024)
+#define HDMI_PIPE_DEFAULT_DEPTH     4
+#define HDMI_PIPE_DEFAULT_ESSENCE   (4 * 1024 * 1024)
+
+//
+// STATUS_IO_TIMEOUT, how the driver completes a frame it dropped as late.
+// A transfer the watchdog fails gets STATUS_IO_DEVICE_ERROR and counts as
+// an error.
+//
+#define HDMI_STATUS_IO_TIMEOUT      ((LONG) 0xC00000B5L)
+
+//
+// The sample as it is packed: 12 bits, through the LUT if there is one.
+//
+static __forceinline
+ULONG
+HdmiPackSample(
+    IN ULONG            Sample,
+    IN const USHORT    *Lut
+    )
+{
+    Sample &= 0xFFF;
+
+    if (Lut != NULL) {
+        Sample = Lut[Sample] & 0xFFF;
+    }
+
+    return Sample;
+}
+
+#endif // _HDMI_SDK_P_H_
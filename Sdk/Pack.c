@@ -0,0 +1,354 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Pack.c
+
+Abstract:
+
+    Packing of planar 12-bit pictures into the card's pixel layouts: the
+    scalar kernels, which are also the reference for the SIMD ones, and
+    the choice of kernel for the processor.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+
+static INIT_ONCE        HdmiPackInitOnce = INIT_ONCE_STATIC_INIT;
+static HDMI_SIMD_LEVEL  HdmiPackCpuLevel = HdmiSimdScalar;
+static volatile LONG    HdmiPackLevelCap = HdmiSimdAvx512;
+
+static const PHDMI_PACK_ROW HdmiPackScalarRows[HdmiPixelFormatCount] = {
+    HdmiPackRowRgb48,
+    HdmiPackRowRgb36,
+    HdmiPackRowRgb30
+};
+
+#if defined(HDMI_SDK_AVX2)
+static const PHDMI_PACK_ROW HdmiPackAvx2Rows[HdmiPixelFormatCount] = {
+    HdmiPackRowRgb48Avx2,
+    HdmiPackRowRgb36Avx2,
+    HdmiPackRowRgb30Avx2
+};
+#endif
+
+#if defined(HDMI_SDK_AVX512)
+static const PHDMI_PACK_ROW HdmiPackAvx512Rows[HdmiPixelFormatCount] = {
+    HdmiPackRowRgb48Avx512,
+    HdmiPackRowRgb36Avx512,
+    HdmiPackRowRgb30Avx512
+};
+#endif
+
+
+VOID
+HdmiPackRowRgb48(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    PUSHORT dest = (PUSHORT) Dest;
+    ULONG   x;
+
+    for (x = First; x < Width; x++) {
+        dest[3 * x + 0] = (USHORT) (HdmiPackSample(Plane0[x], Lut) << 4);
+        dest[3 * x + 1] = (USHORT) (HdmiPackSample(Plane1[x], Lut) << 4);
+        dest[3 * x + 2] = (USHORT) (HdmiPackSample(Plane2[x], Lut) << 4);
+    }
+}
+
+
+VOID
+HdmiPackRowRgb36(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+/*++
+Routine Description:
+
+    Two pixels at a time; First and Width are even. The six components
+    of a pair go into three 3-byte groups of two.
+
+--*/
+{
+    ULONG   s[6];
+    PUCHAR  dest;
+    ULONG   x;
+    ULONG   i;
+
+    for (x = First; x < Width; x += 2) {
+
+        s[0] = HdmiPackSample(Plane0[x], Lut);
+        s[1] = HdmiPackSample(Plane1[x], Lut);
+        s[2] = HdmiPackSample(Plane2[x], Lut);
+        s[3] = HdmiPackSample(Plane0[x + 1], Lut);
+        s[4] = HdmiPackSample(Plane1[x + 1], Lut);
+        s[5] = HdmiPackSample(Plane2[x + 1], Lut);
+
+        dest = Dest + (x / 2) * 9;
+
+        for (i = 0; i < 6; i += 2) {
+            dest[0] = (UCHAR) s[i];
+            dest[1] = (UCHAR) ((s[i] >> 8) | (s[i + 1] << 4));
+            dest[2] = (UCHAR) (s[i + 1] >> 4);
+            dest += 3;
+        }
+    }
+}
+
+
+VOID
+HdmiPackRowRgb30(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    PULONG  dest = (PULONG) Dest;
+    ULONG   x;
+
+    for (x = First; x < Width; x++) {
+        dest[x] = (HdmiPackSample(Plane0[x], Lut) >> 2) |
+                  ((HdmiPackSample(Plane1[x], Lut) >> 2) << 10) |
+                  ((HdmiPackSample(Plane2[x], Lut) >> 2) << 20);
+    }
+}
+
+
+static BOOL
+HdmiPackOsSavesState(
+    IN ULONGLONG        Mask
+    )
+/*++
+Routine Description:
+
+    Returns TRUE if the operating system saves all the register state in
+    Mask (XCR0 bits) across context switches.
+
+--*/
+{
+    int info[4];
+
+    __cpuid(info, 1);
+
+    if ((info[2] & (1 << 27)) == 0) {           // OSXSAVE
+        return FALSE;
+    }
+
+    return (_xgetbv(0) & Mask) == Mask;
+}
+
+
+static BOOL CALLBACK
+HdmiPackInitialize(
+    IN OUT PINIT_ONCE   InitOnce,
+    IN     PVOID        Parameter,
+    OUT    PVOID       *Context
+    )
+{
+    int info[4];
+
+    UNREFERENCED_PARAMETER(InitOnce);
+    UNREFERENCED_PARAMETER(Parameter);
+    UNREFERENCED_PARAMETER(Context);
+
+    __cpuid(info, 0);
+
+    if (info[0] < 7) {
+        return TRUE;
+    }
+
+    __cpuidex(info, 7, 0);
+
+#if defined(HDMI_SDK_AVX2)
+    //
+    // XMM and YMM state.
+    //
+    if ((info[1] & (1 << 5)) != 0 && HdmiPackOsSavesState(0x6)) {
+        HdmiPackAvx2Initialize();
+        HdmiPackCpuLevel = HdmiSimdAvx2;
+    }
+#endif
+
+#if defined(HDMI_SDK_AVX512)
+    //
+    // AVX-512F and BW; opmask, ZMM0-15 upper halves and ZMM16-31 state
+    // on top of the above.
+    //
+    if (HdmiPackCpuLevel == HdmiSimdAvx2 &&
+        (info[1] & (1 << 16)) != 0 &&
+        (info[1] & (1 << 30)) != 0 &&
+        HdmiPackOsSavesState(0xE6)) {
+        HdmiPackAvx512Initialize();
+        HdmiPackCpuLevel = HdmiSimdAvx512;
+    }
+#endif
+
+    return TRUE;
+}
+
+
+HDMI_SIMD_LEVEL
+HdmiSdkGetSimdLevel(
+    VOID
+    )
+{
+    (VOID) InitOnceExecuteOnce(&HdmiPackInitOnce, HdmiPackInitialize, NULL, NULL);
+
+    return HdmiPackCpuLevel;
+}
+
+
+HDMI_SIMD_LEVEL
+HdmiSdkSetSimdLevel(
+    IN HDMI_SIMD_LEVEL      Level
+    )
+/*++
+Routine Description:
+
+    Caps the kernels used from now on at Level, e.g. to compare against
+    the scalar ones. Returns the level that will be used.
+
+--*/
+{
+    HDMI_SIMD_LEVEL cpuLevel = HdmiSdkGetSimdLevel();
+
+    InterlockedExchange(&HdmiPackLevelCap, (LONG) Level);
+
+    return (Level < cpuLevel) ? Level : cpuLevel;
+}
+
+
+SIZE_T
+HdmiSdkPackRowSize(
+    IN HDMI_PIXEL_FORMAT    Format,
+    IN ULONG                Width
+    )
+/*++
+Routine Description:
+
+    Returns the bytes one packed row of Width pixels takes, or 0 if
+    Format cannot take such a row.
+
+--*/
+{
+    switch (Format) {
+
+    case HdmiPixelRgb48:
+        return (SIZE_T) Width * 6;
+
+    case HdmiPixelRgb36:
+        return (Width & 1) ? 0 : (SIZE_T) (Width / 2) * 9;
+
+    case HdmiPixelRgb30:
+        return (SIZE_T) Width * 4;
+
+    default:
+        return 0;
+    }
+}
+
+
+DWORD
+HdmiSdkPack(
+    IN  PHDMI_PACK_PARAMS   Params,
+    IN  PHDMI_PLANAR_FRAME  Source,
+    OUT PVOID               Dest,
+    IN  SIZE_T              DestSize
+    )
+/*++
+Routine Description:
+
+    Packs Source into Dest in one pass, e.g. straight into a ring slot.
+
+--*/
+{
+    PHDMI_PACK_ROW  packRow;
+    HDMI_SIMD_LEVEL level;
+    const USHORT   *lut;
+    SIZE_T          rowSize;
+    SIZE_T          pitch;
+    ULONG           y;
+
+    rowSize = HdmiSdkPackRowSize(Params->Format, Params->Width);
+
+    if (rowSize == 0 || Params->Height == 0 ||
+        Source->Plane[0] == NULL ||
+        Source->Plane[1] == NULL ||
+        Source->Plane[2] == NULL) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    pitch = (Params->DestPitch != 0) ? Params->DestPitch : rowSize;
+
+    if (pitch < rowSize) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (DestSize < pitch * (Params->Height - 1) + rowSize) {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    level = HdmiSdkGetSimdLevel();
+
+    if ((LONG) level > HdmiPackLevelCap) {
+        level = (HDMI_SIMD_LEVEL) HdmiPackLevelCap;
+    }
+
+    switch (level) {
+
+#if defined(HDMI_SDK_AVX512)
+    case HdmiSimdAvx512:
+        packRow = HdmiPackAvx512Rows[Params->Format];
+        break;
+#endif
+
+#if defined(HDMI_SDK_AVX2)
+    case HdmiSimdAvx2:
+        packRow = HdmiPackAvx2Rows[Params->Format];
+        break;
+#endif
+
+    default:
+        packRow = HdmiPackScalarRows[Params->Format];
+        break;
+    }
+
+    lut = (Params->Lut != NULL) ? Params->Lut->Entry : NULL;
+
+    for (y = 0; y < Params->Height; y++) {
+        packRow( (const USHORT *) ((const UCHAR *) Source->Plane[0] + y * Source->Pitch[0]),
+                 (const USHORT *) ((const UCHAR *) Source->Plane[1] + y * Source->Pitch[1]),
+                 (const USHORT *) ((const UCHAR *) Source->Plane[2] + y * Source->Pitch[2]),
+                 (PUCHAR) Dest + y * pitch,
+                 0,
+                 Params->Width,
+                 lut );
+    }
+
+    return ERROR_SUCCESS;
+}
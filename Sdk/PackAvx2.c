@@ -0,0 +1,290 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    PackAvx2.c
+
+Abstract:
+
+    AVX2 packing kernels, 16 pixels per step. Each 128-bit lane
+    interleaves 8 pixels of the three planes with byte shuffles into 24
+    words, and the lanes are put back in memory order before the store.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+
+#if defined(HDMI_SDK_AVX2)
+
+#include <immintrin.h>
+
+//
+// HdmiPackAvx2Interleave[k][c] moves the words of component c into
+// output vector k; the bytes of the other components are zeroed.
+//
+static __declspec(align(32)) UCHAR HdmiPackAvx2Interleave[3][3][32];
+
+//
+// Keeps the low 3 bytes of each ULONG of a lane, at the bottom.
+//
+static __declspec(align(32)) const UCHAR HdmiPackAvx2Compact24[32] = {
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80
+};
+
+
+VOID
+HdmiPackAvx2Initialize(
+    VOID
+    )
+{
+    ULONG   k;
+    ULONG   c;
+    ULONG   j;
+    ULONG   word;
+
+    for (k = 0; k < 3; k++) {
+        for (c = 0; c < 3; c++) {
+            for (j = 0; j < 16; j++) {
+
+                word = 8 * k + j % 8;
+
+                if (word % 3 == c) {
+                    HdmiPackAvx2Interleave[k][c][2 * j]     = (UCHAR) (2 * (word / 3));
+                    HdmiPackAvx2Interleave[k][c][2 * j + 1] = (UCHAR) (2 * (word / 3) + 1);
+                } else {
+                    HdmiPackAvx2Interleave[k][c][2 * j]     = 0x80;
+                    HdmiPackAvx2Interleave[k][c][2 * j + 1] = 0x80;
+                }
+            }
+        }
+    }
+}
+
+
+static __forceinline __m256i
+HdmiPackAvx2Load(
+    IN const USHORT    *Plane,
+    IN const USHORT    *Lut
+    )
+/*++
+Routine Description:
+
+    Loads 16 samples and maps them like HdmiPackSample. Lut is read as
+    ULONGs at word offsets, hence HDMI_PACK_LUT.Reserved.
+
+--*/
+{
+    const __m256i   mask = _mm256_set1_epi32(0xFFF);
+    __m256i         v;
+    __m256i         lo;
+    __m256i         hi;
+
+    v = _mm256_and_si256( _mm256_loadu_si256((const __m256i *) Plane),
+                          _mm256_set1_epi16(0xFFF) );
+
+    if (Lut == NULL) {
+        return v;
+    }
+
+    lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+    hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+
+    lo = _mm256_and_si256(_mm256_i32gather_epi32((const int *) Lut, lo, 2), mask);
+    hi = _mm256_and_si256(_mm256_i32gather_epi32((const int *) Lut, hi, 2), mask);
+
+    //
+    // packus works per lane; put the four quarters back in order.
+    //
+    return _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+}
+
+
+static __forceinline VOID
+HdmiPackAvx2Interleave3(
+    IN  __m256i     A,
+    IN  __m256i     B,
+    IN  __m256i     C,
+    OUT __m256i    *Out
+    )
+/*++
+Routine Description:
+
+    Interleaves 16 words of each of A, B and C into Out[0..2] in memory
+    order: A0 B0 C0 A1 B1 C1 ...
+
+--*/
+{
+    __m256i     out[3];
+    ULONG       k;
+
+    for (k = 0; k < 3; k++) {
+        out[k] = _mm256_or_si256(
+                     _mm256_or_si256(
+                         _mm256_shuffle_epi8(A, _mm256_load_si256((const __m256i *) HdmiPackAvx2Interleave[k][0])),
+                         _mm256_shuffle_epi8(B, _mm256_load_si256((const __m256i *) HdmiPackAvx2Interleave[k][1]))),
+                     _mm256_shuffle_epi8(C, _mm256_load_si256((const __m256i *) HdmiPackAvx2Interleave[k][2])));
+    }
+
+    //
+    // Lane 0 of out[] holds pixels 0-7, lane 1 pixels 8-15.
+    //
+    Out[0] = _mm256_permute2x128_si256(out[0], out[1], 0x20);
+    Out[1] = _mm256_permute2x128_si256(out[2], out[0], 0x30);
+    Out[2] = _mm256_permute2x128_si256(out[1], out[2], 0x31);
+}
+
+
+VOID
+HdmiPackRowRgb48Avx2(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    __m256i     out[3];
+    __m256i    *dest;
+    ULONG       x;
+
+    for (x = First; x + 16 <= Width; x += 16) {
+
+        HdmiPackAvx2Interleave3( _mm256_slli_epi16(HdmiPackAvx2Load(Plane0 + x, Lut), 4),
+                                 _mm256_slli_epi16(HdmiPackAvx2Load(Plane1 + x, Lut), 4),
+                                 _mm256_slli_epi16(HdmiPackAvx2Load(Plane2 + x, Lut), 4),
+                                 out );
+
+        dest = (__m256i *) (Dest + (SIZE_T) x * 6);
+
+        _mm256_storeu_si256(dest + 0, out[0]);
+        _mm256_storeu_si256(dest + 1, out[1]);
+        _mm256_storeu_si256(dest + 2, out[2]);
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb48(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+
+VOID
+HdmiPackRowRgb36Avx2(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+/*++
+Routine Description:
+
+    The 72 bytes of a step are stored as six 16-byte lanes at 12-byte
+    intervals, so the last store runs 4 bytes past them. The loop stops
+    while at least two pixels are left, and the scalar kernel writes
+    those bytes over.
+
+--*/
+{
+    const __m256i   compact = _mm256_load_si256((const __m256i *) HdmiPackAvx2Compact24);
+    const __m256i   low = _mm256_set1_epi32(0x000FFF);
+    const __m256i   high = _mm256_set1_epi32(0xFFF000);
+    __m256i         out[3];
+    __m256i         v;
+    PUCHAR          dest;
+    ULONG           x;
+    ULONG           k;
+
+    for (x = First; x + 16 < Width; x += 16) {
+
+        HdmiPackAvx2Interleave3( HdmiPackAvx2Load(Plane0 + x, Lut),
+                                 HdmiPackAvx2Load(Plane1 + x, Lut),
+                                 HdmiPackAvx2Load(Plane2 + x, Lut),
+                                 out );
+
+        dest = Dest + (SIZE_T) (x / 2) * 9;
+
+        for (k = 0; k < 3; k++) {
+
+            //
+            // Each ULONG holds two components; close the 4-bit gap
+            // between them and drop the top byte.
+            //
+            v = _mm256_or_si256( _mm256_and_si256(out[k], low),
+                                 _mm256_and_si256(_mm256_srli_epi32(out[k], 4), high) );
+
+            v = _mm256_shuffle_epi8(v, compact);
+
+            _mm_storeu_si128((__m128i *) (dest + 24 * k),
+                             _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i *) (dest + 24 * k + 12),
+                             _mm256_extracti128_si256(v, 1));
+        }
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb36(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+
+VOID
+HdmiPackRowRgb30Avx2(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    __m256i     a;
+    __m256i     b;
+    __m256i     c;
+    __m256i    *dest;
+    ULONG       x;
+
+    for (x = First; x + 16 <= Width; x += 16) {
+
+        a = _mm256_srli_epi16(HdmiPackAvx2Load(Plane0 + x, Lut), 2);
+        b = _mm256_srli_epi16(HdmiPackAvx2Load(Plane1 + x, Lut), 2);
+        c = _mm256_srli_epi16(HdmiPackAvx2Load(Plane2 + x, Lut), 2);
+
+        dest = (__m256i *) (Dest + (SIZE_T) x * 4);
+
+        _mm256_storeu_si256(dest,
+            _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_cvtepu16_epi32(_mm256_castsi256_si128(a)),
+                    _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(b)), 10)),
+                _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(c)), 20)));
+
+        _mm256_storeu_si256(dest + 1,
+            _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_cvtepu16_epi32(_mm256_extracti128_si256(a, 1)),
+                    _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(b, 1)), 10)),
+                _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(c, 1)), 20)));
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb30(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+#endif // HDMI_SDK_AVX2
@@ -0,0 +1,289 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    PackAvx512.c
+
+Abstract:
+
+    AVX-512 (F and BW) packing kernels, 32 pixels per step. Word
+    permutes across the whole register interleave the planes, so unlike
+    AVX2 no lane fix-up is needed.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+
+#if defined(HDMI_SDK_AVX512)
+
+#include <immintrin.h>
+
+//
+// Output vector k of an interleave is permutex2var(A, AB[k], B) with the
+// words of C merged in through CMask[k] and C[k].
+//
+static __declspec(align(64)) USHORT HdmiPackAvx512IndexAB[3][32];
+static __declspec(align(64)) USHORT HdmiPackAvx512IndexC[3][32];
+static __mmask32 HdmiPackAvx512MaskC[3];
+
+//
+// Keeps the low 3 bytes of each ULONG of a lane, at the bottom, then
+// moves the 12 bytes of each lane together.
+//
+static __declspec(align(64)) const UCHAR HdmiPackAvx512Compact24[64] = {
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80
+};
+
+static __declspec(align(64)) const ULONG HdmiPackAvx512Gather24[16] = {
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0
+};
+
+
+VOID
+HdmiPackAvx512Initialize(
+    VOID
+    )
+{
+    ULONG   k;
+    ULONG   j;
+    ULONG   word;
+
+    for (k = 0; k < 3; k++) {
+
+        HdmiPackAvx512MaskC[k] = 0;
+
+        for (j = 0; j < 32; j++) {
+
+            word = 32 * k + j;
+
+            switch (word % 3) {
+            case 0:
+                HdmiPackAvx512IndexAB[k][j] = (USHORT) (word / 3);
+                break;
+            case 1:
+                HdmiPackAvx512IndexAB[k][j] = (USHORT) (32 + word / 3);
+                break;
+            default:
+                HdmiPackAvx512IndexAB[k][j] = 0;
+                HdmiPackAvx512MaskC[k] |= (__mmask32) 1 << j;
+                break;
+            }
+
+            HdmiPackAvx512IndexC[k][j] = (USHORT) (word / 3);
+        }
+    }
+}
+
+
+static __forceinline __m256i
+HdmiPackAvx512Lookup(
+    IN __m256i          Samples,
+    IN const USHORT    *Lut
+    )
+{
+    __m512i     v;
+
+    v = _mm512_i32gather_epi32( _mm512_cvtepu16_epi32(Samples),
+                                (const int *) Lut,
+                                2 );
+
+    return _mm512_cvtepi32_epi16(_mm512_and_si512(v, _mm512_set1_epi32(0xFFF)));
+}
+
+
+static __forceinline __m512i
+HdmiPackAvx512Load(
+    IN const USHORT    *Plane,
+    IN const USHORT    *Lut
+    )
+/*++
+Routine Description:
+
+    Loads 32 samples and maps them like HdmiPackSample.
+
+--*/
+{
+    __m512i     v;
+
+    v = _mm512_and_si512( _mm512_loadu_si512(Plane),
+                          _mm512_set1_epi16(0xFFF) );
+
+    if (Lut == NULL) {
+        return v;
+    }
+
+    return _mm512_inserti64x4(
+               _mm512_castsi256_si512(HdmiPackAvx512Lookup(_mm512_castsi512_si256(v), Lut)),
+               HdmiPackAvx512Lookup(_mm512_extracti64x4_epi64(v, 1), Lut),
+               1 );
+}
+
+
+static __forceinline VOID
+HdmiPackAvx512Interleave3(
+    IN  __m512i     A,
+    IN  __m512i     B,
+    IN  __m512i     C,
+    OUT __m512i    *Out
+    )
+{
+    ULONG   k;
+
+    for (k = 0; k < 3; k++) {
+        Out[k] = _mm512_mask_permutexvar_epi16(
+                     _mm512_permutex2var_epi16(A, _mm512_load_si512(HdmiPackAvx512IndexAB[k]), B),
+                     HdmiPackAvx512MaskC[k],
+                     _mm512_load_si512(HdmiPackAvx512IndexC[k]),
+                     C );
+    }
+}
+
+
+VOID
+HdmiPackRowRgb48Avx512(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    __m512i     out[3];
+    PUCHAR      dest;
+    ULONG       x;
+
+    for (x = First; x + 32 <= Width; x += 32) {
+
+        HdmiPackAvx512Interleave3( _mm512_slli_epi16(HdmiPackAvx512Load(Plane0 + x, Lut), 4),
+                                   _mm512_slli_epi16(HdmiPackAvx512Load(Plane1 + x, Lut), 4),
+                                   _mm512_slli_epi16(HdmiPackAvx512Load(Plane2 + x, Lut), 4),
+                                   out );
+
+        dest = Dest + (SIZE_T) x * 6;
+
+        _mm512_storeu_si512(dest, out[0]);
+        _mm512_storeu_si512(dest + 64, out[1]);
+        _mm512_storeu_si512(dest + 128, out[2]);
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb48(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+
+VOID
+HdmiPackRowRgb36Avx512(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+/*++
+Routine Description:
+
+    Each interleaved vector becomes 48 bytes, stored with a mask, so
+    nothing past the step is written.
+
+--*/
+{
+    const __m512i   compact = _mm512_load_si512(HdmiPackAvx512Compact24);
+    const __m512i   gather = _mm512_load_si512(HdmiPackAvx512Gather24);
+    const __m512i   low = _mm512_set1_epi32(0x000FFF);
+    const __m512i   high = _mm512_set1_epi32(0xFFF000);
+    __m512i         out[3];
+    __m512i         v;
+    PUCHAR          dest;
+    ULONG           x;
+    ULONG           k;
+
+    for (x = First; x + 32 <= Width; x += 32) {
+
+        HdmiPackAvx512Interleave3( HdmiPackAvx512Load(Plane0 + x, Lut),
+                                   HdmiPackAvx512Load(Plane1 + x, Lut),
+                                   HdmiPackAvx512Load(Plane2 + x, Lut),
+                                   out );
+
+        dest = Dest + (SIZE_T) (x / 2) * 9;
+
+        for (k = 0; k < 3; k++) {
+
+            v = _mm512_or_si512( _mm512_and_si512(out[k], low),
+                                 _mm512_and_si512(_mm512_srli_epi32(out[k], 4), high) );
+
+            v = _mm512_permutexvar_epi32(gather, _mm512_shuffle_epi8(v, compact));
+
+            _mm512_mask_storeu_epi32(dest + 48 * k, 0x0FFF, v);
+        }
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb36(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+
+VOID
+HdmiPackRowRgb30Avx512(
+    IN  const USHORT   *Plane0,
+    IN  const USHORT   *Plane1,
+    IN  const USHORT   *Plane2,
+    OUT PUCHAR          Dest,
+    IN  ULONG           First,
+    IN  ULONG           Width,
+    IN  const USHORT   *Lut
+    )
+{
+    __m512i     a;
+    __m512i     b;
+    __m512i     c;
+    PUCHAR      dest;
+    ULONG       x;
+
+    for (x = First; x + 32 <= Width; x += 32) {
+
+        a = _mm512_srli_epi16(HdmiPackAvx512Load(Plane0 + x, Lut), 2);
+        b = _mm512_srli_epi16(HdmiPackAvx512Load(Plane1 + x, Lut), 2);
+        c = _mm512_srli_epi16(HdmiPackAvx512Load(Plane2 + x, Lut), 2);
+
+        dest = Dest + (SIZE_T) x * 4;
+
+        _mm512_storeu_si512(dest,
+            _mm512_or_si512(
+                _mm512_or_si512(
+                    _mm512_cvtepu16_epi32(_mm512_castsi512_si256(a)),
+                    _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(b)), 10)),
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(c)), 20)));
+
+        _mm512_storeu_si512(dest + 64,
+            _mm512_or_si512(
+                _mm512_or_si512(
+                    _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(a, 1)),
+                    _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(b, 1)), 10)),
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(c, 1)), 20)));
+    }
+
+    _mm256_zeroupper();
+
+    HdmiPackRowRgb30(Plane0, Plane1, Plane2, Dest, x, Width, Lut);
+}
+
+#endif // HDMI_SDK_AVX512
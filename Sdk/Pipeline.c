@@ -0,0 +1,1299 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Pipeline.c
+
+Abstract:
+
+    Reference playout pipeline: a track file is read, decoded and sent
+    to the card by three threads.
+
+        read    unbuffered overlapped reads of the file, ReadDepth in
+                flight, into page-aligned buffers; picture KLVs are
+                picked out and their values copied into free frames
+        decode  the player's callback, from essence into the frame
+        submit  WriteFile, or the completion ring with the frames
+                decoded straight into the slots
+
+    Frames circulate free -> decode -> submit -> free through three
+    single-producer, single-consumer queues. A stage only blocks when
+    its input is empty or its output is at its limit, so a slow stage
+    holds back the ones before it instead of letting frames pile up.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+#include <process.h>
+
+typedef struct _HDMI_PIPE_QUEUE {
+
+    volatile LONG   Head;               // written by the consumer
+    volatile LONG   ConsumerWaiting;
+    UCHAR           Pad0[HDMI_PIPE_LINE - 2 * sizeof(LONG)];
+
+    volatile LONG   Tail;               // written by the producer
+    volatile LONG   ProducerWaiting;
+    UCHAR           Pad1[HDMI_PIPE_LINE - 2 * sizeof(LONG)];
+
+    ULONG           Limit;              // entries at most
+    ULONG           Mask;
+    PVOID          *Entries;
+    HANDLE          NotEmpty;
+    HANDLE          NotFull;
+
+} HDMI_PIPE_QUEUE, *PHDMI_PIPE_QUEUE;
+
+typedef struct _HDMI_PIPE_ENTRY {
+
+    HDMI_PIPE_FRAME Frame;
+    BOOL            Skip;               // not decoded, only to be freed
+
+} HDMI_PIPE_ENTRY, *PHDMI_PIPE_ENTRY;
+
+typedef struct _HDMI_PIPE_READ {
+
+    OVERLAPPED      Overlapped;
+    PUCHAR          Buffer;
+    BOOL            Pending;
+
+} HDMI_PIPE_READ, *PHDMI_PIPE_READ;
+
+//
+// Where the read stage is in the KLV stream of the file.
+//
+typedef struct _HDMI_PIPE_KLV {
+
+    UCHAR           Header[HDMI_PIPE_KLV_HEADER_MAX];
+    ULONG           HeaderLength;       // bytes of Header received
+    ULONG           HeaderNeed;         // bytes of Header there are
+    BOOL            InValue;
+    BOOL            Picture;            // the value goes into Entry
+    ULONGLONG       Remaining;          // bytes of the value still to come
+    PHDMI_PIPE_ENTRY Entry;
+    ULONG           Pictures;
+
+} HDMI_PIPE_KLV, *PHDMI_PIPE_KLV;
+
+//
+// Each stage's counters on a line of their own.
+//
+typedef struct _HDMI_PIPE_STAGE {
+
+    HDMI_PIPE_STAGE_STATS Stats;
+    UCHAR           Pad[HDMI_PIPE_LINE - sizeof(HDMI_PIPE_STAGE_STATS)];
+
+} HDMI_PIPE_STAGE;
+
+struct _HDMI_PIPE {
+
+    HDMI_PIPE_CONFIG Config;
+
+    HANDLE          File;
+    HANDLE          Threads[HdmiPipeStageCount];
+    HANDLE          Done;
+
+    volatile LONG   Stopping;
+    volatile LONG   Status;
+    volatile LONGLONG Errors;
+    volatile LONGLONG Dropped;
+    LONGLONG        TimestampFrequency;
+
+    ULONG           EntryCount;
+    PHDMI_PIPE_ENTRY Entries;
+
+    PUCHAR          ReadBuffer;
+    HDMI_PIPE_READ  Reads[HDMI_PIPE_MAX_READS];
+    ULONGLONG       ReadOffset;
+    HDMI_PIPE_KLV   Klv;
+
+    HDMI_PIPE_QUEUE FreeQueue;
+    HDMI_PIPE_QUEUE DecodeQueue;
+    HDMI_PIPE_QUEUE SubmitQueue;
+
+    HDMI_PIPE_STAGE Stage[HdmiPipeStageCount];
+};
+
+//
+// Passed down the queues after the last picture.
+//
+static HDMI_PIPE_ENTRY HdmiPipeEnd;
+
+//
+// A generic container picture item (SMPTE 379M), such as a frame-wrapped
+// JPEG 2000 picture of a DCP track file. Byte 7 is the registry version
+// and is not compared; bytes 13-15 name the element within the item.
+//
+static const UCHAR HdmiPipePictureKey[13] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x02, 0x01, 0x01,
+    0x0D, 0x01, 0x03, 0x01, 0x15
+};
+
+
+static __forceinline LONGLONG
+HdmiPipeNow(
+    VOID
+    )
+{
+    LARGE_INTEGER   now;
+
+    QueryPerformanceCounter(&now);
+
+    return now.QuadPart;
+}
+
+
+static DWORD
+HdmiQueueInitialize(
+    OUT PHDMI_PIPE_QUEUE    Queue,
+    IN  ULONG               Limit
+    )
+{
+    ULONG   size = 1;
+
+    while (size < Limit) {
+        size <<= 1;
+    }
+
+    Queue->Limit = Limit;
+    Queue->Mask = size - 1;
+    Queue->Entries = (PVOID *) HeapAlloc(GetProcessHeap(), 0, size * sizeof(PVOID));
+    Queue->NotEmpty = CreateEvent(NULL, FALSE, FALSE, NULL);
+    Queue->NotFull = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (Queue->Entries == NULL ||
+        Queue->NotEmpty == NULL ||
+        Queue->NotFull == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+static VOID
+HdmiQueueFree(
+    IN PHDMI_PIPE_QUEUE     Queue
+    )
+{
+    if (Queue->Entries != NULL) {
+        HeapFree(GetProcessHeap(), 0, Queue->Entries);
+    }
+
+    if (Queue->NotEmpty != NULL) {
+        CloseHandle(Queue->NotEmpty);
+    }
+
+    if (Queue->NotFull != NULL) {
+        CloseHandle(Queue->NotFull);
+    }
+}
+
+
+static BOOL
+HdmiQueueTryPush(
+    IN PHDMI_PIPE_QUEUE     Queue,
+    IN PVOID                Item
+    )
+/*++
+Routine Description:
+
+    Producer side. The interlocked store of Tail publishes the entry and
+    orders it before the read of ConsumerWaiting; the consumer does the
+    mirror image, so one of the two always sees the other.
+
+--*/
+{
+    LONG    tail = Queue->Tail;
+
+    if ((ULONG) (tail - Queue->Head) >= Queue->Limit) {
+        return FALSE;
+    }
+
+    Queue->Entries[tail & Queue->Mask] = Item;
+
+    InterlockedExchange(&Queue->Tail, tail + 1);
+
+    if (Queue->ConsumerWaiting) {
+        SetEvent(Queue->NotEmpty);
+    }
+
+    return TRUE;
+}
+
+
+static PVOID
+HdmiQueueTryPop(
+    IN PHDMI_PIPE_QUEUE     Queue
+    )
+{
+    LONG    head = Queue->Head;
+    PVOID   item;
+
+    if (head == Queue->Tail) {
+        return NULL;
+    }
+
+    item = Queue->Entries[head & Queue->Mask];
+
+    InterlockedExchange(&Queue->Head, head + 1);
+
+    if (Queue->ProducerWaiting) {
+        SetEvent(Queue->NotFull);
+    }
+
+    return item;
+}
+
+
+static BOOL
+HdmiQueuePush(
+    IN     PHDMI_PIPE           Pipe,
+    IN     PHDMI_PIPE_QUEUE     Queue,
+    IN     PVOID                Item,
+    IN OUT PLONGLONG            WaitTicks
+    )
+/*++
+Routine Description:
+
+    Pushes Item, waiting for room if the queue is at its limit. The
+    wait is added to WaitTicks. Returns FALSE if the pipeline stops.
+
+--*/
+{
+    LONGLONG    start;
+    BOOL        pushed;
+
+    if (HdmiQueueTryPush(Queue, Item)) {
+        return TRUE;
+    }
+
+    start = HdmiPipeNow();
+
+    for (;;) {
+
+        InterlockedExchange(&Queue->ProducerWaiting, 1);
+
+        if (Pipe->Stopping) {
+            pushed = FALSE;
+            break;
+        }
+
+        if (HdmiQueueTryPush(Queue, Item)) {
+            pushed = TRUE;
+            break;
+        }
+
+        WaitForSingleObject(Queue->NotFull, INFINITE);
+    }
+
+    Queue->ProducerWaiting = 0;
+
+    *WaitTicks += HdmiPipeNow() - start;
+
+    return pushed;
+}
+
+
+static PVOID
+HdmiQueuePop(
+    IN     PHDMI_PIPE           Pipe,
+    IN     PHDMI_PIPE_QUEUE     Queue,
+    IN OUT PLONGLONG            WaitTicks
+    )
+/*++
+Routine Description:
+
+    Pops an item, waiting for one if the queue is empty. The wait is
+    added to WaitTicks. Returns NULL if the pipeline stops.
+
+--*/
+{
+    LONGLONG    start;
+    PVOID       item;
+
+    item = HdmiQueueTryPop(Queue);
+
+    if (item != NULL) {
+        return item;
+    }
+
+    start = HdmiPipeNow();
+
+    for (;;) {
+
+        InterlockedExchange(&Queue->ConsumerWaiting, 1);
+
+        if (Pipe->Stopping) {
+            item = NULL;
+            break;
+        }
+
+        item = HdmiQueueTryPop(Queue);
+
+        if (item != NULL) {
+            break;
+        }
+
+        WaitForSingleObject(Queue->NotEmpty, INFINITE);
+    }
+
+    Queue->ConsumerWaiting = 0;
+
+    *WaitTicks += HdmiPipeNow() - start;
+
+    return item;
+}
+
+
+static VOID
+HdmiPipeStop(
+    IN PHDMI_PIPE   Pipe,
+    IN DWORD        Error
+    )
+/*++
+Routine Description:
+
+    Stops all stages. Error, if not ERROR_SUCCESS and the first one, is
+    what HdmiSdkPipeWait returns.
+
+--*/
+{
+    if (Error != ERROR_SUCCESS) {
+        InterlockedCompareExchange(&Pipe->Status, (LONG) Error, ERROR_SUCCESS);
+    }
+
+    InterlockedExchange(&Pipe->Stopping, TRUE);
+
+    SetEvent(Pipe->FreeQueue.NotEmpty);
+    SetEvent(Pipe->FreeQueue.NotFull);
+    SetEvent(Pipe->DecodeQueue.NotEmpty);
+    SetEvent(Pipe->DecodeQueue.NotFull);
+    SetEvent(Pipe->SubmitQueue.NotEmpty);
+    SetEvent(Pipe->SubmitQueue.NotFull);
+
+    if (Pipe->File != INVALID_HANDLE_VALUE) {
+        CancelIoEx(Pipe->File, NULL);
+    }
+
+    SetEvent(Pipe->Done);
+}
+
+
+static DWORD
+HdmiPipeIssueRead(
+    IN PHDMI_PIPE       Pipe,
+    IN PHDMI_PIPE_READ  Read
+    )
+/*++
+Routine Description:
+
+    Starts the read of the next ReadSize bytes of the file into Read.
+    A read at or past the end of the file is not pending and yields no
+    bytes.
+
+--*/
+{
+    DWORD   error;
+
+    Read->Overlapped.Offset = (DWORD) Pipe->ReadOffset;
+    Read->Overlapped.OffsetHigh = (DWORD) (Pipe->ReadOffset >> 32);
+    Read->Pending = FALSE;
+
+    Pipe->ReadOffset += Pipe->Config.ReadSize;
+
+    if (!ReadFile( Pipe->File,
+                   Read->Buffer,
+                   Pipe->Config.ReadSize,
+                   NULL,
+                   &Read->Overlapped )) {
+
+        error = GetLastError();
+
+        if (error == ERROR_HANDLE_EOF) {
+            return ERROR_SUCCESS;
+        }
+
+        if (error != ERROR_IO_PENDING) {
+            return error;
+        }
+    }
+
+    Read->Pending = TRUE;
+
+    return ERROR_SUCCESS;
+}
+
+
+static DWORD
+HdmiPipeCompleteRead(
+    IN  PHDMI_PIPE      Pipe,
+    IN  PHDMI_PIPE_READ Read,
+    OUT PULONG          Bytes
+    )
+{
+    DWORD   error;
+
+    *Bytes = 0;
+
+    if (!Read->Pending) {
+        return ERROR_SUCCESS;
+    }
+
+    Read->Pending = FALSE;
+
+    if (!GetOverlappedResult(Pipe->File, &Read->Overlapped, Bytes, TRUE)) {
+
+        error = GetLastError();
+        *Bytes = 0;
+
+        if (error != ERROR_HANDLE_EOF) {
+            return error;
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+static BOOL
+HdmiPipeIsPicture(
+    IN const UCHAR     *Key
+    )
+{
+    ULONG   i;
+
+    for (i = 0; i < sizeof(HdmiPipePictureKey); i++) {
+        if (i != 7 && Key[i] != HdmiPipePictureKey[i]) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static DWORD
+HdmiPipeParse(
+    IN PHDMI_PIPE       Pipe,
+    IN const UCHAR     *Data,
+    IN ULONG            Length
+    )
+/*++
+Routine Description:
+
+    Runs the next Length bytes of the file through the KLV parser. A
+    KLV is a 16-byte key, a BER length of 1 to 9 bytes and the value;
+    any of them may be split across reads. The values of picture KLVs
+    are copied into free frames and passed to the decode stage, all
+    other KLVs (partitions, metadata, index tables, fill) are skipped.
+
+    Returns ERROR_CANCELLED if the pipeline stops meanwhile.
+
+--*/
+{
+    PHDMI_PIPE_KLV          klv = &Pipe->Klv;
+    PHDMI_PIPE_STAGE_STATS  stats = &Pipe->Stage[HdmiPipeStageRead].Stats;
+    ULONGLONG               length;
+    ULONG                   n;
+    ULONG                   i;
+
+    while (Length > 0) {
+
+        if (!klv->InValue) {
+
+            n = ((klv->HeaderLength < 17) ? 17 : klv->HeaderNeed) - klv->HeaderLength;
+
+            if (n > Length) {
+                n = Length;
+            }
+
+            CopyMemory(klv->Header + klv->HeaderLength, Data, n);
+            klv->HeaderLength += n;
+            Data += n;
+            Length -= n;
+
+            if (klv->HeaderLength < 17) {
+                continue;
+            }
+
+            if (klv->HeaderLength == 17) {
+
+                klv->HeaderNeed = 17;
+
+                if (klv->Header[16] & 0x80) {
+
+                    if ((klv->Header[16] & 0x7F) > 8) {
+                        return ERROR_INVALID_DATA;
+                    }
+
+                    klv->HeaderNeed += klv->Header[16] & 0x7F;
+                }
+            }
+
+            if (klv->HeaderLength < klv->HeaderNeed) {
+                continue;
+            }
+
+            if (klv->Header[16] & 0x80) {
+                for (length = 0, i = 17; i < klv->HeaderNeed; i++) {
+                    length = (length << 8) | klv->Header[i];
+                }
+            } else {
+                length = klv->Header[16];
+            }
+
+            klv->HeaderLength = 0;
+            klv->InValue = TRUE;
+            klv->Remaining = length;
+            klv->Picture = FALSE;
+
+            if (HdmiPipeIsPicture(klv->Header)) {
+
+                if (length > Pipe->Config.EssenceSize) {
+
+                    InterlockedIncrement64(&Pipe->Errors);
+
+                } else {
+
+                    if (klv->Entry == NULL) {
+                        klv->Entry = (PHDMI_PIPE_ENTRY) HdmiQueuePop( Pipe,
+                                                                      &Pipe->FreeQueue,
+                                                                      &stats->BlockedTicks );
+                        if (klv->Entry == NULL) {
+                            return ERROR_CANCELLED;
+                        }
+                    }
+
+                    klv->Entry->Frame.EssenceLength = 0;
+                    klv->Picture = TRUE;
+                }
+            }
+        }
+
+        n = (klv->Remaining < Length) ? (ULONG) klv->Remaining : Length;
+
+        if (klv->Picture) {
+            CopyMemory( (PUCHAR) klv->Entry->Frame.Essence + klv->Entry->Frame.EssenceLength,
+                        Data,
+                        n );
+            klv->Entry->Frame.EssenceLength += n;
+        }
+
+        Data += n;
+        Length -= n;
+        klv->Remaining -= n;
+
+        if (klv->Remaining == 0) {
+
+            klv->InValue = FALSE;
+
+            if (klv->Picture) {
+
+                klv->Entry->Frame.Index = klv->Pictures++;
+                klv->Entry->Skip = FALSE;
+
+                if (!HdmiQueuePush( Pipe,
+                                    &Pipe->DecodeQueue,
+                                    klv->Entry,
+                                    &stats->BlockedTicks )) {
+                    return ERROR_CANCELLED;
+                }
+
+                klv->Entry = NULL;
+                stats->Frames++;
+            }
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+static unsigned __stdcall
+HdmiPipeReadThread(
+    IN PVOID    Context
+    )
+/*++
+Routine Description:
+
+    Keeps ReadDepth reads in flight and parses them in file order. Time
+    waiting for the disk counts as starved, time waiting for a free
+    frame or for room in the decode queue as blocked.
+
+--*/
+{
+    PHDMI_PIPE              pipe = (PHDMI_PIPE) Context;
+    PHDMI_PIPE_STAGE_STATS  stats = &pipe->Stage[HdmiPipeStageRead].Stats;
+    PHDMI_PIPE_READ         read;
+    LONGLONG                start;
+    LONGLONG                blocked;
+    DWORD                   error = ERROR_SUCCESS;
+    ULONG                   bytes;
+    ULONG                   i;
+
+    for (i = 0; i < pipe->Config.ReadDepth && error == ERROR_SUCCESS; i++) {
+        error = HdmiPipeIssueRead(pipe, &pipe->Reads[i]);
+    }
+
+    for (i = 0; error == ERROR_SUCCESS; i = (i + 1) % pipe->Config.ReadDepth) {
+
+        read = &pipe->Reads[i];
+
+        start = HdmiPipeNow();
+
+        error = HdmiPipeCompleteRead(pipe, read, &bytes);
+
+        stats->StarvedTicks += HdmiPipeNow() - start;
+
+        if (error != ERROR_SUCCESS || pipe->Stopping) {
+            break;
+        }
+
+        start = HdmiPipeNow();
+        blocked = stats->BlockedTicks;
+
+        stats->Bytes += bytes;
+
+        error = HdmiPipeParse(pipe, read->Buffer, bytes);
+
+        stats->BusyTicks += HdmiPipeNow() - start - (stats->BlockedTicks - blocked);
+
+        if (error != ERROR_SUCCESS || bytes < pipe->Config.ReadSize) {
+            break;
+        }
+
+        error = HdmiPipeIssueRead(pipe, read);
+    }
+
+    if (error == ERROR_SUCCESS && !pipe->Stopping) {
+
+        //
+        // End of the file. A picture cut short is not passed on.
+        //
+        if (pipe->Klv.Picture && pipe->Klv.InValue) {
+            InterlockedIncrement64(&pipe->Errors);
+        }
+
+        (VOID) HdmiQueuePush(pipe, &pipe->DecodeQueue, &HdmiPipeEnd, &stats->BlockedTicks);
+
+    } else if (error != ERROR_CANCELLED && error != ERROR_OPERATION_ABORTED) {
+
+        HdmiPipeStop(pipe, error);
+    }
+
+    for (i = 0; i < pipe->Config.ReadDepth; i++) {
+        if (pipe->Reads[i].Pending) {
+            CancelIoEx(pipe->File, &pipe->Reads[i].Overlapped);
+            (VOID) HdmiPipeCompleteRead(pipe, &pipe->Reads[i], &bytes);
+        }
+    }
+
+    return 0;
+}
+
+
+static unsigned __stdcall
+HdmiPipeDecodeThread(
+    IN PVOID    Context
+    )
+/*++
+Routine Description:
+
+    Runs the decode callback on each picture. A picture it fails is
+    still passed on, marked to be skipped, since only the submit stage
+    may put frames back on the free queue.
+
+--*/
+{
+    PHDMI_PIPE              pipe = (PHDMI_PIPE) Context;
+    PHDMI_PIPE_STAGE_STATS  stats = &pipe->Stage[HdmiPipeStageDecode].Stats;
+    PHDMI_PIPE_ENTRY        entry;
+    LONGLONG                start;
+    DWORD                   error;
+
+    for (;;) {
+
+        entry = (PHDMI_PIPE_ENTRY) HdmiQueuePop(pipe, &pipe->DecodeQueue, &stats->StarvedTicks);
+
+        if (entry == NULL) {
+            break;
+        }
+
+        if (entry != &HdmiPipeEnd) {
+
+            entry->Frame.FrameLength = 0;
+            entry->Frame.Deadline = 0;
+
+            start = HdmiPipeNow();
+
+            error = pipe->Config.Decode(pipe->Config.Context, &entry->Frame);
+
+            stats->BusyTicks += HdmiPipeNow() - start;
+
+            if (error != ERROR_SUCCESS ||
+                entry->Frame.FrameLength > entry->Frame.FrameSize) {
+
+                InterlockedIncrement64(&pipe->Errors);
+                entry->Skip = TRUE;
+
+            } else {
+
+                if (entry->Frame.FrameLength == 0) {
+                    entry->Frame.FrameLength = entry->Frame.FrameSize;
+                }
+
+                stats->Frames++;
+                stats->Bytes += entry->Frame.EssenceLength;
+            }
+        }
+
+        if (!HdmiQueuePush(pipe, &pipe->SubmitQueue, entry, &stats->BlockedTicks) ||
+            entry == &HdmiPipeEnd) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+static VOID
+HdmiPipeWriteFrames(
+    IN PHDMI_PIPE   Pipe
+    )
+/*++
+Routine Description:
+
+    Submit stage on the WriteFile path. The write returns once the card
+    has the frame, so all of it counts as busy.
+
+--*/
+{
+    PHDMI_PIPE_STAGE_STATS  stats = &Pipe->Stage[HdmiPipeStageSubmit].Stats;
+    PHDMI_PIPE_ENTRY        entry;
+    LONGLONG                start;
+
+    for (;;) {
+
+        entry = (PHDMI_PIPE_ENTRY) HdmiQueuePop(Pipe, &Pipe->SubmitQueue, &stats->StarvedTicks);
+
+        if (entry == NULL) {
+            return;
+        }
+
+        if (entry == &HdmiPipeEnd) {
+            SetEvent(Pipe->Done);
+            return;
+        }
+
+        if (!entry->Skip) {
+
+            start = HdmiPipeNow();
+
+            if (HdmiSdkWriteFrame( Pipe->Config.Device,
+                                   entry->Frame.Frame,
+                                   entry->Frame.FrameLength ) == ERROR_SUCCESS) {
+                stats->Frames++;
+                stats->Bytes += entry->Frame.FrameLength;
+            } else {
+                InterlockedIncrement64(&Pipe->Errors);
+            }
+
+            stats->BusyTicks += HdmiPipeNow() - start;
+        }
+
+        if (!HdmiQueuePush(Pipe, &Pipe->FreeQueue, entry, &stats->BlockedTicks)) {
+            return;
+        }
+    }
+}
+
+
+static VOID
+HdmiPipeRingFrames(
+    IN PHDMI_PIPE   Pipe
+    )
+/*++
+Routine Description:
+
+    Submit stage on the ring. Everything decoded is queued as SQEs at
+    once; then the stage sleeps in HdmiSdkRingEnter, which also starts
+    an idle channel, until a frame has gone to the card and its slot
+    can be decoded into again. That sleep counts as blocked.
+
+    A frame that finds the SQ full waits for the next round. With none
+    of the pipeline's frames in flight nothing would make room, so the
+    pipeline fails with ERROR_BUSY instead.
+
+--*/
+{
+    PHDMI_PIPE_STAGE_STATS  stats = &Pipe->Stage[HdmiPipeStageSubmit].Stats;
+    PHDMI_SDK_RING          ring = Pipe->Config.Ring;
+    PHDMI_PIPE_ENTRY        entry;
+    PHDMI_PIPE_ENTRY        held = NULL;
+    HDMI_RING_SQE           sqe;
+    HDMI_RING_CQE           cqe;
+    LONGLONG                start;
+    ULONG                   inFlight = 0;
+    BOOL                    end = FALSE;
+    DWORD                   error;
+
+    for (;;) {
+
+        while (!end) {
+
+            if (held != NULL) {
+                entry = held;
+                held = NULL;
+            } else if (inFlight == 0) {
+                entry = (PHDMI_PIPE_ENTRY) HdmiQueuePop( Pipe,
+                                                         &Pipe->SubmitQueue,
+                                                         &stats->StarvedTicks );
+                if (entry == NULL) {
+                    return;
+                }
+            } else {
+                entry = (PHDMI_PIPE_ENTRY) HdmiQueueTryPop(&Pipe->SubmitQueue);
+
+                if (entry == NULL) {
+                    break;
+                }
+            }
+
+            if (entry == &HdmiPipeEnd) {
+                end = TRUE;
+                break;
+            }
+
+            if (entry->Skip) {
+                if (!HdmiQueuePush(Pipe, &Pipe->FreeQueue, entry, &stats->BlockedTicks)) {
+                    return;
+                }
+                continue;
+            }
+
+            start = HdmiPipeNow();
+
+            ZeroMemory(&sqe, sizeof(sqe));
+
+            sqe.Slot = entry->Frame.Slot;
+            sqe.Length = entry->Frame.FrameLength;
+            sqe.UserTag = (ULONG_PTR) entry;
+            sqe.Deadline = entry->Frame.Deadline;
+
+            //
+            // There are fewer slots than SQ entries, so only SQEs queued
+            // on the ring by someone else can fill it.
+            //
+            if (!HdmiSdkRingSubmit(ring, &sqe)) {
+
+                stats->BusyTicks += HdmiPipeNow() - start;
+
+                if (inFlight == 0) {
+                    HdmiPipeStop(Pipe, ERROR_BUSY);
+                    return;
+                }
+
+                held = entry;
+                break;
+            }
+
+            inFlight++;
+
+            stats->BusyTicks += HdmiPipeNow() - start;
+        }
+
+        if (inFlight == 0) {
+            SetEvent(Pipe->Done);
+            return;
+        }
+
+        start = HdmiPipeNow();
+
+        error = HdmiSdkRingEnter(ring);
+
+        stats->BlockedTicks += HdmiPipeNow() - start;
+
+        if (error != ERROR_SUCCESS) {
+            HdmiPipeStop(Pipe, error);
+            return;
+        }
+
+        while (HdmiSdkRingReap(ring, &cqe)) {
+
+            entry = (PHDMI_PIPE_ENTRY) (ULONG_PTR) cqe.UserTag;
+            inFlight--;
+
+            if (cqe.Status == HDMI_STATUS_IO_TIMEOUT) {
+                InterlockedIncrement64(&Pipe->Dropped);
+            } else if (cqe.Status < 0) {
+                InterlockedIncrement64(&Pipe->Errors);
+            } else {
+                stats->Frames++;
+                stats->Bytes += cqe.BytesTransferred;
+            }
+
+            if (!HdmiQueuePush(Pipe, &Pipe->FreeQueue, entry, &stats->BlockedTicks)) {
+                return;
+            }
+        }
+    }
+}
+
+
+static unsigned __stdcall
+HdmiPipeSubmitThread(
+    IN PVOID    Context
+    )
+{
+    PHDMI_PIPE  pipe = (PHDMI_PIPE) Context;
+
+    if (pipe->Config.Ring != NULL) {
+        HdmiPipeRingFrames(pipe);
+    } else {
+        HdmiPipeWriteFrames(pipe);
+    }
+
+    return 0;
+}
+
+
+static DWORD
+HdmiPipeAllocate(
+    IN PHDMI_PIPE   Pipe
+    )
+/*++
+Routine Description:
+
+    Allocates the frames and read buffers and puts all frames on the
+    free queue. On the ring the frames are the slots; otherwise there
+    is one per queue entry plus one in the hands of each stage.
+
+--*/
+{
+    PHDMI_PIPE_CONFIG   config = &Pipe->Config;
+    PHDMI_PIPE_ENTRY    entry;
+    DWORD               error;
+    ULONG               i;
+
+    if (config->Ring != NULL) {
+        Pipe->EntryCount = config->Ring->SlotCount;
+    } else {
+        Pipe->EntryCount = config->DecodeDepth + config->SubmitDepth + HdmiPipeStageCount;
+    }
+
+    Pipe->Entries = (PHDMI_PIPE_ENTRY) HeapAlloc( GetProcessHeap(),
+                                                  HEAP_ZERO_MEMORY,
+                                                  Pipe->EntryCount * sizeof(HDMI_PIPE_ENTRY) );
+    if (Pipe->Entries == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    error = HdmiQueueInitialize(&Pipe->FreeQueue, Pipe->EntryCount);
+
+    if (error == ERROR_SUCCESS) {
+        error = HdmiQueueInitialize(&Pipe->DecodeQueue, config->DecodeDepth);
+    }
+
+    if (error == ERROR_SUCCESS) {
+        error = HdmiQueueInitialize(&Pipe->SubmitQueue, config->SubmitDepth);
+    }
+
+    for (i = 0; i < Pipe->EntryCount && error == ERROR_SUCCESS; i++) {
+
+        entry = &Pipe->Entries[i];
+
+        error = HdmiSdkAllocateFrame(config->EssenceSize, 0, &entry->Frame.Essence, NULL);
+
+        if (error != ERROR_SUCCESS) {
+            break;
+        }
+
+        entry->Frame.FrameSize = config->FrameSize;
+
+        if (config->Ring != NULL) {
+            entry->Frame.Frame = config->Ring->Slots[i];
+            entry->Frame.Slot = i;
+        } else {
+            error = HdmiSdkAllocateFrame( config->FrameSize,
+                                          HDMI_FRAME_LARGE_PAGES,
+                                          &entry->Frame.Frame,
+                                          NULL );
+        }
+
+        HdmiQueueTryPush(&Pipe->FreeQueue, entry);
+    }
+
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+
+    Pipe->ReadBuffer = (PUCHAR) VirtualAlloc( NULL,
+                                              (SIZE_T) config->ReadDepth * config->ReadSize,
+                                              MEM_RESERVE | MEM_COMMIT,
+                                              PAGE_READWRITE );
+    if (Pipe->ReadBuffer == NULL) {
+        return GetLastError();
+    }
+
+    for (i = 0; i < config->ReadDepth; i++) {
+
+        Pipe->Reads[i].Buffer = Pipe->ReadBuffer + (SIZE_T) i * config->ReadSize;
+        Pipe->Reads[i].Overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        if (Pipe->Reads[i].Overlapped.hEvent == NULL) {
+            return GetLastError();
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+HdmiSdkPipeCreate(
+    IN  PHDMI_PIPE_CONFIG   Config,
+    OUT PHDMI_PIPE         *Pipe
+    )
+/*++
+Routine Description:
+
+    Opens the track file and starts the pipeline. Zero fields of Config
+    take their defaults.
+
+--*/
+{
+    PHDMI_PIPE          pipe;
+    PHDMI_PIPE_CONFIG   config;
+    LARGE_INTEGER       frequency;
+    DWORD               error;
+    ULONG               i;
+
+    static unsigned (__stdcall * const threads[HdmiPipeStageCount])(PVOID) = {
+        HdmiPipeReadThread,
+        HdmiPipeDecodeThread,
+        HdmiPipeSubmitThread
+    };
+
+    *Pipe = NULL;
+
+    if (Config->TrackFile == NULL || Config->Decode == NULL ||
+        (Config->Ring == NULL && (Config->Device == NULL || Config->FrameSize == 0)) ||
+        (Config->Ring != NULL && Config->FrameSize > Config->Ring->SlotSize) ||
+        Config->ReadDepth > HDMI_PIPE_MAX_READS ||
+        Config->DecodeDepth > HDMI_PIPE_MAX_DEPTH ||
+        Config->SubmitDepth > HDMI_PIPE_MAX_DEPTH) {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    pipe = (PHDMI_PIPE) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*pipe));
+
+    if (pipe == NULL) {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    pipe->Config = *Config;
+    pipe->File = INVALID_HANDLE_VALUE;
+
+    config = &pipe->Config;
+
+    if (config->Ring != NULL && config->FrameSize == 0) {
+        config->FrameSize = config->Ring->SlotSize;
+    }
+
+    if (config->EssenceSize == 0) {
+        config->EssenceSize = HDMI_PIPE_DEFAULT_ESSENCE;
+    }
+
+    if (config->DecodeDepth == 0) {
+        config->DecodeDepth = HDMI_PIPE_DEFAULT_DEPTH;
+    }
+
+    if (config->SubmitDepth == 0) {
+        config->SubmitDepth = HDMI_PIPE_DEFAULT_DEPTH;
+    }
+
+    if (config->ReadDepth == 0) {
+        config->ReadDepth = HDMI_PIPE_DEFAULT_READS;
+    }
+
+    if (config->ReadSize == 0) {
+        config->ReadSize = HDMI_PIPE_DEFAULT_READ_SIZE;
+    }
+
+    //
+    // Unbuffered reads must be whole sectors at sector offsets.
+    //
+    config->ReadSize = (config->ReadSize + HDMI_PIPE_READ_ALIGN - 1) &
+                       ~(HDMI_PIPE_READ_ALIGN - 1);
+
+    QueryPerformanceFrequency(&frequency);
+    pipe->TimestampFrequency = frequency.QuadPart;
+
+    pipe->Done = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (pipe->Done == NULL) {
+        error = GetLastError();
+        goto Error;
+    }
+
+    error = HdmiPipeAllocate(pipe);
+
+    if (error != ERROR_SUCCESS) {
+        goto Error;
+    }
+
+    pipe->File = CreateFileW( Config->TrackFile,
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              NULL,
+                              OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                              NULL );
+    if (pipe->File == INVALID_HANDLE_VALUE) {
+        error = GetLastError();
+        goto Error;
+    }
+
+    config->TrackFile = NULL;
+
+    for (i = 0; i < HdmiPipeStageCount; i++) {
+
+        pipe->Threads[i] = (HANDLE) _beginthreadex(NULL, 0, threads[i], pipe, 0, NULL);
+
+        if (pipe->Threads[i] == NULL) {
+            error = ERROR_NOT_ENOUGH_MEMORY;
+            goto Error;
+        }
+    }
+
+    *Pipe = pipe;
+
+    return ERROR_SUCCESS;
+
+Error:
+
+    HdmiSdkPipeClose(pipe);
+
+    return error;
+}
+
+
+DWORD
+HdmiSdkPipeWait(
+    IN PHDMI_PIPE   Pipe,
+    IN DWORD        Milliseconds
+    )
+/*++
+Routine Description:
+
+    Waits until the whole track file has been sent or the pipeline has
+    stopped on an error. Returns WAIT_TIMEOUT, or the error that stopped
+    it; frames that failed on their own are only counted.
+
+--*/
+{
+    if (WaitForSingleObject(Pipe->Done, Milliseconds) == WAIT_TIMEOUT) {
+        return WAIT_TIMEOUT;
+    }
+
+    return (DWORD) Pipe->Status;
+}
+
+
+VOID
+HdmiSdkPipeGetStats(
+    IN  PHDMI_PIPE          Pipe,
+    OUT PHDMI_PIPE_STATS    Stats
+    )
+/*++
+Routine Description:
+
+    The counters are read without stopping the stages, so while the
+    pipeline runs they are only approximately consistent.
+
+--*/
+{
+    ULONG   i;
+
+    Stats->TimestampFrequency = Pipe->TimestampFrequency;
+    Stats->Errors = Pipe->Errors;
+    Stats->Dropped = Pipe->Dropped;
+
+    for (i = 0; i < HdmiPipeStageCount; i++) {
+        Stats->Stage[i] = Pipe->Stage[i].Stats;
+    }
+}
+
+
+VOID
+HdmiSdkPipeClose(
+    IN PHDMI_PIPE   Pipe
+    )
+/*++
+Routine Description:
+
+    Stops the pipeline if it is still running and frees it. Frames
+    already queued on the ring are still sent; their slots belong to the
+    ring, which the caller closes afterwards.
+
+--*/
+{
+    ULONG   i;
+
+    HdmiPipeStop(Pipe, ERROR_SUCCESS);
+
+    for (i = 0; i < HdmiPipeStageCount; i++) {
+        if (Pipe->Threads[i] != NULL) {
+            WaitForSingleObject(Pipe->Threads[i], INFINITE);
+            CloseHandle(Pipe->Threads[i]);
+        }
+    }
+
+    if (Pipe->File != INVALID_HANDLE_VALUE) {
+        CloseHandle(Pipe->File);
+    }
+
+    for (i = 0; i < HDMI_PIPE_MAX_READS; i++) {
+        if (Pipe->Reads[i].Overlapped.hEvent != NULL) {
+            CloseHandle(Pipe->Reads[i].Overlapped.hEvent);
+        }
+    }
+
+    if (Pipe->ReadBuffer != NULL) {
+        VirtualFree(Pipe->ReadBuffer, 0, MEM_RELEASE);
+    }
+
+    if (Pipe->Entries != NULL) {
+        for (i = 0; i < Pipe->EntryCount; i++) {
+            HdmiSdkFreeFrame(Pipe->Entries[i].Frame.Essence);
+
+            if (Pipe->Config.Ring == NULL) {
+                HdmiSdkFreeFrame(Pipe->Entries[i].Frame.Frame);
+            }
+        }
+
+        HeapFree(GetProcessHeap(), 0, Pipe->Entries);
+    }
+
+    HdmiQueueFree(&Pipe->FreeQueue);
+    HdmiQueueFree(&Pipe->DecodeQueue);
+    HdmiQueueFree(&Pipe->SubmitQueue);
+
+    if (Pipe->Done != NULL) {
+        CloseHandle(Pipe->Done);
+    }
+
+    HeapFree(GetProcessHeap(), 0, Pipe);
+}
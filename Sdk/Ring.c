@@ -0,0 +1,183 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Ring.c
+
+Abstract:
+
+    Player side of the shared submission/completion ring. One thread
+    submits and reaps on a ring; the driver is the other party.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkP.h"
+
+
+static DWORD
+HdmiSdkIoctl(
+    IN  HANDLE  Device,
+    IN  ULONG   IoControlCode,
+    IN  PVOID   Input,
+    IN  ULONG   InputLength,
+    OUT PVOID   Output,
+    IN  ULONG   OutputLength
+    )
+{
+    DWORD   returned;
+
+    if (!DeviceIoControl( Device,
+                          IoControlCode,
+                          Input,
+                          InputLength,
+                          Output,
+                          OutputLength,
+                          &returned,
+                          NULL )) {
+        return GetLastError();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+HdmiSdkRingOpen(
+    IN  HANDLE              Device,
+    IN  PHDMI_RING_SETUP    Setup,
+    OUT PHDMI_SDK_RING      Ring
+    )
+/*++
+Routine Description:
+
+    Sets up the stream's ring and records where its pages are mapped.
+
+--*/
+{
+    HDMI_RING_MAPPING   mapping;
+    DWORD               error;
+    ULONG               i;
+
+    ZeroMemory(Ring, sizeof(HDMI_SDK_RING));
+
+    error = HdmiSdkIoctl( Device,
+                          IOCTL_HDMI_RING_SETUP,
+                          Setup,
+                          sizeof(HDMI_RING_SETUP),
+                          &mapping,
+                          sizeof(HDMI_RING_MAPPING) );
+    if (error != ERROR_SUCCESS) {
+        return error;
+    }
+
+    Ring->Device    = Device;
+    Ring->Ring      = (PHDMI_RING) (ULONG_PTR) mapping.Ring;
+    Ring->SlotCount = Ring->Ring->SlotCount;
+    Ring->SlotSize  = Ring->Ring->SlotSize;
+    Ring->Eplast    = (volatile ULONG *) (ULONG_PTR) mapping.Eplast;
+
+    for (i = 0; i < Ring->SlotCount; i++) {
+        Ring->Slots[i] = (PVOID) (ULONG_PTR) mapping.Slots[i];
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+DWORD
+HdmiSdkRingClose(
+    IN PHDMI_SDK_RING       Ring
+    )
+{
+    DWORD   error;
+
+    error = HdmiSdkIoctl( Ring->Device,
+                          IOCTL_HDMI_RING_TEARDOWN,
+                          NULL, 0, NULL, 0 );
+
+    ZeroMemory(Ring, sizeof(HDMI_SDK_RING));
+
+    return error;
+}
+
+
+BOOL
+HdmiSdkRingSubmit(
+    IN PHDMI_SDK_RING       Ring,
+    IN PHDMI_RING_SQE       Sqe
+    )
+/*++
+Routine Description:
+
+    Queues Sqe. The driver only sees it once SqTail moves, so the entry
+    is written first. Call HdmiSdkRingEnter if the channel may be idle.
+
+--*/
+{
+    PHDMI_RING  ring = Ring->Ring;
+    ULONG       tail = ring->SqTail;
+
+    if (tail - ring->SqHead >= ring->Entries) {
+        return FALSE;
+    }
+
+    ring->Sq[tail & (HDMI_RING_ENTRIES - 1)] = *Sqe;
+
+    MemoryBarrier();
+
+    ring->SqTail = tail + 1;
+
+    return TRUE;
+}
+
+
+BOOL
+HdmiSdkRingReap(
+    IN  PHDMI_SDK_RING      Ring,
+    OUT PHDMI_RING_CQE      Cqe
+    )
+/*++
+Routine Description:
+
+    Takes the oldest CQE off the ring, if there is one.
+
+--*/
+{
+    PHDMI_RING  ring = Ring->Ring;
+    ULONG       head = ring->CqHead;
+
+    if (head == ring->CqTail) {
+        return FALSE;
+    }
+
+    MemoryBarrier();
+
+    *Cqe = ring->Cq[head & (HDMI_RING_ENTRIES - 1)];
+
+    MemoryBarrier();
+
+    ring->CqHead = head + 1;
+
+    return TRUE;
+}
+
+
+DWORD
+HdmiSdkRingEnter(
+    IN PHDMI_SDK_RING       Ring
+    )
+{
+    return HdmiSdkIoctl( Ring->Device,
+                         IOCTL_HDMI_RING_ENTER,
+                         NULL, 0, NULL, 0 );
+}
@@ -0,0 +1,83 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    HdmiSdkTest.h
+
+Abstract:
+
+    Declarations shared by the SDK tests. The tests need no card; they
+    link the SDK library and call the private kernels directly where the
+    public functions would hide a level or a tail.
+
+Environment:
+
+    User mode
+
+--*/
+
+#if !defined(_HDMI_SDK_TEST_H_)
+#define _HDMI_SDK_TEST_H_
+
+#include "..\HdmiSdkP.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+//
+// A test returns the number of checks that failed; HdmiTestFail prints
+// what went wrong and counts it.
+//
+typedef ULONG
+HDMI_TEST(
+    VOID
+    );
+
+typedef HDMI_TEST *PHDMI_TEST;
+
+VOID
+HdmiTestFail(
+    IN PCSTR    Format,
+    ...
+    );
+
+ULONG
+HdmiTestFailures(
+    VOID
+    );
+
+//
+// Deterministic, so that a failure can be reproduced.
+//
+VOID
+HdmiTestSeed(
+    IN ULONG    Seed
+    );
+
+ULONG
+HdmiTestRandom(
+    VOID
+    );
+
+//
+// TestFrame.c
+//
+HDMI_TEST HdmiTestFrame;
+
+//
+// TestPack.c
+//
+HDMI_TEST HdmiTestPack;
+
+//
+// TestPipeline.c
+//
+HDMI_TEST HdmiTestPipeline;
+
+#endif // _HDMI_SDK_TEST_H_
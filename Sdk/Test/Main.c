@@ -0,0 +1,141 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Main.c
+
+Abstract:
+
+    Runs the SDK tests, all of them or those named on the command line,
+    and exits with the number of failed checks.
+
+        HdmiSdkTest [pack] [frame] [pipeline] ...
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkTest.h"
+
+static const struct {
+    PCSTR       Name;
+    PHDMI_TEST  Run;
+} HdmiTests[] = {
+    { "pack",       HdmiTestPack },
+    { "frame",      HdmiTestFrame },
+    { "pipeline",   HdmiTestPipeline },
+};
+
+static ULONG    HdmiTestFailCount;
+static ULONG    HdmiTestState;
+
+
+VOID
+HdmiTestFail(
+    IN PCSTR    Format,
+    ...
+    )
+{
+    va_list args;
+
+    //
+    // The first few are enough to go on; a broken kernel would otherwise
+    // print one line per byte.
+    //
+    if (HdmiTestFailCount++ < 20) {
+
+        va_start(args, Format);
+        printf("    FAIL: ");
+        vprintf(Format, args);
+        printf("\n");
+        va_end(args);
+    }
+}
+
+
+ULONG
+HdmiTestFailures(
+    VOID
+    )
+{
+    return HdmiTestFailCount;
+}
+
+
+VOID
+HdmiTestSeed(
+    IN ULONG    Seed
+    )
+{
+    HdmiTestState = (Seed != 0) ? Seed : 1;
+}
+
+
+ULONG
+HdmiTestRandom(
+    VOID
+    )
+/*++
+Routine Description:
+
+    xorshift32.
+
+--*/
+{
+    HdmiTestState ^= HdmiTestState << 13;
+    HdmiTestState ^= HdmiTestState >> 17;
+    HdmiTestState ^= HdmiTestState << 5;
+
+    return HdmiTestState;
+}
+
+
+int __cdecl
+main(
+    IN int      argc,
+    IN char    *argv[]
+    )
+{
+    ULONG   failed;
+    ULONG   total = 0;
+    ULONG   i;
+    int     arg;
+    BOOL    run;
+
+    for (i = 0; i < ARRAYSIZE(HdmiTests); i++) {
+
+        run = (argc < 2);
+
+        for (arg = 1; arg < argc; arg++) {
+            if (_stricmp(argv[arg], HdmiTests[i].Name) == 0) {
+                run = TRUE;
+            }
+        }
+
+        if (!run) {
+            continue;
+        }
+
+        HdmiTestFailCount = 0;
+        HdmiTestSeed(0x1D4A5C07);
+
+        printf("%s\n", HdmiTests[i].Name);
+
+        failed = HdmiTests[i].Run();
+
+        printf("%s: %s (%u failed)\n",
+               HdmiTests[i].Name, failed ? "FAILED" : "passed", failed);
+
+        total += failed;
+    }
+
+    return (int) total;
+}
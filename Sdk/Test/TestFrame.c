@@ -0,0 +1,253 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestFrame.c
+
+Abstract:
+
+    Checks HdmiSdkFillFrame and HdmiSdkCopyFrame byte for byte. Lengths
+    sit on either side of HDMI_FRAME_STREAM_MIN, where the caller stops
+    doing it all with ordinary stores, and of the multiples of
+    HDMI_FRAME_MIN_CHUNK and HDMI_FRAME_CHUNK_ALIGN where the frame is
+    cut into chunks for the thread pool. Every length is run with one
+    thread, with several, and with more than HDMI_FRAME_MAX_THREADS, and
+    at destination offsets that leave the chunks unaligned, which is
+    where a fill that restarts its pattern at each chunk goes wrong. The
+    bytes around the destination must come back untouched.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkTest.h"
+
+#define TEST_FRAME_GUARD        64      // bytes checked on either side of a frame
+#define TEST_FRAME_GUARD_BYTE   0xA5
+#define TEST_FRAME_MAX_OFFSET   15
+
+//
+// 0 is the default of one thread per processor.
+//
+static const ULONG TestFrameThreads[] = {
+    1, 2, 3, HDMI_FRAME_MAX_THREADS, 64, 0
+};
+
+static const ULONG TestFrameOffsets[] = {
+    0, 1, 4, 7, TEST_FRAME_MAX_OFFSET
+};
+
+//
+// Sizes on their own, then relative to the stream threshold and to
+// chunk multiples: exactly, a byte either side and a page either side.
+//
+static const SIZE_T TestFrameSmallLengths[] = {
+    0, 1, 3, 15, 16, 17, 63, 64, 65, 4095, 4096, 4097
+};
+
+static const SIZE_T TestFrameBases[] = {
+    HDMI_FRAME_STREAM_MIN,
+    HDMI_FRAME_MIN_CHUNK * 2,
+    HDMI_FRAME_MIN_CHUNK * 3,
+    HDMI_FRAME_MIN_CHUNK * 2 * HDMI_FRAME_MAX_THREADS,
+    1920 * 1080 * 6                     // an RGB48 1080p frame
+};
+
+static const LONG TestFrameDeltas[] = {
+    -HDMI_FRAME_CHUNK_ALIGN, -1, 0, 1, HDMI_FRAME_CHUNK_ALIGN
+};
+
+
+static BOOL
+TestFrameGuardIntact(
+    IN const UCHAR     *Guard,
+    IN SIZE_T           Length
+    )
+{
+    SIZE_T i;
+
+    for (i = 0; i < Length; i++) {
+        if (Guard[i] != TEST_FRAME_GUARD_BYTE) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+TestFrameFill(
+    IN PUCHAR           Buffer,
+    IN SIZE_T           Length,
+    IN ULONG            Offset,
+    IN ULONG            Threads,
+    IN ULONG            Pattern
+    )
+{
+    PUCHAR  dest = Buffer + TEST_FRAME_GUARD + Offset;
+    SIZE_T  i;
+
+    memset(Buffer, TEST_FRAME_GUARD_BYTE, Length + 2 * TEST_FRAME_GUARD + Offset);
+
+    HdmiSdkFillFrame(dest, Length, Pattern, Threads);
+
+    for (i = 0; i < Length; i++) {
+        if (dest[i] != (UCHAR) (Pattern >> (8 * (i & 3)))) {
+            HdmiTestFail("fill %u bytes, offset %u, %u threads: byte %u is %02x, not %02x",
+                         (ULONG) Length, Offset, Threads, (ULONG) i, dest[i],
+                         (UCHAR) (Pattern >> (8 * (i & 3))));
+            return;
+        }
+    }
+
+    if (!TestFrameGuardIntact(Buffer, TEST_FRAME_GUARD + Offset) ||
+        !TestFrameGuardIntact(dest + Length, TEST_FRAME_GUARD)) {
+        HdmiTestFail("fill %u bytes, offset %u, %u threads: wrote outside the frame",
+                     (ULONG) Length, Offset, Threads);
+    }
+}
+
+
+static VOID
+TestFrameCopy(
+    IN PUCHAR           Buffer,
+    IN const UCHAR     *Source,
+    IN SIZE_T           Length,
+    IN ULONG            Offset,
+    IN ULONG            Threads
+    )
+{
+    PUCHAR  dest = Buffer + TEST_FRAME_GUARD + Offset;
+    SIZE_T  i;
+
+    memset(Buffer, TEST_FRAME_GUARD_BYTE, Length + 2 * TEST_FRAME_GUARD + Offset);
+
+    HdmiSdkCopyFrame(dest, Source, Length, Threads);
+
+    if (memcmp(dest, Source, Length) != 0) {
+
+        for (i = 0; dest[i] == Source[i]; i++) {
+            ;
+        }
+
+        HdmiTestFail("copy %u bytes, offset %u, source offset %u, %u threads: "
+                     "byte %u is %02x, not %02x",
+                     (ULONG) Length, Offset, (ULONG) ((ULONG_PTR) Source & 15), Threads,
+                     (ULONG) i, dest[i], Source[i]);
+        return;
+    }
+
+    if (!TestFrameGuardIntact(Buffer, TEST_FRAME_GUARD + Offset) ||
+        !TestFrameGuardIntact(dest + Length, TEST_FRAME_GUARD)) {
+        HdmiTestFail("copy %u bytes, offset %u, %u threads: wrote outside the frame",
+                     (ULONG) Length, Offset, Threads);
+    }
+}
+
+
+static VOID
+TestFrameLength(
+    IN PUCHAR           Buffer,
+    IN const UCHAR     *Source,
+    IN SIZE_T           Length
+    )
+{
+    ULONG   pattern;
+    ULONG   o;
+    ULONG   t;
+
+    for (t = 0; t < ARRAYSIZE(TestFrameThreads); t++) {
+        for (o = 0; o < ARRAYSIZE(TestFrameOffsets); o++) {
+
+            //
+            // No two bytes alike, so a pattern out of phase shows.
+            //
+            pattern = (HdmiTestRandom() & 0x3F3F3F3F) | 0xC0804000;
+
+            TestFrameFill(Buffer, Length, TestFrameOffsets[o],
+                          TestFrameThreads[t], pattern);
+
+            //
+            // The source is misaligned differently from the destination,
+            // so the copy cannot get away with aligned loads.
+            //
+            TestFrameCopy(Buffer, Source + (TestFrameOffsets[o] * 5 + 3) % 16,
+                          Length, TestFrameOffsets[o], TestFrameThreads[t]);
+        }
+    }
+}
+
+
+ULONG
+HdmiTestFrame(
+    VOID
+    )
+{
+    PUCHAR      buffer = NULL;
+    PUCHAR      source = NULL;
+    SIZE_T      maxLength = 0;
+    SIZE_T      bufferSize;
+    BOOL        largePages;
+    DWORD       error;
+    ULONG       b;
+    ULONG       d;
+    ULONG       i;
+
+    for (b = 0; b < ARRAYSIZE(TestFrameBases); b++) {
+        if (TestFrameBases[b] + HDMI_FRAME_CHUNK_ALIGN > maxLength) {
+            maxLength = TestFrameBases[b] + HDMI_FRAME_CHUNK_ALIGN;
+        }
+    }
+
+    bufferSize = maxLength + 2 * TEST_FRAME_GUARD + TEST_FRAME_MAX_OFFSET;
+
+    error = HdmiSdkAllocateFrame(bufferSize, 0, (PVOID *) &buffer, &largePages);
+
+    if (error != ERROR_SUCCESS) {
+        HdmiTestFail("HdmiSdkAllocateFrame: error %u", error);
+        return HdmiTestFailures();
+    }
+
+    if (((ULONG_PTR) buffer & (HDMI_FRAME_CHUNK_ALIGN - 1)) != 0 || largePages) {
+        HdmiTestFail("HdmiSdkAllocateFrame: %p is not a page-aligned small-page buffer",
+                     buffer);
+    }
+
+    source = (PUCHAR) malloc(maxLength + 16);
+
+    if (source == NULL) {
+        HdmiTestFail("out of memory");
+        goto Done;
+    }
+
+    for (i = 0; i < maxLength + 16; i++) {
+        source[i] = (UCHAR) HdmiTestRandom();
+    }
+
+    for (i = 0; i < ARRAYSIZE(TestFrameSmallLengths); i++) {
+        TestFrameLength(buffer, source, TestFrameSmallLengths[i]);
+    }
+
+    for (b = 0; b < ARRAYSIZE(TestFrameBases); b++) {
+        for (d = 0; d < ARRAYSIZE(TestFrameDeltas); d++) {
+            TestFrameLength(buffer, source,
+                            TestFrameBases[b] + TestFrameDeltas[d]);
+        }
+    }
+
+Done:
+
+    HdmiSdkFreeFrame(buffer);
+    free(source);
+
+    return HdmiTestFailures();
+}
@@ -0,0 +1,401 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestPack.c
+
+Abstract:
+
+    Checks every row kernel the processor can run, scalar, AVX2 and
+    AVX-512, for every pixel format, with and without a LUT, against a
+    reference written here from the layouts in HdmiSdk.h. Widths cover
+    every tail length of both vector widths. The bytes around each row
+    are filled with a guard pattern and must come back untouched, which
+    catches a kernel that stores past the row, as the RGB36 AVX2 one
+    does by design before the scalar tail writes those bytes over.
+
+    HdmiSdkPack is then run at each level over several rows with a pitch
+    wider than the row, so that the gap between rows is checked too.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkTest.h"
+
+#define TEST_PACK_GUARD         64      // bytes checked on either side of a row
+#define TEST_PACK_GUARD_BYTE    0xA5
+#define TEST_PACK_MAX_WIDTH     4096
+#define TEST_PACK_ROWS          3
+
+static const PCSTR TestPackFormatName[HdmiPixelFormatCount] = {
+    "Rgb48", "Rgb36", "Rgb30"
+};
+
+static const PCSTR TestPackLevelName[] = {
+    "scalar", "AVX2", "AVX-512"
+};
+
+static const PHDMI_PACK_ROW TestPackRows[][HdmiPixelFormatCount] = {
+    { HdmiPackRowRgb48,       HdmiPackRowRgb36,       HdmiPackRowRgb30 },
+#if defined(HDMI_SDK_AVX2)
+    { HdmiPackRowRgb48Avx2,   HdmiPackRowRgb36Avx2,   HdmiPackRowRgb30Avx2 },
+#endif
+#if defined(HDMI_SDK_AVX512)
+    { HdmiPackRowRgb48Avx512, HdmiPackRowRgb36Avx512, HdmiPackRowRgb30Avx512 },
+#endif
+};
+
+//
+// Every tail of a 16- and a 32-pixel step, and some real raster widths.
+//
+static const ULONG TestPackWideWidths[] = {
+    127, 128, 129, 1918, 1920, 1998, 2048, 3996, 4096
+};
+
+
+static ULONG
+TestPackSample(
+    IN USHORT           Sample,
+    IN const USHORT    *Lut
+    )
+{
+    ULONG s = Sample & 0xFFF;
+
+    return (Lut != NULL) ? (Lut[s] & 0xFFFu) : s;
+}
+
+
+static VOID
+TestPackReference(
+    IN  HDMI_PIXEL_FORMAT   Format,
+    IN  const USHORT       *Plane[3],
+    OUT PUCHAR              Dest,
+    IN  ULONG               Width,
+    IN  const USHORT       *Lut
+    )
+/*++
+Routine Description:
+
+    Packs a row the slow way, straight from the description of the
+    formats: RGB36 as one little-endian bit stream of 12-bit components.
+
+--*/
+{
+    ULONG   x;
+    ULONG   c;
+    ULONG   s;
+    ULONG   v;
+    ULONG   bit;
+    ULONG   b;
+
+    memset(Dest, 0, HdmiSdkPackRowSize(Format, Width));
+
+    for (x = 0; x < Width; x++) {
+
+        v = 0;
+
+        for (c = 0; c < 3; c++) {
+
+            s = TestPackSample(Plane[c][x], Lut);
+
+            switch (Format) {
+
+            case HdmiPixelRgb48:
+                Dest[6 * x + 2 * c]     = (UCHAR) (s << 4);
+                Dest[6 * x + 2 * c + 1] = (UCHAR) (s >> 4);
+                break;
+
+            case HdmiPixelRgb36:
+                for (b = 0; b < 12; b++) {
+                    bit = 12 * (3 * x + c) + b;
+                    Dest[bit / 8] |= (UCHAR) (((s >> b) & 1) << (bit % 8));
+                }
+                break;
+
+            case HdmiPixelRgb30:
+                v |= (s >> 2) << (10 * c);
+                break;
+            }
+        }
+
+        if (Format == HdmiPixelRgb30) {
+            Dest[4 * x]     = (UCHAR) v;
+            Dest[4 * x + 1] = (UCHAR) (v >> 8);
+            Dest[4 * x + 2] = (UCHAR) (v >> 16);
+            Dest[4 * x + 3] = (UCHAR) (v >> 24);
+        }
+    }
+}
+
+
+static BOOL
+TestPackGuardIntact(
+    IN const UCHAR *Bytes,
+    IN SIZE_T       Length
+    )
+{
+    SIZE_T i;
+
+    for (i = 0; i < Length; i++) {
+        if (Bytes[i] != TEST_PACK_GUARD_BYTE) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static VOID
+TestPackRow(
+    IN HDMI_SIMD_LEVEL      Level,
+    IN HDMI_PIXEL_FORMAT    Format,
+    IN ULONG                Width,
+    IN ULONG                Misalign,
+    IN const USHORT        *Plane[3],
+    IN const USHORT        *Lut,
+    IN PUCHAR               Expected,
+    IN PUCHAR               Buffer
+    )
+/*++
+Routine Description:
+
+    Runs one kernel on one row at Buffer + TEST_PACK_GUARD + Misalign and
+    compares the row and the guards around it.
+
+--*/
+{
+    PUCHAR  row = Buffer + TEST_PACK_GUARD + Misalign;
+    SIZE_T  rowSize = HdmiSdkPackRowSize(Format, Width);
+    SIZE_T  i;
+
+    memset(Buffer, TEST_PACK_GUARD_BYTE, rowSize + 2 * TEST_PACK_GUARD + Misalign);
+
+    TestPackRows[Level][Format](Plane[0], Plane[1], Plane[2], row, 0, Width, Lut);
+
+    for (i = 0; i < rowSize; i++) {
+        if (row[i] != Expected[i]) {
+            HdmiTestFail("%s %s, width %u, %s LUT, offset %u: byte %u is %02x, not %02x",
+                         TestPackLevelName[Level], TestPackFormatName[Format],
+                         Width, Lut ? "with" : "no", Misalign,
+                         (ULONG) i, row[i], Expected[i]);
+            return;
+        }
+    }
+
+    if (!TestPackGuardIntact(Buffer, TEST_PACK_GUARD + Misalign) ||
+        !TestPackGuardIntact(row + rowSize, TEST_PACK_GUARD)) {
+        HdmiTestFail("%s %s, width %u, %s LUT, offset %u: wrote outside the row",
+                     TestPackLevelName[Level], TestPackFormatName[Format],
+                     Width, Lut ? "with" : "no", Misalign);
+    }
+}
+
+
+static VOID
+TestPackFrame(
+    IN HDMI_SIMD_LEVEL      Level,
+    IN HDMI_PIXEL_FORMAT    Format,
+    IN ULONG                Width,
+    IN const USHORT        *Plane[3],
+    IN PHDMI_PACK_LUT       Lut,
+    IN PUCHAR               Expected,
+    IN PUCHAR               Buffer
+    )
+/*++
+Routine Description:
+
+    Packs TEST_PACK_ROWS rows, each source row the one before shifted by
+    a pixel, through HdmiSdkPack with 5 spare bytes between rows.
+
+--*/
+{
+    HDMI_PACK_PARAMS    params;
+    HDMI_PLANAR_FRAME   source;
+    SIZE_T              rowSize = HdmiSdkPackRowSize(Format, Width);
+    SIZE_T              pitch = rowSize + 5;
+    SIZE_T              size = pitch * (TEST_PACK_ROWS - 1) + rowSize;
+    const USHORT       *rowPlane[3];
+    PUCHAR              row;
+    DWORD               error;
+    ULONG               y;
+    ULONG               c;
+
+    for (c = 0; c < 3; c++) {
+        source.Plane[c] = Plane[c];
+        source.Pitch[c] = sizeof(USHORT);
+    }
+
+    params.Format    = Format;
+    params.Width     = Width;
+    params.Height    = TEST_PACK_ROWS;
+    params.DestPitch = pitch;
+    params.Lut       = Lut;
+
+    memset(Buffer, TEST_PACK_GUARD_BYTE, size + TEST_PACK_GUARD);
+
+    HdmiSdkSetSimdLevel(Level);
+
+    error = HdmiSdkPack(&params, &source, Buffer, size);
+
+    HdmiSdkSetSimdLevel(HdmiSimdAvx512);
+
+    if (error != ERROR_SUCCESS) {
+        HdmiTestFail("HdmiSdkPack %s %s, width %u: error %u",
+                     TestPackLevelName[Level], TestPackFormatName[Format],
+                     Width, error);
+        return;
+    }
+
+    for (y = 0; y < TEST_PACK_ROWS; y++) {
+
+        for (c = 0; c < 3; c++) {
+            rowPlane[c] = Plane[c] + y;
+        }
+
+        TestPackReference(Format, rowPlane, Expected, Width,
+                          Lut ? Lut->Entry : NULL);
+
+        row = Buffer + y * pitch;
+
+        if (memcmp(row, Expected, rowSize) != 0) {
+            HdmiTestFail("HdmiSdkPack %s %s, width %u, %s LUT: row %u differs",
+                         TestPackLevelName[Level], TestPackFormatName[Format],
+                         Width, Lut ? "with" : "no", y);
+        }
+
+        if (!TestPackGuardIntact(row + rowSize,
+                                 (y + 1 < TEST_PACK_ROWS) ? pitch - rowSize
+                                                          : TEST_PACK_GUARD)) {
+            HdmiTestFail("HdmiSdkPack %s %s, width %u, %s LUT: wrote past row %u",
+                         TestPackLevelName[Level], TestPackFormatName[Format],
+                         Width, Lut ? "with" : "no", y);
+        }
+    }
+}
+
+
+ULONG
+HdmiTestPack(
+    VOID
+    )
+{
+    HDMI_SIMD_LEVEL     top = HdmiSdkGetSimdLevel();
+    HDMI_SIMD_LEVEL     level;
+    HDMI_PIXEL_FORMAT   format;
+    PHDMI_PACK_LUT      lut;
+    const USHORT       *plane[3];
+    USHORT             *samples;
+    PUCHAR              expected;
+    PUCHAR              buffer;
+    SIZE_T              bufferSize;
+    ULONG               planeLength = TEST_PACK_MAX_WIDTH + TEST_PACK_ROWS;
+    ULONG               width;
+    ULONG               i;
+    ULONG               w;
+    ULONG               l;
+
+    if ((ULONG) top >= ARRAYSIZE(TestPackRows)) {
+        top = (HDMI_SIMD_LEVEL) (ARRAYSIZE(TestPackRows) - 1);
+    }
+
+    printf("    kernels up to %s\n", TestPackLevelName[top]);
+
+    bufferSize = HdmiSdkPackRowSize(HdmiPixelRgb48, TEST_PACK_MAX_WIDTH) *
+                 TEST_PACK_ROWS + 2 * TEST_PACK_GUARD + 16;
+
+    samples  = (USHORT *) malloc(3 * planeLength * sizeof(USHORT));
+    lut      = (PHDMI_PACK_LUT) malloc(sizeof(HDMI_PACK_LUT));
+    expected = (PUCHAR) malloc(bufferSize);
+    buffer   = (PUCHAR) malloc(bufferSize);
+
+    if (!samples || !lut || !expected || !buffer) {
+        HdmiTestFail("out of memory");
+        goto Done;
+    }
+
+    //
+    // Whole words, so that the kernels must drop the bits above 12 both
+    // of the samples and of the LUT entries.
+    //
+    for (i = 0; i < 3 * planeLength; i++) {
+        samples[i] = (USHORT) HdmiTestRandom();
+    }
+
+    for (i = 0; i < HDMI_PACK_LUT_ENTRIES + 2; i++) {
+        ((PUSHORT) lut)[i] = (USHORT) HdmiTestRandom();
+    }
+
+    for (i = 0; i < 3; i++) {
+        plane[i] = samples + i * planeLength;
+    }
+
+    for (level = HdmiSimdScalar; level <= top; level = (HDMI_SIMD_LEVEL) (level + 1)) {
+        for (format = HdmiPixelRgb48; format < HdmiPixelFormatCount;
+             format = (HDMI_PIXEL_FORMAT) (format + 1)) {
+            for (l = 0; l < 2; l++) {
+
+                for (w = 0; w < 70 + ARRAYSIZE(TestPackWideWidths); w++) {
+
+                    width = (w < 70) ? w + 1 : TestPackWideWidths[w - 70];
+
+                    if (HdmiSdkPackRowSize(format, width) == 0) {
+                        continue;
+                    }
+
+                    TestPackReference(format, plane, expected, width,
+                                      l ? lut->Entry : NULL);
+
+                    TestPackRow(level, format, width, 0, plane,
+                                l ? lut->Entry : NULL, expected, buffer);
+                    TestPackRow(level, format, width, 1 + width % 3, plane,
+                                l ? lut->Entry : NULL, expected, buffer);
+
+                    TestPackFrame(level, format, width, plane,
+                                  l ? lut : NULL, expected, buffer);
+                }
+            }
+        }
+    }
+
+    //
+    // RGB36 takes pixels in pairs.
+    //
+    {
+        HDMI_PACK_PARAMS    params;
+        HDMI_PLANAR_FRAME   source;
+
+        for (i = 0; i < 3; i++) {
+            source.Plane[i] = plane[i];
+            source.Pitch[i] = 0;
+        }
+
+        params.Format    = HdmiPixelRgb36;
+        params.Width     = 1919;
+        params.Height    = 1;
+        params.DestPitch = 0;
+        params.Lut       = NULL;
+
+        if (HdmiSdkPack(&params, &source, buffer, bufferSize) != ERROR_INVALID_PARAMETER) {
+            HdmiTestFail("HdmiSdkPack took an odd RGB36 width");
+        }
+    }
+
+Done:
+
+    free(samples);
+    free(lut);
+    free(expected);
+    free(buffer);
+
+    return HdmiTestFailures();
+}
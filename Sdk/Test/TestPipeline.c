@@ -0,0 +1,748 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestPipeline.c
+
+Abstract:
+
+    Plays a track file written here through the pipeline into a pipe,
+    which stands in for the card: HdmiSdkWriteFrame is a WriteFile, and
+    a thread on the other end reads back what was sent. The file has
+    KLVs whose key, BER length or value are split across reads, every
+    form of BER length, fill and other items to skip, a picture too big
+    for the essence buffers and, in one case, a last picture cut short.
+
+    The decoder checks that it gets the pictures in order and intact,
+    fails some of them, and writes frames of several lengths; what comes
+    out of the pipe must be exactly those frames, in order. Slowing the
+    decoder or the reader of the pipe must hold back the stages before
+    it without letting frames pile up, and closing the pipeline while
+    it runs must stop it.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiSdkTest.h"
+#include <process.h>
+
+#define TEST_PIPE_READ_SIZE     HDMI_PIPE_READ_ALIGN
+#define TEST_PIPE_ESSENCE_SIZE  (4 * TEST_PIPE_READ_SIZE)
+#define TEST_PIPE_FRAME_SIZE    (64 * 1024)
+#define TEST_PIPE_FILE_MAX      (4 * 1024 * 1024)
+#define TEST_PIPE_MAX_PICTURES  64
+#define TEST_PIPE_MORE_PICTURES 40      // of random sizes after the fixed ones
+#define TEST_PIPE_SINK_READ     4096    // also the size asked of the pipe
+#define TEST_PIPE_TIMEOUT_MS    60000
+
+typedef struct _TEST_PIPE_TRACK {
+
+    PUCHAR          Data;
+    ULONG           Length;
+    ULONG           Pictures;
+    ULONG           EssenceLength[TEST_PIPE_MAX_PICTURES];
+    ULONG           LastValue;          // where the last picture's value starts
+
+} TEST_PIPE_TRACK, *PTEST_PIPE_TRACK;
+
+typedef struct _TEST_PIPE_CASE {
+
+    PCSTR           Name;
+    BOOL            CutShort;           // end the file inside the last picture
+    ULONG           DecodeDepth;
+    ULONG           SubmitDepth;
+    ULONG           ReadDepth;
+    ULONG           DecodeDelay;        // ms per picture
+    ULONG           SinkDelay;          // ms per read of the pipe
+    ULONG           CloseAfter;         // pictures, 0 to play to the end
+    ULONG           Blocked;            // stages that must have waited on
+    ULONG           Starved;            // their output, or their input
+
+} TEST_PIPE_CASE, *PTEST_PIPE_CASE;
+
+typedef struct _TEST_PIPE_RUN {
+
+    const TEST_PIPE_CASE   *Case;
+    PTEST_PIPE_TRACK        Track;
+    ULONG                   SubmitDepth;
+
+    //
+    // Decode callback.
+    //
+    ULONG                   NextIndex;
+    ULONG                   OutOfOrder;
+    ULONG                   BadEssence;
+    volatile LONG           Decoded;
+    LONGLONG                DecodedBytes;
+    LONGLONG                MaxOutstanding;
+
+    //
+    // Reader of the pipe.
+    //
+    HANDLE                  SinkRead;
+    PUCHAR                  Sink;
+    SIZE_T                  SinkSize;
+    volatile LONGLONG       SinkBytes;
+
+} TEST_PIPE_RUN, *PTEST_PIPE_RUN;
+
+#define TEST_PIPE_STAGE(s)      (1 << (s))
+
+static const TEST_PIPE_CASE TestPipeCases[] = {
+    //  name            cut    depths    reads  delays  close  blocked / starved
+    { "defaults",       FALSE, 0, 0,     0,     0, 0,   0,     0, 0 },
+    { "one read",       FALSE, 2, 2,     1,     0, 0,   0,     0, 0 },
+    { "slow card",      FALSE, 1, 1,     2,     0, 1,   0,
+      TEST_PIPE_STAGE(HdmiPipeStageRead) | TEST_PIPE_STAGE(HdmiPipeStageDecode), 0 },
+    { "slow decoder",   FALSE, 2, 2,     4,     2, 0,   0,
+      TEST_PIPE_STAGE(HdmiPipeStageRead), TEST_PIPE_STAGE(HdmiPipeStageSubmit) },
+    { "cut short",      TRUE,  0, 0,     0,     0, 0,   0,     0, 0 },
+    { "closed early",   FALSE, 1, 1,     2,     0, 1,   5,     0, 0 },
+};
+
+static const PCSTR TestPipeStageName[HdmiPipeStageCount] = {
+    "read", "decode", "submit"
+};
+
+//
+// Only bytes 7 (the registry version) and 13-15 may differ for the
+// pipeline to take a KLV as a picture.
+//
+static const UCHAR TestPipePictureKey[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x02, 0x01, 0x01,
+    0x0D, 0x01, 0x03, 0x01, 0x15, 0x01, 0x08, 0x01
+};
+
+static const UCHAR TestPipeOtherPictureKey[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x02, 0x01, 0x05,
+    0x0D, 0x01, 0x03, 0x01, 0x15, 0x01, 0x02, 0x01
+};
+
+static const UCHAR TestPipeSoundKey[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x02, 0x01, 0x01,
+    0x0D, 0x01, 0x03, 0x01, 0x16, 0x01, 0x01, 0x01
+};
+
+static const UCHAR TestPipePartitionKey[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x02, 0x05, 0x01, 0x01,
+    0x0D, 0x01, 0x02, 0x01, 0x01, 0x02, 0x04, 0x00
+};
+
+static const UCHAR TestPipeFillKey[16] = {
+    0x06, 0x0E, 0x2B, 0x34, 0x01, 0x01, 0x01, 0x02,
+    0x03, 0x01, 0x02, 0x10, 0x01, 0x00, 0x00, 0x00
+};
+
+
+static __forceinline UCHAR
+TestPipeEssenceByte(
+    IN ULONG    Picture,
+    IN ULONG    Offset
+    )
+{
+    return (UCHAR) (Picture * 37 + Offset + (Offset >> 8) * 11);
+}
+
+
+static __forceinline UCHAR
+TestPipeFrameByte(
+    IN ULONG    Picture,
+    IN ULONG    Offset
+    )
+{
+    return (UCHAR) (Picture * 53 + Offset * 7 + (Offset >> 8));
+}
+
+
+static BOOL
+TestPipeDecodeFails(
+    IN ULONG    Picture
+    )
+/*++
+Routine Description:
+
+    Some pictures the decoder fails, and picture 9 it decodes into a
+    frame longer than FrameSize, which the pipeline must not send.
+
+--*/
+{
+    return (Picture % 7 == 3) || Picture == 9;
+}
+
+
+static ULONG
+TestPipeFrameLength(
+    IN ULONG    Picture
+    )
+{
+    if (Picture == 9) {
+        return TEST_PIPE_FRAME_SIZE + 1;
+    }
+
+    //
+    // 0 asks for FrameSize.
+    //
+    return (Picture % 5 == 4) ? 0 : 1 + (Picture * 7919) % TEST_PIPE_FRAME_SIZE;
+}
+
+
+static VOID
+TestPipeKlv(
+    IN OUT PTEST_PIPE_TRACK Track,
+    IN     const UCHAR     *Key,
+    IN     ULONG            Length,
+    IN     ULONG            Form,           // 0 for a short length, else bytes
+    IN     BOOL             Picture
+    )
+/*++
+Routine Description:
+
+    Appends a KLV. Form is 0 for a short-form BER length, or the number
+    of bytes, 1 to 8, of a long-form one. A picture's value is that of
+    the next picture of the track; anything else is filled with zeros.
+
+--*/
+{
+    PUCHAR  p = Track->Data + Track->Length;
+    ULONG   i;
+
+    CopyMemory(p, Key, 16);
+    p += 16;
+
+    if (Form == 0) {
+        *p++ = (UCHAR) Length;
+    } else {
+        *p++ = (UCHAR) (0x80 | Form);
+
+        for (i = Form; i-- > 0; ) {
+            *p++ = (i < sizeof(ULONG)) ? (UCHAR) (Length >> (8 * i)) : 0;
+        }
+    }
+
+    if (Picture) {
+
+        Track->LastValue = (ULONG) (p - Track->Data);
+
+        if (Length <= TEST_PIPE_ESSENCE_SIZE) {
+
+            for (i = 0; i < Length; i++) {
+                p[i] = TestPipeEssenceByte(Track->Pictures, i);
+            }
+
+            Track->EssenceLength[Track->Pictures++] = Length;
+
+        } else {
+            FillMemory(p, Length, 0x55);
+        }
+
+    } else {
+        ZeroMemory(p, Length);
+    }
+
+    Track->Length = (ULONG) (p - Track->Data) + Length;
+}
+
+
+static VOID
+TestPipePadTo(
+    IN OUT PTEST_PIPE_TRACK Track,
+    IN     ULONG            Offset
+    )
+/*++
+Routine Description:
+
+    Appends a fill item that ends at Offset, at least 17 bytes on.
+
+--*/
+{
+    ULONG   gap = Offset - Track->Length;
+
+    if (gap - 17 < 0x80) {
+        TestPipeKlv(Track, TestPipeFillKey, gap - 17, 0, FALSE);
+    } else {
+        TestPipeKlv(Track, TestPipeFillKey, gap - 20, 3, FALSE);
+    }
+}
+
+
+static VOID
+TestPipeBuildTrack(
+    OUT PTEST_PIPE_TRACK    Track
+    )
+{
+    const ULONG r = TEST_PIPE_READ_SIZE;
+    ULONG       length;
+    ULONG       form;
+    ULONG       i;
+
+    Track->Length = 0;
+    Track->Pictures = 0;
+
+    TestPipeKlv(Track, TestPipePartitionKey, 120, 3, FALSE);
+    TestPipeKlv(Track, TestPipePictureKey, 100, 0, TRUE);
+    TestPipeKlv(Track, TestPipePictureKey, 200, 1, TRUE);
+    TestPipeKlv(Track, TestPipeSoundKey, 300, 2, FALSE);
+
+    //
+    // A key split across reads, a key at the end of a read with the BER
+    // length in the next one, and a long BER length split.
+    //
+    TestPipePadTo(Track, r - 5);
+    TestPipeKlv(Track, TestPipePictureKey, 3000, 2, TRUE);
+
+    TestPipePadTo(Track, 2 * r - 16);
+    TestPipeKlv(Track, TestPipePictureKey, 5000, 8, TRUE);
+
+    TestPipePadTo(Track, 3 * r - 20);
+    TestPipeKlv(Track, TestPipePictureKey, 7000, 8, TRUE);
+
+    //
+    // A value over several reads, one too big to be taken, another
+    // version of the key and an empty picture.
+    //
+    TestPipeKlv(Track, TestPipePictureKey, 3 * r, 4, TRUE);
+    TestPipeKlv(Track, TestPipePictureKey, TEST_PIPE_ESSENCE_SIZE + 1, 3, TRUE);
+    TestPipeKlv(Track, TestPipeOtherPictureKey, 1000, 3, TRUE);
+    TestPipeKlv(Track, TestPipePictureKey, 0, 0, TRUE);
+
+    //
+    // A value that ends with a read.
+    //
+    TestPipePadTo(Track, (Track->Length / r + 2) * r - 19 - 500);
+    TestPipeKlv(Track, TestPipePictureKey, 500, 2, TRUE);
+
+    for (i = 0; i < TEST_PIPE_MORE_PICTURES; i++) {
+
+        while (HdmiTestRandom() % 3 == 0) {
+            TestPipeKlv(Track, TestPipeFillKey, HdmiTestRandom() % 300, 3, FALSE);
+        }
+
+        length = 1 + HdmiTestRandom() % ((i % 8 == 7) ? TEST_PIPE_ESSENCE_SIZE : 20000);
+
+        //
+        // Any long form wide enough for the length, even 1 byte wider
+        // than it need be.
+        //
+        form = (length < 0x80) ? HdmiTestRandom() % 9 :
+               (length < 0x100) ? 1 + HdmiTestRandom() % 8 :
+               (length < 0x10000) ? 2 + HdmiTestRandom() % 7 : 3 + HdmiTestRandom() % 6;
+
+        TestPipeKlv(Track, TestPipePictureKey, length, form, TRUE);
+    }
+
+    TestPipeKlv(Track, TestPipePartitionKey, 120, 3, FALSE);
+}
+
+
+static DWORD
+TestPipeDecode(
+    IN     PVOID            Context,
+    IN OUT PHDMI_PIPE_FRAME Frame
+    )
+{
+    PTEST_PIPE_RUN  run = (PTEST_PIPE_RUN) Context;
+    PUCHAR          frame = (PUCHAR) Frame->Frame;
+    const UCHAR    *essence = (const UCHAR *) Frame->Essence;
+    ULONG           picture = Frame->Index;
+    ULONG           length;
+    LONGLONG        outstanding;
+    ULONG           i;
+
+    if (run->Case->DecodeDelay != 0) {
+        Sleep(run->Case->DecodeDelay);
+    }
+
+    if (picture != run->NextIndex || picture >= run->Track->Pictures) {
+        run->OutOfOrder++;
+    } else if (Frame->EssenceLength != run->Track->EssenceLength[picture]) {
+        run->BadEssence++;
+    } else {
+        for (i = 0; i < Frame->EssenceLength; i++) {
+            if (essence[i] != TestPipeEssenceByte(picture, i)) {
+                run->BadEssence++;
+                break;
+            }
+        }
+    }
+
+    run->NextIndex = picture + 1;
+
+    //
+    // Frames decoded but not yet out of the pipe: the submit queue, the
+    // one being written, up to a pipe buffer of one already sent and the
+    // read the other end has not counted yet.
+    //
+    outstanding = run->DecodedBytes - run->SinkBytes;
+
+    if (outstanding > run->MaxOutstanding) {
+        run->MaxOutstanding = outstanding;
+    }
+
+    InterlockedIncrement(&run->Decoded);
+
+    if (TestPipeDecodeFails(picture) && picture != 9) {
+        return ERROR_INVALID_DATA;
+    }
+
+    length = TestPipeFrameLength(picture);
+
+    for (i = 0; i < Frame->FrameSize && (length == 0 || i < length); i++) {
+        frame[i] = TestPipeFrameByte(picture, i);
+    }
+
+    Frame->FrameLength = length;
+
+    if (!TestPipeDecodeFails(picture)) {
+        run->DecodedBytes += (length != 0) ? length : Frame->FrameSize;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+
+static unsigned __stdcall
+TestPipeSinkThread(
+    IN PVOID    Context
+    )
+/*++
+Routine Description:
+
+    The card: reads the pipe until the write end is closed.
+
+--*/
+{
+    PTEST_PIPE_RUN  run = (PTEST_PIPE_RUN) Context;
+    UCHAR           buffer[TEST_PIPE_SINK_READ];
+    LONGLONG        offset = 0;
+    DWORD           bytes;
+
+    while (ReadFile(run->SinkRead, buffer, sizeof(buffer), &bytes, NULL) && bytes != 0) {
+
+        if (offset + bytes <= (LONGLONG) run->SinkSize) {
+            CopyMemory(run->Sink + offset, buffer, bytes);
+        }
+
+        offset += bytes;
+        InterlockedExchangeAdd64(&run->SinkBytes, bytes);
+
+        if (run->Case->SinkDelay != 0) {
+            Sleep(run->Case->SinkDelay);
+        }
+    }
+
+    return 0;
+}
+
+
+static VOID
+TestPipeCheckSink(
+    IN PTEST_PIPE_RUN   Run,
+    IN ULONG            Pictures,
+    IN BOOL             Prefix          // the pipeline was closed early
+    )
+{
+    ULONGLONG   offset = 0;
+    ULONG       length;
+    ULONG       picture;
+    ULONG       i;
+
+    if ((ULONGLONG) Run->SinkBytes > Run->SinkSize) {
+        HdmiTestFail("%s: %u bytes sent, more than all frames",
+                     Run->Case->Name, (ULONG) Run->SinkBytes);
+        return;
+    }
+
+    for (picture = 0; picture < Pictures && offset < (ULONGLONG) Run->SinkBytes; picture++) {
+
+        if (TestPipeDecodeFails(picture)) {
+            continue;
+        }
+
+        length = TestPipeFrameLength(picture);
+
+        if (length == 0) {
+            length = TEST_PIPE_FRAME_SIZE;
+        }
+
+        for (i = 0; i < length && offset + i < (ULONGLONG) Run->SinkBytes; i++) {
+            if (Run->Sink[offset + i] != TestPipeFrameByte(picture, i)) {
+                HdmiTestFail("%s: byte %u of the frame of picture %u is %02x, not %02x",
+                             Run->Case->Name, i, picture, Run->Sink[offset + i],
+                             TestPipeFrameByte(picture, i));
+                return;
+            }
+        }
+
+        offset += length;
+    }
+
+    //
+    // Whole frames only, and all of them unless the pipeline was closed.
+    //
+    if (offset != (ULONGLONG) Run->SinkBytes ||
+        (!Prefix && offset != Run->SinkSize)) {
+        HdmiTestFail("%s: %u bytes sent, not the %u of the frames up to picture %u",
+                     Run->Case->Name, (ULONG) Run->SinkBytes,
+                     (ULONG) (Prefix ? offset : Run->SinkSize), picture);
+    }
+}
+
+
+static VOID
+TestPipePlay(
+    IN const TEST_PIPE_CASE    *Case,
+    IN PTEST_PIPE_TRACK         Track,
+    IN PCWSTR                   Path
+    )
+{
+    HDMI_PIPE_CONFIG    config;
+    HDMI_PIPE_STATS     stats;
+    TEST_PIPE_RUN       run;
+    PHDMI_PIPE          pipe = NULL;
+    HANDLE              file;
+    HANDLE              sinkWrite = NULL;
+    HANDLE              sinkThread = NULL;
+    ULONG               length = Track->Length;
+    ULONG               pictures = Track->Pictures;
+    ULONG               errors = 1;             // the picture too big
+    ULONG               decoded = 0;
+    ULONGLONG           bytes = 0;
+    DWORD               written;
+    DWORD               error;
+    ULONG               frameLength;
+    ULONG               i;
+
+    ZeroMemory(&run, sizeof(run));
+
+    run.Case = Case;
+    run.Track = Track;
+    run.SubmitDepth = Case->SubmitDepth ? Case->SubmitDepth : HDMI_PIPE_DEFAULT_DEPTH;
+
+    if (Case->CutShort) {
+        length = Track->LastValue + Track->EssenceLength[pictures - 1] / 2;
+        pictures--;
+        errors++;
+    }
+
+    for (i = 0; i < pictures; i++) {
+        if (TestPipeDecodeFails(i)) {
+            errors++;
+        } else {
+            frameLength = TestPipeFrameLength(i);
+            bytes += (frameLength != 0) ? frameLength : TEST_PIPE_FRAME_SIZE;
+            decoded++;
+        }
+    }
+
+    file = CreateFileW( Path,
+                        GENERIC_WRITE,
+                        0,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL );
+
+    if (file == INVALID_HANDLE_VALUE) {
+        HdmiTestFail("%s: cannot create the track file, error %u", Case->Name, GetLastError());
+        return;
+    }
+
+    if (!WriteFile(file, Track->Data, length, &written, NULL) || written != length) {
+        HdmiTestFail("%s: cannot write the track file, error %u", Case->Name, GetLastError());
+        CloseHandle(file);
+        return;
+    }
+
+    CloseHandle(file);
+
+    run.SinkSize = (SIZE_T) bytes;
+    run.Sink = (PUCHAR) malloc(run.SinkSize + 1);
+
+    if (run.Sink == NULL ||
+        !CreatePipe(&run.SinkRead, &sinkWrite, NULL, TEST_PIPE_SINK_READ)) {
+        HdmiTestFail("%s: cannot create the pipe", Case->Name);
+        free(run.Sink);
+        return;
+    }
+
+    sinkThread = (HANDLE) _beginthreadex(NULL, 0, TestPipeSinkThread, &run, 0, NULL);
+
+    if (sinkThread == NULL) {
+        HdmiTestFail("%s: cannot start the reader of the pipe", Case->Name);
+        goto Done;
+    }
+
+    ZeroMemory(&config, sizeof(config));
+
+    config.TrackFile   = Path;
+    config.Device      = sinkWrite;
+    config.FrameSize   = TEST_PIPE_FRAME_SIZE;
+    config.EssenceSize = TEST_PIPE_ESSENCE_SIZE;
+    config.DecodeDepth = Case->DecodeDepth;
+    config.SubmitDepth = Case->SubmitDepth;
+    config.ReadSize    = TEST_PIPE_READ_SIZE;
+    config.ReadDepth   = Case->ReadDepth;
+    config.Decode      = TestPipeDecode;
+    config.Context     = &run;
+
+    error = HdmiSdkPipeCreate(&config, &pipe);
+
+    if (error != ERROR_SUCCESS) {
+        HdmiTestFail("%s: HdmiSdkPipeCreate: error %u", Case->Name, error);
+        goto Done;
+    }
+
+    if (Case->CloseAfter != 0) {
+
+        while ((ULONG) run.Decoded < Case->CloseAfter &&
+               HdmiSdkPipeWait(pipe, 10) == WAIT_TIMEOUT) {
+            ;
+        }
+
+        HdmiSdkPipeClose(pipe);
+        pipe = NULL;
+
+        //
+        // Closed, the pipeline must not decode any more. Reading the pipe
+        // slowly, it cannot have got far.
+        //
+        i = run.Decoded;
+        Sleep(50);
+
+        if ((ULONG) run.Decoded != i || i >= pictures) {
+            HdmiTestFail("%s: %u pictures decoded, %u after closing",
+                         Case->Name, i, (ULONG) run.Decoded);
+        }
+
+        goto Done;
+    }
+
+    error = HdmiSdkPipeWait(pipe, TEST_PIPE_TIMEOUT_MS);
+
+    if (error != ERROR_SUCCESS) {
+        HdmiTestFail("%s: HdmiSdkPipeWait: %u", Case->Name, error);
+        goto Done;
+    }
+
+    HdmiSdkPipeGetStats(pipe, &stats);
+
+    if (stats.Stage[HdmiPipeStageRead].Bytes != length ||
+        stats.Stage[HdmiPipeStageRead].Frames != pictures ||
+        stats.Stage[HdmiPipeStageDecode].Frames != decoded ||
+        stats.Stage[HdmiPipeStageSubmit].Frames != decoded ||
+        stats.Stage[HdmiPipeStageSubmit].Bytes != bytes ||
+        stats.Errors != errors ||
+        stats.Dropped != 0) {
+
+        HdmiTestFail("%s: read %u bytes, %u pictures, decoded %u, sent %u "
+                     "frames, %u bytes, %u errors, %u dropped; expected %u, "
+                     "%u, %u, %u, %u, %u, 0",
+                     Case->Name,
+                     (ULONG) stats.Stage[HdmiPipeStageRead].Bytes,
+                     (ULONG) stats.Stage[HdmiPipeStageRead].Frames,
+                     (ULONG) stats.Stage[HdmiPipeStageDecode].Frames,
+                     (ULONG) stats.Stage[HdmiPipeStageSubmit].Frames,
+                     (ULONG) stats.Stage[HdmiPipeStageSubmit].Bytes,
+                     (ULONG) stats.Errors,
+                     (ULONG) stats.Dropped,
+                     length, pictures, decoded, decoded, (ULONG) bytes, errors);
+    }
+
+    for (i = 0; i < HdmiPipeStageCount; i++) {
+
+        if ((Case->Blocked & TEST_PIPE_STAGE(i)) != 0 &&
+            stats.Stage[i].BlockedTicks == 0) {
+            HdmiTestFail("%s: the %s stage was never held back",
+                         Case->Name, TestPipeStageName[i]);
+        }
+
+        if ((Case->Starved & TEST_PIPE_STAGE(i)) != 0 &&
+            stats.Stage[i].StarvedTicks == 0) {
+            HdmiTestFail("%s: the %s stage never waited for input",
+                         Case->Name, TestPipeStageName[i]);
+        }
+    }
+
+    if ((ULONG) run.Decoded != pictures) {
+        HdmiTestFail("%s: %u of %u pictures decoded",
+                     Case->Name, (ULONG) run.Decoded, pictures);
+    }
+
+Done:
+
+    if (pipe != NULL) {
+        HdmiSdkPipeClose(pipe);
+    }
+
+    CloseHandle(sinkWrite);
+
+    if (sinkThread != NULL) {
+        WaitForSingleObject(sinkThread, INFINITE);
+        CloseHandle(sinkThread);
+    }
+
+    CloseHandle(run.SinkRead);
+
+    if (run.OutOfOrder != 0 || run.BadEssence != 0) {
+        HdmiTestFail("%s: %u pictures out of order, %u with the wrong essence",
+                     Case->Name, run.OutOfOrder, run.BadEssence);
+    }
+
+    if (run.MaxOutstanding >
+        (LONGLONG) (run.SubmitDepth + 2) * TEST_PIPE_FRAME_SIZE + TEST_PIPE_SINK_READ) {
+        HdmiTestFail("%s: %u bytes decoded and not yet sent, %u frames queued at most",
+                     Case->Name, (ULONG) run.MaxOutstanding, run.SubmitDepth);
+    }
+
+    TestPipeCheckSink(&run, pictures, Case->CloseAfter != 0);
+
+    free(run.Sink);
+}
+
+
+ULONG
+HdmiTestPipeline(
+    VOID
+    )
+{
+    TEST_PIPE_TRACK track;
+    WCHAR           directory[MAX_PATH];
+    WCHAR           path[MAX_PATH];
+    ULONG           i;
+
+    track.Data = (PUCHAR) malloc(TEST_PIPE_FILE_MAX);
+
+    if (track.Data == NULL) {
+        HdmiTestFail("out of memory");
+        return HdmiTestFailures();
+    }
+
+    if (GetTempPathW(MAX_PATH, directory) == 0 ||
+        GetTempFileNameW(directory, L"hdm", 0, path) == 0) {
+        HdmiTestFail("cannot make a temporary file name, error %u", GetLastError());
+        free(track.Data);
+        return HdmiTestFailures();
+    }
+
+    TestPipeBuildTrack(&track);
+
+    printf("    %u pictures, %u bytes\n", track.Pictures, track.Length);
+
+    for (i = 0; i < ARRAYSIZE(TestPipeCases); i++) {
+        TestPipePlay(&TestPipeCases[i], &track, path);
+    }
+
+    DeleteFileW(path);
+    free(track.Data);
+
+    return HdmiTestFailures();
+}
@@ -0,0 +1,235 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Stats.c
+
+Abstract:
+
+    Device statistics page. The ISR, the DPC and the write path count
+    frames, bytes, descriptors, interrupts, errors, dropped and late
+    frames and register accesses into the cache lines of the processor
+    they run on, see HdmiStatsCpu. The page is mapped read-only into any
+    process that asks, which sums the lines itself whenever it likes.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Stats.tmh"
+
+C_ASSERT(sizeof(HDMI_STATS_CPU) == 2 * HDMI_STATS_LINE_SIZE);
+C_ASSERT(FIELD_OFFSET(HDMI_STATS_PAGE, Cpu) == HDMI_STATS_LINE_SIZE);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, HdmiStatsInitialize)
+#pragma alloc_text (PAGE, HdmiStatsFree)
+#endif
+
+
+NTSTATUS
+HdmiStatsInitialize(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Allocates the statistics page, or pages, with a line for every
+    processor the system can ever have, so a processor added later needs
+    no new memory. The pages are whole, so a user view shows nothing else.
+
+--*/
+{
+    ULONG   cpuCount;
+    SIZE_T  length;
+
+    PAGED_CODE();
+
+    cpuCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    length   = ROUND_TO_PAGES(FIELD_OFFSET(HDMI_STATS_PAGE, Cpu) +
+                              cpuCount * sizeof(HDMI_STATS_CPU));
+
+    DevExt->StatsMdl = HdmiRingAllocatePages(DevExt, length);
+    if (!DevExt->StatsMdl) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "HdmiStatsInitialize: %Iu bytes failed", length);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DevExt->Stats = (PHDMI_STATS_PAGE) MmGetSystemAddressForMdlSafe( DevExt->StatsMdl,
+                                                                     NormalPagePriority );
+    if (!DevExt->Stats) {
+        HdmiStatsFree(DevExt);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DevExt->Stats->Version            = HDMI_STATS_VERSION;
+    DevExt->Stats->CpuCount           = cpuCount;
+    DevExt->Stats->TimestampFrequency = DevExt->TimestampFrequency;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP,
+                "Statistics page: %d processors, %Iu bytes", cpuCount, length);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HdmiStatsFree(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Releases the statistics page. Called when the device object goes
+    away, after every handle has been closed and the interrupt has been
+    disconnected.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (DevExt->StatsMdl) {
+
+        if (DevExt->Stats) {
+            MmUnmapLockedPages(DevExt->Stats, DevExt->StatsMdl);
+            DevExt->Stats = NULL;
+        }
+
+        MmFreePagesFromMdl(DevExt->StatsMdl);
+        ExFreePool(DevExt->StatsMdl);
+        DevExt->StatsMdl = NULL;
+    }
+}
+
+
+VOID
+HdmiStatsMap(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_MAP_STATISTICS from HdmiEvtIoInCallerContext. Maps
+    the statistics page read-only into the calling process; the view is
+    removed when the handle is closed. A handle has one view.
+
+Arguments:
+
+    DevExt      Pointer to our DEVICE_EXTENSION
+
+    Request     The map request; completed here.
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS                status;
+    PHDMI_STATS_MAPPING     mapping;
+    PHDMI_STREAM_CONTEXT    stream;
+    PVOID                   userVa = NULL;
+
+    PAGED_CODE();
+
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             sizeof(HDMI_STATS_MAPPING),
+                                             &mapping,
+                                             NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    stream = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+
+    userVa = HdmiRingMapToUser(DevExt->StatsMdl, TRUE);
+    if (!userVa) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Done;
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    if (stream->Closing) {
+        status = STATUS_DELETE_PENDING;
+    } else if (stream->StatsUserVa != NULL) {
+        status = STATUS_DEVICE_BUSY;
+    } else {
+        stream->StatsUserVa  = userVa;
+        stream->StatsProcess = PsGetCurrentProcess();
+        ObReferenceObject(stream->StatsProcess);
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    RtlZeroMemory(mapping, sizeof(HDMI_STATS_MAPPING));
+
+    mapping->Page   = (ULONGLONG) (ULONG_PTR) userVa;
+    mapping->Length = MmGetMdlByteCount(DevExt->StatsMdl);
+
+    userVa = NULL;
+
+Done:
+
+    if (userVa) {
+        MmUnmapLockedPages(userVa, DevExt->StatsMdl);
+    }
+
+    WdfRequestCompleteWithInformation( Request,
+                                       status,
+                                       NT_SUCCESS(status) ?
+                                           sizeof(HDMI_STATS_MAPPING) : 0 );
+}
+
+
+VOID
+HdmiStatsUnmap(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Removes the stream's view of the statistics page. Called from
+    HdmiStreamCleanup at PASSIVE_LEVEL, possibly in another process than
+    the one with the view, once the stream is closing and no new view
+    can be made.
+
+--*/
+{
+    PVOID       userVa;
+    PEPROCESS   process;
+
+    PAGED_CODE();
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    userVa  = Stream->StatsUserVa;
+    process = Stream->StatsProcess;
+    Stream->StatsUserVa  = NULL;
+    Stream->StatsProcess = NULL;
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    if (userVa) {
+        HdmiRingUnmapFromUser(process, userVa, DevExt->StatsMdl);
+        ObDereferenceObject(process);
+    }
+}
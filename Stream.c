@@ -0,0 +1,638 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Stream.c
+
+Abstract:
+
+    Per-handle streams. Every file object carries an HDMI_STREAM_CONTEXT
+    with its own queue of IRP_MJ_WRITEs, its own completion ring, the
+    card offset its frames go to and its own statistics, so several
+    clients can share the card without stepping on each other.
+
+    The streams are kept on DevExt->StreamList. Whenever the write channel
+    goes idle, HdmiStreamStartNext gives it to a stream with work: a
+    queued write or batch, else the next SQE of its ring.
+
+    Picture-class streams are served strictly before the others. Within
+    a class the channel is shared by start-time fair queueing: every
+    transfer charges its stream Length * HDMI_STREAM_VT_SCALE / Weight of
+    virtual time, and the stream with work and the smallest virtual time
+    goes next. A stream that was idle is moved up to the current virtual
+    time, so it cannot save up a share it did not use.
+
+    Transfers of the other classes are cut into HDMI_STREAM_CHUNK_SIZE
+    pieces: long writes as HdmiXferChunk transfers, ring SQEs as internal
+    slices. The scheduler runs between the pieces, which bounds how long
+    a picture frame can be held up by them.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Stream.tmh"
+
+
+static VOID
+HdmiStreamFinishChunks(
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN NTSTATUS             Status
+    );
+
+
+NTSTATUS
+HdmiStreamCreate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    )
+/*++
+Routine Description:
+
+    Sets up the stream of a new handle. Called from
+    HdmiEvtDeviceFileCreate. The first one also allocates the descriptor
+    tables. The card stays in D0 for the stream until its show ends, see
+    Power.c.
+
+--*/
+{
+    NTSTATUS              status;
+    PHDMI_STREAM_CONTEXT  stream = HdmiGetStreamContext(FileObject);
+    WDF_IO_QUEUE_CONFIG   queueConfig;
+
+    PAGED_CODE();
+
+    status = HdmiAllocateTransferResources(DevExt);
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    stream->Weight = HDMI_STREAM_WEIGHT_DEFAULT;
+    stream->Class  = HDMI_STREAM_CLASS_NORMAL;
+
+    //
+    // Writes of the stream wait here until it is the stream's turn.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT ( &queueConfig,
+                              WdfIoQueueDispatchManual);
+
+    status = WdfIoQueueCreate( DevExt->Device,
+                               &queueConfig,
+                               WDF_NO_OBJECT_ATTRIBUTES,
+                               &stream->WriteQueue );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfIoQueueCreate (stream) failed: %!STATUS!", status);
+        return status;
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    InsertTailList(&DevExt->StreamList, &stream->Link);
+
+    HdmiPowerStreamActive(DevExt, stream);
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HdmiStreamCleanup(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    )
+/*++
+Routine Description:
+
+    Called from HdmiEvtFileCleanup. Tears down the stream's ring and its
+    view of the statistics page, cancels the writes that have not been
+    started, waits for one that is on the channel and takes the stream
+    off the list. A write being sent in chunks is cancelled at once, or
+    when its chunk on the channel lands, rather than waiting for the
+    stream's next turn. Batches are cancelled; one with a frame on the
+    channel completes with it.
+
+    The queue itself goes with the file object, see
+    HdmiEvtStreamContextCleanup.
+
+--*/
+{
+    PHDMI_STREAM_CONTEXT  stream = HdmiGetStreamContext(FileObject);
+
+    PAGED_CODE();
+
+    if (stream->WriteQueue == NULL) {
+        return;
+    }
+
+    if (stream->RingCtx != NULL) {
+        HdmiRingTeardown(DevExt, stream, NULL);
+    }
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    stream->Closing = TRUE;
+
+    if (stream->ChunkRequest != NULL &&
+        !(DevExt->XferSource == HdmiXferChunk && DevExt->XferStream == stream)) {
+        HdmiStreamFinishChunks(stream, STATUS_CANCELLED);
+    }
+
+    HdmiBatchFlush(DevExt, FileObject);
+
+    WdfObjectReleaseLock(DevExt->Device);
+
+    HdmiStatsUnmap(DevExt, stream);
+
+    WdfIoQueuePurgeSynchronously(stream->WriteQueue);
+
+    WdfObjectAcquireLock(DevExt->Device);
+
+    RemoveEntryList(&stream->Link);
+
+    HdmiPowerStreamIdle(DevExt, stream);
+
+    if (DevExt->XferStream == stream &&
+        DevExt->XferSource != HdmiXferBatch) {
+        //
+        // Only a ring SQE or a batch frame can still be on the channel.
+        // The ring is already detached from the stream; the batch keeps
+        // the file object, and with it the stream, until it completes.
+        //
+        DevExt->XferStream = NULL;
+    }
+
+    WdfObjectReleaseLock(DevExt->Device);
+}
+
+
+VOID
+HdmiEvtStreamContextCleanup(
+    IN WDFOBJECT Object
+    )
+{
+    PHDMI_STREAM_CONTEXT  stream = HdmiGetStreamContext(Object);
+
+    if (stream->WriteQueue != NULL) {
+        WdfObjectDelete(stream->WriteQueue);
+        stream->WriteQueue = NULL;
+    }
+}
+
+
+VOID
+HdmiStreamConfigure(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_SET_STREAM. The new settings apply to transfers
+    started from now on.
+
+--*/
+{
+    NTSTATUS              status;
+    PHDMI_STREAM_CONFIG   config;
+    PHDMI_STREAM_CONTEXT  stream;
+
+    status = WdfRequestRetrieveInputBuffer( Request,
+                                            sizeof(HDMI_STREAM_CONFIG),
+                                            &config,
+                                            NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    if ((config->DeviceOffset & 3) != 0 ||
+        !HdmiSramFits(DevExt, config->DeviceOffset, 1) ||
+        config->Weight > HDMI_STREAM_WEIGHT_MAX ||
+        config->Class > HDMI_STREAM_CLASS_PICTURE) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Done;
+    }
+
+    stream = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+
+    stream->DeviceOffset = config->DeviceOffset;
+    stream->Weight       = config->Weight ? config->Weight
+                                          : HDMI_STREAM_WEIGHT_DEFAULT;
+    stream->Class        = config->Class;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "HdmiStreamConfigure: stream %p at SRAM offset %x, "
+                "weight %d, class %d",
+                stream, stream->DeviceOffset, stream->Weight, stream->Class);
+
+Done:
+
+    WdfRequestComplete(Request, status);
+}
+
+
+static BOOLEAN
+HdmiStreamHasWork(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+{
+    PHDMI_RING_CONTEXT  ringCtx = Stream->RingCtx;
+    WDFREQUEST          batch;
+    ULONG               queued;
+
+    if (Stream->ChunkRequest != NULL || Stream->BatchRequest != NULL) {
+        return TRUE;
+    }
+
+    WdfIoQueueGetState(Stream->WriteQueue, &queued, NULL);
+
+    if (queued != 0) {
+        return TRUE;
+    }
+
+    if (NT_SUCCESS(WdfIoQueueFindRequest( DevExt->BatchQueue,
+                                          NULL,
+                                          (WDFFILEOBJECT) WdfObjectContextGetObject(Stream),
+                                          NULL,
+                                          &batch ))) {
+        WdfObjectDereference(batch);
+        return TRUE;
+    }
+
+    return (BOOLEAN) (ringCtx != NULL && !ringCtx->Closing &&
+                      (ringCtx->Partial ||
+                       ringCtx->SqHead != ringCtx->Ring->SqTail));
+}
+
+
+static VOID
+HdmiStreamFinishChunks(
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN NTSTATUS             Status
+    )
+{
+    WDFREQUEST  request = Stream->ChunkRequest;
+
+    Stream->ChunkRequest = NULL;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
+                "HdmiStreamFinishChunks: Request %p, %d bytes, %!STATUS!",
+                request, Stream->ChunkOffset, Status);
+
+    WdfRequestCompleteWithInformation(request, Status, Stream->ChunkOffset);
+}
+
+
+static BOOLEAN
+HdmiStreamStartChunk(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Starts the next chunk of the stream's ChunkRequest. The request is
+    completed here if the stream is closing or the chunk cannot be
+    started.
+
+Return Value:
+
+    TRUE if a transfer was started.
+
+--*/
+{
+    NTSTATUS    status;
+    PMDL        mdl;
+    ULONG       length;
+
+    if (Stream->Closing) {
+        HdmiStreamFinishChunks(Stream, STATUS_CANCELLED);
+        return FALSE;
+    }
+
+    status = WdfRequestRetrieveInputWdmMdl(Stream->ChunkRequest, &mdl);
+    if (!NT_SUCCESS(status)) {
+        HdmiStreamFinishChunks(Stream, status);
+        return FALSE;
+    }
+
+    length = MmGetMdlByteCount(mdl) - Stream->ChunkOffset;
+
+    if (length > HDMI_STREAM_CHUNK_SIZE) {
+        length = HDMI_STREAM_CHUNK_SIZE;
+    }
+
+    status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                          HdmiEvtProgramWriteDma,
+                                          WdfDmaDirectionWriteToDevice,
+                                          mdl,
+                                          (PUCHAR) MmGetMdlVirtualAddress(mdl) +
+                                              Stream->ChunkOffset,
+                                          length );
+    if (!NT_SUCCESS(status)) {
+        HdmiStreamFinishChunks(Stream, status);
+        return FALSE;
+    }
+
+    DevExt->WriteDeviceOffset = Stream->ChunkDeviceOffset + Stream->ChunkOffset;
+    DevExt->WriteStartTime    = KeQueryPerformanceCounter(NULL).QuadPart;
+    DevExt->XferSource        = HdmiXferChunk;
+
+    status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                       WDF_NO_CONTEXT );
+    if (!NT_SUCCESS(status)) {
+        DevExt->XferSource        = HdmiXferNone;
+        DevExt->WriteDeviceOffset = 0;
+        WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+        HdmiStreamFinishChunks(Stream, status);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+VOID
+HdmiStreamChunkComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Called from the DPC when a chunk has been transferred. The write is
+    completed after its last chunk or the first failed one; otherwise
+    the rest waits for the stream's next turn.
+
+--*/
+{
+    PHDMI_STREAM_CONTEXT  stream = DevExt->XferStream;
+    PMDL                  mdl;
+
+    stream->ChunkOffset += (ULONG)
+        WdfDmaTransactionGetBytesTransferred(DevExt->WriteDmaTransaction);
+
+    WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+
+    DevExt->XferSource        = HdmiXferNone;
+    DevExt->WriteDeviceOffset = 0;
+
+    if (!NT_SUCCESS(Status)) {
+        HdmiStreamFinishChunks(stream, Status);
+        return;
+    }
+
+    if (NT_SUCCESS(WdfRequestRetrieveInputWdmMdl(stream->ChunkRequest, &mdl)) &&
+        stream->ChunkOffset >= MmGetMdlByteCount(mdl)) {
+        HdmiStreamFinishChunks(stream, STATUS_SUCCESS);
+    } else if (stream->Closing) {
+        HdmiStreamFinishChunks(stream, STATUS_CANCELLED);
+    }
+}
+
+
+VOID
+HdmiStreamFlush(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    Handles IOCTL_HDMI_FLUSH from the IOCTL queue, under the device lock.
+    A transfer of the calling handle on the channel is aborted first, so
+    it completes ahead of the frames queued behind it. Then the write
+    being sent in chunks, the queued writes, the ring and the batches of
+    the handle are cancelled and the channel is handed on.
+
+--*/
+{
+    WDFFILEOBJECT         fileObject = WdfRequestGetFileObject(Request);
+    PHDMI_STREAM_CONTEXT  stream = HdmiGetStreamContext(fileObject);
+    WDFREQUEST            request;
+    ULONG                 cancelled = 0;
+
+    if (DevExt->XferStream == stream) {
+
+        HdmiAbortWriteTransfer(DevExt, STATUS_CANCELLED);
+    }
+
+    if (stream->ChunkRequest != NULL) {
+        HdmiStreamFinishChunks(stream, STATUS_CANCELLED);
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(stream->WriteQueue,
+                                                    &request))) {
+        WdfRequestComplete(request, STATUS_CANCELLED);
+        cancelled++;
+    }
+
+    if (stream->RingCtx != NULL && !stream->RingCtx->Closing) {
+        HdmiRingFlush(stream->RingCtx);
+        HdmiRingWakeWaiters(DevExt, stream, STATUS_SUCCESS);
+    }
+
+    HdmiBatchFlush(DevExt, fileObject);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS,
+                "HdmiStreamFlush: stream %p, %d writes cancelled",
+                stream, cancelled);
+
+    HdmiStartNextWrite(DevExt);
+
+    WdfRequestComplete(Request, STATUS_SUCCESS);
+}
+
+
+VOID
+HdmiStreamCharge(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Called from the DPC for every finished transfer. Charges the stream
+    that had the channel for it, and accounts for the time spent mapping
+    the transfer.
+
+--*/
+{
+    PHDMI_STREAM_CONTEXT  stream = DevExt->XferStream;
+
+    if (stream == NULL) {
+        return;
+    }
+
+    stream->VirtualTime += (ULONGLONG) Length * HDMI_STREAM_VT_SCALE /
+                           stream->Weight;
+    stream->Stats.BytesWritten += Length;
+
+    if (DevExt->XferDirect) {
+        stream->Stats.TransfersPremapped++;
+    } else {
+        stream->Stats.MapTicks += DevExt->XferMapTicks;
+        stream->Stats.TransfersMapped++;
+    }
+}
+
+
+static BOOLEAN
+HdmiStreamStartOne(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+Routine Description:
+
+    Starts the stream's next transfer. A batch already started goes on
+    first. Writes that went by PIO or failed are already completed, so
+    keep taking writes until one is on the channel; then try the next
+    batch and then the ring.
+
+Return Value:
+
+    TRUE if a transfer was started.
+
+--*/
+{
+    WDFREQUEST  request;
+
+    if (Stream->ChunkRequest != NULL) {
+        return HdmiStreamStartChunk(DevExt, Stream);
+    }
+
+    //
+    // Nothing of the stream gets between the frames of its batch.
+    //
+    if (Stream->BatchRequest != NULL && HdmiBatchStartNext(DevExt, Stream)) {
+        return TRUE;
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(Stream->WriteQueue,
+                                                    &request))) {
+
+        if (Stream->Class != HDMI_STREAM_CLASS_PICTURE) {
+
+            WDF_REQUEST_PARAMETERS  params;
+
+            WDF_REQUEST_PARAMETERS_INIT(&params);
+            WdfRequestGetParameters(request, &params);
+
+            if (params.Parameters.Write.Length > HDMI_STREAM_CHUNK_SIZE) {
+
+                //
+                // All chunks go where the stream was when the first one
+                // started, whatever SET_STREAM does meanwhile.
+                //
+                if (!HdmiSramFits(DevExt, Stream->DeviceOffset,
+                                  params.Parameters.Write.Length)) {
+                    WdfRequestComplete(request, STATUS_INVALID_BUFFER_SIZE);
+                    continue;
+                }
+
+                Stream->ChunkRequest      = request;
+                Stream->ChunkOffset       = 0;
+                Stream->ChunkDeviceOffset = Stream->DeviceOffset;
+
+                if (HdmiStreamStartChunk(DevExt, Stream)) {
+                    return TRUE;
+                }
+                continue;
+            }
+        }
+
+        HdmiStartWriteRequest(DevExt, Stream, request);
+
+        if (DevExt->XferSource != HdmiXferNone) {
+            return TRUE;
+        }
+    }
+
+    if (HdmiBatchStartNext(DevExt, Stream)) {
+        return TRUE;
+    }
+
+    return HdmiRingStartNext(DevExt, Stream);
+}
+
+
+BOOLEAN
+HdmiStreamStartNext(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Class
+    )
+/*++
+Routine Description:
+
+    Called from HdmiStartNextWrite with the write channel idle. Gives the
+    channel to the stream of Class with work and the smallest virtual
+    time; if that one turns out to have nothing it can start, to the
+    next one.
+
+Return Value:
+
+    TRUE if a transfer was started.
+
+--*/
+{
+    PLIST_ENTRY           entry;
+    PHDMI_STREAM_CONTEXT  stream;
+    PHDMI_STREAM_CONTEXT  best;
+
+    DevExt->StreamRound++;
+
+    for (;;) {
+
+        best = NULL;
+
+        for (entry = DevExt->StreamList.Flink;
+             entry != &DevExt->StreamList;
+             entry = entry->Flink) {
+
+            stream = CONTAINING_RECORD(entry, HDMI_STREAM_CONTEXT, Link);
+
+            if (stream->Class != Class ||
+                stream->Round == DevExt->StreamRound ||
+                !HdmiStreamHasWork(DevExt, stream)) {
+                continue;
+            }
+
+            if (stream->VirtualTime < DevExt->VirtualTime) {
+                stream->VirtualTime = DevExt->VirtualTime;
+            }
+
+            if (best == NULL || stream->VirtualTime < best->VirtualTime) {
+                best = stream;
+            }
+        }
+
+        if (best == NULL) {
+            return FALSE;
+        }
+
+        best->Round = DevExt->StreamRound;
+
+        if (HdmiStreamStartOne(DevExt, best)) {
+            DevExt->XferStream  = best;
+            DevExt->VirtualTime = best->VirtualTime;
+            return TRUE;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    HdmiModelTest.h
+
+Abstract:
+
+    Declarations shared by the tests of the driver's portable parts, the
+    files described in Model.h. They are built here in user mode, from
+    the driver's own sources, and need neither the card nor the driver.
+
+Environment:
+
+    User mode
+
+--*/
+
+#if !defined(_HDMI_MODEL_TEST_H_)
+#define _HDMI_MODEL_TEST_H_
+
+#include "..\precomp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+//
+// A test returns the number of checks that failed; HdmiTestFail prints
+// what went wrong and counts it.
+//
+typedef ULONG
+HDMI_TEST(
+    VOID
+    );
+
+typedef HDMI_TEST *PHDMI_TEST;
+
+VOID
+HdmiTestFail(
+    IN PCSTR    Format,
+    ...
+    );
+
+ULONG
+HdmiTestFailures(
+    VOID
+    );
+
+//
+// Deterministic, so that a failure can be reproduced.
+//
+VOID
+HdmiTestSeed(
+    IN ULONG    Seed
+    );
+
+ULONG
+HdmiTestRandom(
+    VOID
+    );
+
+//
+// TestClock.c
+//
+HDMI_TEST HdmiTestClock;
+
+//
+// TestCost.c
+//
+HDMI_TEST HdmiTestCost;
+
+//
+// TestMapCache.c
+//
+HDMI_TEST HdmiTestMapCache;
+
+#endif // _HDMI_MODEL_TEST_H_
@@ -0,0 +1,302 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestClock.c
+
+Abstract:
+
+    Feeds the clock model of Clock.c the completion times of synthetic
+    cards: frame rates from 24 to 120 Hz against 10 MHz and 3 GHz
+    counters, clocks off by a fixed or a drifting number of parts per
+    million, uniform jitter and lost completions. After each completion
+    the predicted time of the next frame is compared with the true one,
+    without jitter; every case must converge within a given number of
+    completions and then hold its tolerance.
+
+    Stalls longer than HDMI_CLOCK_MAX_GAP frames and a counter going
+    backwards must restart the fit, and a shorter gap must not.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiModelTest.h"
+
+typedef struct _TEST_CLOCK_CASE {
+
+    PCSTR       Name;
+    LONGLONG    Frequency;          // counter ticks per second
+    ULONG       Rate;               // frames per Scale seconds
+    ULONG       Scale;
+    LONG        Ppm;                // card clock fast by, at the start
+    LONG        Drift;              // ppm more every 1000 frames
+    ULONG       Jitter;             // +/- microseconds, uniform
+    ULONG       LoseEvery;          // lose every Nth completion after the first window
+    ULONG       Frames;
+    ULONG       Converge;           // completions until the tolerance holds
+    ULONG       Tolerance;          // microseconds of prediction error
+
+} TEST_CLOCK_CASE, *PTEST_CLOCK_CASE;
+
+//
+// Without jitter the model must be right once it first fits; with it,
+// within two windows.
+//
+#define TEST_CLOCK_FIT          HDMI_CLOCK_MIN_SAMPLES
+#define TEST_CLOCK_SETTLE       (2 * HDMI_CLOCK_SAMPLES)
+
+static const TEST_CLOCK_CASE TestClockCases[] = {
+    //  name                freq        rate   scale  ppm  drift jitter lose frames converge        tol
+    { "60 Hz",              10000000,   60,    1,     0,   0,    0,     0,   2000,  TEST_CLOCK_FIT,    1 },
+    { "59.94 Hz, +80 ppm",  10000000,   60000, 1001,  80,  0,    0,     0,   2000,  TEST_CLOCK_FIT,    1 },
+    { "24 Hz on a TSC",     3000000000, 24,    1,    -150, 0,    0,     0,   2000,  TEST_CLOCK_FIT,    1 },
+    { "120 Hz, drifting",   10000000,   120,   1,     0,   100,  0,     0,   5000,  TEST_CLOCK_FIT,    2 },
+    { "lost completions",   10000000,   50,    1,    -40,  0,    0,     5,   2000,  TEST_CLOCK_FIT,    1 },
+    { "100 us jitter",      10000000,   60,    1,     30,  0,    100,   0,   5000,  TEST_CLOCK_SETTLE, 100 },
+    { "1 ms jitter, 24 Hz", 3000000000, 24,    1,    -20,  0,    1000,  0,   5000,  TEST_CLOCK_SETTLE, 1000 },
+    { "all of it",          10000000,   60000, 1001,  60,  50,   200,   7,   10000, TEST_CLOCK_SETTLE, 200 },
+};
+
+//
+// Some 23 days of a 10 MHz counter, so that the sums the fit takes
+// would overflow if it did not take times relative to the window.
+//
+#define TEST_CLOCK_START        0x123456789ABCLL
+
+
+static double
+TestClockUniform(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Returns a number in [-1, 1).
+
+--*/
+{
+    return (double) HdmiTestRandom() / 2147483648.0 - 1.0;
+}
+
+
+static VOID
+TestClockRun(
+    IN const TEST_CLOCK_CASE   *Case
+    )
+{
+    HDMI_CLOCK_STATE    clock;
+    HDMI_CLOCK          model;
+    double              period = 0;
+    double              time = (double) TEST_CLOCK_START;
+    double              next;
+    double              tick = (double) Case->Frequency / 1e6;     // per microsecond
+    double              error;
+    double              maxError = 0;
+    double              sumError = 0;
+    double              sumJitter = 0;
+    ULONG               counted = 0;
+    ULONG               windows = 0;
+    ULONG               updates = 0;
+    ULONG               converged = 0;
+    ULONG               frame;
+    LONGLONG            timestamp;
+
+    RtlZeroMemory(&clock, sizeof(clock));
+
+    for (frame = 0; frame < Case->Frames; frame++) {
+
+        period = (double) Case->Frequency * Case->Scale / Case->Rate /
+                 (1.0 + (Case->Ppm + Case->Drift * (frame / 1000.0)) * 1e-6);
+        next = time + period;
+
+        if (Case->LoseEvery != 0 && frame >= HDMI_CLOCK_SAMPLES &&
+            frame % Case->LoseEvery == 0) {
+            time = next;
+            continue;
+        }
+
+        timestamp = (LONGLONG) (time + Case->Jitter * tick * TestClockUniform());
+
+        HdmiClockUpdate(&clock, timestamp);
+        updates++;
+
+        HdmiClockQuery(&clock, &model);
+
+        if (model.Samples != (updates < HDMI_CLOCK_SAMPLES ? updates : HDMI_CLOCK_SAMPLES)) {
+            HdmiTestFail("%s: %u samples after %u completions",
+                         Case->Name, model.Samples, updates);
+            return;
+        }
+
+        if (updates < HDMI_CLOCK_MIN_SAMPLES) {
+            if (model.Period != 0) {
+                HdmiTestFail("%s: a period after %u completions", Case->Name, updates);
+                return;
+            }
+            time = next;
+            continue;
+        }
+
+        if (model.Period == 0) {
+            HdmiTestFail("%s: no period after %u completions", Case->Name, updates);
+            return;
+        }
+
+        error = ((double) model.NextTimestamp - next) / tick;
+
+        if (error < 0) {
+            error = -error;
+        }
+
+        if (error > Case->Tolerance) {
+            converged = updates + 1;
+        }
+
+        if (updates >= HDMI_CLOCK_SAMPLES) {
+            sumJitter += (double) model.Jitter / tick;
+            windows++;
+        }
+
+        if (updates > converged && updates >= HDMI_CLOCK_SAMPLES) {
+            if (error > maxError) {
+                maxError = error;
+            }
+            sumError += error;
+            counted++;
+        }
+
+        if (updates >= Case->Converge && error > Case->Tolerance) {
+            HdmiTestFail("%s: frame %u predicted %.1f us off after %u completions",
+                         Case->Name, frame + 1, error, updates);
+            return;
+        }
+
+        time = next;
+    }
+
+    //
+    // Across the window, an error in the period adds up to no more than
+    // the tolerance. Uniform jitter of +/- J has a mean deviation of J / 2,
+    // a little of which the fit takes up; averaged over every full window
+    // the estimate must come within 5%.
+    //
+    error = ((double) model.Period / 65536 - period) * HDMI_CLOCK_SAMPLES / tick;
+
+    if (error > Case->Tolerance || error < -(double) Case->Tolerance) {
+        HdmiTestFail("%s: period %.3f ticks, not %.3f",
+                     Case->Name, (double) model.Period / 65536, period);
+    }
+
+    error = sumJitter / windows - Case->Jitter / 2.0;
+
+    if (error > Case->Jitter / 20.0 + 0.1 || error < -(Case->Jitter / 20.0 + 0.1)) {
+        HdmiTestFail("%s: jitter %.1f us on average, not about %.1f",
+                     Case->Name, sumJitter / windows, Case->Jitter / 2.0);
+    }
+
+    printf("    %-20s converged after %2u, then within %6.1f us, %6.1f on average\n",
+           Case->Name, converged > HDMI_CLOCK_MIN_SAMPLES ? converged : HDMI_CLOCK_MIN_SAMPLES,
+           maxError, counted ? sumError / counted : 0.0);
+}
+
+
+static VOID
+TestClockRestart(
+    VOID
+    )
+/*++
+Routine Description:
+
+    A 60 Hz clock on a 10 MHz counter that stalls for HDMI_CLOCK_MAX_GAP
+    frames, which the model must bridge, then for one more, and then
+    steps back; both of the latter must restart the fit.
+
+--*/
+{
+    static const struct {
+        LONG    Frames;                 // since the last completion
+        ULONG   Samples;                // the model must then hold
+    } steps[] = {
+        { HDMI_CLOCK_MAX_GAP,       HDMI_CLOCK_SAMPLES },
+        { HDMI_CLOCK_MAX_GAP + 1,   1 },
+        { -1,                       1 },
+    };
+
+    HDMI_CLOCK_STATE    clock;
+    HDMI_CLOCK          model;
+    const LONGLONG      period = 10000000 / 60;
+    LONGLONG            time = TEST_CLOCK_START;
+    ULONG               step;
+    ULONG               i;
+
+    RtlZeroMemory(&clock, sizeof(clock));
+
+    for (step = 0; step < ARRAYSIZE(steps); step++) {
+
+        for (i = 0; i < HDMI_CLOCK_SAMPLES; i++) {
+            time += period;
+            HdmiClockUpdate(&clock, time);
+        }
+
+        time += steps[step].Frames * period;
+
+        HdmiClockUpdate(&clock, time);
+        HdmiClockQuery(&clock, &model);
+
+        if (model.Samples != steps[step].Samples) {
+            HdmiTestFail("gap of %d frames: %u samples, not %u",
+                         steps[step].Frames, model.Samples, steps[step].Samples);
+            continue;
+        }
+
+        if (model.Samples == 1) {
+
+            if (model.Period != 0) {
+                HdmiTestFail("gap of %d frames: a period from one sample",
+                             steps[step].Frames);
+            }
+
+            //
+            // And it fits again as soon as it has enough samples.
+            //
+            for (i = 1; i < HDMI_CLOCK_MIN_SAMPLES; i++) {
+                time += period;
+                HdmiClockUpdate(&clock, time);
+            }
+
+            HdmiClockQuery(&clock, &model);
+        }
+
+        if (model.NextTimestamp < time + period - 1 ||
+            model.NextTimestamp > time + period + 1) {
+            HdmiTestFail("gap of %d frames: next frame predicted %d ticks off",
+                         steps[step].Frames, (LONG) (model.NextTimestamp - (time + period)));
+        }
+    }
+}
+
+
+ULONG
+HdmiTestClock(
+    VOID
+    )
+{
+    ULONG   i;
+
+    for (i = 0; i < ARRAYSIZE(TestClockCases); i++) {
+        TestClockRun(&TestClockCases[i]);
+    }
+
+    TestClockRestart();
+
+    return HdmiTestFailures();
+}
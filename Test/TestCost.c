@@ -0,0 +1,346 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestCost.c
+
+Abstract:
+
+    Feeds the path cost model of Cost.c synthetic cost curves, a fixed
+    cost per write plus a cost per kilobyte for each path with +/- 10%
+    noise, in rounds the way calibration measures them: the largest
+    write of every bucket, once by PIO and once by DMA. The curves are
+    chosen so that the cheaper path is clear despite the noise, and the
+    PIO threshold must then be the expected one after every round, from
+    the first on. Run back to back, the model must follow each change of
+    curve within a few rounds.
+
+    Then the corners: which bucket a length lands in, writes too long
+    for PIO or without a time, buckets measured on one path only, and
+    the lengths at the threshold.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiModelTest.h"
+
+typedef struct _TEST_COST_CASE {
+
+    PCSTR       Name;
+    LONG        DmaFixed;           // ticks per write
+    LONG        DmaPerKb;           // and per kilobyte
+    LONG        PioFixed;
+    LONG        PioPerKb;
+    ULONG       Bump;               // bucket where PIO costs Factor times more
+    LONG        Factor;
+    ULONG       Threshold;          // the model must arrive at
+
+} TEST_COST_CASE, *PTEST_COST_CASE;
+
+static const TEST_COST_CASE TestCostCases[] = {
+    //  name                    dma fixed  per kb  pio fixed  per kb  bump  factor  threshold
+    { "PIO never cheaper",      100,       10,     500,       800,    0,    1,      0 },
+    { "PIO always cheaper",     5000,      100,    50,        20,     0,    1,      HDMI_PIO_MAX_LENGTH },
+    { "crossover above 4K",     4000,      50,     100,       750,    0,    1,      4096 },
+    { "PIO bump at 1K",         2000,      100,    100,       50,     2,    20,     512 },
+};
+
+#define TEST_COST_ROUNDS        50
+
+//
+// Rounds the model may take to follow a change of curve; the smoothing
+// leaves (3/4)^n of the old cost after n of them.
+//
+#define TEST_COST_ADAPT         16
+
+
+static LONGLONG
+TestCostTicks(
+    IN LONG     Fixed,
+    IN LONG     PerKb,
+    IN ULONG    Length
+    )
+/*++
+Routine Description:
+
+    Returns the cost of one write of Length bytes with up to 10% noise
+    either way.
+
+--*/
+{
+    double  ticks = Fixed + (double) PerKb * Length / 1024;
+    double  noise = (double) HdmiTestRandom() / 2147483648.0 * 0.2 - 0.1;
+
+    return (LONGLONG) (ticks * (1.0 + noise));
+}
+
+
+static VOID
+TestCostRound(
+    IN OUT PHDMI_PATH_COST      Cost,
+    IN const TEST_COST_CASE     *Case
+    )
+{
+    ULONG   bucket;
+    ULONG   length;
+    LONG    factor;
+
+    for (bucket = 0; bucket < HDMI_COST_BUCKETS; bucket++) {
+
+        length = 1UL << (HDMI_COST_MIN_SHIFT + bucket);
+        factor = bucket == Case->Bump ? Case->Factor : 1;
+
+        HdmiCostUpdate(Cost, TRUE, length,
+                       factor * TestCostTicks(Case->PioFixed, Case->PioPerKb, length));
+        HdmiCostUpdate(Cost, FALSE, length,
+                       TestCostTicks(Case->DmaFixed, Case->DmaPerKb, length));
+    }
+}
+
+
+static VOID
+TestCostRun(
+    IN const TEST_COST_CASE     *Case
+    )
+{
+    HDMI_PATH_COST  cost;
+    ULONG           round;
+
+    RtlZeroMemory(&cost, sizeof(cost));
+
+    for (round = 0; round < TEST_COST_ROUNDS; round++) {
+
+        TestCostRound(&cost, Case);
+
+        if (cost.PioThreshold != Case->Threshold) {
+            HdmiTestFail("%s: PIO up to %u bytes after %u rounds, not %u",
+                         Case->Name, cost.PioThreshold, round + 1, Case->Threshold);
+            return;
+        }
+    }
+
+    printf("    %-24s PIO up to %u bytes\n", Case->Name, cost.PioThreshold);
+}
+
+
+static VOID
+TestCostAdapt(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Runs every pair of curves back to back on the same model; after
+    TEST_COST_ADAPT rounds of the second it must have forgotten the
+    first.
+
+--*/
+{
+    HDMI_PATH_COST  cost;
+    ULONG           from;
+    ULONG           to;
+    ULONG           round;
+    ULONG           adapted;
+    ULONG           slowest = 0;
+
+    for (from = 0; from < ARRAYSIZE(TestCostCases); from++) {
+
+        for (to = 0; to < ARRAYSIZE(TestCostCases); to++) {
+
+            RtlZeroMemory(&cost, sizeof(cost));
+
+            for (round = 0; round < TEST_COST_ROUNDS; round++) {
+                TestCostRound(&cost, &TestCostCases[from]);
+            }
+
+            adapted = 0;
+
+            for (round = 0; round < TEST_COST_ADAPT + TEST_COST_ROUNDS; round++) {
+
+                TestCostRound(&cost, &TestCostCases[to]);
+
+                if (cost.PioThreshold != TestCostCases[to].Threshold) {
+                    adapted = round + 1;
+                }
+            }
+
+            if (adapted > TEST_COST_ADAPT) {
+                HdmiTestFail("%s, then %s: PIO up to %u bytes after %u rounds",
+                             TestCostCases[from].Name, TestCostCases[to].Name,
+                             cost.PioThreshold, adapted);
+            }
+
+            if (adapted > slowest) {
+                slowest = adapted;
+            }
+        }
+    }
+
+    printf("    %-24s within %u rounds\n", "change of curve", slowest);
+}
+
+
+static VOID
+TestCostBuckets(
+    VOID
+    )
+/*++
+Routine Description:
+
+    A single write must land in the bucket of the smallest power of two
+    that holds it; one too long for PIO, or without a time, in none.
+
+--*/
+{
+    static const struct {
+        ULONG   Length;
+        LONGLONG Ticks;
+        ULONG   Bucket;             // HDMI_COST_BUCKETS for none
+    } writes[] = {
+        { 1,                                    10, 0 },
+        { 1UL << HDMI_COST_MIN_SHIFT,           10, 0 },
+        { (1UL << HDMI_COST_MIN_SHIFT) + 1,     10, 1 },
+        { 3000,                                 10, 4 },
+        { 4096,                                 10, 4 },
+        { 4097,                                 10, 5 },
+        { HDMI_PIO_MAX_LENGTH,                  10, HDMI_COST_BUCKETS - 1 },
+        { HDMI_PIO_MAX_LENGTH + 1,              10, HDMI_COST_BUCKETS },
+        { 0xFFFFFFFF,                           10, HDMI_COST_BUCKETS },
+        { 4096,                                 0,  HDMI_COST_BUCKETS },
+        { 4096,                                 -5, HDMI_COST_BUCKETS },
+    };
+
+    HDMI_PATH_COST  cost;
+    ULONG           i;
+    ULONG           bucket;
+    ULONG           pio;
+
+    for (i = 0; i < ARRAYSIZE(writes); i++) {
+
+        for (pio = 0; pio < 2; pio++) {
+
+            RtlZeroMemory(&cost, sizeof(cost));
+
+            HdmiCostUpdate(&cost, (BOOLEAN) pio, writes[i].Length, writes[i].Ticks);
+
+            for (bucket = 0; bucket < HDMI_COST_BUCKETS; bucket++) {
+
+                if ((pio ? cost.Pio : cost.Dma)[bucket] !=
+                    (bucket == writes[i].Bucket ? writes[i].Ticks : 0) ||
+                    (pio ? cost.Dma : cost.Pio)[bucket] != 0) {
+
+                    HdmiTestFail("%s write of %u bytes in %d ticks landed in the wrong bucket",
+                                 pio ? "PIO" : "DMA", writes[i].Length, (LONG) writes[i].Ticks);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+static VOID
+TestCostCorners(
+    VOID
+    )
+{
+    HDMI_PATH_COST  cost;
+    ULONG           bucket;
+    ULONG           length;
+
+    //
+    // Nothing measured, nothing by PIO.
+    //
+    RtlZeroMemory(&cost, sizeof(cost));
+
+    if (HdmiCostUsePio(&cost, 4) || cost.PioThreshold != 0) {
+        HdmiTestFail("PIO with nothing measured");
+    }
+
+    //
+    // PIO measured everywhere but DMA nowhere: no comparison, no PIO.
+    // Then DMA, dearer, in the first four buckets only, and a cheaper DMA
+    // in the sixth: the threshold stops at the first bucket it cannot
+    // compare.
+    //
+    for (bucket = 0; bucket < HDMI_COST_BUCKETS; bucket++) {
+        HdmiCostUpdate(&cost, TRUE, 1UL << (HDMI_COST_MIN_SHIFT + bucket), 100);
+    }
+
+    if (cost.PioThreshold != 0) {
+        HdmiTestFail("PIO up to %u bytes with no DMA measured", cost.PioThreshold);
+    }
+
+    for (bucket = 0; bucket < 4; bucket++) {
+        HdmiCostUpdate(&cost, FALSE, 1UL << (HDMI_COST_MIN_SHIFT + bucket), 200);
+    }
+
+    HdmiCostUpdate(&cost, FALSE, 1UL << (HDMI_COST_MIN_SHIFT + 5), 50);
+
+    length = 1UL << (HDMI_COST_MIN_SHIFT + 3);
+
+    if (cost.PioThreshold != length) {
+        HdmiTestFail("PIO up to %u bytes with DMA measured up to %u", cost.PioThreshold, length);
+    }
+
+    //
+    // The threshold itself goes by PIO, the byte after it and an empty
+    // write do not.
+    //
+    if (!HdmiCostUsePio(&cost, 1) || !HdmiCostUsePio(&cost, length) ||
+        HdmiCostUsePio(&cost, length + 1) || HdmiCostUsePio(&cost, 0)) {
+        HdmiTestFail("PIO up to %u bytes: wrong path at 1, %u, %u or 0 bytes",
+                     length, length, length + 1);
+    }
+
+    //
+    // Measuring the missing bucket, dearer by DMA, carries the threshold
+    // over it up to the sixth, where DMA was cheaper.
+    //
+    HdmiCostUpdate(&cost, FALSE, 1UL << (HDMI_COST_MIN_SHIFT + 4), 200);
+
+    length = 1UL << (HDMI_COST_MIN_SHIFT + 4);
+
+    if (cost.PioThreshold != length) {
+        HdmiTestFail("PIO up to %u bytes with DMA cheaper above %u", cost.PioThreshold, length);
+    }
+
+    //
+    // A tie goes to DMA.
+    //
+    RtlZeroMemory(&cost, sizeof(cost));
+    HdmiCostUpdate(&cost, TRUE, 1, 100);
+    HdmiCostUpdate(&cost, FALSE, 1, 100);
+
+    if (cost.PioThreshold != 0) {
+        HdmiTestFail("PIO up to %u bytes on a tie", cost.PioThreshold);
+    }
+}
+
+
+ULONG
+HdmiTestCost(
+    VOID
+    )
+{
+    ULONG   i;
+
+    for (i = 0; i < ARRAYSIZE(TestCostCases); i++) {
+        TestCostRun(&TestCostCases[i]);
+    }
+
+    TestCostAdapt();
+    TestCostBuckets();
+    TestCostCorners();
+
+    return HdmiTestFailures();
+}
@@ -0,0 +1,406 @@
+/*++
+    Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    TestMapCache.c
+
+Abstract:
+
+    Checks the buffer cache policy of MapCache.c: reuse of an unused
+    buffer of the same length, oldest first; eviction of unused buffers,
+    oldest first and no more than needed, to make room for a new one;
+    buffers that do not fit; lengths that would wrap the byte count.
+
+    Then a long random run of rings set up and freed, with some buffers
+    failing to allocate, against a plain model of the same policy: the
+    cache must hand out, evict and reserve what the model does, and its
+    byte count must stay that of the buffers it knows of and within the
+    limit.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include "HdmiModelTest.h"
+
+#define TEST_MAP_PAGE           4096
+#define TEST_MAP_LIMIT          (16 * TEST_MAP_PAGE)
+
+//
+// A buffer as Map.c would have it, and what the model knows of it.
+//
+typedef enum _TEST_MAP_STATE {
+    TestMapFree,                        // not allocated
+    TestMapInUse,
+    TestMapUnused,                      // in the cache
+} TEST_MAP_STATE;
+
+typedef struct _TEST_MAP_BUFFER {
+
+    HDMI_MAP_ENTRY  Entry;
+    TEST_MAP_STATE  State;
+    ULONG           Age;                // when put back, while unused
+
+} TEST_MAP_BUFFER, *PTEST_MAP_BUFFER;
+
+#define TEST_MAP_BUFFERS        64
+#define TEST_MAP_STEPS          200000
+
+
+static ULONG
+TestMapCount(
+    IN PLIST_ENTRY  List
+    )
+{
+    PLIST_ENTRY entry;
+    ULONG       count = 0;
+
+    for (entry = List->Flink; entry != List; entry = entry->Flink) {
+        count++;
+    }
+
+    return count;
+}
+
+
+static PTEST_MAP_BUFFER
+TestMapTake(
+    IN OUT PHDMI_MAP_CACHE  Cache,
+    IN     ULONG            Length,
+    OUT    PLIST_ENTRY      Evicted,
+    OUT    PBOOLEAN         Reserved
+    )
+{
+    PHDMI_MAP_ENTRY entry = HdmiMapCacheTake(Cache, Length, Evicted, Reserved);
+
+    return entry ? CONTAINING_RECORD(entry, TEST_MAP_BUFFER, Entry) : NULL;
+}
+
+
+static VOID
+TestMapBasics(
+    VOID
+    )
+{
+    HDMI_MAP_CACHE      cache;
+    TEST_MAP_BUFFER     buffers[4];
+    PTEST_MAP_BUFFER    taken;
+    LIST_ENTRY          evicted;
+    BOOLEAN             reserved;
+    ULONG               i;
+
+    RtlZeroMemory(buffers, sizeof(buffers));
+
+    HdmiMapCacheInitialize(&cache, TEST_MAP_LIMIT);
+
+    //
+    // An empty cache reserves: two buffers of a page, one of two and one
+    // of four, put back in that order.
+    //
+    for (i = 0; i < ARRAYSIZE(buffers); i++) {
+
+        buffers[i].Entry.Length = (i < 2 ? 1 : 2 * (i - 1)) * TEST_MAP_PAGE;
+
+        taken = TestMapTake(&cache, buffers[i].Entry.Length, &evicted, &reserved);
+
+        if (taken != NULL || !reserved || !IsListEmpty(&evicted)) {
+            HdmiTestFail("empty cache: %u bytes not reserved", buffers[i].Entry.Length);
+            return;
+        }
+    }
+
+    for (i = 0; i < ARRAYSIZE(buffers); i++) {
+        HdmiMapCachePut(&cache, &buffers[i].Entry);
+    }
+
+    if (cache.Bytes != 8 * TEST_MAP_PAGE) {
+        HdmiTestFail("%u bytes counted, not %u", cache.Bytes, 8 * TEST_MAP_PAGE);
+        return;
+    }
+
+    //
+    // The same length comes back, the older of two first, and it stays
+    // counted; then a length it has no buffer of is reserved as long as
+    // it fits, without evicting anything.
+    //
+    if (TestMapTake(&cache, 2 * TEST_MAP_PAGE, &evicted, &reserved) != &buffers[2] ||
+        reserved || !IsListEmpty(&evicted) ||
+        TestMapTake(&cache, TEST_MAP_PAGE, &evicted, &reserved) != &buffers[0] ||
+        TestMapTake(&cache, TEST_MAP_PAGE, &evicted, &reserved) != &buffers[1] ||
+        cache.Bytes != 8 * TEST_MAP_PAGE) {
+
+        HdmiTestFail("cached buffers not reused, oldest first");
+        return;
+    }
+
+    HdmiMapCachePut(&cache, &buffers[1].Entry);
+    HdmiMapCachePut(&cache, &buffers[0].Entry);
+    HdmiMapCachePut(&cache, &buffers[2].Entry);
+
+    if (TestMapTake(&cache, 8 * TEST_MAP_PAGE, &evicted, &reserved) != NULL ||
+        !reserved || !IsListEmpty(&evicted) || cache.Bytes != TEST_MAP_LIMIT) {
+
+        HdmiTestFail("%u bytes counted after filling the cache, not %u",
+                     cache.Bytes, TEST_MAP_LIMIT);
+        return;
+    }
+
+    //
+    // Full now, unused in the order 3, 1, 0, 2. Five pages evict the
+    // oldest two, no more, and are counted in their place.
+    //
+    if (TestMapTake(&cache, 5 * TEST_MAP_PAGE, &evicted, &reserved) != NULL || !reserved ||
+        TestMapCount(&evicted) != 2 ||
+        evicted.Flink != &buffers[3].Entry.Link ||
+        evicted.Blink != &buffers[1].Entry.Link ||
+        cache.Bytes != TEST_MAP_LIMIT ||
+        TestMapCount(&cache.Unused) != 2) {
+
+        HdmiTestFail("eviction not of the oldest two: %u evicted, %u bytes counted",
+                     TestMapCount(&evicted), cache.Bytes);
+        return;
+    }
+
+    //
+    // A buffer that could not be created gives its room back.
+    //
+    HdmiMapCacheUnreserve(&cache, 5 * TEST_MAP_PAGE);
+
+    if (cache.Bytes != TEST_MAP_LIMIT - 5 * TEST_MAP_PAGE) {
+        HdmiTestFail("%u bytes counted after giving back a reservation", cache.Bytes);
+        return;
+    }
+
+    //
+    // Larger than the whole cache: never reserved. A length that would
+    // wrap the byte count must not sneak past the limit either.
+    //
+    if (TestMapTake(&cache, TEST_MAP_LIMIT + 1, &evicted, &reserved) != NULL || reserved ||
+        cache.Bytes > TEST_MAP_LIMIT) {
+
+        HdmiTestFail("%u bytes reserved in a cache of %u", TEST_MAP_LIMIT + 1, TEST_MAP_LIMIT);
+        return;
+    }
+
+    HdmiMapCacheInitialize(&cache, TEST_MAP_LIMIT);
+    TestMapTake(&cache, TEST_MAP_PAGE, &evicted, &reserved);
+
+    if (TestMapTake(&cache, 0 - TEST_MAP_PAGE + 1, &evicted, &reserved) != NULL || reserved ||
+        cache.Bytes != TEST_MAP_PAGE) {
+
+        HdmiTestFail("%u bytes reserved on top of %u", 0 - TEST_MAP_PAGE + 1, TEST_MAP_PAGE);
+        return;
+    }
+}
+
+
+static VOID
+TestMapRandom(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Sets up and frees rings of random slot sizes against a model that
+    keeps the state of every buffer. A setup whose buffer cannot be
+    created, one in eight or for want of test buffers, gives back its
+    reservation the way HdmiMapAcquire does.
+
+--*/
+{
+    static TEST_MAP_BUFFER  buffers[TEST_MAP_BUFFERS];
+    static const ULONG      lengths[] = { 1, 2, 3, 5, 8 };
+
+    HDMI_MAP_CACHE      cache;
+    PTEST_MAP_BUFFER    taken;
+    PTEST_MAP_BUFFER    expected;
+    PTEST_MAP_BUFFER    oldest;
+    PLIST_ENTRY         entry;
+    LIST_ENTRY          evicted;
+    BOOLEAN             reserved;
+    ULONG               length;
+    ULONG               bytes;
+    ULONG               age = 0;
+    ULONG               reuses = 0;
+    ULONG               evictions = 0;
+    ULONG               refusals = 0;
+    ULONG               step;
+    ULONG               i;
+    ULONG               n;
+
+    RtlZeroMemory(buffers, sizeof(buffers));
+
+    HdmiMapCacheInitialize(&cache, TEST_MAP_LIMIT);
+
+    for (step = 0; step < TEST_MAP_STEPS; step++) {
+
+        //
+        // Half the time, free the ring of the first buffer in use from a
+        // random one on.
+        //
+        i = HdmiTestRandom() % TEST_MAP_BUFFERS;
+
+        for (n = 0; n < TEST_MAP_BUFFERS; n++) {
+            if (buffers[(i + n) % TEST_MAP_BUFFERS].State == TestMapInUse) {
+                break;
+            }
+        }
+
+        i = (i + n) % TEST_MAP_BUFFERS;
+
+        if (n < TEST_MAP_BUFFERS && HdmiTestRandom() % 2 == 0) {
+
+            buffers[i].State = TestMapUnused;
+            buffers[i].Age = age++;
+            HdmiMapCachePut(&cache, &buffers[i].Entry);
+            continue;
+        }
+
+        length = lengths[HdmiTestRandom() % ARRAYSIZE(lengths)] * TEST_MAP_PAGE;
+
+        //
+        // The model: the oldest unused buffer of the length if there is
+        // one, else the room taken by the unused buffers oldest first.
+        //
+        expected = NULL;
+        bytes = 0;
+
+        for (i = 0; i < TEST_MAP_BUFFERS; i++) {
+
+            if (buffers[i].State == TestMapUnused && buffers[i].Entry.Length == length &&
+                (expected == NULL || buffers[i].Age < expected->Age)) {
+                expected = &buffers[i];
+            }
+
+            if (buffers[i].State != TestMapFree) {
+                bytes += buffers[i].Entry.Length;
+            }
+        }
+
+        taken = TestMapTake(&cache, length, &evicted, &reserved);
+
+        if (taken != expected) {
+            HdmiTestFail("step %u: buffer %d for %u bytes, not %d", step,
+                         taken ? (LONG) (taken - buffers) : -1, length,
+                         expected ? (LONG) (expected - buffers) : -1);
+            return;
+        }
+
+        if (taken != NULL) {
+
+            taken->State = TestMapInUse;
+            reuses++;
+
+            if (reserved || !IsListEmpty(&evicted)) {
+                HdmiTestFail("step %u: reused buffer reserved or evicting", step);
+                return;
+            }
+
+            continue;
+        }
+
+        while (bytes + length > TEST_MAP_LIMIT) {
+
+            oldest = NULL;
+
+            for (i = 0; i < TEST_MAP_BUFFERS; i++) {
+                if (buffers[i].State == TestMapUnused &&
+                    (oldest == NULL || buffers[i].Age < oldest->Age)) {
+                    oldest = &buffers[i];
+                }
+            }
+
+            if (oldest == NULL) {
+                break;
+            }
+
+            if (IsListEmpty(&evicted) ||
+                RemoveHeadList(&evicted) != &oldest->Entry.Link) {
+                HdmiTestFail("step %u: buffer %d not evicted for %u bytes",
+                             step, (LONG) (oldest - buffers), length);
+                return;
+            }
+
+            oldest->State = TestMapFree;
+            bytes -= oldest->Entry.Length;
+            evictions++;
+        }
+
+        if (!IsListEmpty(&evicted)) {
+            HdmiTestFail("step %u: %u buffers evicted beyond need", step, TestMapCount(&evicted));
+            return;
+        }
+
+        if (reserved != (bytes + length <= TEST_MAP_LIMIT)) {
+            HdmiTestFail("step %u: %u bytes %sreserved with %u counted", step,
+                         length, reserved ? "" : "not ", bytes);
+            return;
+        }
+
+        if (!reserved) {
+            refusals++;
+        } else {
+
+            bytes += length;
+
+            for (i = 0; i < TEST_MAP_BUFFERS; i++) {
+                if (buffers[i].State == TestMapFree) {
+                    break;
+                }
+            }
+
+            if (i == TEST_MAP_BUFFERS || HdmiTestRandom() % 8 == 0) {
+                HdmiMapCacheUnreserve(&cache, length);
+                bytes -= length;
+            } else {
+                buffers[i].State = TestMapInUse;
+                buffers[i].Entry.Length = length;
+            }
+        }
+
+        if (cache.Bytes != bytes || cache.Bytes > TEST_MAP_LIMIT) {
+            HdmiTestFail("step %u: %u bytes counted, not %u", step, cache.Bytes, bytes);
+            return;
+        }
+    }
+
+    //
+    // And the list holds exactly the unused buffers, oldest first.
+    //
+    age = 0;
+
+    for (entry = cache.Unused.Flink; entry != &cache.Unused; entry = entry->Flink) {
+
+        taken = CONTAINING_RECORD(entry, TEST_MAP_BUFFER, Entry.Link);
+
+        if (taken->State != TestMapUnused || taken->Age < age) {
+            HdmiTestFail("buffer %d out of place in the cache", (LONG) (taken - buffers));
+            return;
+        }
+
+        age = taken->Age;
+    }
+
+    printf("    %u steps: %u reused, %u evicted, %u refused\n",
+           TEST_MAP_STEPS, reuses, evictions, refusals);
+}
+
+
+ULONG
+HdmiTestMapCache(
+    VOID
+    )
+{
+    TestMapBasics();
+    TestMapRandom();
+
+    return HdmiTestFailures();
+}
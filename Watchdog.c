@@ -0,0 +1,296 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Watchdog.c
+
+Abstract:
+
+    Write channel watchdog. Every transfer arms a one-shot timer for the
+    time the measured bandwidth predicts for it. If the completion
+    interrupt has not come by then, the transfer is failed with
+    STATUS_IO_DEVICE_ERROR, only the write channel is reset and the channel
+    is handed to the next transfer, so a lost interrupt costs one frame
+    instead of a hung queue. STATUS_IO_TIMEOUT is kept for frames the
+    scheduler drops as late and for group frames given up on because
+    another card did not arm in time.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include "precomp.h"
+
+#include "Watchdog.tmh"
+
+
+NTSTATUS
+HdmiWatchdogCreate(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Creates the watchdog timer. It is serialized with the queues and the
+    DPC, so its callback sees the channel state under the device lock.
+
+--*/
+{
+    NTSTATUS                status;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, HdmiEvtWatchdogTimer);
+    timerConfig.AutomaticSerialization = TRUE;
+
+#if (KMDF_VERSION_MINOR >= 13)
+    //
+    // The deadlines are a few milliseconds; the default clock tick would
+    // add up to 15.6 of them.
+    //
+    timerConfig.UseHighResolutionTimer = WdfTrue;
+#endif
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = DevExt->Device;
+
+    status = WdfTimerCreate( &timerConfig,
+                             &attributes,
+                             &DevExt->WatchdogTimer );
+
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfTimerCreate (watchdog) failed: %!STATUS!", status);
+    }
+
+    return status;
+}
+
+
+VOID
+HdmiWatchdogArm(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Called as a transfer of Length bytes is programmed. Sets the stall
+    deadline, HDMI_WATCHDOG_FACTOR times the expected duration but no
+    less than HDMI_WATCHDOG_MIN_MS, and (re)starts the timer for it.
+
+--*/
+{
+    LONGLONG    ticksPerMb = DevExt->WatchdogTicksPerMb;
+    LONGLONG    timeout;
+
+    if (ticksPerMb == 0) {
+        ticksPerMb = DevExt->TimestampFrequency / HDMI_WATCHDOG_DEFAULT_MBPS;
+    }
+
+    timeout = HDMI_WATCHDOG_FACTOR * (((LONGLONG) Length * ticksPerMb) >> 20);
+
+    if (timeout < DevExt->TimestampFrequency * HDMI_WATCHDOG_MIN_MS / 1000) {
+        timeout = DevExt->TimestampFrequency * HDMI_WATCHDOG_MIN_MS / 1000;
+    }
+
+    DevExt->WatchdogTimeout = timeout;
+    DevExt->WatchdogArmTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    WdfTimerStart( DevExt->WatchdogTimer,
+                   -(timeout * 10000000 / DevExt->TimestampFrequency) - 1 );
+}
+
+
+VOID
+HdmiWatchdogUpdate(
+    IN PDEVICE_EXTENSION DevExt,
+    IN ULONG             Length,
+    IN LONGLONG          Ticks
+    )
+/*++
+Routine Description:
+
+    Folds the duration of a finished transfer into the bandwidth the
+    deadlines are computed from. Short transfers are mostly setup time
+    and would make the estimate too pessimistic.
+
+--*/
+{
+    LONGLONG    ticksPerMb;
+
+    if (Length < HDMI_WATCHDOG_MIN_SAMPLE || Ticks <= 0) {
+        return;
+    }
+
+    ticksPerMb = (Ticks << 20) / Length;
+
+    if (DevExt->WatchdogTicksPerMb == 0) {
+        DevExt->WatchdogTicksPerMb = ticksPerMb;
+    } else {
+        DevExt->WatchdogTicksPerMb += (ticksPerMb - DevExt->WatchdogTicksPerMb) / 8;
+    }
+}
+
+
+VOID
+HdmiResetWriteChannel(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Stops the write engine and clears its descriptor state. The read
+    channel is not touched. The next transfer programs the channel's
+    registers afresh.
+
+    The read of CtrBit returns only after everything the engine posted
+    before it stopped, an EPLAST write-back or an interrupt message, has
+    reached the host, so nothing of the old transfer lands in a table
+    after its Eplast is set IDLE here. An interrupt of it that the ISR
+    has yet to see finds no table on the channel.
+
+--*/
+{
+    WdfInterruptAcquireLock( DevExt->Interrupt );
+
+    HdmiRegStrobe( DevExt, HDMI_REG(WriteCtr.CtrBit), 0xffffffff );
+    HdmiRegStrobe( DevExt, HDMI_REG(WriteCtr.CtrBit), 0 );
+
+    (VOID) HdmiRegRead( DevExt, HDMI_REG(WriteCtr.CtrBit) );
+
+    HdmiRegInvalidate( DevExt, HDMI_REG(WriteCtr), sizeof(DMA_TRANSFER_CTR) );
+
+    if (DevExt->WriteTable != NULL) {
+        DevExt->WriteTable->Eplast = HDMI_EPLAST_IDLE;
+        DevExt->WriteTable = NULL;
+    }
+
+    WdfInterruptReleaseLock( DevExt->Interrupt );
+}
+
+
+LONGLONG
+HdmiWriteTransferStart(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+Routine Description:
+
+    Returns when the transfer on the channel began to run: when it was
+    programmed or, for a group frame, when the doorbells were rung,
+    whichever is later. Its deadline counts from then.
+
+--*/
+{
+    if (DevExt->WriteStartTime > DevExt->WatchdogArmTime) {
+        return DevExt->WriteStartTime;
+    }
+
+    return DevExt->WatchdogArmTime;
+}
+
+
+VOID
+HdmiAbortWriteTransfer(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+Routine Description:
+
+    Resets the write channel and fails the transfer on it with Status.
+    The engine cannot be stopped at a descriptor boundary, so the frame
+    is cut off wherever it was. An interrupt it raised before the reset
+    is recognized as stale by the ISR, see HdmiResetWriteChannel.
+
+    The caller hands the channel on with HdmiStartNextWrite.
+
+--*/
+{
+    HdmiResetWriteChannel(DevExt);
+
+    if (!DevExt->XferDirect) {
+
+        NTSTATUS status;
+
+        (VOID) WdfDmaTransactionDmaCompletedFinal( DevExt->WriteDmaTransaction,
+                                                   0,
+                                                   &status );
+    }
+
+    HdmiCompleteWriteTransfer(DevExt, Status);
+
+    DevExt->XferStream = NULL;
+}
+
+
+VOID
+HdmiEvtWatchdogTimer(
+    IN WDFTIMER Timer
+    )
+/*++
+Routine Description:
+
+    Runs when the deadline of the transfer on the channel may have
+    passed. A group frame whose doorbells have not been rung is not
+    running yet, and a transfer whose interrupt has arrived is about to
+    be completed by the DPC; neither is stalled. A group frame that has
+    waited HDMI_GROUP_ARM_TIMEOUT_MS for the other members gives the
+    group up, see HdmiGroupArmTimeout.
+
+--*/
+{
+    PDEVICE_EXTENSION   devExt;
+    LONGLONG            start;
+    LONGLONG            elapsed;
+
+    devExt = HdmiGetDeviceContext(WdfTimerGetParentObject(Timer));
+
+    start = HdmiWriteTransferStart(devExt);
+
+    if (devExt->XferSource == HdmiXferNone ||
+        devExt->IsrSequence == devExt->WriteSequence) {
+        return;
+    }
+
+    elapsed = KeQueryPerformanceCounter(NULL).QuadPart - start;
+
+    if (devExt->XferSource == HdmiXferGroup &&
+        devExt->Group->ArmStatus != STATUS_SUCCESS) {
+
+        if (elapsed >= devExt->TimestampFrequency * HDMI_GROUP_ARM_TIMEOUT_MS / 1000) {
+            HdmiGroupArmTimeout(devExt);
+        }
+
+        WdfTimerStart( Timer,
+                       WDF_REL_TIMEOUT_IN_MS(HDMI_WATCHDOG_MIN_MS) );
+        return;
+    }
+
+    if (elapsed < devExt->WatchdogTimeout) {
+
+        WdfTimerStart( Timer,
+                       WDF_REL_TIMEOUT_IN_MS(HDMI_WATCHDOG_MIN_MS) );
+        return;
+    }
+
+    TraceEvents(TRACE_LEVEL_ERROR, DBG_DPC,
+                "Write channel stalled: source %d, %I64d of %I64d ticks",
+                devExt->XferSource, elapsed, devExt->WatchdogTimeout);
+
+    devExt->ChannelResets++;
+
+    HdmiAbortWriteTransfer(devExt, STATUS_IO_DEVICE_ERROR);
+
+    HdmiStartNextWrite(devExt);
+}
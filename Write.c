@@ -25,9 +25,6 @@ Environment:
 #include "Write.tmh"
 
 
-ULONG_PTR pa_buf;
-ULONG     dma_num_buf;
-
 //-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
@@ -62,8 +59,9 @@ Return Value:
 
 --*/
 {
-    NTSTATUS          status = STATUS_UNSUCCESSFUL;
     PDEVICE_EXTENSION devExt = NULL;
+    PHDMI_STREAM_CONTEXT stream;
+    NTSTATUS          status;
 
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
@@ -75,23 +73,78 @@ Return Value:
 
 	
     devExt = HdmiGetDeviceContext(WdfIoQueueGetDevice(Queue));
-		devExt->Request = Request;
+
     //
     // Validate the Length parameter.
     //
     if (Length > HDMI_SRAM_SIZE)  {
-        status = STATUS_INVALID_BUFFER_SIZE;
-        goto CleanUp;
+        WdfRequestComplete(Request, STATUS_INVALID_BUFFER_SIZE);
+        return;
+    }
+
+    stream = HdmiGetStreamContext(WdfRequestGetFileObject(Request));
+
+    if (!HdmiSramFits(devExt, stream->DeviceOffset, Length))  {
+        WdfRequestComplete(Request, STATUS_INVALID_BUFFER_SIZE);
+        return;
     }
-			if (devExt->DMAcompleted == 7)
-			{
-					devExt->DMAcompleted = 1;
-			}
-			else if (devExt->DMAcompleted == 1)
-			{
-					WdfDmaTransactionDmaCompleted( devExt->WriteDmaTransaction,
-                                                       &status );
-			}    
+
+    //
+    // Writes wait on their stream's queue; the streams take turns on the
+    // write channel.
+    //
+    status = WdfRequestForwardToIoQueue(Request, stream->WriteQueue);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    HdmiPowerStreamActive(devExt, stream);
+
+    HdmiStartNextWrite(devExt);
+}
+
+VOID
+HdmiStartWriteRequest(
+    IN PDEVICE_EXTENSION    devExt,
+    IN PHDMI_STREAM_CONTEXT Stream,
+    IN WDFREQUEST           Request
+    )
+/*++
+
+Routine Description:
+
+    Starts the DMA for a write request of Stream on the idle write
+    channel. On failure the request is completed here.
+
+--*/
+{
+    NTSTATUS          status = STATUS_UNSUCCESSFUL;
+    WDF_REQUEST_PARAMETERS  params;
+
+    //
+    // HdmiEvtIoWrite checked the offset the stream had then; SET_STREAM
+    // may have moved it since.
+    //
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (!HdmiSramFits(devExt, Stream->DeviceOffset,
+                      params.Parameters.Write.Length)) {
+        WdfRequestComplete(Request, STATUS_INVALID_BUFFER_SIZE);
+        return;
+    }
+
+    devExt->WriteDeviceOffset = Stream->DeviceOffset;
+
+    //
+    // Small writes may be cheaper through the SRAM mapping.
+    //
+    if (HdmiPioWriteRequest(devExt, Stream, Request)) {
+        devExt->WriteDeviceOffset = 0;
+        return;
+    }
+
     //
     // Following code illustrates two different ways of initializing a DMA
     // transaction object. If ASSOC_WRITE_REQUEST_WITH_DMA_TRANSACTION is
@@ -199,6 +252,9 @@ Return Value:
     //
     // Execute this DmaTransaction transaction.
     //
+    devExt->XferSource = HdmiXferRequest;
+    devExt->WriteStartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
     status = WdfDmaTransactionExecute( devExt->WriteDmaTransaction, 
                                        WDF_NO_CONTEXT);
 
@@ -225,84 +281,90 @@ CleanUp:
     // If there are errors, then clean up and complete the Request.
     //
     if (!NT_SUCCESS(status)) {
+        devExt->XferSource = HdmiXferNone;
+        devExt->WriteDeviceOffset = 0;
         WdfDmaTransactionRelease(devExt->WriteDmaTransaction);        
         WdfRequestComplete(Request, status);
     }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
-                "<-- HdmiEvtIoWrite: %!STATUS!", status);
+                "<-- HdmiStartWriteRequest: %!STATUS!", status);
 
     return;
 }
 
-//-----------------------------------------------------------------------------
-//
-//-----------------------------------------------------------------------------
-BOOLEAN
-HdmiEvtProgramWriteDma(
-    IN  WDFDMATRANSACTION       Transaction,
-    IN  WDFDEVICE               Device,
-    IN  PVOID                   Context,
-    IN  WDF_DMA_DIRECTION       Direction,
-    IN  PSCATTER_GATHER_LIST    SgList
+static VOID
+HdmiProgramWriteDescriptors(
+    IN PDEVICE_EXTENSION    devExt,
+    IN PSCATTER_GATHER_LIST SgList,
+    IN size_t               offset
     )
 /*++
 
 Routine Description:
 
+    Builds the write descriptor table for SgList and starts the channel,
+    or only arms it for a group frame.
+
 Arguments:
 
+    devExt  - Pointer to our DEVICE_EXTENSION
+
+    SgList  - Logical addresses of the data
+
+    offset  - Bytes of the transfer already sent by earlier stages
+
 Return Value:
 
+    None
+
 --*/
 {
-    PDEVICE_EXTENSION        devExt;
-    size_t                   offset = 0;
-    size_t                   bytecount = 0;
-    unsigned int             dmacount = 0;
     PDMA_TRANSFER_ELEMENT    dteVA;
     ULONG_PTR                dteLA;
-    BOOLEAN                  errors;
+    PDMA_DESC_HEADER         header;
+    BOOLEAN                  poll;
+    ULONG                    ctrBit;
     ULONG                    i;
-
-    UNREFERENCED_PARAMETER( Context );
-    UNREFERENCED_PARAMETER( Direction );
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
-                "--> HdmiEvtProgramWriteDma");
+    size_t                   first = offset;
 
     //
-    // Initialize locals
+    // Every transfer gets the EPLAST write-back, by which the ISR tells its
+    // interrupt from a late one, see HdmiEvtInterruptIsr. A polled ring's
+    // goes to a table of its own, so the player sees the frame leave
+    // without waiting for the interrupt.
     //
-    devExt = HdmiGetDeviceContext(Device);
-    errors = FALSE;
+    poll = (BOOLEAN) (devExt->XferSource == HdmiXferRing &&
+                      devExt->XferRing->Poll);
+    ctrBit = HDMI_DMA_CTR_EPLAST_ENA;
 
-    //
-    // Get the number of bytes as the offset to the beginning of this
-    // Dma operations transfer location in the buffer.
-    //
-     offset = WdfDmaTransactionGetBytesTransferred(Transaction);
+    if (poll) {
 
+        PHDMI_MAPPED_BUFFER table = devExt->XferRing->PollTable;
 
+        header = (PDMA_DESC_HEADER)
+            ((PUCHAR) table->VirtualAddress + HDMI_POLL_TABLE_OFFSET);
+        dteLA = (ULONG_PTR) table->LogicalAddress.QuadPart + HDMI_POLL_TABLE_OFFSET;
+
+    } else {
+
+        header = (PDMA_DESC_HEADER) devExt->WriteCommonBuffer1Base;
+        dteLA = (((ULONG_PTR)devExt->WriteCommonBuffer1BaseLA.HighPart << 32) | devExt->WriteCommonBuffer1BaseLA.LowPart);
+    }
 
         //
         // Setup the pointer to the next DMA_TRANSFER_ELEMENT
         // for both virtual and physical address references.
         //
-        dteVA = (PDMA_TRANSFER_ELEMENT) devExt->WriteCommonBuffer1Base + 16;
-        dteLA = (((ULONG_PTR)devExt->WriteCommonBuffer1BaseLA.HighPart << 32) | devExt->WriteCommonBuffer1BaseLA.LowPart);
-		 devExt->CommonBufferPA = dteLA;
-		 devExt->DmaNumber = SgList->NumberOfElements;
-		 
-		pa_buf = dteLA;
-		dma_num_buf = SgList->NumberOfElements;
+        dteVA = (PDMA_TRANSFER_ELEMENT) header + 16;
 
         for (i=0; i < SgList->NumberOfElements; i++) 
         {
 
                 if (i == (SgList->NumberOfElements-1))
                 {  
-                    dteVA->DescPtr = 0x40000000 | (SgList->Elements[i].Length >> 2);
+                    dteVA->DescPtr = 0x40000000 | HDMI_DESC_EPLAST_ENA |
+                                     (SgList->Elements[i].Length >> 2);
                 }
                 else
                 {
@@ -319,7 +381,7 @@ Return Value:
             dteVA->HostAddressLow  = SgList->Elements[i].Address.LowPart;
             dteVA->HostAddressHigh = SgList->Elements[i].Address.HighPart;
 
-            dteVA->DeviceAddress   = (ULONG) offset;
+            dteVA->DeviceAddress   = devExt->WriteDeviceOffset + (ULONG) offset;
 
 
             //
@@ -335,25 +397,110 @@ Return Value:
         }
 
 	//WdfRequestMarkCancelable(devExt->Request, HdmiEvtRequestCancel);
+
+    header->Eplast = HDMI_EPLAST_IDLE;
+
+    if (poll) {
+
+        PHDMI_RING ring = devExt->XferRing->Ring;
+
+        ring->PollLastDesc = SgList->NumberOfElements - 1;
+        KeMemoryBarrier();
+        ring->PollSequence = devExt->XferRing->SqHead;
+    }
+
+    HdmiWatchdogArm(devExt, (ULONG) (offset - first));
+
+    HdmiStatsCpu(devExt)->Descriptors += SgList->NumberOfElements;
 	
 		WdfInterruptAcquireLock( devExt->Interrupt );
+
+    devExt->WriteTable    = header;
+    devExt->WriteLastDesc = SgList->NumberOfElements - 1;
+    devExt->WriteSequence++;
 		
-    WRITE_REGISTER_ULONG( (PULONG)&devExt->Regs->WriteCtr.CtrBit,
-            0xffffffff );
-
-    WRITE_REGISTER_ULONG( (PULONG)&devExt->Regs->WriteCtr.CtrBit,
-                            0x00000 | SgList->NumberOfElements );
-  
-    WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->WriteCtr.DescTableAddressHigh,
-                            dteLA >> 32 );
- 
-    WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->WriteCtr.DescTableAddressLow,
-                            dteLA & 0xffffffff );
- 
-    WRITE_REGISTER_ULONG( (PULONG) &devExt->Regs->WriteCtr.LastDesc,
-                            SgList->NumberOfElements - 1 );
+    //
+    // The table is at the same address for every frame but those of
+    // polled rings and most frames need the same number of descriptors,
+    // so the shadow usually leaves only the LastDesc doorbell, which
+    // starts the engine and goes last.
+    //
+    HdmiRegWrite( devExt, HDMI_REG(WriteCtr.CtrBit),
+                  ctrBit | SgList->NumberOfElements );
+
+    HdmiRegWrite( devExt, HDMI_REG(WriteCtr.DescTableAddressHigh),
+                  (ULONG) (dteLA >> 32) );
+
+    HdmiRegWrite( devExt, HDMI_REG(WriteCtr.DescTableAddressLow),
+                  (ULONG) (dteLA & 0xffffffff) );
+
+    if (devExt->XferSource == HdmiXferGroup) {
+        //
+        // Armed only; the doorbell is rung together with the other
+        // cards of the group.
+        //
+        HdmiGroupSetDoorbell( devExt, SgList->NumberOfElements - 1 );
+    } else {
+        HdmiRegStrobe( devExt, HDMI_REG(WriteCtr.LastDesc),
+                       SgList->NumberOfElements - 1 );
+    }
 	
 		WdfInterruptReleaseLock( devExt->Interrupt );
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//-----------------------------------------------------------------------------
+BOOLEAN
+HdmiEvtProgramWriteDma(
+    IN  WDFDMATRANSACTION       Transaction,
+    IN  WDFDEVICE               Device,
+    IN  PVOID                   Context,
+    IN  WDF_DMA_DIRECTION       Direction,
+    IN  PSCATTER_GATHER_LIST    SgList
+    )
+/*++
+
+Routine Description:
+
+Arguments:
+
+Return Value:
+
+--*/
+{
+    PDEVICE_EXTENSION        devExt;
+    size_t                   offset = 0;
+    BOOLEAN                  errors;
+
+    UNREFERENCED_PARAMETER( Context );
+    UNREFERENCED_PARAMETER( Direction );
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE,
+                "--> HdmiEvtProgramWriteDma");
+
+    //
+    // Initialize locals
+    //
+    devExt = HdmiGetDeviceContext(Device);
+    errors = FALSE;
+
+    //
+    // Everything since the transfer was started went into allocating map
+    // registers and building SgList.
+    //
+    devExt->XferMapTicks =
+        KeQueryPerformanceCounter(NULL).QuadPart - devExt->WriteStartTime;
+
+    //
+    // Get the number of bytes as the offset to the beginning of this
+    // Dma operations transfer location in the buffer.
+    //
+     offset = WdfDmaTransactionGetBytesTransferred(Transaction);
+
+    HdmiProgramWriteDescriptors(devExt, SgList, offset);
+
     //
     // NOTE: This shows how to process errors which occur in the
     //       PFN_WDF_PROGRAM_DMA function in general.
@@ -368,7 +515,7 @@ Return Value:
 
         (VOID) WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
         ASSERT(NT_SUCCESS(status));
-        HdmiWriteRequestComplete( Transaction, STATUS_INVALID_DEVICE_STATE );
+        HdmiCompleteWriteTransfer( devExt, STATUS_INVALID_DEVICE_STATE );
         TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
                     "<-- HdmiEvtProgramWriteDma: error ****");
         return FALSE;
@@ -381,6 +528,100 @@ Return Value:
 }
 
 
+VOID
+HdmiCompleteWriteTransfer(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+
+Routine Description:
+
+    Hands the transfer on the write channel back to whoever started it.
+    Its DMA transaction, if it has one, must already be completed.
+
+Arguments:
+
+    DevExt  - Pointer to our DEVICE_EXTENSION
+
+    Status  - Outcome of the transfer
+
+Return Value:
+
+    None
+
+--*/
+{
+    if (!NT_SUCCESS(Status) && Status != STATUS_CANCELLED) {
+        DevExt->HwErrCount++;
+        HdmiStatsCpu(DevExt)->Errors++;
+    }
+
+    if (DevExt->XferSource == HdmiXferRing) {
+        HdmiRingTransferComplete( DevExt, Status );
+    } else if (DevExt->XferSource == HdmiXferBatch) {
+        HdmiBatchTransferComplete( DevExt, Status );
+    } else if (DevExt->XferSource == HdmiXferCalibrate) {
+        HdmiCalibrateTransferComplete( DevExt, Status );
+    } else if (DevExt->XferSource == HdmiXferGroup) {
+        HdmiGroupTransferComplete( DevExt, Status );
+    } else if (DevExt->XferSource == HdmiXferChunk) {
+        HdmiStreamChunkComplete( DevExt, Status );
+    } else if (DevExt->XferSource == HdmiXferSelfTest) {
+        HdmiSelfTestTransferComplete( DevExt, Status );
+    } else {
+        HdmiWriteRequestComplete( DevExt->WriteDmaTransaction, Status );
+    }
+}
+
+
+VOID
+HdmiProgramWriteDirect(
+    IN PDEVICE_EXTENSION DevExt,
+    IN PHYSICAL_ADDRESS  LogicalAddress,
+    IN ULONG             Length
+    )
+/*++
+
+Routine Description:
+
+    Starts a write from memory that is already mapped for DMA, a
+    pre-mapped ring slot. No DMA transaction is involved; the DPC sees
+    XferDirect and takes the length from XferDirectLength.
+
+Arguments:
+
+    DevExt          - Pointer to our DEVICE_EXTENSION
+
+    LogicalAddress  - Device-visible address of the data
+
+    Length          - Bytes to write
+
+Return Value:
+
+    None
+
+--*/
+{
+    DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT)
+    UCHAR                   sgBuffer[FIELD_OFFSET(SCATTER_GATHER_LIST, Elements) +
+                                     sizeof(SCATTER_GATHER_ELEMENT)];
+    PSCATTER_GATHER_LIST    sgList = (PSCATTER_GATHER_LIST) sgBuffer;
+
+    RtlZeroMemory(sgBuffer, sizeof(sgBuffer));
+
+    sgList->NumberOfElements    = 1;
+    sgList->Elements[0].Address = LogicalAddress;
+    sgList->Elements[0].Length  = Length;
+
+    DevExt->XferDirect       = TRUE;
+    DevExt->XferDirectLength = Length;
+    DevExt->XferMapTicks     = 0;
+
+    HdmiProgramWriteDescriptors(DevExt, sgList, 0);
+}
+
+
 VOID
 HdmiWriteRequestComplete(
     IN WDFDMATRANSACTION  DmaTransaction,
@@ -436,11 +677,522 @@ Return Value:
 
     WdfDmaTransactionRelease(DmaTransaction);        
 
+    devExt->XferSource = HdmiXferNone;
+    devExt->WriteDeviceOffset = 0;
+
     WdfRequestCompleteWithInformation( request, Status, bytesTransferred);
 
 }
 
 
+VOID
+HdmiStartNextWrite(
+    IN PDEVICE_EXTENSION DevExt
+    )
+/*++
+
+Routine Description:
+
+    Called whenever the write channel may have gone idle. A group frame
+    waiting to be armed goes first, then the picture streams, then the
+    other streams and, when there is nothing else to do, a step of the
+    transfer path calibration. Batches are sent in the turns of the
+    stream that submitted them.
+
+Arguments:
+
+    DevExt - Pointer to our DEVICE_EXTENSION
+
+Return Value:
+
+--*/
+{
+    if (DevExt->XferSource != HdmiXferNone) {
+        return;
+    }
+
+    if (DevExt->LowPower) {
+        //
+        // Leaving D0; the channel is idle now, see HdmiPowerQuiesce.
+        //
+        KeSetEvent(&DevExt->QuiesceEvent, IO_NO_INCREMENT, FALSE);
+        return;
+    }
+
+    if (DevExt->Group != NULL && HdmiGroupArm(DevExt)) {
+        return;
+    }
+
+    if (DevExt->SelfTestPending && HdmiSelfTestStartNext(DevExt)) {
+        return;
+    }
+
+    if (HdmiStreamStartNext(DevExt, HDMI_STREAM_CLASS_PICTURE)) {
+        return;
+    }
+
+    if (HdmiStreamStartNext(DevExt, HDMI_STREAM_CLASS_NORMAL)) {
+        return;
+    }
+
+    //
+    // Nothing more will land on any ring for now; don't leave
+    // IOCTL_HDMI_RING_ENTER callers waiting for it.
+    //
+    HdmiRingWakeWaiters(DevExt, NULL, STATUS_SUCCESS);
+
+    HdmiCalibrateStartNext(DevExt);
+}
+
+
+VOID
+HdmiBatchPrepare(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+
+Routine Description:
+
+    Called for IOCTL_HDMI_WRITE_BATCH from HdmiEvtIoInCallerContext.
+    Validates the batch, probes and locks every frame while we are still
+    in the caller's process and then queues the request.
+
+Arguments:
+
+    DevExt  - Pointer to our DEVICE_EXTENSION
+
+    Request - The batch request; completed here on failure.
+
+Return Value:
+
+--*/
+{
+    NTSTATUS              status;
+    PHDMI_BATCH           batch;
+    size_t                inputLength;
+    PVOID                 results;
+    PHDMI_BATCH_CONTEXT   batchCtx;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    ULONG                 frameCount;
+    ULONG                 length;
+    ULONG                 i;
+    PMDL                  mdl;
+
+    status = WdfRequestRetrieveInputBuffer( Request,
+                                            FIELD_OFFSET(HDMI_BATCH, Frames),
+                                            &batch,
+                                            &inputLength );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    frameCount = batch->FrameCount;
+
+    if (frameCount == 0 || frameCount > HDMI_BATCH_MAX_FRAMES ||
+        inputLength < FIELD_OFFSET(HDMI_BATCH, Frames) +
+                      frameCount * sizeof(HDMI_BATCH_FRAME)) {
+        status = STATUS_INVALID_PARAMETER;
+        goto Done;
+    }
+
+    status = WdfRequestRetrieveOutputBuffer( Request,
+                                             frameCount * sizeof(HDMI_BATCH_RESULT),
+                                             &results,
+                                             NULL );
+    if (!NT_SUCCESS(status)) {
+        goto Done;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, HDMI_BATCH_CONTEXT);
+    attributes.EvtCleanupCallback = HdmiEvtBatchContextCleanup;
+
+    status = WdfObjectAllocateContext( Request, &attributes, &batchCtx );
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                    "WdfObjectAllocateContext (batch) failed: %!STATUS!", status);
+        goto Done;
+    }
+
+    batchCtx->FrameCount = frameCount;
+
+    for (i = 0; i < frameCount; i++) {
+
+        length = batch->Frames[i].Length;
+
+        if (length == 0 || length > DevExt->MaximumTransferLength) {
+            status = STATUS_INVALID_BUFFER_SIZE;
+            goto Done;
+        }
+
+        mdl = IoAllocateMdl( (PVOID) (ULONG_PTR) batch->Frames[i].Buffer,
+                             length,
+                             FALSE,
+                             FALSE,
+                             NULL );
+        if (!mdl) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        __try {
+
+            MmProbeAndLockPages(mdl, UserMode, IoReadAccess);
+
+        } __except(EXCEPTION_EXECUTE_HANDLER) {
+
+            status = GetExceptionCode();
+            IoFreeMdl(mdl);
+            mdl = NULL;
+        }
+
+        if (!mdl) {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "HdmiBatchPrepare: frame %d not accessible: %!STATUS!",
+                        i, status);
+            goto Done;
+        }
+
+        //
+        // HdmiEvtBatchContextCleanup unlocks whatever is recorded here.
+        //
+        batchCtx->Mdl[i]    = mdl;
+        batchCtx->Length[i] = length;
+    }
+
+    status = WdfDeviceEnqueueRequest(DevExt->Device, Request);
+
+Done:
+
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+
+VOID
+HdmiEvtBatchContextCleanup(
+    IN WDFOBJECT Object
+    )
+/*++
+
+Routine Description:
+
+    Unlocks the frames of a batch request when the request goes away.
+
+--*/
+{
+    PHDMI_BATCH_CONTEXT batchCtx = HdmiGetBatchContext(Object);
+    ULONG               i;
+
+    for (i = 0; i < HDMI_BATCH_MAX_FRAMES; i++) {
+
+        if (batchCtx->Mdl[i]) {
+            MmUnlockPages(batchCtx->Mdl[i]);
+            IoFreeMdl(batchCtx->Mdl[i]);
+            batchCtx->Mdl[i] = NULL;
+        }
+    }
+}
+
+
+VOID
+HdmiBatchSubmit(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+
+Routine Description:
+
+    Handles IOCTL_HDMI_WRITE_BATCH from the IOCTL queue. The batch waits on
+    BatchQueue, so the sequential IOCTL queue is not held up meanwhile,
+    until its stream gets to it.
+
+--*/
+{
+    NTSTATUS    status;
+
+    status = WdfRequestForwardToIoQueue(Request, DevExt->BatchQueue);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    HdmiPowerStreamActive( DevExt,
+                           HdmiGetStreamContext(WdfRequestGetFileObject(Request)) );
+
+    HdmiStartNextWrite(DevExt);
+}
+
+
+static VOID
+HdmiBatchComplete(
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+
+Routine Description:
+
+    Returns the per-frame results and completes the stream's current
+    batch.
+
+--*/
+{
+    NTSTATUS            status;
+    WDFREQUEST          request = Stream->BatchRequest;
+    PHDMI_BATCH_CONTEXT batchCtx = HdmiGetBatchContext(request);
+    PVOID               results;
+    size_t              length;
+
+    Stream->BatchRequest = NULL;
+
+    length = batchCtx->FrameCount * sizeof(HDMI_BATCH_RESULT);
+
+    status = WdfRequestRetrieveOutputBuffer(request, length, &results, NULL);
+    if (NT_SUCCESS(status)) {
+        RtlCopyMemory(results, batchCtx->Result, length);
+    } else {
+        length = 0;
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC,
+                "HdmiBatchComplete: Request %p, %d frames",
+                request, batchCtx->FrameCount);
+
+    WdfRequestCompleteWithInformation(request, status, length);
+}
+
+
+static VOID
+HdmiBatchCancelRest(
+    IN PHDMI_BATCH_CONTEXT BatchCtx
+    )
+/*++
+
+Routine Description:
+
+    Gives every frame not yet finished STATUS_CANCELLED. A frame cut off
+    between chunks keeps the bytes it got.
+
+--*/
+{
+    ULONG   i;
+
+    for (i = BatchCtx->Next; i < BatchCtx->FrameCount; i++) {
+        BatchCtx->Result[i].Status           = STATUS_CANCELLED;
+        BatchCtx->Result[i].BytesTransferred = 0;
+    }
+
+    if (BatchCtx->Next < BatchCtx->FrameCount) {
+        BatchCtx->Result[BatchCtx->Next].BytesTransferred = BatchCtx->FrameOffset;
+    }
+
+    BatchCtx->Next        = BatchCtx->FrameCount;
+    BatchCtx->FrameOffset = 0;
+}
+
+
+BOOLEAN
+HdmiBatchStartNext(
+    IN PDEVICE_EXTENSION    DevExt,
+    IN PHDMI_STREAM_CONTEXT Stream
+    )
+/*++
+
+Routine Description:
+
+    Called from HdmiStreamStartOne with the write channel idle. Puts the
+    next frame of the stream's current batch on the channel, taking the
+    stream's oldest queued batch if it has none. Unless the stream is of
+    the picture class, a frame longer than HDMI_STREAM_CHUNK_SIZE goes
+    one chunk per turn like a write. Frames that cannot be started get an
+    error result; a batch with no frame left is completed.
+
+Return Value:
+
+    TRUE if a transfer was started.
+
+--*/
+{
+    NTSTATUS            status;
+    PHDMI_BATCH_CONTEXT batchCtx;
+    ULONG               length;
+    ULONG               i;
+
+    for (;;) {
+
+        if (Stream->BatchRequest == NULL &&
+            !NT_SUCCESS(WdfIoQueueRetrieveRequestByFileObject(
+                            DevExt->BatchQueue,
+                            (WDFFILEOBJECT) WdfObjectContextGetObject(Stream),
+                            &Stream->BatchRequest))) {
+            Stream->BatchRequest = NULL;
+            return FALSE;
+        }
+
+        batchCtx = HdmiGetBatchContext(Stream->BatchRequest);
+
+        while (batchCtx->Next < batchCtx->FrameCount) {
+
+            i = batchCtx->Next;
+
+            //
+            // A frame goes where the stream is when its first chunk
+            // starts, whatever SET_STREAM does meanwhile.
+            //
+            if (batchCtx->FrameOffset == 0) {
+                batchCtx->DeviceOffset = Stream->DeviceOffset;
+            }
+
+            length = batchCtx->Length[i] - batchCtx->FrameOffset;
+
+            if (Stream->Class != HDMI_STREAM_CLASS_PICTURE &&
+                length > HDMI_STREAM_CHUNK_SIZE) {
+                length = HDMI_STREAM_CHUNK_SIZE;
+            }
+
+            if (!HdmiSramFits(DevExt, batchCtx->DeviceOffset, batchCtx->Length[i])) {
+                status = STATUS_INVALID_BUFFER_SIZE;
+            } else {
+                status = WdfDmaTransactionInitialize( DevExt->WriteDmaTransaction,
+                                                      HdmiEvtProgramWriteDma,
+                                                      WdfDmaDirectionWriteToDevice,
+                                                      batchCtx->Mdl[i],
+                                                      (PUCHAR) MmGetMdlVirtualAddress(batchCtx->Mdl[i]) +
+                                                          batchCtx->FrameOffset,
+                                                      length );
+            }
+
+            if (NT_SUCCESS(status)) {
+
+                DevExt->XferSource = HdmiXferBatch;
+                DevExt->XferSlice  = (BOOLEAN)
+                    (batchCtx->FrameOffset + length < batchCtx->Length[i]);
+                DevExt->WriteDeviceOffset = batchCtx->DeviceOffset +
+                                            batchCtx->FrameOffset;
+                DevExt->WriteStartTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+                status = WdfDmaTransactionExecute( DevExt->WriteDmaTransaction,
+                                                   WDF_NO_CONTEXT );
+                if (NT_SUCCESS(status)) {
+                    return TRUE;
+                }
+
+                DevExt->XferSource = HdmiXferNone;
+                DevExt->XferSlice  = FALSE;
+                DevExt->WriteDeviceOffset = 0;
+                WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+            }
+
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE,
+                        "HdmiBatchStartNext: frame %d failed: %!STATUS!", i, status);
+
+            batchCtx->Result[i].Status           = status;
+            batchCtx->Result[i].BytesTransferred = batchCtx->FrameOffset;
+            batchCtx->FrameOffset = 0;
+            batchCtx->Next++;
+        }
+
+        HdmiBatchComplete(Stream);
+    }
+}
+
+
+VOID
+HdmiBatchTransferComplete(
+    IN PDEVICE_EXTENSION DevExt,
+    IN NTSTATUS          Status
+    )
+/*++
+
+Routine Description:
+
+    Called from the DPC when a batch frame, or a chunk of one, has been
+    transferred. Records the frame's result once it is done and completes
+    the batch after its last frame; otherwise the rest waits for the
+    stream's next turn.
+
+--*/
+{
+    PHDMI_STREAM_CONTEXT stream = DevExt->XferStream;
+    PHDMI_BATCH_CONTEXT  batchCtx = HdmiGetBatchContext(stream->BatchRequest);
+    ULONG                i = batchCtx->Next;
+
+    batchCtx->FrameOffset += (ULONG)
+        WdfDmaTransactionGetBytesTransferred(DevExt->WriteDmaTransaction);
+
+    WdfDmaTransactionRelease(DevExt->WriteDmaTransaction);
+
+    DevExt->XferSource = HdmiXferNone;
+    DevExt->XferSlice  = FALSE;
+    DevExt->WriteDeviceOffset = 0;
+
+    if (NT_SUCCESS(Status) && batchCtx->FrameOffset < batchCtx->Length[i]) {
+
+        if (!batchCtx->Cancelled) {
+            return;
+        }
+
+        Status = STATUS_CANCELLED;
+    }
+
+    batchCtx->Result[i].Status           = Status;
+    batchCtx->Result[i].BytesTransferred = batchCtx->FrameOffset;
+    batchCtx->FrameOffset = 0;
+    batchCtx->Next++;
+
+    if (batchCtx->Cancelled) {
+        HdmiBatchCancelRest(batchCtx);
+    }
+
+    if (batchCtx->Next >= batchCtx->FrameCount) {
+        HdmiBatchComplete(stream);
+    }
+}
+
+
+VOID
+HdmiBatchFlush(
+    IN PDEVICE_EXTENSION DevExt,
+    IN WDFFILEOBJECT     FileObject
+    )
+/*++
+
+Routine Description:
+
+    Cancels the batches of FileObject, for IOCTL_HDMI_FLUSH and when the
+    handle is cleaned up. Frames of the current batch that have not been
+    finished get STATUS_CANCELLED. The batch is completed at once, or with
+    its frame on the channel if there is one; queued batches are
+    completed at once.
+
+--*/
+{
+    PHDMI_STREAM_CONTEXT stream = HdmiGetStreamContext(FileObject);
+    PHDMI_BATCH_CONTEXT  batchCtx;
+    WDFREQUEST           request;
+
+    if (stream->BatchRequest != NULL) {
+
+        batchCtx = HdmiGetBatchContext(stream->BatchRequest);
+
+        if (DevExt->XferSource == HdmiXferBatch && DevExt->XferStream == stream) {
+            batchCtx->Cancelled = TRUE;
+        } else {
+            HdmiBatchCancelRest(batchCtx);
+            HdmiBatchComplete(stream);
+        }
+    }
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveRequestByFileObject(DevExt->BatchQueue,
+                                                            FileObject,
+                                                            &request))) {
+        WdfRequestComplete(request, STATUS_CANCELLED);
+    }
+}
+
+
 /*void HdmiEvtRequestCancel(IN WDFREQUEST Request)
 {
 	WDFDEVICE	device;